@@ -1,4 +1,31 @@
+/*
+** Memory mapped file input needs POSIX.
+** Everywhere else files are read through stdio
+** as before.
+*/
+
+#if (defined(__unix__) || defined(__APPLE__)) && !defined(_XOPEN_SOURCE)
+#define _XOPEN_SOURCE 700
+#endif
+
 #include "mpc.h"
+#include <limits.h>
+#include <time.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define MPC_USE_MMAP
+#endif
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSSE3__)
+#include <tmmintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 /*
 ** State Type
@@ -20,34 +47,222 @@ static mpc_state_t mpc_state_new(void) {
   return s;
 }
 
+/*
+** Character Classes
+**
+** The characters matched by `oneof` and `noneof`
+** are kept as a 256 bit map so testing a byte is
+** a single lookup rather than a `strchr`.
+**
+** Runs of characters from a class can also be
+** scanned many bytes at a time. With SSSE3 or
+** AVX2 the map is split into two nibble lookup
+** tables for `pshufb`, with plain SSE2 classes of
+** a few contiguous ranges are tested with range
+** compares, and otherwise bytes are looked up one
+** at a time.
+*/
+
+enum { MPC_CLASS_RANGES_MAX = 8 };
+
+typedef struct {
+  unsigned char map[32];
+  unsigned char lo[16];
+  unsigned char hi[16];
+  int ranges_num;
+  unsigned char ranges[MPC_CLASS_RANGES_MAX][2];
+} mpc_class_t;
+
+static int mpc_class_has(const mpc_class_t *c, char x) {
+  unsigned char b = (unsigned char)x;
+  return (c->map[b >> 3] >> (b & 7)) & 1;
+}
+
+static void mpc_class_add(mpc_class_t *c, int b) {
+  c->map[b >> 3] |= (unsigned char)(1 << (b & 7));
+}
+
+/* Builds the nibble tables and ranges once the map is filled */
+static void mpc_class_index(mpc_class_t *c) {
+  
+  int b;
+  
+  for (b = 0; b < 256; b++) {
+    if (!mpc_class_has(c, (char)b)) { continue; }
+    
+    if (b < 128) { c->lo[b & 15] |= (unsigned char)(1 << (b >> 4)); }
+    else         { c->hi[b & 15] |= (unsigned char)(1 << ((b >> 4) - 8)); }
+    
+    if (b > 0 && mpc_class_has(c, (char)(b-1))) {
+      if (c->ranges_num <= MPC_CLASS_RANGES_MAX) { c->ranges[c->ranges_num-1][1] = (unsigned char)b; }
+    } else {
+      if (c->ranges_num < MPC_CLASS_RANGES_MAX) {
+        c->ranges[c->ranges_num][0] = (unsigned char)b;
+        c->ranges[c->ranges_num][1] = (unsigned char)b;
+      }
+      c->ranges_num++;
+    }
+  }
+  
+}
+
+static mpc_class_t *mpc_class_new(const char *s, int complement) {
+  
+  int b;
+  mpc_class_t *c = calloc(1, sizeof(mpc_class_t));
+  
+  /* Matches `strchr` which also finds the terminator */
+  for (b = 0; b < 256; b++) {
+    if ((strchr(s, (char)b) != 0) == !complement) { mpc_class_add(c, b); }
+  }
+  
+  mpc_class_index(c);
+  return c;
+}
+
+static mpc_class_t *mpc_class_copy(const mpc_class_t *c) {
+  mpc_class_t *d = malloc(sizeof(mpc_class_t));
+  memcpy(d, c, sizeof(mpc_class_t));
+  return d;
+}
+
+#if defined(__SSE2__)
+static int mpc_class_ctz(unsigned int x) {
+#if defined(__GNUC__)
+  return __builtin_ctz(x);
+#else
+  int n = 0;
+  while (!(x & 1)) { x >>= 1; n++; }
+  return n;
+#endif
+}
+#endif
+
+/*
+** Returns the length of the longest prefix of
+** the `n` bytes at `x` made up of characters in
+** the class.
+*/
+
+static long mpc_class_span(const mpc_class_t *c, const char *x, long n) {
+  
+  long j = 0;
+  
+#if defined(__AVX2__)
+  
+  __m256i lo = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)c->lo));
+  __m256i hi = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)c->hi));
+  __m256i bits = _mm256_broadcastsi128_si256(_mm_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128));
+  __m256i nibble = _mm256_set1_epi8(0x0F);
+  __m256i v, l, h, m, b;
+  unsigned int found;
+  
+  for (; j + 32 <= n; j += 32) {
+    v = _mm256_loadu_si256((const __m256i*)(x + j));
+    l = _mm256_and_si256(v, nibble);
+    h = _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble);
+    m = _mm256_blendv_epi8(_mm256_shuffle_epi8(lo, l), _mm256_shuffle_epi8(hi, l), v);
+    b = _mm256_shuffle_epi8(bits, h);
+    found = ~(unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_and_si256(m, b), b));
+    if (found) { return j + mpc_class_ctz(found); }
+  }
+  
+#elif defined(__SSSE3__)
+  
+  __m128i lo = _mm_loadu_si128((const __m128i*)c->lo);
+  __m128i hi = _mm_loadu_si128((const __m128i*)c->hi);
+  __m128i bits = _mm_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128);
+  __m128i nibble = _mm_set1_epi8(0x0F);
+  __m128i v, l, h, m, b, top;
+  unsigned int found;
+  
+  for (; j + 16 <= n; j += 16) {
+    v = _mm_loadu_si128((const __m128i*)(x + j));
+    l = _mm_and_si128(v, nibble);
+    h = _mm_and_si128(_mm_srli_epi16(v, 4), nibble);
+    top = _mm_cmplt_epi8(v, _mm_setzero_si128());
+    m = _mm_or_si128(
+      _mm_andnot_si128(top, _mm_shuffle_epi8(lo, l)),
+      _mm_and_si128(top, _mm_shuffle_epi8(hi, l)));
+    b = _mm_shuffle_epi8(bits, h);
+    found = ~(unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(m, b), b)) & 0xFFFF;
+    if (found) { return j + mpc_class_ctz(found); }
+  }
+  
+#elif defined(__SSE2__)
+  
+  __m128i v, d, in;
+  unsigned int found;
+  int k;
+  
+  if (c->ranges_num <= MPC_CLASS_RANGES_MAX) {
+    for (; j + 16 <= n; j += 16) {
+      v = _mm_loadu_si128((const __m128i*)(x + j));
+      in = _mm_setzero_si128();
+      for (k = 0; k < c->ranges_num; k++) {
+        d = _mm_sub_epi8(v, _mm_set1_epi8((char)c->ranges[k][0]));
+        in = _mm_or_si128(in, _mm_cmpeq_epi8(d, _mm_min_epu8(d, 
+          _mm_set1_epi8((char)(c->ranges[k][1] - c->ranges[k][0])))));
+      }
+      found = ~(unsigned int)_mm_movemask_epi8(in) & 0xFFFF;
+      if (found) { return j + mpc_class_ctz(found); }
+    }
+  }
+  
+#endif
+  
+  while (j < n && mpc_class_has(c, x[j])) { j++; }
+  return j;
+}
+
 /*
 ** Input Type
 */
 
 /*
-** In mpc the input type has three modes of 
-** operation: String, File and Pipe.
+** In mpc the input type has four modes of 
+** operation: String, Mmap, File and Pipe.
 **
-** String is easy. The whole contents are 
-** loaded into a buffer and scanned through.
-** The cursor can jump around at will making 
+** String is easy. The caller's buffer is
+** borrowed along with its length and scanned
+** through in place, so nothing is copied and
+** the end is found without a `strlen`. The
+** cursor can jump around at will making 
 ** backtracking easy.
 **
-** The second is a File which is also somewhat
+** Mmap is used for regular files where the
+** platform supports it. The file is mapped
+** read-only and scanned exactly like a String,
+** so reading costs page faults rather than
+** stdio calls and seeks.
+**
+** The third is a File which is also somewhat
 ** easy. The contents are never loaded into 
 ** memory but backtracking can still be achieved
 ** by seeking in the file at different positions.
+** This is the fallback when a file can't be
+** mapped.
 **
 ** The final mode is Pipe. This is the difficult
 ** one. As we assume pipes cannot be seeked - and 
 ** only support a single character lookahead at 
-** any point, when the input is marked for a 
-** potential backtracking we start buffering any 
-** input.
+** any point, every character read from a pipe
+** goes into a ring buffer indexed by its
+** absolute position.
 **
 ** This means that if we are requested to seek
 ** back we can simply start reading from the
-** buffer instead of the input.
+** buffer instead of the input. Anything below
+** the oldest mark can never be revisited so it
+** is dropped once the ring fills, which keeps
+** memory bounded by the longest backtrack
+** rather than the length of the stream.
+**
+** Push input shares the Pipe ring buffer but
+** is filled by the user through `mpc_push_feed`.
+** When the parser runs out of input it returns
+** with its stack of frames intact and carries
+** on when more arrives or the input is ended.
 **
 ** Of course using `mpc_predictive` will disable
 ** backtracking and make LL(1) grammars easy
@@ -58,7 +273,9 @@ static mpc_state_t mpc_state_new(void) {
 enum {
   MPC_INPUT_STRING = 0,
   MPC_INPUT_FILE   = 1,
-  MPC_INPUT_PIPE   = 2
+  MPC_INPUT_PIPE   = 2,
+  MPC_INPUT_MMAP   = 3,
+  MPC_INPUT_PUSH   = 4
 };
 
 enum {
@@ -66,35 +283,235 @@ enum {
 };
 
 enum {
-  MPC_INPUT_MEM_NUM = 512
+  MPC_INPUT_BUFFER_MIN = 4096
 };
 
-typedef struct {
-  char mem[64];
+enum {
+  MPC_INPUT_LINES_MIN   = 64,
+  MPC_INPUT_LINES_AHEAD = 4096
+};
+
+/*
+** Memory allocated while parsing comes from an
+** arena owned by the input. Fresh memory is
+** handed out by bumping a pointer through a
+** chunk, which grows by doubling. Each block has
+** a header with its size in units of `mpc_mem_t`
+** and blocks that are freed go on a free list for
+** their size to be handed out again. The whole
+** arena is dropped once a parse completes, so
+** results that outlive it are copied out with
+** `mpc_export`.
+*/
+
+enum {
+  MPC_MEM_CLASSES   = 64,
+  MPC_MEM_CHUNK_MIN = 4096
+};
+
+typedef union {
+  size_t size;
+  void *next;
+  long l;
+  double d;
 } mpc_mem_t;
 
+typedef struct mpc_mem_chunk_t {
+  struct mpc_mem_chunk_t *next;
+  mpc_mem_t *end;
+  mpc_mem_t data[1];
+} mpc_mem_chunk_t;
+
+/*
+** Trees built in AST arena mode are allocated
+** from an arena that belongs to the parse while
+** it runs and to the root of the tree afterward.
+*/
+
+typedef struct mpc_ast_arena_t mpc_ast_arena_t;
+
+/*
+** Errors are not built while parsing. Parsers
+** that fail with a message record where they
+** failed and what they expected instead, and
+** only records at the farthest position reached
+** are kept, as those are all a failed parse can
+** report. The error is built from them if the
+** parse fails.
+*/
+
+typedef struct {
+  long pos;
+  char recieved;
+  const char *expected;
+  const char *failure;
+} mpc_fail_t;
+
+/*
+** Packrat parsers remember the outcome of
+** running at a given position so they can be
+** answered from the table when revisited after
+** backtracking. Entries only last for a single
+** parse.
+*/
+
+typedef struct {
+  mpc_parser_t *parser;
+  long pos;
+  int suppress;
+  int success;
+  long end;
+  char last;
+  mpc_val_t *output;
+  mpc_err_t *error;
+  int fails_num;
+  mpc_fail_t *fails;
+} mpc_memo_t;
+
+/*
+** Parsers are run by a loop rather than by
+** recursion. Each combinator still in progress
+** has a frame on a stack kept with the input,
+** and the results its children have produced so
+** far go on a separate stack of values, so the
+** depth of nesting is only limited by memory.
+*/
+
+typedef struct {
+  mpc_parser_t *parser;
+  int index;
+  int values;
+  long capture;
+} mpc_frame_t;
+
+/*
+** Packrat parsers in progress also keep the
+** position they started at and how many failures
+** were recorded then, on a stack of their own.
+*/
+
+typedef struct {
+  long pos;
+  int fails;
+  long fails_resets;
+} mpc_pending_t;
+
+/*
+** A profile has an entry for each named parser
+** it has seen, found from the parser through a
+** table of indices, -1 where empty. The name is
+** copied as the parser may be gone by the time
+** the profile is printed.
+*/
+
+typedef struct {
+  mpc_parser_t *parser;
+  char *name;
+  unsigned long calls;
+  unsigned long successes;
+  unsigned long failures;
+  unsigned long rewinds;
+  unsigned long bytes;
+  double inclusive;
+  double exclusive;
+} mpc_profile_rule_t;
+
+struct mpc_profile_t {
+  int rules_num;
+  int rules_slots;
+  mpc_profile_rule_t *rules;
+  int *table;
+};
+
+/*
+** Named parsers running under a profile keep
+** where and when they started, and the time
+** spent in named parsers they called, on a
+** stack of their own. Each ends when a result
+** comes back with no more frames on the stack
+** than there were when it started.
+*/
+
+typedef struct {
+  int rule;
+  int frames;
+  long pos;
+  double start;
+  double children;
+} mpc_profile_frame_t;
+
+enum {
+  MPC_PARSE_FRAMES_MIN = 64
+};
+
 typedef struct {
 
   int type;
   char *filename;  
-  mpc_state_t state;
+  long pos;
   
-  char *string;
+  const char *string;
+  long length;
   char *buffer;
+  long buffer_lo;
+  long buffer_hi;
+  long buffer_slots;
   FILE *file;
+  void *map;
+  size_t map_length;
+  mpc_push_t *push;
+  
+  long *lines;
+  long lines_num;
+  long lines_slots;
+  long lines_hi;
+  long lines_row;
   
   int suppress;
   int backtrack;
+  int exact;
+  int inexact;
+  int capture;
   int marks_slots;
   int marks_num;
-  mpc_state_t *marks;
+  long *marks;
   
   char *lasts;
   char last;
   
-  size_t mem_index;
-  char mem_full[MPC_INPUT_MEM_NUM];
-  mpc_mem_t mem[MPC_INPUT_MEM_NUM];
+  int memo_num;
+  int memo_slots;
+  mpc_memo_t *memo;
+  
+  mpc_parser_t *call;
+  mpc_parser_t *parser;
+  long start;
+  char start_last;
+  int fails_num;
+  int fails_slots;
+  long fails_resets;
+  mpc_fail_t *fails;
+  int frames_num;
+  int frames_slots;
+  mpc_frame_t *frames;
+  int values_num;
+  int values_slots;
+  mpc_val_t **values;
+  int pending_num;
+  int pending_slots;
+  mpc_pending_t *pending;
+  
+  mpc_profile_t *profile;
+  int profile_num;
+  int profile_slots;
+  mpc_profile_frame_t *profile_frames;
+  
+  mpc_mem_chunk_t *mem_chunks;
+  mpc_mem_t *mem_bump;
+  mpc_mem_t *mem_end;
+  mpc_mem_t *mem_free[MPC_MEM_CLASSES+1];
+  
+  mpc_ast_arena_t *ast_arena;
   
 } mpc_input_t;
 
@@ -106,23 +523,67 @@ static mpc_input_t *mpc_input_new_string(const char *filename, const char *strin
   strcpy(i->filename, filename);
   i->type = MPC_INPUT_STRING;
   
-  i->state = mpc_state_new();
+  i->pos = 0;
   
-  i->string = malloc(strlen(string) + 1);
-  strcpy(i->string, string);
+  i->string = string;
+  i->length = strlen(string);
   i->buffer = NULL;
+  i->buffer_lo = 0;
+  i->buffer_hi = 0;
+  i->buffer_slots = 0;
   i->file = NULL;
+  i->map = NULL;
+  i->map_length = 0;
+  i->push = NULL;
+  
+  i->lines = NULL;
+  i->lines_num = 0;
+  i->lines_slots = 0;
+  i->lines_hi = 0;
+  i->lines_row = 0;
   
   i->suppress = 0;
   i->backtrack = 1;
+  i->exact = 0;
+  i->inexact = 0;
+  i->capture = 0;
   i->marks_num = 0;
   i->marks_slots = MPC_INPUT_MARKS_MIN;
-  i->marks = malloc(sizeof(mpc_state_t) * i->marks_slots);
+  i->marks = malloc(sizeof(long) * i->marks_slots);
   i->lasts = malloc(sizeof(char) * i->marks_slots);
   i->last = '\0';
   
-  i->mem_index = 0;
-  memset(i->mem_full, 0, sizeof(char) * MPC_INPUT_MEM_NUM);
+  i->memo_num = 0;
+  i->memo_slots = 0;
+  i->memo = NULL;
+  
+  i->call = NULL;
+  i->parser = NULL;
+  i->fails_num = 0;
+  i->fails_slots = 0;
+  i->fails_resets = 0;
+  i->fails = NULL;
+  i->frames_num = 0;
+  i->frames_slots = 0;
+  i->frames = NULL;
+  i->values_num = 0;
+  i->values_slots = 0;
+  i->values = NULL;
+  i->pending_num = 0;
+  i->pending_slots = 0;
+  i->pending = NULL;
+  
+  i->profile = NULL;
+  i->profile_num = 0;
+  i->profile_slots = 0;
+  i->profile_frames = NULL;
+  
+  i->mem_chunks = NULL;
+  i->mem_bump = NULL;
+  i->mem_end = NULL;
+  memset(i->mem_free, 0, sizeof(i->mem_free));
+  
+  i->ast_arena = NULL;
   
   return i;
 }
@@ -135,24 +596,67 @@ static mpc_input_t *mpc_input_new_nstring(const char *filename, const char *stri
   strcpy(i->filename, filename);
   i->type = MPC_INPUT_STRING;
   
-  i->state = mpc_state_new();
+  i->pos = 0;
   
-  i->string = malloc(length + 1);
-  strncpy(i->string, string, length);
-  i->string[length] = '\0';
+  i->string = string;
+  i->length = memchr(string, '\0', length) ? (long)strlen(string) : (long)length;
   i->buffer = NULL;
+  i->buffer_lo = 0;
+  i->buffer_hi = 0;
+  i->buffer_slots = 0;
   i->file = NULL;
+  i->map = NULL;
+  i->map_length = 0;
+  i->push = NULL;
+  
+  i->lines = NULL;
+  i->lines_num = 0;
+  i->lines_slots = 0;
+  i->lines_hi = 0;
+  i->lines_row = 0;
   
   i->suppress = 0;
   i->backtrack = 1;
+  i->exact = 0;
+  i->inexact = 0;
+  i->capture = 0;
   i->marks_num = 0;
   i->marks_slots = MPC_INPUT_MARKS_MIN;
-  i->marks = malloc(sizeof(mpc_state_t) * i->marks_slots);
+  i->marks = malloc(sizeof(long) * i->marks_slots);
   i->lasts = malloc(sizeof(char) * i->marks_slots);
   i->last = '\0';
   
-  i->mem_index = 0;
-  memset(i->mem_full, 0, sizeof(char) * MPC_INPUT_MEM_NUM);
+  i->memo_num = 0;
+  i->memo_slots = 0;
+  i->memo = NULL;
+  
+  i->call = NULL;
+  i->parser = NULL;
+  i->fails_num = 0;
+  i->fails_slots = 0;
+  i->fails_resets = 0;
+  i->fails = NULL;
+  i->frames_num = 0;
+  i->frames_slots = 0;
+  i->frames = NULL;
+  i->values_num = 0;
+  i->values_slots = 0;
+  i->values = NULL;
+  i->pending_num = 0;
+  i->pending_slots = 0;
+  i->pending = NULL;
+  
+  i->profile = NULL;
+  i->profile_num = 0;
+  i->profile_slots = 0;
+  i->profile_frames = NULL;
+  
+  i->mem_chunks = NULL;
+  i->mem_bump = NULL;
+  i->mem_end = NULL;
+  memset(i->mem_free, 0, sizeof(i->mem_free));
+  
+  i->ast_arena = NULL;
   
   return i;
 
@@ -166,27 +670,197 @@ static mpc_input_t *mpc_input_new_pipe(const char *filename, FILE *pipe) {
   strcpy(i->filename, filename);
   
   i->type = MPC_INPUT_PIPE;
-  i->state = mpc_state_new();
+  i->pos = 0;
   
   i->string = NULL;
-  i->buffer = NULL;
+  i->length = 0;
+  i->buffer = malloc(MPC_INPUT_BUFFER_MIN);
+  i->buffer_lo = 0;
+  i->buffer_hi = 0;
+  i->buffer_slots = MPC_INPUT_BUFFER_MIN;
   i->file = pipe;
+  i->map = NULL;
+  i->map_length = 0;
+  i->push = NULL;
+  
+  i->lines = NULL;
+  i->lines_num = 0;
+  i->lines_slots = 0;
+  i->lines_hi = 0;
+  i->lines_row = 0;
+  
+  i->suppress = 0;
+  i->backtrack = 1;
+  i->exact = 0;
+  i->inexact = 0;
+  i->capture = 0;
+  i->marks_num = 0;
+  i->marks_slots = MPC_INPUT_MARKS_MIN;
+  i->marks = malloc(sizeof(long) * i->marks_slots);
+  i->lasts = malloc(sizeof(char) * i->marks_slots);
+  i->last = '\0';
+  
+  i->memo_num = 0;
+  i->memo_slots = 0;
+  i->memo = NULL;
+  
+  i->call = NULL;
+  i->parser = NULL;
+  i->fails_num = 0;
+  i->fails_slots = 0;
+  i->fails_resets = 0;
+  i->fails = NULL;
+  i->frames_num = 0;
+  i->frames_slots = 0;
+  i->frames = NULL;
+  i->values_num = 0;
+  i->values_slots = 0;
+  i->values = NULL;
+  i->pending_num = 0;
+  i->pending_slots = 0;
+  i->pending = NULL;
+  
+  i->profile = NULL;
+  i->profile_num = 0;
+  i->profile_slots = 0;
+  i->profile_frames = NULL;
+  
+  i->mem_chunks = NULL;
+  i->mem_bump = NULL;
+  i->mem_end = NULL;
+  memset(i->mem_free, 0, sizeof(i->mem_free));
+  
+  i->ast_arena = NULL;
+  
+  return i;
+  
+}
+
+static mpc_input_t *mpc_input_new_push(const char *filename, mpc_push_t *push) {
+
+  mpc_input_t *i = malloc(sizeof(mpc_input_t));
+  
+  i->filename = malloc(strlen(filename) + 1);
+  strcpy(i->filename, filename);
+  
+  i->type = MPC_INPUT_PUSH;
+  i->pos = 0;
+  
+  i->string = NULL;
+  i->length = 0;
+  i->buffer = malloc(MPC_INPUT_BUFFER_MIN);
+  i->buffer_lo = 0;
+  i->buffer_hi = 0;
+  i->buffer_slots = MPC_INPUT_BUFFER_MIN;
+  i->file = NULL;
+  i->map = NULL;
+  i->map_length = 0;
+  i->push = push;
+  
+  i->lines = NULL;
+  i->lines_num = 0;
+  i->lines_slots = 0;
+  i->lines_hi = 0;
+  i->lines_row = 0;
   
   i->suppress = 0;
   i->backtrack = 1;
+  i->exact = 0;
+  i->inexact = 0;
+  i->capture = 0;
   i->marks_num = 0;
   i->marks_slots = MPC_INPUT_MARKS_MIN;
-  i->marks = malloc(sizeof(mpc_state_t) * i->marks_slots);
+  i->marks = malloc(sizeof(long) * i->marks_slots);
   i->lasts = malloc(sizeof(char) * i->marks_slots);
   i->last = '\0';
   
-  i->mem_index = 0;
-  memset(i->mem_full, 0, sizeof(char) * MPC_INPUT_MEM_NUM);
+  i->memo_num = 0;
+  i->memo_slots = 0;
+  i->memo = NULL;
+  
+  i->call = NULL;
+  i->parser = NULL;
+  i->fails_num = 0;
+  i->fails_slots = 0;
+  i->fails_resets = 0;
+  i->fails = NULL;
+  i->frames_num = 0;
+  i->frames_slots = 0;
+  i->frames = NULL;
+  i->values_num = 0;
+  i->values_slots = 0;
+  i->values = NULL;
+  i->pending_num = 0;
+  i->pending_slots = 0;
+  i->pending = NULL;
+  
+  i->profile = NULL;
+  i->profile_num = 0;
+  i->profile_slots = 0;
+  i->profile_frames = NULL;
+  
+  i->mem_chunks = NULL;
+  i->mem_bump = NULL;
+  i->mem_end = NULL;
+  memset(i->mem_free, 0, sizeof(i->mem_free));
+  
+  i->ast_arena = NULL;
   
   return i;
   
 }
 
+#ifdef MPC_USE_MMAP
+
+/*
+** Switch a File input over to a read-only
+** mapping of the file, starting from the
+** stream's current position. Anything that
+** isn't a regular file stays on stdio.
+*/
+
+static void mpc_input_map(mpc_input_t *i) {
+  
+  struct stat st;
+  long offset;
+  void *map;
+  
+  if (fflush(i->file) != 0) { return; }
+  offset = ftell(i->file);
+  if (offset < 0) { return; }
+  if (fstat(fileno(i->file), &st) != 0 || !S_ISREG(st.st_mode)) { return; }
+  
+  if (st.st_size <= offset) {
+    i->type = MPC_INPUT_MMAP;
+    i->string = "";
+    i->length = 0;
+    return;
+  }
+  
+  map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fileno(i->file), 0);
+  if (map == MAP_FAILED) { return; }
+  posix_madvise(map, (size_t)st.st_size, POSIX_MADV_SEQUENTIAL);
+  
+  i->type = MPC_INPUT_MMAP;
+  i->map = map;
+  i->map_length = (size_t)st.st_size;
+  i->string = (char*)map + offset;
+  i->length = (long)st.st_size - offset;
+}
+
+/*
+** Leave the stream just after the consumed
+** input, as reading it with stdio would.
+*/
+
+static void mpc_input_unmap(mpc_input_t *i) {
+  long offset = i->map ? (long)(i->string - (char*)i->map) : ftell(i->file);
+  if (i->map) { munmap(i->map, i->map_length); }
+  fseek(i->file, offset + i->pos, SEEK_SET);
+}
+
+#endif
+
 static mpc_input_t *mpc_input_new_file(const char *filename, FILE *file) {
   
   mpc_input_t *i = malloc(sizeof(mpc_input_t));
@@ -194,62 +868,222 @@ static mpc_input_t *mpc_input_new_file(const char *filename, FILE *file) {
   i->filename = malloc(strlen(filename) + 1);
   strcpy(i->filename, filename);
   i->type = MPC_INPUT_FILE;
-  i->state = mpc_state_new();
+  i->pos = 0;
   
   i->string = NULL;
+  i->length = 0;
   i->buffer = NULL;
+  i->buffer_lo = 0;
+  i->buffer_hi = 0;
+  i->buffer_slots = 0;
   i->file = file;
+  i->map = NULL;
+  i->map_length = 0;
+  i->push = NULL;
+  
+  i->lines = NULL;
+  i->lines_num = 0;
+  i->lines_slots = 0;
+  i->lines_hi = 0;
+  i->lines_row = 0;
   
   i->suppress = 0;
   i->backtrack = 1;
+  i->exact = 0;
+  i->inexact = 0;
+  i->capture = 0;
   i->marks_num = 0;
   i->marks_slots = MPC_INPUT_MARKS_MIN;
-  i->marks = malloc(sizeof(mpc_state_t) * i->marks_slots);
+  i->marks = malloc(sizeof(long) * i->marks_slots);
   i->lasts = malloc(sizeof(char) * i->marks_slots);
   i->last = '\0';
   
-  i->mem_index = 0;
-  memset(i->mem_full, 0, sizeof(char) * MPC_INPUT_MEM_NUM);
+  i->memo_num = 0;
+  i->memo_slots = 0;
+  i->memo = NULL;
+  
+  i->call = NULL;
+  i->parser = NULL;
+  i->fails_num = 0;
+  i->fails_slots = 0;
+  i->fails_resets = 0;
+  i->fails = NULL;
+  i->frames_num = 0;
+  i->frames_slots = 0;
+  i->frames = NULL;
+  i->values_num = 0;
+  i->values_slots = 0;
+  i->values = NULL;
+  i->pending_num = 0;
+  i->pending_slots = 0;
+  i->pending = NULL;
+  
+  i->profile = NULL;
+  i->profile_num = 0;
+  i->profile_slots = 0;
+  i->profile_frames = NULL;
+  
+  i->mem_chunks = NULL;
+  i->mem_bump = NULL;
+  i->mem_end = NULL;
+  memset(i->mem_free, 0, sizeof(i->mem_free));
+  
+  i->ast_arena = NULL;
+  
+#ifdef MPC_USE_MMAP
+  mpc_input_map(i);
+#endif
   
   return i;
 }
 
+/*
+** Points a string input which has been parsed
+** before at a new string, keeping everything it
+** has allocated to use again.
+*/
+
+static void mpc_input_reuse_string(mpc_input_t *i, const char *filename, const char *string) {
+  
+  if (strcmp(i->filename, filename) != 0) {
+    i->filename = realloc(i->filename, strlen(filename) + 1);
+    strcpy(i->filename, filename);
+  }
+  
+  i->pos = 0;
+  i->string = string;
+  i->length = strlen(string);
+  
+  i->lines_num = 0;
+  i->lines_hi = 0;
+  i->lines_row = 0;
+  
+  i->suppress = 0;
+  i->backtrack = 1;
+  i->exact = 0;
+  i->inexact = 0;
+  i->capture = 0;
+  i->marks_num = 0;
+  i->last = '\0';
+}
+
+static void mpc_mem_delete(mpc_input_t *i);
+static void mpc_ast_arena_delete(mpc_ast_arena_t *m);
+
 static void mpc_input_delete(mpc_input_t *i) {
   
   free(i->filename);
   
-  if (i->type == MPC_INPUT_STRING) { free(i->string); }
-  if (i->type == MPC_INPUT_PIPE) { free(i->buffer); }
+#ifdef MPC_USE_MMAP
+  if (i->type == MPC_INPUT_MMAP) { mpc_input_unmap(i); }
+#endif
+  
+  /*
+  ** Bytes read past the end of the parse are put
+  ** back so the next parse of the pipe sees them.
+  ** Usually that is only the byte looked ahead at,
+  ** which is all the pushback ISO C promises.
+  */
+  
+  if (i->type == MPC_INPUT_PIPE) {
+    while (i->buffer_hi > i->pos) {
+      i->buffer_hi--;
+      ungetc((unsigned char)i->buffer[i->buffer_hi & (i->buffer_slots-1)], i->file);
+    }
+    free(i->buffer);
+  }
+  
+  if (i->type == MPC_INPUT_PUSH) { free(i->buffer); }
   
+  free(i->lines);
   free(i->marks);
   free(i->lasts);
+  free(i->memo);
+  free(i->frames);
+  free(i->values);
+  free(i->pending);
+  free(i->profile_frames);
+  free(i->fails);
+  if (i->ast_arena) { mpc_ast_arena_delete(i->ast_arena); }
+  mpc_mem_delete(i);
   free(i);
 }
 
 static int mpc_mem_ptr(mpc_input_t *i, void *p) {
-  return
-    (char*)p >= (char*)(i->mem) &&
-    (char*)p <  (char*)(i->mem) + (MPC_INPUT_MEM_NUM * sizeof(mpc_mem_t));
+  mpc_mem_chunk_t *c;
+  for (c = i->mem_chunks; c; c = c->next) {
+    if ((char*)p >= (char*)c->data && (char*)p < (char*)c->end) { return 1; }
+  }
+  return 0;
+}
+
+static void mpc_mem_grow(mpc_input_t *i, size_t n) {
+  
+  mpc_mem_chunk_t *c;
+  size_t size = i->mem_chunks 
+    ? (size_t)(i->mem_chunks->end - i->mem_chunks->data) * 2
+    : MPC_MEM_CHUNK_MIN;
+  
+  while (size < n) { size *= 2; }
+  
+  c = malloc(sizeof(mpc_mem_chunk_t) + sizeof(mpc_mem_t) * (size - 1));
+  c->next = i->mem_chunks;
+  c->end = c->data + size;
+  i->mem_chunks = c;
+  i->mem_bump = c->data;
+  i->mem_end = c->end;
+}
+
+/*
+** Keeps only the newest and largest chunk, which
+** the next parse will start bumping through.
+*/
+
+static void mpc_mem_reset(mpc_input_t *i) {
+  
+  mpc_mem_chunk_t *c, *n;
+  
+  if (!i->mem_chunks) { return; }
+  
+  for (c = i->mem_chunks->next; c; c = n) {
+    n = c->next;
+    free(c);
+  }
+  
+  i->mem_chunks->next = NULL;
+  i->mem_bump = i->mem_chunks->data;
+  i->mem_end = i->mem_chunks->end;
+  memset(i->mem_free, 0, sizeof(i->mem_free));
+}
+
+static void mpc_mem_delete(mpc_input_t *i) {
+  mpc_mem_chunk_t *c, *n;
+  for (c = i->mem_chunks; c; c = n) {
+    n = c->next;
+    free(c);
+  }
 }
 
 static void *mpc_malloc(mpc_input_t *i, size_t n) {
-  size_t j;
-  char *p;
   
-  if (n > sizeof(mpc_mem_t)) { return malloc(n); }
+  mpc_mem_t *b;
+  size_t k = (n + sizeof(mpc_mem_t) - 1) / sizeof(mpc_mem_t);
   
-  j = i->mem_index;
-  do {
-    if (!i->mem_full[i->mem_index]) {
-      p = (void*)(i->mem + i->mem_index);
-      i->mem_full[i->mem_index] = 1;
-      i->mem_index = (i->mem_index+1) % MPC_INPUT_MEM_NUM;
-      return p;
-    }
-    i->mem_index = (i->mem_index+1) % MPC_INPUT_MEM_NUM;
-  } while (j != i->mem_index);
+  if (k > MPC_MEM_CLASSES) { return malloc(n); }
+  if (k == 0) { k = 1; }
   
-  return malloc(n);
+  if (i->mem_free[k]) {
+    b = i->mem_free[k];
+    i->mem_free[k] = b[1].next;
+    return b + 1;
+  }
+  
+  if (i->mem_bump + k + 1 > i->mem_end) { mpc_mem_grow(i, k + 1); }
+  
+  b = i->mem_bump;
+  b[0].size = k;
+  i->mem_bump += k + 1;
+  return b + 1;
 }
 
 static void *mpc_calloc(mpc_input_t *i, size_t n, size_t m) {
@@ -259,37 +1093,152 @@ static void *mpc_calloc(mpc_input_t *i, size_t n, size_t m) {
 }
 
 static void mpc_free(mpc_input_t *i, void *p) {
-  size_t j;
+  
+  mpc_mem_t *b;
+  
   if (!mpc_mem_ptr(i, p)) { free(p); return; }
-  j = ((size_t)(((char*)p) - ((char*)i->mem))) / sizeof(mpc_mem_t);
-  i->mem_full[j] = 0;
+  
+  b = (mpc_mem_t*)p - 1;
+  
+  if (b + b[0].size + 1 == i->mem_bump) {
+    i->mem_bump = b;
+  } else {
+    b[1].next = i->mem_free[b[0].size];
+    i->mem_free[b[0].size] = b;
+  }
 }
 
 static void *mpc_realloc(mpc_input_t *i, void *p, size_t n) {
   
   char *q = NULL;
+  mpc_mem_t *b;
+  size_t k = (n + sizeof(mpc_mem_t) - 1) / sizeof(mpc_mem_t);
   
   if (!mpc_mem_ptr(i, p)) { return realloc(p, n); }
   
-  if (n > sizeof(mpc_mem_t)) {
-    q = malloc(n);
-    memcpy(q, p, sizeof(mpc_mem_t));
-    mpc_free(i, p);
-    return q;
+  b = (mpc_mem_t*)p - 1;
+  if (k <= b[0].size) { return p; }
+  
+  /* The newest block can grow in place */
+  if (k <= MPC_MEM_CLASSES
+  &&  b + b[0].size + 1 == i->mem_bump
+  &&  b + k + 1 <= i->mem_end) {
+    b[0].size = k;
+    i->mem_bump = b + k + 1;
+    return p;
   }
   
-  return p;
+  q = mpc_malloc(i, n);
+  memcpy(q, p, b[0].size * sizeof(mpc_mem_t));
+  mpc_free(i, p);
+  return q;
 }
 
 static void *mpc_export(mpc_input_t *i, void *p) {
   char *q = NULL;
+  mpc_mem_t *b;
   if (!mpc_mem_ptr(i, p)) { return p; }
-  q = malloc(sizeof(mpc_mem_t));
-  memcpy(q, p, sizeof(mpc_mem_t));
+  b = (mpc_mem_t*)p - 1;
+  q = malloc(b[0].size * sizeof(mpc_mem_t));
+  memcpy(q, p, b[0].size * sizeof(mpc_mem_t));
   mpc_free(i, p);
   return q; 
 }
 
+/*
+** While parsing a position is just an offset
+** into the input. The row and column are only
+** worked out when a state is handed out, from
+** an index of where the newlines are. It is
+** built up as far as it is needed, and before
+** a Pipe or Push input drops from its buffer.
+*/
+
+static void mpc_input_lines_add(mpc_input_t *i, long pos) {
+  if (i->lines_num == i->lines_slots) {
+    i->lines_slots = i->lines_slots ? i->lines_slots * 2 : MPC_INPUT_LINES_MIN;
+    i->lines = realloc(i->lines, sizeof(long) * i->lines_slots);
+  }
+  i->lines[i->lines_num++] = pos;
+}
+
+static void mpc_input_lines(mpc_input_t *i, long pos) {
+  
+  const char *x, *end;
+  char chunk[512];
+  long j, k, n, resume;
+  
+  if (pos <= i->lines_hi) { return; }
+  
+  switch (i->type) {
+    
+    /* The whole string is there, so index a block ahead at once */
+    case MPC_INPUT_STRING:
+    case MPC_INPUT_MMAP:
+      if (pos < i->lines_hi + MPC_INPUT_LINES_AHEAD) { pos = i->lines_hi + MPC_INPUT_LINES_AHEAD; }
+      if (pos > i->length) { pos = i->length; }
+      x = i->string + i->lines_hi;
+      end = i->string + pos;
+      while (x < end && (x = memchr(x, '\n', (size_t)(end - x)))) {
+        mpc_input_lines_add(i, (long)(x - i->string));
+        x++;
+      }
+      break;
+    
+    case MPC_INPUT_PIPE:
+    case MPC_INPUT_PUSH:
+      for (j = i->lines_hi; j < pos; j++) {
+        if (i->buffer[j & (i->buffer_slots - 1)] == '\n') { mpc_input_lines_add(i, j); }
+      }
+      break;
+    
+    case MPC_INPUT_FILE:
+      resume = ftell(i->file);
+      fseek(i->file, i->lines_hi, SEEK_SET);
+      for (j = i->lines_hi; j < pos; j += n) {
+        n = pos - j < (long)sizeof(chunk) ? pos - j : (long)sizeof(chunk);
+        n = (long)fread(chunk, 1, (size_t)n, i->file);
+        if (n <= 0) { break; }
+        for (k = 0; k < n; k++) {
+          if (chunk[k] == '\n') { mpc_input_lines_add(i, j + k); }
+        }
+      }
+      fseek(i->file, resume, SEEK_SET);
+      break;
+    
+    default: break;
+  }
+  
+  i->lines_hi = pos;
+}
+
+static mpc_state_t mpc_input_state(mpc_input_t *i, long pos) {
+  
+  mpc_state_t s;
+  long lo, hi, mid, row = i->lines_row;
+  
+  if (pos < 0) { return mpc_state_invalid(); }
+  mpc_input_lines(i, pos);
+  
+  /* The row is how many newlines come before `pos`, most often the last row or the next */
+  if (row < i->lines_num && i->lines[row] < pos) { row++; }
+  if ((row > 0 && i->lines[row-1] >= pos) 
+  ||  (row < i->lines_num && i->lines[row] < pos)) {
+    lo = 0; hi = i->lines_num;
+    while (lo < hi) {
+      mid = lo + (hi - lo) / 2;
+      if (i->lines[mid] < pos) { lo = mid + 1; } else { hi = mid; }
+    }
+    row = lo;
+  }
+  
+  i->lines_row = row;
+  s.pos = pos;
+  s.row = row;
+  s.col = row > 0 ? pos - i->lines[row-1] - 1 : pos;
+  return s;
+}
+
 static void mpc_input_backtrack_disable(mpc_input_t *i) { i->backtrack--; }
 static void mpc_input_backtrack_enable(mpc_input_t *i) { i->backtrack++; }
 
@@ -304,67 +1253,131 @@ static void mpc_input_mark(mpc_input_t *i) {
   
   if (i->marks_num > i->marks_slots) {
     i->marks_slots = i->marks_num + i->marks_num / 2;
-    i->marks = realloc(i->marks, sizeof(mpc_state_t) * i->marks_slots);
+    i->marks = realloc(i->marks, sizeof(long) * i->marks_slots);
     i->lasts = realloc(i->lasts, sizeof(char) * i->marks_slots);
   }
 
-  i->marks[i->marks_num-1] = i->state;
+  i->marks[i->marks_num-1] = i->pos;
   i->lasts[i->marks_num-1] = i->last;
   
-  if (i->type == MPC_INPUT_PIPE && i->marks_num == 1) {
-    i->buffer = calloc(1, 1);
-  }
-  
 }
 
+/*
+** Like the other stacks the marks are never
+** shrunk, so going in and out of a deep nesting
+** doesn't reallocate them every time.
+*/
+
 static void mpc_input_unmark(mpc_input_t *i) {
-  
   if (i->backtrack < 1) { return; }
-  
   i->marks_num--;
-  
-  if (i->marks_slots > i->marks_num + i->marks_num / 2
-  &&  i->marks_slots > MPC_INPUT_MARKS_MIN) {
-    i->marks_slots = 
-      i->marks_num > MPC_INPUT_MARKS_MIN ?
-      i->marks_num : MPC_INPUT_MARKS_MIN;
-    i->marks = realloc(i->marks, sizeof(mpc_state_t) * i->marks_slots);
-    i->lasts = realloc(i->lasts, sizeof(char) * i->marks_slots);      
-  }
-  
-  if (i->type == MPC_INPUT_PIPE && i->marks_num == 0) {
-    free(i->buffer);
-    i->buffer = NULL;
-  }
-  
 }
 
 static void mpc_input_rewind(mpc_input_t *i) {
   
   if (i->backtrack < 1) { return; }
   
-  i->state = i->marks[i->marks_num-1];
+  i->pos = i->marks[i->marks_num-1];
   i->last  = i->lasts[i->marks_num-1];
   
+  if (i->profile_num > 0) {
+    i->profile->rules[i->profile_frames[i->profile_num-1].rule].rewinds++;
+  }
+  
   if (i->type == MPC_INPUT_FILE) {
-    fseek(i->file, i->state.pos, SEEK_SET);
+    fseek(i->file, i->pos, SEEK_SET);
   }
   
   mpc_input_unmark(i);
 }
 
-static int mpc_input_buffer_in_range(mpc_input_t *i) {
-  return i->state.pos < (long)(strlen(i->buffer) + i->marks[0].pos);
+/*
+** Make room for `n` more characters in the
+** ring. When it is full everything below the
+** oldest mark is dropped, and only if that
+** frees too little does the ring grow.
+*/
+
+static void mpc_input_buffer_reserve(mpc_input_t *i, long n) {
+  
+  long keep, j, slots;
+  char *buffer;
+  
+  if (i->buffer_hi - i->buffer_lo + n <= i->buffer_slots) { return; }
+  
+  keep = i->marks_num > 0 ? i->marks[0] : i->pos;
+  if (keep > i->buffer_lo) {
+    mpc_input_lines(i, keep);
+    i->buffer_lo = keep;
+  }
+  
+  slots = i->buffer_slots;
+  while (i->buffer_hi - i->buffer_lo + n > slots) { slots *= 2; }
+  if (slots == i->buffer_slots) { return; }
+  
+  buffer = malloc(slots);
+  for (j = i->buffer_lo; j < i->buffer_hi; j++) {
+    buffer[j & (slots - 1)] = i->buffer[j & (i->buffer_slots - 1)];
+  }
+  free(i->buffer);
+  i->buffer = buffer;
+  i->buffer_slots = slots;
+}
+
+static void mpc_input_buffer_append(mpc_input_t *i, const char *c, long n) {
+  long j;
+  mpc_input_buffer_reserve(i, n);
+  for (j = 0; j < n; j++) {
+    i->buffer[(i->buffer_hi + j) & (i->buffer_slots - 1)] = c[j];
+  }
+  i->buffer_hi += n;
+}
+
+/*
+** A push parser owns a Push input, which keeps
+** the state of a parse that is waiting on input.
+*/
+
+struct mpc_push_t {
+  mpc_input_t *input;
+  mpc_parser_t *parser;
+  mpc_dtor_t destructor;
+  int ended;
+  int running;
+};
+
+/*
+** Make sure the character at the current
+** position is in the buffer, reading it from
+** the pipe if needed.
+*/
+
+static int mpc_input_buffer_fill(mpc_input_t *i) {
+  
+  int c;
+  
+  if (i->pos < i->buffer_hi) { return 1; }
+  if (i->type == MPC_INPUT_PUSH) { return 0; }
+  
+  c = getc(i->file);
+  if (c == EOF) { return 0; }
+  
+  mpc_input_buffer_reserve(i, 1);
+  i->buffer[i->buffer_hi & (i->buffer_slots - 1)] = (char)c;
+  i->buffer_hi++;
+  return 1;
 }
 
 static char mpc_input_buffer_get(mpc_input_t *i) {
-  return i->buffer[i->state.pos - i->marks[0].pos];
+  return i->buffer[i->pos & (i->buffer_slots - 1)];
 }
 
 static int mpc_input_terminated(mpc_input_t *i) {
-  if (i->type == MPC_INPUT_STRING && i->state.pos == (long)strlen(i->string)) { return 1; }
+  if (i->type == MPC_INPUT_STRING && i->pos >= i->length) { return 1; }
+  if (i->type == MPC_INPUT_MMAP && i->pos >= i->length) { return 1; }
   if (i->type == MPC_INPUT_FILE && feof(i->file)) { return 1; }
-  if (i->type == MPC_INPUT_PIPE && feof(i->file)) { return 1; }
+  if (i->type == MPC_INPUT_PIPE && i->pos >= i->buffer_hi && feof(i->file)) { return 1; }
+  if (i->type == MPC_INPUT_PUSH && i->pos >= i->buffer_hi && i->push->ended) { return 1; }
   return 0;
 }
 
@@ -374,19 +1387,12 @@ static char mpc_input_getc(mpc_input_t *i) {
   
   switch (i->type) {
     
-    case MPC_INPUT_STRING: return i->string[i->state.pos];
+    case MPC_INPUT_STRING:
+    case MPC_INPUT_MMAP: return i->pos < i->length ? i->string[i->pos] : '\0';
     case MPC_INPUT_FILE: c = fgetc(i->file); return c;
     case MPC_INPUT_PIPE:
-    
-      if (!i->buffer) { c = getc(i->file); return c; }
-      
-      if (i->buffer && mpc_input_buffer_in_range(i)) {
-        c = mpc_input_buffer_get(i);
-        return c;
-      } else {
-        c = getc(i->file);
-        return c;
-      }
+    case MPC_INPUT_PUSH:
+      return mpc_input_buffer_fill(i) ? mpc_input_buffer_get(i) : c;
     
     default: return c;
   }
@@ -397,7 +1403,8 @@ static char mpc_input_peekc(mpc_input_t *i) {
   char c = '\0';
   
   switch (i->type) {
-    case MPC_INPUT_STRING: return i->string[i->state.pos];
+    case MPC_INPUT_STRING:
+    case MPC_INPUT_MMAP: return i->pos < i->length ? i->string[i->pos] : '\0';
     case MPC_INPUT_FILE: 
       
       c = fgetc(i->file);
@@ -407,43 +1414,22 @@ static char mpc_input_peekc(mpc_input_t *i) {
       return c;
     
     case MPC_INPUT_PIPE:
-      
-      if (!i->buffer) {
-        c = getc(i->file);
-        if (feof(i->file)) { return '\0'; }
-        ungetc(c, i->file);
-        return c;
-      }
-      
-      if (i->buffer && mpc_input_buffer_in_range(i)) {
-        return mpc_input_buffer_get(i);
-      } else {
-        c = getc(i->file);
-        if (feof(i->file)) { return '\0'; }
-        ungetc(c, i->file);
-        return c;
-      }
+    case MPC_INPUT_PUSH:
+      return mpc_input_buffer_fill(i) ? mpc_input_buffer_get(i) : '\0';
     
     default: return c;
   }
   
 }
 
-static int mpc_input_failure(mpc_input_t *i, char c) {
+static int mpc_input_failure(mpc_input_t *i) {
 
   switch (i->type) {
-    case MPC_INPUT_STRING: { break; }
+    case MPC_INPUT_STRING:
+    case MPC_INPUT_MMAP:
+    case MPC_INPUT_PIPE:
+    case MPC_INPUT_PUSH: { break; }
     case MPC_INPUT_FILE: fseek(i->file, -1, SEEK_CUR); { break; }
-    case MPC_INPUT_PIPE: {
-      
-      if (!i->buffer) { ungetc(c, i->file); break; }
-      
-      if (i->buffer && mpc_input_buffer_in_range(i)) {
-        break;
-      } else {
-        ungetc(c, i->file); 
-      }
-    }
     default: { break; }
   }
   return 0;
@@ -451,23 +1437,12 @@ static int mpc_input_failure(mpc_input_t *i, char c) {
 
 static int mpc_input_success(mpc_input_t *i, char c, char **o) {
   
-  if (i->type == MPC_INPUT_PIPE
-  &&  i->buffer && !mpc_input_buffer_in_range(i)) {
-    i->buffer = realloc(i->buffer, strlen(i->buffer) + 2);
-    i->buffer[strlen(i->buffer) + 1] = '\0';
-    i->buffer[strlen(i->buffer) + 0] = c;
-  }
-  
   i->last = c;
-  i->state.pos++;
-  i->state.col++;
-  
-  if (c == '\n') {
-    i->state.col = 0;
-    i->state.row++;
-  }
+  i->pos++;
   
-  if (o) {
+  if (o && i->capture) {
+    (*o) = NULL;
+  } else if (o) {
     (*o) = mpc_malloc(i, 2);
     (*o)[0] = c;
     (*o)[1] = '\0';
@@ -485,37 +1460,65 @@ static int mpc_input_any(mpc_input_t *i, char **o) {
 static int mpc_input_char(mpc_input_t *i, char c, char **o) {
   char x = mpc_input_getc(i);
   if (mpc_input_terminated(i)) { return 0; }
-  return x == c ? mpc_input_success(i, x, o) : mpc_input_failure(i, x);
+  return x == c ? mpc_input_success(i, x, o) : mpc_input_failure(i);
 }
 
 static int mpc_input_range(mpc_input_t *i, char c, char d, char **o) {
   char x = mpc_input_getc(i);
   if (mpc_input_terminated(i)) { return 0; }
-  return x >= c && x <= d ? mpc_input_success(i, x, o) : mpc_input_failure(i, x);  
+  return x >= c && x <= d ? mpc_input_success(i, x, o) : mpc_input_failure(i);  
 }
 
-static int mpc_input_oneof(mpc_input_t *i, const char *c, char **o) {
+static int mpc_input_class(mpc_input_t *i, const mpc_class_t *c, char **o) {
   char x = mpc_input_getc(i);
   if (mpc_input_terminated(i)) { return 0; }
-  return strchr(c, x) != 0 ? mpc_input_success(i, x, o) : mpc_input_failure(i, x);  
+  return mpc_class_has(c, x) ? mpc_input_success(i, x, o) : mpc_input_failure(i);  
 }
 
-static int mpc_input_noneof(mpc_input_t *i, const char *c, char **o) {
+static int mpc_input_satisfy(mpc_input_t *i, int(*cond)(char), char **o) {
   char x = mpc_input_getc(i);
   if (mpc_input_terminated(i)) { return 0; }
-  return strchr(c, x) == 0 ? mpc_input_success(i, x, o) : mpc_input_failure(i, x);  
+  return cond(x) ? mpc_input_success(i, x, o) : mpc_input_failure(i);  
 }
 
-static int mpc_input_satisfy(mpc_input_t *i, int(*cond)(char), char **o) {
-  char x = mpc_input_getc(i);
-  if (mpc_input_terminated(i)) { return 0; }
-  return cond(x) ? mpc_input_success(i, x, o) : mpc_input_failure(i, x);  
+static int mpc_input_span(mpc_input_t *i) {
+  return i->type == MPC_INPUT_STRING || i->type == MPC_INPUT_MMAP;
+}
+
+static int mpc_input_span_success(mpc_input_t *i, long n, char **o) {
+  
+  const char *x = i->string + i->pos;
+  
+  if (n > 0) { i->last = x[n-1]; }
+  i->pos += n;
+  
+  if (i->capture) { *o = NULL; return 1; }
+  
+  *o = mpc_malloc(i, n + 1);
+  memcpy(*o, x, n);
+  (*o)[n] = '\0';
+  return 1;
 }
 
+/*
+** Over String and Mmap input a literal is
+** compared in place, so it needs no mark to
+** go back to if it only partly matches. With
+** backtracking off a partial match is left
+** consumed, as it is over any other input.
+*/
+
 static int mpc_input_string(mpc_input_t *i, const char *c, char **o) {
   
   const char *x = c;
-
+  long n;
+  
+  if (mpc_input_span(i) && i->backtrack > 0) {
+    n = (long)strlen(c);
+    if (i->length - i->pos < n || memcmp(i->string + i->pos, c, n) != 0) { return 0; }
+    return mpc_input_span_success(i, n, o);
+  }
+  
   mpc_input_mark(i);
   while (*x) {
     if (!mpc_input_char(i, *x, NULL)) {
@@ -531,6 +1534,56 @@ static int mpc_input_string(mpc_input_t *i, const char *c, char **o) {
   return 1;
 }
 
+/*
+** Over String and Mmap input a whole run of
+** characters from a class can be consumed in
+** one go. This is used for `many` and `many1`
+** of a class folded with `mpcf_strfold`.
+*/
+
+static int mpc_input_class_run(mpc_input_t *i, const mpc_class_t *c, char **o) {
+  long n = mpc_class_span(c, i->string + i->pos, i->length - i->pos);
+  return n > 0 ? mpc_input_span_success(i, n, o) : 0;
+}
+
+/*
+** Regular expressions compiled to a DFA are
+** matched directly over String and Mmap input.
+** Each state has a row of 256 transitions with
+** -1 for the dead state, and the longest prefix
+** ending in an accepting state is consumed.
+** States which loop back to themselves also
+** keep the class of characters they loop on so
+** runs of them can be scanned in one go.
+**
+** This skips the errors the combinators would
+** have merged on the way, so it is only done
+** when errors are suppressed anyway or when the
+** whole parse can be rerun exactly on failure.
+*/
+
+static int mpc_input_dfa(mpc_input_t *i, const int *trans, const char *accept, mpc_class_t **loops, char **o) {
+  
+  const char *x = i->string + i->pos;
+  long j, n = i->length - i->pos, end = accept[0] ? 0 : -1;
+  int s = 0;
+  
+  if (!i->suppress) { i->inexact = 1; }
+  
+  for (j = 0; j < n; j++) {
+    if (loops[s]) {
+      j += mpc_class_span(loops[s], x + j, n - j);
+      if (accept[s]) { end = j; }
+      if (j == n) { break; }
+    }
+    s = trans[s * 256 + (unsigned char)x[j]];
+    if (s < 0) { break; }
+    if (accept[s]) { end = j + 1; }
+  }
+  
+  return end < 0 ? 0 : mpc_input_span_success(i, end, o);
+}
+
 static int mpc_input_anchor(mpc_input_t* i, int(*f)(char,char), char **o) {
   *o = NULL;
   return f(i->last, mpc_input_peekc(i));
@@ -538,7 +1591,7 @@ static int mpc_input_anchor(mpc_input_t* i, int(*f)(char,char), char **o) {
 
 static mpc_state_t *mpc_input_state_copy(mpc_input_t *i) {
   mpc_state_t *r = mpc_malloc(i, sizeof(mpc_state_t));
-  memcpy(r, &i->state, sizeof(mpc_state_t));
+  *r = mpc_input_state(i, i->pos);
   return r;
 }
 
@@ -565,24 +1618,19 @@ void mpc_err_print_to(mpc_err_t *x, FILE *f) {
   free(str);
 }
 
-static void mpc_err_string_cat(char *buffer, int *pos, int *max, char const *fmt, ...) {
-  /* TODO: Error Checking on Length */
-  int left = ((*max) - (*pos));
+static void mpc_err_string_cat(char *buffer, int *pos, char const *fmt, ...) {
   va_list va;
   va_start(va, fmt);
-  if (left < 0) { left = 0;}
   (*pos) += vsprintf(buffer + (*pos), fmt, va);
   va_end(va);
 }
 
-static char char_unescape_buffer[4];
-
-static const char *mpc_err_char_unescape(char c) {
+static const char *mpc_err_char_unescape(char c, char *buffer) {
   
-  char_unescape_buffer[0] = '\'';
-  char_unescape_buffer[1] = ' ';
-  char_unescape_buffer[2] = '\'';
-  char_unescape_buffer[3] = '\0';
+  buffer[0] = '\'';
+  buffer[1] = ' ';
+  buffer[2] = '\'';
+  buffer[3] = '\0';
   
   switch (c) {
     case '\a': return "bell";
@@ -595,77 +1643,61 @@ static const char *mpc_err_char_unescape(char c) {
     case '\t': return "tab";
     case ' ' : return "space";
     default:
-      char_unescape_buffer[1] = c;
-      return char_unescape_buffer;
+      buffer[1] = c;
+      return buffer;
   }
   
 }
 
+/*
+** The length of the string is worked out before
+** it is written so errors of any size fit. Other
+** than the filename, failure and expected strings
+** the text is at most two numbers, each at most
+** eleven characters, and a few fixed words.
+*/
+
+enum { MPC_ERR_STRING_FIXED = 128 };
+
 char *mpc_err_string(mpc_err_t *x) {
 
   int i;  
   int pos = 0; 
-  int max = 1023;
-  char *buffer = calloc(1, 1024);
+  size_t max = MPC_ERR_STRING_FIXED + strlen(x->filename);
+  char unescaped[4];
+  char *buffer;
   
   if (x->failure) {
-    mpc_err_string_cat(buffer, &pos, &max,
+    buffer = malloc(max + strlen(x->failure));
+    mpc_err_string_cat(buffer, &pos,
     "%s: error: %s\n", x->filename, x->failure);
     return buffer;
   }
   
-  mpc_err_string_cat(buffer, &pos, &max, 
+  for (i = 0; i < x->expected_num; i++) { max += strlen(x->expected[i]) + 4; }
+  buffer = malloc(max);
+  
+  mpc_err_string_cat(buffer, &pos, 
     "%s:%i:%i: error: expected ", x->filename, x->state.row+1, x->state.col+1);
   
-  if (x->expected_num == 0) { mpc_err_string_cat(buffer, &pos, &max, "ERROR: NOTHING EXPECTED"); }
-  if (x->expected_num == 1) { mpc_err_string_cat(buffer, &pos, &max, "%s", x->expected[0]); }
+  if (x->expected_num == 0) { mpc_err_string_cat(buffer, &pos, "ERROR: NOTHING EXPECTED"); }
+  if (x->expected_num == 1) { mpc_err_string_cat(buffer, &pos, "%s", x->expected[0]); }
   if (x->expected_num >= 2) {
   
     for (i = 0; i < x->expected_num-2; i++) {
-      mpc_err_string_cat(buffer, &pos, &max, "%s, ", x->expected[i]);
+      mpc_err_string_cat(buffer, &pos, "%s, ", x->expected[i]);
     } 
     
-    mpc_err_string_cat(buffer, &pos, &max, "%s or %s", 
+    mpc_err_string_cat(buffer, &pos, "%s or %s", 
       x->expected[x->expected_num-2], 
       x->expected[x->expected_num-1]);
   }
   
-  mpc_err_string_cat(buffer, &pos, &max, " at ");
-  mpc_err_string_cat(buffer, &pos, &max, mpc_err_char_unescape(x->recieved));
-  mpc_err_string_cat(buffer, &pos, &max, "\n");
+  mpc_err_string_cat(buffer, &pos, " at ");
+  mpc_err_string_cat(buffer, &pos, "%s", mpc_err_char_unescape(x->recieved, unescaped));
+  mpc_err_string_cat(buffer, &pos, "\n");
   
-  return realloc(buffer, strlen(buffer) + 1);
-}
-
-static mpc_err_t *mpc_err_new(mpc_input_t *i, const char *expected) {
-  mpc_err_t *x;
-  if (i->suppress) { return NULL; }
-  x = mpc_malloc(i, sizeof(mpc_err_t));
-  x->filename = mpc_malloc(i, strlen(i->filename) + 1);
-  strcpy(x->filename, i->filename);
-  x->state = i->state;
-  x->expected_num = 1;
-  x->expected = mpc_malloc(i, sizeof(char*));
-  x->expected[0] = mpc_malloc(i, strlen(expected) + 1);
-  strcpy(x->expected[0], expected);
-  x->failure = NULL;
-  x->recieved = mpc_input_peekc(i);
-  return x;
-}
-
-static mpc_err_t *mpc_err_fail(mpc_input_t *i, const char *failure) {
-  mpc_err_t *x;
-  if (i->suppress) { return NULL; }
-  x = mpc_malloc(i, sizeof(mpc_err_t));
-  x->filename = mpc_malloc(i, strlen(i->filename) + 1);
-  strcpy(x->filename, i->filename);
-  x->state = i->state;
-  x->expected_num = 0;
-  x->expected = NULL;
-  x->failure = mpc_malloc(i, strlen(failure) + 1);
-  strcpy(x->failure, failure);
-  x->recieved = ' ';
-  return x;
+  return realloc(buffer, pos + 1);
 }
 
 static mpc_err_t *mpc_err_file(const char *filename, const char *failure) {
@@ -682,174 +1714,6 @@ static mpc_err_t *mpc_err_file(const char *filename, const char *failure) {
   return x;
 }
 
-static void mpc_err_delete_internal(mpc_input_t *i, mpc_err_t *x) {
-  int j;
-  if (x == NULL) { return; }
-  for (j = 0; j < x->expected_num; j++) { mpc_free(i, x->expected[j]); }
-  mpc_free(i, x->expected);
-  mpc_free(i, x->filename);
-  mpc_free(i, x->failure);
-  mpc_free(i, x);
-}
-
-static mpc_err_t *mpc_err_export(mpc_input_t *i, mpc_err_t *x) {
-  int j;
-  for (j = 0; j < x->expected_num; j++) {
-    x->expected[j] = mpc_export(i, x->expected[j]);
-  }
-  x->expected = mpc_export(i, x->expected);
-  x->filename = mpc_export(i, x->filename);
-  x->failure = mpc_export(i, x->failure);
-  return mpc_export(i, x);
-}
-
-static int mpc_err_contains_expected(mpc_input_t *i, mpc_err_t *x, char *expected) {
-  int j;
-  (void)i;
-  for (j = 0; j < x->expected_num; j++) {
-    if (strcmp(x->expected[j], expected) == 0) { return 1; }
-  }
-  return 0;
-}
-
-static void mpc_err_add_expected(mpc_input_t *i, mpc_err_t *x, char *expected) {
-  (void)i;
-  x->expected_num++;
-  x->expected = mpc_realloc(i, x->expected, sizeof(char*) * x->expected_num);
-  x->expected[x->expected_num-1] = mpc_malloc(i, strlen(expected) + 1);
-  strcpy(x->expected[x->expected_num-1], expected);
-}
-
-static mpc_err_t *mpc_err_or(mpc_input_t *i, mpc_err_t** x, int n) {
-  
-  int j, k, fst;
-  mpc_err_t *e;
-  
-  fst = -1;
-  for (j = 0; j < n; j++) {
-    if (x[j] != NULL) { fst = j; }
-  }
-  
-  if (fst == -1) { return NULL; }
-  
-  e = mpc_malloc(i, sizeof(mpc_err_t));
-  e->state = mpc_state_invalid();
-  e->expected_num = 0;
-  e->expected = NULL;
-  e->failure = NULL;
-  e->filename = mpc_malloc(i, strlen(x[fst]->filename)+1);
-  strcpy(e->filename, x[fst]->filename);
-  
-  for (j = 0; j < n; j++) {
-    if (x[j] == NULL) { continue; }
-    if (x[j]->state.pos > e->state.pos) { e->state = x[j]->state; }
-  }
-  
-  for (j = 0; j < n; j++) {
-    if (x[j] == NULL) { continue; }
-    if (x[j]->state.pos < e->state.pos) { continue; }
-    
-    if (x[j]->failure) {
-      e->failure = mpc_malloc(i, strlen(x[j]->failure)+1);
-      strcpy(e->failure, x[j]->failure);
-      break;
-    }
-    
-    e->recieved = x[j]->recieved;
-    
-    for (k = 0; k < x[j]->expected_num; k++) {
-      if (!mpc_err_contains_expected(i, e, x[j]->expected[k])) {
-        mpc_err_add_expected(i, e, x[j]->expected[k]);
-      }
-    }
-  }
-  
-  for (j = 0; j < n; j++) {
-    if (x[j] == NULL) { continue; }
-    mpc_err_delete_internal(i, x[j]);
-  }
-  
-  return e;
-}
-
-static mpc_err_t *mpc_err_repeat(mpc_input_t *i, mpc_err_t *x, const char *prefix) {
-
-  int j = 0;
-  size_t l = 0;
-  char *expect = NULL;
-  
-  if (x == NULL) { return NULL; }
-  
-  if (x->expected_num == 0) {
-    expect = mpc_calloc(i, 1, 1);
-    x->expected_num = 1;
-    x->expected = mpc_realloc(i, x->expected, sizeof(char*) * x->expected_num);
-    x->expected[0] = expect;
-    return x;
-  }
-  
-  else if (x->expected_num == 1) {
-    expect = mpc_malloc(i, strlen(prefix) + strlen(x->expected[0]) + 1);
-    strcpy(expect, prefix);
-    strcat(expect, x->expected[0]);
-    mpc_free(i, x->expected[0]);
-    x->expected[0] = expect;
-    return x;
-  }
-  
-  else if (x->expected_num > 1) {
-    
-    l += strlen(prefix);
-    for (j = 0; j < x->expected_num-2; j++) {
-      l += strlen(x->expected[j]) + strlen(", ");
-    }
-    l += strlen(x->expected[x->expected_num-2]);
-    l += strlen(" or ");
-    l += strlen(x->expected[x->expected_num-1]);
-    
-    expect = mpc_malloc(i, l + 1);
-    
-    strcpy(expect, prefix);
-    for (j = 0; j < x->expected_num-2; j++) {
-      strcat(expect, x->expected[j]); strcat(expect, ", ");
-    }
-    strcat(expect, x->expected[x->expected_num-2]);
-    strcat(expect, " or ");
-    strcat(expect, x->expected[x->expected_num-1]);
-
-    for (j = 0; j < x->expected_num; j++) { mpc_free(i, x->expected[j]); }
-    
-    x->expected_num = 1;
-    x->expected = mpc_realloc(i, x->expected, sizeof(char*) * x->expected_num);
-    x->expected[0] = expect;
-    return x;
-  }
-  
-  return NULL;
-}
-
-static mpc_err_t *mpc_err_many1(mpc_input_t *i, mpc_err_t *x) {
-  return mpc_err_repeat(i, x, "one or more of ");
-}
-
-static mpc_err_t *mpc_err_count(mpc_input_t *i, mpc_err_t *x, int n) {
-  mpc_err_t *y;
-  int digits = n/10 + 1;
-  char *prefix;
-  prefix = mpc_malloc(i, digits + strlen(" of ") + 1);
-  sprintf(prefix, "%i of ", n);
-  y = mpc_err_repeat(i, x, prefix);
-  mpc_free(i, prefix);
-  return y;
-}
-
-static mpc_err_t *mpc_err_merge(mpc_input_t *i, mpc_err_t *x, mpc_err_t *y) {
-  mpc_err_t *errs[2];
-  errs[0] = x;
-  errs[1] = y;
-  return mpc_err_or(i, errs, 2);
-}
-
 /*
 ** Parser Type
 */
@@ -882,7 +1746,23 @@ enum {
   MPC_TYPE_COUNT     = 22,
   
   MPC_TYPE_OR        = 23,
-  MPC_TYPE_AND       = 24
+  MPC_TYPE_AND       = 24,
+  
+  MPC_TYPE_PACKRAT   = 25,
+  MPC_TYPE_DFA       = 26,
+  MPC_TYPE_ARENA     = 27,
+  MPC_TYPE_TOKEN     = 28
+};
+
+/*
+** An `or` with a dispatch table maps the next
+** character to the only alternative that could
+** match it, or else to one of these.
+*/
+
+enum {
+  MPC_OR_ALL  = 254,
+  MPC_OR_NONE = 255
 };
 
 typedef struct { char *m; } mpc_pdata_fail_t;
@@ -893,13 +1773,18 @@ typedef struct { char x; } mpc_pdata_single_t;
 typedef struct { char x; char y; } mpc_pdata_range_t;
 typedef struct { int(*f)(char); } mpc_pdata_satisfy_t;
 typedef struct { char *x; } mpc_pdata_string_t;
+typedef struct { char *x; mpc_class_t *c; } mpc_pdata_class_t;
 typedef struct { mpc_parser_t *x; mpc_apply_t f; } mpc_pdata_apply_t;
 typedef struct { mpc_parser_t *x; mpc_apply_to_t f; void *d; } mpc_pdata_apply_to_t;
 typedef struct { mpc_parser_t *x; } mpc_pdata_predict_t;
+typedef struct { mpc_parser_t *x; mpc_apply_t cf; mpc_dtor_t dx; } mpc_pdata_packrat_t;
+typedef struct { mpc_parser_t *x; } mpc_pdata_arena_t;
+typedef struct { mpc_parser_t *x; int n; int *trans; char *accept; mpc_class_t **loops; } mpc_pdata_dfa_t;
+typedef struct { mpc_parser_t *x; mpc_class_t *c; } mpc_pdata_token_t;
 typedef struct { mpc_parser_t *x; mpc_dtor_t dx; mpc_ctor_t lf; } mpc_pdata_not_t;
-typedef struct { int n; mpc_fold_t f; mpc_parser_t *x; mpc_dtor_t dx; } mpc_pdata_repeat_t;
-typedef struct { int n; mpc_parser_t **xs; } mpc_pdata_or_t;
-typedef struct { int n; mpc_fold_t f; mpc_parser_t **xs; mpc_dtor_t *dxs;  } mpc_pdata_and_t;
+typedef struct { int n; mpc_fold_t f; mpc_parser_t *x; mpc_dtor_t dx; char span; } mpc_pdata_repeat_t;
+typedef struct { int n; mpc_parser_t **xs; unsigned char *first; } mpc_pdata_or_t;
+typedef struct { int n; mpc_fold_t f; mpc_parser_t **xs; mpc_dtor_t *dxs; char nomark; char span; } mpc_pdata_and_t;
 
 typedef union {
   mpc_pdata_fail_t fail;
@@ -910,9 +1795,14 @@ typedef union {
   mpc_pdata_range_t range;
   mpc_pdata_satisfy_t satisfy;
   mpc_pdata_string_t string;
+  mpc_pdata_class_t oneof;
   mpc_pdata_apply_t apply;
   mpc_pdata_apply_to_t apply_to;
   mpc_pdata_predict_t predict;
+  mpc_pdata_packrat_t packrat;
+  mpc_pdata_dfa_t dfa;
+  mpc_pdata_token_t token;
+  mpc_pdata_arena_t arena;
   mpc_pdata_not_t not;
   mpc_pdata_repeat_t repeat;
   mpc_pdata_and_t and;
@@ -924,6 +1814,9 @@ struct mpc_parser_t {
   mpc_pdata_t data;
   char type;
   char retained;
+  int id;
+  mpc_fold_t action;
+  mpc_dtor_t action_dtor;
 };
 
 static mpc_val_t *mpcf_input_nth_free(mpc_input_t *i, int n, mpc_val_t **xs, int x) {
@@ -938,14 +1831,50 @@ static mpc_val_t *mpcf_input_trd_free(mpc_input_t *i, int n, mpc_val_t **xs) { r
 
 static mpc_val_t *mpcf_input_strfold(mpc_input_t *i, int n, mpc_val_t **xs) {
   int j;
-  size_t l = 0;
+  size_t l = 0, k, m;
+  if (i->capture) {
+    for (j = 0; j < n; j++) { mpc_free(i, xs[j]); }
+    return NULL;
+  }
   if (n == 0) { return mpc_calloc(i, 1, 1); }
   for (j = 0; j < n; j++) { l += strlen(xs[j]); }
+  k = strlen(xs[0]);
   xs[0] = mpc_realloc(i, xs[0], l + 1);
-  for (j = 1; j < n; j++) { strcat(xs[0], xs[j]); mpc_free(i, xs[j]); }
+  for (j = 1; j < n; j++) {
+    m = strlen(xs[j]);
+    memcpy((char*)xs[0] + k, xs[j], m + 1);
+    k += m; mpc_free(i, xs[j]);
+  }
   return xs[0];
 }
 
+static mpc_ast_arena_t *mpc_ast_arena_new(void);
+static mpc_ast_t *mpc_ast_arena_node(mpc_ast_arena_t *m, const char *tag, const char *contents);
+static mpc_ast_t *mpc_ast_fold(mpc_ast_arena_t *m, int n, mpc_ast_t **as);
+static mpc_ast_t *mpc_ast_arena_copy(mpc_ast_arena_t *m, mpc_ast_t *a);
+static mpc_ast_t *mpc_ast_arena_share(mpc_ast_arena_t *m, mpc_ast_t *a, int depth);
+static mpc_val_t *mpcf_ast_share(mpc_val_t *x);
+
+static mpc_val_t *mpcaf_list_text(mpc_val_t *x);
+static mpc_val_t *mpcaf_list_same(mpc_val_t *x);
+static mpc_val_t *mpcaf_list_same_to(mpc_val_t *x, void *d);
+static mpc_val_t *mpcaf_list_fold(int n, mpc_val_t **xs);
+static void mpcaf_list_delete(mpc_val_t *x);
+static mpc_val_t *mpcaf_list_rule(mpc_val_t *x, void *d);
+static mpc_val_t *mpcaf_action_values(mpc_val_t *x, void *d);
+static mpc_val_t *mpcaf_action_text(mpc_val_t *x, void *d);
+static mpc_val_t *mpcaf_input_list_text(mpc_input_t *i, mpc_val_t *x);
+static mpc_val_t *mpcaf_input_list_fold(mpc_input_t *i, int n, mpc_val_t **xs);
+static void mpcaf_input_list_delete(mpc_input_t *i, mpc_val_t *x);
+static mpc_val_t *mpcaf_input_list_rule(mpc_input_t *i, mpc_val_t *x, void *d);
+static mpc_val_t *mpcaf_input_action_values(mpc_input_t *i, mpc_val_t *x, void *d);
+static mpc_val_t *mpcaf_input_action_text(mpc_input_t *i, mpc_val_t *x, void *d);
+static void mpc_ast_arena_root(mpc_ast_arena_t *m, mpc_ast_t *a);
+
+static mpc_val_t *mpcf_input_fold_ast(mpc_input_t *i, int n, mpc_val_t **xs) {
+  return mpc_ast_fold(i->ast_arena, n, (mpc_ast_t**)xs);
+}
+
 static mpc_val_t *mpcf_input_state_ast(mpc_input_t *i, int n, mpc_val_t **xs) {
   mpc_state_t *s = ((mpc_state_t**)xs)[0];
   mpc_ast_t *a = ((mpc_ast_t**)xs)[1];
@@ -966,6 +1895,8 @@ static mpc_val_t *mpc_parse_fold(mpc_input_t *i, mpc_fold_t f, int n, mpc_val_t
   if (f == mpcf_trd_free)  { return mpcf_input_trd_free(i, n, xs); }
   if (f == mpcf_strfold)   { return mpcf_input_strfold(i, n, xs); }
   if (f == mpcf_state_ast) { return mpcf_input_state_ast(i, n, xs); }
+  if (f == mpcf_fold_ast && i->ast_arena) { return mpcf_input_fold_ast(i, n, xs); }
+  if (f == mpcaf_list_fold) { return mpcaf_input_list_fold(i, n, xs); }
   for (j = 0; j < n; j++) { xs[j] = mpc_export(i, xs[j]); }
   return f(j, xs);
 }
@@ -976,2867 +1907,6416 @@ static mpc_val_t *mpcf_input_free(mpc_input_t *i, mpc_val_t *x) {
 }
 
 static mpc_val_t *mpcf_input_str_ast(mpc_input_t *i, mpc_val_t *c) {
-  mpc_ast_t *a = mpc_ast_new("", c);
+  mpc_ast_t *a = i->ast_arena ? mpc_ast_arena_node(i->ast_arena, "", c) : mpc_ast_new("", c);
   mpc_free(i, c);
   return a;
 }
 
 static mpc_val_t *mpc_parse_apply(mpc_input_t *i, mpc_apply_t f, mpc_val_t *x) {
-  if (f == mpcf_free)     { return mpcf_input_free(i, x); }
-  if (f == mpcf_str_ast)  { return mpcf_input_str_ast(i, x); }
+  if (f == mpcf_free)        { return mpcf_input_free(i, x); }
+  if (f == mpcf_str_ast)     { return mpcf_input_str_ast(i, x); }
+  if (f == mpcaf_list_text)  { return mpcaf_input_list_text(i, x); }
+  if (f == mpcaf_list_same)  { return x; }
   return f(mpc_export(i, x));
 }
 
 static mpc_val_t *mpc_parse_apply_to(mpc_input_t *i, mpc_apply_to_t f, mpc_val_t *x, mpc_val_t *d) {
+  if (f == mpcaf_list_rule)     { return mpcaf_input_list_rule(i, x, d); }
+  if (f == mpcaf_list_same_to)  { return x; }
+  if (f == mpcaf_action_values) { return mpcaf_input_action_values(i, x, d); }
+  if (f == mpcaf_action_text)   { return mpcaf_input_action_text(i, x, d); }
   return f(mpc_export(i, x), d);
 }
 
+static mpc_val_t *mpc_parse_lift(mpc_input_t *i, mpc_ctor_t f) {
+  if (f == mpcf_ctor_str) { return mpc_calloc(i, 1, 1); }
+  return f();
+}
+
+static mpc_val_t *mpc_parse_copy(mpc_input_t *i, mpc_apply_t f, mpc_val_t *x) {
+  if (f == (mpc_apply_t)mpc_ast_copy && i->ast_arena) { return mpc_ast_arena_copy(i->ast_arena, x); }
+  if (f == mpcf_ast_share && i->ast_arena) { return mpc_ast_arena_share(i->ast_arena, x, 2); }
+  return f(x);
+}
+
 static void mpc_parse_dtor(mpc_input_t *i, mpc_dtor_t d, mpc_val_t *x) {
   if (d == free) { mpc_free(i, x); return; }
+  if (d == mpcaf_list_delete) { mpcaf_input_list_delete(i, x); return; }
   d(mpc_export(i, x));
 }
 
+/*
+** Memo Table
+*/
+
 enum {
-  MPC_PARSE_STACK_MIN = 4
+  MPC_MEMO_SLOTS_MIN = 64
 };
 
-#define MPC_SUCCESS(x) r->output = x; return 1
-#define MPC_FAILURE(x) r->error = x; return 0
-#define MPC_PRIMITIVE(x) \
-  if (x) { MPC_SUCCESS(r->output); } \
-  else { MPC_FAILURE(NULL); }
+static unsigned long mpc_memo_hash(mpc_parser_t *p, long pos, int suppress) {
+  unsigned long h = (unsigned long)(size_t)p >> 4;
+  h ^= (unsigned long)pos * 2654435761UL;
+  h ^= (unsigned long)suppress << 7;
+  return h ^ (h >> 15);
+}
 
-static int mpc_parse_run(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, mpc_err_t **e) {
+static mpc_memo_t *mpc_memo_find(mpc_input_t *i, mpc_parser_t *p) {
   
-  int j = 0, k = 0;
-  mpc_result_t results_stk[MPC_PARSE_STACK_MIN];
-  mpc_result_t *results;
-  int results_slots = MPC_PARSE_STACK_MIN;
+  int suppress = i->suppress > 0;
+  unsigned long j;
+  mpc_memo_t *m;
   
-  switch (p->type) {
-      
-    /* Basic Parsers */
+  if (i->memo_num == 0) { return NULL; }
+  
+  j = mpc_memo_hash(p, i->pos, suppress);
+  for (;;) {
+    m = &i->memo[j & (i->memo_slots-1)];
+    if (m->parser == NULL) { return NULL; }
+    if (m->parser == p && m->pos == i->pos && m->suppress == suppress) { return m; }
+    j++;
+  }
+}
 
-    case MPC_TYPE_ANY:     MPC_PRIMITIVE(mpc_input_any(i, (char**)&r->output));
-    case MPC_TYPE_SINGLE:  MPC_PRIMITIVE(mpc_input_char(i, p->data.single.x, (char**)&r->output));
-    case MPC_TYPE_RANGE:   MPC_PRIMITIVE(mpc_input_range(i, p->data.range.x, p->data.range.y, (char**)&r->output));
-    case MPC_TYPE_ONEOF:   MPC_PRIMITIVE(mpc_input_oneof(i, p->data.string.x, (char**)&r->output));
-    case MPC_TYPE_NONEOF:  MPC_PRIMITIVE(mpc_input_noneof(i, p->data.string.x, (char**)&r->output));
-    case MPC_TYPE_SATISFY: MPC_PRIMITIVE(mpc_input_satisfy(i, p->data.satisfy.f, (char**)&r->output));
-    case MPC_TYPE_STRING:  MPC_PRIMITIVE(mpc_input_string(i, p->data.string.x, (char**)&r->output));
-    case MPC_TYPE_ANCHOR:  MPC_PRIMITIVE(mpc_input_anchor(i, p->data.anchor.f, (char**)&r->output));
-    
-    /* Other parsers */
-    
-    case MPC_TYPE_UNDEFINED: MPC_FAILURE(mpc_err_fail(i, "Parser Undefined!"));
-    case MPC_TYPE_PASS:      MPC_SUCCESS(NULL);
-    case MPC_TYPE_FAIL:      MPC_FAILURE(mpc_err_fail(i, p->data.fail.m));
-    case MPC_TYPE_LIFT:      MPC_SUCCESS(p->data.lift.lf());
-    case MPC_TYPE_LIFT_VAL:  MPC_SUCCESS(p->data.lift.x);
-    case MPC_TYPE_STATE:     MPC_SUCCESS(mpc_input_state_copy(i));
-    
-    /* Application Parsers */
-    
-    case MPC_TYPE_APPLY:
-      if (mpc_parse_run(i, p->data.apply.x, r, e)) {
-        MPC_SUCCESS(mpc_parse_apply(i, p->data.apply.f, r->output));
-      } else {
-        MPC_FAILURE(r->output);
-      }
-    
-    case MPC_TYPE_APPLY_TO:
-      if (mpc_parse_run(i, p->data.apply_to.x, r, e)) {
-        MPC_SUCCESS(mpc_parse_apply_to(i, p->data.apply_to.f, r->output, p->data.apply_to.d));
-      } else {
-        MPC_FAILURE(r->error);
-      }
-    
-    case MPC_TYPE_EXPECT:
-      mpc_input_suppress_enable(i);
-      if (mpc_parse_run(i, p->data.expect.x, r, e)) {
-        mpc_input_suppress_disable(i);
-        MPC_SUCCESS(r->output);
-      } else {
-        mpc_input_suppress_disable(i);
-        MPC_FAILURE(mpc_err_new(i, p->data.expect.m));
-      }
-    
-    case MPC_TYPE_PREDICT:
-      mpc_input_backtrack_disable(i);
-      if (mpc_parse_run(i, p->data.predict.x, r, e)) {      
-        mpc_input_backtrack_enable(i);
-        MPC_SUCCESS(r->output);
-      } else {
-        mpc_input_backtrack_enable(i);
-        MPC_FAILURE(r->error);
-      }
-    
-    /* Optional Parsers */
+static void mpc_memo_insert(mpc_input_t *i, mpc_memo_t *x) {
+  unsigned long j = mpc_memo_hash(x->parser, x->pos, x->suppress);
+  while (i->memo[j & (i->memo_slots-1)].parser != NULL) { j++; }
+  i->memo[j & (i->memo_slots-1)] = *x;
+}
+
+static void mpc_memo_add(mpc_input_t *i, mpc_memo_t *x) {
+  
+  int j, slots;
+  mpc_memo_t *memo;
+  
+  if (2 * (i->memo_num + 1) > i->memo_slots) {
     
-    /* TODO: Update Not Error Message */
+    slots = i->memo_slots ? i->memo_slots * 2 : MPC_MEMO_SLOTS_MIN;
+    memo = i->memo;
     
-    case MPC_TYPE_NOT:
-      mpc_input_mark(i);
-      mpc_input_suppress_enable(i);
-      if (mpc_parse_run(i, p->data.not.x, r, e)) {
-        mpc_input_rewind(i);
-        mpc_input_suppress_disable(i);
-        mpc_parse_dtor(i, p->data.not.dx, r->output);
-        MPC_FAILURE(mpc_err_new(i, "opposite"));
-      } else {
-        mpc_input_unmark(i);
-        mpc_input_suppress_disable(i);
-        MPC_SUCCESS(p->data.not.lf());
-      }
+    i->memo = calloc(slots, sizeof(mpc_memo_t));
+    i->memo_slots = slots;
     
-    case MPC_TYPE_MAYBE:
-      if (mpc_parse_run(i, p->data.not.x, r, e)) {
-        MPC_SUCCESS(r->output);
-      } else {
-        *e = mpc_err_merge(i, *e, r->error);
-        MPC_SUCCESS(p->data.not.lf());
-      }
-    
-    /* Repeat Parsers */
-    
-    case MPC_TYPE_MANY:
-      
-      results = results_stk;
-      
-      while (mpc_parse_run(i, p->data.repeat.x, &results[j], e)) {
-        j++;
-        if (j == MPC_PARSE_STACK_MIN) {
-          results_slots = j + j / 2;
-          results = mpc_malloc(i, sizeof(mpc_result_t) * results_slots);
-          memcpy(results, results_stk, sizeof(mpc_result_t) * MPC_PARSE_STACK_MIN);
-        } else if (j >= results_slots) {
-          results_slots = j + j / 2;
-          results = mpc_realloc(i, results, sizeof(mpc_result_t) * results_slots);
-        }
-      }
-      
-      *e = mpc_err_merge(i, *e, results[j].error);
-      MPC_SUCCESS(
-        mpc_parse_fold(i, p->data.repeat.f, j, (mpc_val_t**)results);
-        if (j >= MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
-    
-    case MPC_TYPE_MANY1:
-      
-      results = results_stk;
-      
-      while (mpc_parse_run(i, p->data.repeat.x, &results[j], e)) {
-        j++;
-        if (j == MPC_PARSE_STACK_MIN) {
-          results_slots = j + j / 2;
-          results = mpc_malloc(i, sizeof(mpc_result_t) * results_slots);
-          memcpy(results, results_stk, sizeof(mpc_result_t) * MPC_PARSE_STACK_MIN);
-        } else if (j >= results_slots) {
-          results_slots = j + j / 2;
-          results = mpc_realloc(i, results, sizeof(mpc_result_t) * results_slots);
-        }
-      }
-      
-      if (j == 0) {
-        MPC_FAILURE(
-          mpc_err_many1(i, results[j].error);
-          if (j >= MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
-      } else {
-        *e = mpc_err_merge(i, *e, results[j].error);
-        MPC_SUCCESS(
-          mpc_parse_fold(i, p->data.repeat.f, j, (mpc_val_t**)results);
-          if (j >= MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
-      }
-    
-    case MPC_TYPE_COUNT:
-      
-      results = p->data.repeat.n > MPC_PARSE_STACK_MIN
-        ? mpc_malloc(i, sizeof(mpc_result_t) * p->data.repeat.n)
-        : results_stk;
-      
-      while (mpc_parse_run(i, p->data.repeat.x, &results[j], e)) {
-        j++;
-        if (j == p->data.repeat.n) { break; }
-      }
-      
-      if (j == p->data.repeat.n) {
-        MPC_SUCCESS(
-          mpc_parse_fold(i, p->data.repeat.f, j, (mpc_val_t**)results);
-          if (p->data.repeat.n > MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
-      } else {
-        for (k = 0; k < j; k++) {
-          mpc_parse_dtor(i, p->data.repeat.dx, results[k].output);
-        }
-        MPC_FAILURE(
-          mpc_err_count(i, results[j].error, p->data.repeat.n);
-          if (p->data.repeat.n > MPC_PARSE_STACK_MIN) { mpc_free(i, results); });  
-      }
-      
-    /* Combinatory Parsers */
-    
-    case MPC_TYPE_OR:
-      
-      if (p->data.or.n == 0) { MPC_SUCCESS(NULL); }
-      
-      results = p->data.or.n > MPC_PARSE_STACK_MIN
-        ? mpc_malloc(i, sizeof(mpc_result_t) * p->data.or.n)
-        : results_stk;
-      
-      for (j = 0; j < p->data.or.n; j++) {
-        if (mpc_parse_run(i, p->data.or.xs[j], &results[j], e)) {
-          MPC_SUCCESS(results[j].output;
-            if (p->data.or.n > MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
-        } else {
-          *e = mpc_err_merge(i, *e, results[j].error);
-        } 
-      }
-      
-      MPC_FAILURE(NULL;
-        if (p->data.or.n > MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
-    
-    case MPC_TYPE_AND:
-      
-      if (p->data.and.n == 0) { MPC_SUCCESS(NULL); }
-      
-      results = p->data.or.n > MPC_PARSE_STACK_MIN
-        ? mpc_malloc(i, sizeof(mpc_result_t) * p->data.or.n)
-        : results_stk;
-      
-      mpc_input_mark(i);
-      for (j = 0; j < p->data.and.n; j++) {
-        if (!mpc_parse_run(i, p->data.and.xs[j], &results[j], e)) {
-          mpc_input_rewind(i);
-          for (k = 0; k < j; k++) {
-            mpc_parse_dtor(i, p->data.and.dxs[k], results[k].output);
-          }
-          MPC_FAILURE(results[j].error;
-            if (p->data.or.n > MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
-        }
-      }
-      mpc_input_unmark(i); 
-      MPC_SUCCESS(
-        mpc_parse_fold(i, p->data.and.f, j, (mpc_val_t**)results);
-        if (p->data.or.n > MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
-    
-    /* End */
-    
-    default:
-      
-      MPC_FAILURE(mpc_err_fail(i, "Unknown Parser Type Id!"));
+    for (j = 0; j < slots / 2 && memo; j++) {
+      if (memo[j].parser) { mpc_memo_insert(i, &memo[j]); }
+    }
+    free(memo);
   }
   
-  return 0;
+  mpc_memo_insert(i, x);
+  i->memo_num++;
+}
+
+static void mpc_memo_clear(mpc_input_t *i) {
+  
+  int j;
+  mpc_memo_t *m;
   
+  for (j = 0; j < i->memo_slots && i->memo_num > 0; j++) {
+    m = &i->memo[j];
+    if (m->parser == NULL) { continue; }
+    if (m->success && m->parser->data.packrat.dx) {
+      m->parser->data.packrat.dx(m->output);
+    }
+    mpc_free(i, m->fails);
+    m->parser = NULL;
+    i->memo_num--;
+  }
 }
 
-#undef MPC_SUCCESS
-#undef MPC_FAILURE
-#undef MPC_PRIMITIVE
+enum {
+  MPC_PARSE_STARVED = -1,
+  MPC_PARSE_CALL    = -2
+};
 
-int mpc_parse_input(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r) {
-  int x;
-  mpc_err_t *e = mpc_err_fail(i, "Unknown Error");
-  e->state = mpc_state_invalid();
-  x = mpc_parse_run(i, p, r, &e);
-  if (x) {
-    mpc_err_delete_internal(i, e);
-    r->output = mpc_export(i, r->output);
-  } else {
-    r->error = mpc_err_export(i, mpc_err_merge(i, e, r->error));
+/*
+** A push input can run out before it has been
+** ended, in which case the driver returns and
+** retries the same primitive once more input has
+** been fed. Primitives are only started when all
+** the input they might look at is buffered, so
+** nothing needs undoing.
+*/
+
+static int mpc_parse_starved(mpc_input_t *i, mpc_parser_t *p) {
+  
+  long n = 0;
+  
+  switch (p->type) {
+    case MPC_TYPE_ANY:
+    case MPC_TYPE_SINGLE:
+    case MPC_TYPE_RANGE:
+    case MPC_TYPE_ONEOF:
+    case MPC_TYPE_NONEOF:
+    case MPC_TYPE_SATISFY:
+    case MPC_TYPE_ANCHOR: n = 1; break;
+    case MPC_TYPE_STRING: n = (long)strlen(p->data.string.x); break;
+    default: return 0;
   }
-  return x;
+  
+  return !i->push->ended && i->buffer_hi - i->pos < n;
 }
 
-int mpc_parse(const char *filename, const char *string, mpc_parser_t *p, mpc_result_t *r) {
-  int x;
-  mpc_input_t *i = mpc_input_new_string(filename, string);
-  x = mpc_parse_input(i, p, r);
-  mpc_input_delete(i);
-  return x;
+static mpc_frame_t *mpc_parse_push(mpc_input_t *i, mpc_parser_t *p) {
+  
+  mpc_frame_t *f;
+  
+  if (i->frames_num == i->frames_slots) {
+    i->frames_slots = i->frames_slots ? i->frames_slots * 2 : MPC_PARSE_FRAMES_MIN;
+    i->frames = realloc(i->frames, sizeof(mpc_frame_t) * i->frames_slots);
+  }
+  
+  f = &i->frames[i->frames_num++];
+  f->parser = p;
+  f->index = 0;
+  f->values = i->values_num;
+  f->capture = -1;
+  return f;
 }
 
-int mpc_nparse(const char *filename, const char *string, size_t length, mpc_parser_t *p, mpc_result_t *r) {
-  int x;
-  mpc_input_t *i = mpc_input_new_nstring(filename, string, length);
-  x = mpc_parse_input(i, p, r);
-  mpc_input_delete(i);
-  return x;
+static void mpc_parse_pending(mpc_input_t *i) {
+  if (i->pending_num == i->pending_slots) {
+    i->pending_slots = i->pending_slots ? i->pending_slots * 2 : MPC_PARSE_FRAMES_MIN;
+    i->pending = realloc(i->pending, sizeof(mpc_pending_t) * i->pending_slots);
+  }
+  i->pending[i->pending_num].pos = i->pos;
+  i->pending[i->pending_num].fails = i->fails_num;
+  i->pending[i->pending_num].fails_resets = i->fails_resets;
+  i->pending_num++;
 }
 
-int mpc_parse_file(const char *filename, FILE *file, mpc_parser_t *p, mpc_result_t *r) {
-  int x;
-  mpc_input_t *i = mpc_input_new_file(filename, file);
-  x = mpc_parse_input(i, p, r);
-  mpc_input_delete(i);
-  return x;
+static void mpc_parse_value(mpc_input_t *i, mpc_val_t *x) {
+  if (i->values_num == i->values_slots) {
+    i->values_slots = i->values_slots ? i->values_slots * 2 : MPC_PARSE_FRAMES_MIN;
+    i->values = realloc(i->values, sizeof(mpc_val_t*) * i->values_slots);
+  }
+  i->values[i->values_num++] = x;
 }
 
-int mpc_parse_pipe(const char *filename, FILE *pipe, mpc_parser_t *p, mpc_result_t *r) {
-  int x;
-  mpc_input_t *i = mpc_input_new_pipe(filename, pipe);
-  x = mpc_parse_input(i, p, r);
-  mpc_input_delete(i);
-  return x;
-}
+/*
+** A parser failing with a message records it,
+** unless errors are suppressed, and passes one
+** of these up in place of an error to say if
+** the record was kept. Records are kept in the
+** order they are made, which is the order the
+** errors they stand for would have been merged
+** in, as each is passed straight up to where it
+** would be merged without any other parser
+** running in between.
+*/
 
-int mpc_parse_contents(const char *filename, mpc_parser_t *p, mpc_result_t *r) {
+static mpc_err_t mpc_err_kept;
+static mpc_err_t mpc_err_dropped;
+
+static mpc_err_t *mpc_parse_fail(mpc_input_t *i, mpc_fail_t *x) {
   
-  FILE *f = fopen(filename, "rb");
-  int res;
+  if (i->fails_num > 0 && x->pos < i->fails[0].pos) { return &mpc_err_dropped; }
   
-  if (f == NULL) {
-    r->output = NULL;
-    r->error = mpc_err_file(filename, "Unable to open file!");
-    return 0;
+  if (i->fails_num > 0 && x->pos > i->fails[0].pos) {
+    i->fails_num = 0;
+    i->fails_resets++;
   }
   
-  res = mpc_parse_file(filename, f, p, r);
-  fclose(f);
-  return res;
+  if (i->fails_num == i->fails_slots) {
+    i->fails_slots = i->fails_slots ? i->fails_slots * 2 : MPC_PARSE_FRAMES_MIN;
+    i->fails = realloc(i->fails, sizeof(mpc_fail_t) * i->fails_slots);
+  }
+  
+  i->fails[i->fails_num++] = *x;
+  return &mpc_err_kept;
+}
+
+static mpc_err_t *mpc_parse_expected(mpc_input_t *i, const char *expected) {
+  mpc_fail_t x;
+  if (i->suppress) { return NULL; }
+  x.pos = i->pos;
+  x.recieved = mpc_input_peekc(i);
+  x.expected = expected;
+  x.failure = NULL;
+  return mpc_parse_fail(i, &x);
+}
+
+static mpc_err_t *mpc_parse_failure(mpc_input_t *i, const char *failure) {
+  mpc_fail_t x;
+  if (i->suppress) { return NULL; }
+  x.pos = i->pos;
+  x.recieved = ' ';
+  x.expected = NULL;
+  x.failure = failure;
+  return mpc_parse_fail(i, &x);
 }
 
 /*
-** Building a Parser
+** A `many1` or `count` that fails puts a prefix
+** on what its child expected. Only the record
+** passed up can need it, which if kept is the
+** last one.
 */
 
-static void mpc_undefine_unretained(mpc_parser_t *p, int force);
-
-static void mpc_undefine_or(mpc_parser_t *p) {
+static mpc_err_t *mpc_parse_repeat(mpc_input_t *i, mpc_err_t *x, const char *prefix) {
   
-  int i;
-  for (i = 0; i < p->data.or.n; i++) {
-    mpc_undefine_unretained(p->data.or.xs[i], 0);
-  }
-  free(p->data.or.xs);
+  mpc_fail_t *f;
+  char *expected;
+  
+  if (x != &mpc_err_kept) { return x; }
+  f = &i->fails[i->fails_num-1];
+  if (f->failure) { return x; }
   
+  expected = mpc_malloc(i, strlen(prefix) + strlen(f->expected) + 1);
+  strcpy(expected, prefix);
+  strcat(expected, f->expected);
+  f->expected = expected;
+  return x;
 }
 
-static void mpc_undefine_and(mpc_parser_t *p) {
-  
-  int i;
-  for (i = 0; i < p->data.and.n; i++) {
-    mpc_undefine_unretained(p->data.and.xs[i], 0);
-  }
-  free(p->data.and.xs);
-  free(p->data.and.dxs);
-  
+static mpc_err_t *mpc_parse_count(mpc_input_t *i, mpc_err_t *x, int n) {
+  char prefix[32];
+  sprintf(prefix, "%i of ", n);
+  return mpc_parse_repeat(i, x, prefix);
 }
 
-static void mpc_undefine_unretained(mpc_parser_t *p, int force) {
+/*
+** Builds the error for a failed parse from the
+** records at the farthest position, just as
+** merging errors as they happened would have.
+** The first failure message takes precedence
+** over anything expected after it.
+*/
+
+static mpc_err_t *mpc_parse_error(mpc_input_t *i) {
   
-  if (p->retained && !force) { return; }
+  int j, k;
+  mpc_fail_t *f;
+  mpc_err_t *e = malloc(sizeof(mpc_err_t));
   
-  switch (p->type) {
-    
-    case MPC_TYPE_FAIL: free(p->data.fail.m); break;
-    
-    case MPC_TYPE_ONEOF: 
-    case MPC_TYPE_NONEOF:
-    case MPC_TYPE_STRING:
-      free(p->data.string.x); 
-      break;
+  e->filename = malloc(strlen(i->filename) + 1);
+  strcpy(e->filename, i->filename);
+  e->state = mpc_input_state(i, i->fails[0].pos);
+  e->expected_num = 0;
+  e->expected = NULL;
+  e->failure = NULL;
+  e->recieved = ' ';
+  
+  for (j = 0; j < i->fails_num; j++) {
     
-    case MPC_TYPE_APPLY:    mpc_undefine_unretained(p->data.apply.x, 0);    break;
-    case MPC_TYPE_APPLY_TO: mpc_undefine_unretained(p->data.apply_to.x, 0); break;
-    case MPC_TYPE_PREDICT:  mpc_undefine_unretained(p->data.predict.x, 0);  break;
+    f = &i->fails[j];
     
-    case MPC_TYPE_MAYBE:
-    case MPC_TYPE_NOT:
-      mpc_undefine_unretained(p->data.not.x, 0);
+    if (f->failure) {
+      e->failure = malloc(strlen(f->failure) + 1);
+      strcpy(e->failure, f->failure);
       break;
+    }
     
-    case MPC_TYPE_EXPECT:
-      mpc_undefine_unretained(p->data.expect.x, 0);
-      free(p->data.expect.m);
-      break;
-      
-    case MPC_TYPE_MANY:
-    case MPC_TYPE_MANY1:
-    case MPC_TYPE_COUNT:
-      mpc_undefine_unretained(p->data.repeat.x, 0);
-      break;
+    e->recieved = f->recieved;
     
-    case MPC_TYPE_OR:  mpc_undefine_or(p);  break;
-    case MPC_TYPE_AND: mpc_undefine_and(p); break;
+    for (k = 0; k < e->expected_num; k++) {
+      if (strcmp(e->expected[k], f->expected) == 0) { break; }
+    }
+    if (k < e->expected_num) { continue; }
     
-    default: break;
-  }
-  
-  if (!force) {
-    free(p->name);
-    free(p);
+    e->expected_num++;
+    e->expected = realloc(e->expected, sizeof(char*) * e->expected_num);
+    e->expected[k] = malloc(strlen(f->expected) + 1);
+    strcpy(e->expected[k], f->expected);
   }
   
+  return e;
 }
 
-void mpc_delete(mpc_parser_t *p) {
-  if (p->retained) {
+/*
+** A `many` or `many1` of a character class
+** folded with `mpcf_strfold` takes the whole
+** run as its first result over String and Mmap
+** input. The loop after then tries the class
+** once more and fails just as it would have,
+** so the errors are unchanged.
+*/
 
-    if (p->type != MPC_TYPE_UNDEFINED) {
-      mpc_undefine_unretained(p, 0);
-    } 
-    
-    free(p->name);
-    free(p);
+static int mpc_parse_class_run(mpc_input_t *i, mpc_parser_t *p, mpc_val_t **o) {
   
-  } else {
-    mpc_undefine_unretained(p, 0);  
-  }
+  mpc_parser_t *x = p->data.repeat.x;
+  
+  if (p->data.repeat.f != mpcf_strfold || !mpc_input_span(i)) { return 0; }
+  while (x->type == MPC_TYPE_EXPECT) { x = x->data.expect.x; }
+  if (x->type != MPC_TYPE_ONEOF && x->type != MPC_TYPE_NONEOF) { return 0; }
+  
+  return mpc_input_class_run(i, x->data.oneof.c, (char**)o);
 }
 
-static void mpc_soft_delete(mpc_val_t *x) {
-  mpc_undefine_unretained(x, 0);
-}
+/*
+** Over String and Mmap input a token is matched
+** in place and the whitespace after it skipped
+** with one class scan, without entering either
+** parser. Like a DFA this skips the errors the
+** whitespace would have merged on the way.
+*/
 
-static mpc_parser_t *mpc_undefined(void) {
-  mpc_parser_t *p = calloc(1, sizeof(mpc_parser_t));
-  p->retained = 0;
-  p->type = MPC_TYPE_UNDEFINED;
-  p->name = NULL;
-  return p;
+static int mpc_parse_token(mpc_input_t *i, mpc_parser_t *p, mpc_val_t **o) {
+  
+  mpc_parser_t *x = p->data.token.x->data.and.xs[0];
+  long n;
+  int r = 0;
+  
+  if (x->type == MPC_TYPE_EXPECT) { x = x->data.expect.x; }
+  if (!i->suppress) { i->inexact = 1; }
+  
+  switch (x->type) {
+    case MPC_TYPE_SINGLE: r = mpc_input_char(i, x->data.single.x, (char**)o); break;
+    case MPC_TYPE_RANGE:  r = mpc_input_range(i, x->data.range.x, x->data.range.y, (char**)o); break;
+    case MPC_TYPE_ONEOF:
+    case MPC_TYPE_NONEOF: r = mpc_input_class(i, x->data.oneof.c, (char**)o); break;
+    case MPC_TYPE_STRING: r = mpc_input_string(i, x->data.string.x, (char**)o); break;
+    case MPC_TYPE_DFA:
+      r = mpc_input_dfa(i, x->data.dfa.trans, x->data.dfa.accept, x->data.dfa.loops, (char**)o);
+      break;
+    default: break;
+  }
+  
+  if (!r) { return 0; }
+  
+  n = mpc_class_span(p->data.token.c, i->string + i->pos, i->length - i->pos);
+  if (n > 0) { i->last = i->string[i->pos + n - 1]; }
+  i->pos += n;
+  return 1;
 }
 
-mpc_parser_t *mpc_new(const char *name) {
-  mpc_parser_t *p = mpc_undefined();
-  p->retained = 1;
-  p->name = realloc(p->name, strlen(name) + 1);
-  strcpy(p->name, name);
-  return p;
+/*
+** A `many`, `count` or `and` folded with
+** `mpcf_strfold` whose parts only ever return
+** the text they consumed is marked `span` by
+** the optimiser. Over String and Mmap input the
+** outermost of these keeps where it started and
+** everything under it returns NULL in place of
+** its text, which is then copied from the input
+** in one go when it finishes.
+*/
+
+static void mpc_parse_capture(mpc_input_t *i, mpc_frame_t *f, int span) {
+  if (span && !i->capture && mpc_input_span(i)) {
+    f->capture = i->pos;
+    i->capture = 1;
+  }
 }
 
-mpc_parser_t *mpc_copy(mpc_parser_t *a) {
-  int i = 0;
-  mpc_parser_t *p;
+static mpc_val_t *mpc_parse_captured(mpc_input_t *i, mpc_frame_t *f, mpc_fold_t g) {
   
-  if (a->retained) { return a; }
+  mpc_val_t **xs = i->values + f->values;
+  char *o;
+  long n;
+  int j;
   
-  p = mpc_undefined();
-  p->retained = a->retained;
-  p->type = a->type;
-  p->data = a->data;
+  if (f->capture < 0) { return mpc_parse_fold(i, g, f->index, xs); }
   
-  if (a->name) {
-    p->name = malloc(strlen(a->name)+1);
-    strcpy(p->name, a->name);
-  }
+  i->capture = 0;
+  for (j = 0; j < f->index; j++) { mpc_free(i, xs[j]); }
   
-  switch (a->type) {
-    
-    case MPC_TYPE_FAIL:
-      p->data.fail.m = malloc(strlen(a->data.fail.m)+1);
-      strcpy(p->data.fail.m, a->data.fail.m);
-    break;
+  n = i->pos - f->capture;
+  o = mpc_malloc(i, n + 1);
+  memcpy(o, i->string + f->capture, n);
+  o[n] = '\0';
+  return o;
+}
+
+/*
+** Starts running a parser, pushing a frame for
+** each combinator on the way down to the first
+** parser that gives a result straight away, and
+** returns that result. If push input runs out
+** first the parser to retry is left in `i->call`.
+*/
+
+#define MPC_SUCCESS(x) r->output = x; return 1
+#define MPC_FAILURE(x) r->error = x; return 0
+#define MPC_PRIMITIVE(x) \
+  if (x) { MPC_SUCCESS(r->output); } \
+  else { MPC_FAILURE(NULL); }
+#define MPC_ENTER(x) p = x; continue
+#define MPC_CALL(x) i->call = x; return MPC_PARSE_CALL
+
+/*
+** Profiling
+*/
+
+enum {
+  MPC_PROFILE_RULES_MIN = 16
+};
+
+static double mpc_profile_clock(void) {
+#if defined(CLOCK_MONOTONIC)
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (double)t.tv_sec + (double)t.tv_nsec / 1e9;
+#else
+  return (double)clock() / CLOCKS_PER_SEC;
+#endif
+}
+
+static unsigned long mpc_profile_hash(mpc_parser_t *p) {
+  unsigned long h = (unsigned long)(size_t)p >> 4;
+  h *= 2654435761UL;
+  return h ^ (h >> 15);
+}
+
+static void mpc_profile_grow(mpc_profile_t *f) {
+  
+  int j;
+  unsigned long k;
+  
+  f->rules_slots = f->rules_slots ? f->rules_slots * 2 : MPC_PROFILE_RULES_MIN;
+  f->rules = realloc(f->rules, sizeof(mpc_profile_rule_t) * f->rules_slots);
+  f->table = realloc(f->table, sizeof(int) * f->rules_slots * 2);
+  
+  for (j = 0; j < f->rules_slots * 2; j++) { f->table[j] = -1; }
+  for (j = 0; j < f->rules_num; j++) {
+    k = mpc_profile_hash(f->rules[j].parser);
+    while (f->table[k & (f->rules_slots * 2 - 1)] >= 0) { k++; }
+    f->table[k & (f->rules_slots * 2 - 1)] = j;
+  }
+}
+
+static int mpc_profile_rule(mpc_profile_t *f, mpc_parser_t *p) {
+  
+  int j;
+  unsigned long k;
+  mpc_profile_rule_t *x;
+  
+  if (f->rules_num == f->rules_slots) { mpc_profile_grow(f); }
+  
+  for (k = mpc_profile_hash(p);; k++) {
+    j = f->table[k & (f->rules_slots * 2 - 1)];
+    if (j < 0) { break; }
+    if (f->rules[j].parser == p) { return j; }
+  }
+  
+  j = f->rules_num++;
+  f->table[k & (f->rules_slots * 2 - 1)] = j;
+  x = &f->rules[j];
+  memset(x, 0, sizeof(mpc_profile_rule_t));
+  x->parser = p;
+  x->name = malloc(strlen(p->name) + 1);
+  strcpy(x->name, p->name);
+  return j;
+}
+
+static void mpc_profile_enter(mpc_input_t *i, mpc_parser_t *p) {
+  
+  mpc_profile_frame_t *f;
+  
+  if (i->profile_num == i->profile_slots) {
+    i->profile_slots = i->profile_slots ? i->profile_slots * 2 : MPC_PARSE_FRAMES_MIN;
+    i->profile_frames = realloc(i->profile_frames, sizeof(mpc_profile_frame_t) * i->profile_slots);
+  }
+  
+  f = &i->profile_frames[i->profile_num++];
+  f->rule = mpc_profile_rule(i->profile, p);
+  f->frames = i->frames_num;
+  f->pos = i->pos;
+  f->children = 0.0;
+  i->profile->rules[f->rule].calls++;
+  f->start = mpc_profile_clock();
+}
+
+static void mpc_profile_leave(mpc_input_t *i, int x) {
+  
+  double end = mpc_profile_clock(), t;
+  mpc_profile_frame_t *f;
+  mpc_profile_rule_t *u;
+  
+  while (i->profile_num > 0 && i->profile_frames[i->profile_num-1].frames >= i->frames_num) {
+    f = &i->profile_frames[--i->profile_num];
+    u = &i->profile->rules[f->rule];
+    t = end - f->start;
+    u->inclusive += t;
+    u->exclusive += t - f->children;
+    if (x) {
+      u->successes++;
+      u->bytes += (unsigned long)(i->pos - f->pos);
+    } else {
+      u->failures++;
+    }
+    if (i->profile_num > 0) { i->profile_frames[i->profile_num-1].children += t; }
+  }
+}
+
+static int mpc_parse_enter(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r) {
+  
+  mpc_frame_t *f;
+  mpc_memo_t *m;
+  int j;
+  
+  while (1) {
     
-    case MPC_TYPE_ONEOF: 
-    case MPC_TYPE_NONEOF:
-    case MPC_TYPE_STRING:
-      p->data.string.x = malloc(strlen(a->data.string.x)+1);
-      strcpy(p->data.string.x, a->data.string.x);
-      break;
+    if (i->type == MPC_INPUT_PUSH && mpc_parse_starved(i, p)) {
+      i->call = p;
+      return MPC_PARSE_STARVED;
+    }
     
-    case MPC_TYPE_APPLY:    p->data.apply.x    = mpc_copy(a->data.apply.x);    break;
-    case MPC_TYPE_APPLY_TO: p->data.apply_to.x = mpc_copy(a->data.apply_to.x); break;
-    case MPC_TYPE_PREDICT:  p->data.predict.x  = mpc_copy(a->data.predict.x);  break;
+    if (i->profile && p->name) { mpc_profile_enter(i, p); }
     
-    case MPC_TYPE_MAYBE:
-    case MPC_TYPE_NOT:
-      p->data.not.x = mpc_copy(a->data.not.x);
-      break;
+    switch (p->type) {
+      
+      /* Basic Parsers */
+
+      case MPC_TYPE_ANY:     MPC_PRIMITIVE(mpc_input_any(i, (char**)&r->output));
+      case MPC_TYPE_SINGLE:  MPC_PRIMITIVE(mpc_input_char(i, p->data.single.x, (char**)&r->output));
+      case MPC_TYPE_RANGE:   MPC_PRIMITIVE(mpc_input_range(i, p->data.range.x, p->data.range.y, (char**)&r->output));
+      case MPC_TYPE_ONEOF:   MPC_PRIMITIVE(mpc_input_class(i, p->data.oneof.c, (char**)&r->output));
+      case MPC_TYPE_NONEOF:  MPC_PRIMITIVE(mpc_input_class(i, p->data.oneof.c, (char**)&r->output));
+      case MPC_TYPE_SATISFY: MPC_PRIMITIVE(mpc_input_satisfy(i, p->data.satisfy.f, (char**)&r->output));
+      case MPC_TYPE_STRING:  MPC_PRIMITIVE(mpc_input_string(i, p->data.string.x, (char**)&r->output));
+      case MPC_TYPE_ANCHOR:  MPC_PRIMITIVE(mpc_input_anchor(i, p->data.anchor.f, (char**)&r->output));
+    
+      /* Other parsers */
+    
+      case MPC_TYPE_UNDEFINED: MPC_FAILURE(mpc_parse_failure(i, "Parser Undefined!"));
+      case MPC_TYPE_PASS:      MPC_SUCCESS(NULL);
+      case MPC_TYPE_FAIL:      MPC_FAILURE(mpc_parse_failure(i, p->data.fail.m));
+      case MPC_TYPE_LIFT:      MPC_SUCCESS(mpc_parse_lift(i, p->data.lift.lf));
+      case MPC_TYPE_LIFT_VAL:  MPC_SUCCESS(p->data.lift.x);
+      case MPC_TYPE_STATE:     MPC_SUCCESS(mpc_input_state_copy(i));
+    
+      /* Application Parsers */
+    
+      case MPC_TYPE_APPLY:    mpc_parse_push(i, p); MPC_ENTER(p->data.apply.x);
+      case MPC_TYPE_APPLY_TO: mpc_parse_push(i, p); MPC_ENTER(p->data.apply_to.x);
+    
+      case MPC_TYPE_EXPECT:
+        mpc_input_suppress_enable(i);
+        mpc_parse_push(i, p);
+        MPC_ENTER(p->data.expect.x);
+    
+      /*
+      ** The errors a packrat parser merges while
+      ** running are gathered separately so they can
+      ** be stored with the entry and replayed into
+      ** the caller's errors on every hit.
+      */
+    
+      case MPC_TYPE_PACKRAT:
+      
+        if (i->backtrack < 1) { MPC_ENTER(p->data.packrat.x); }
+      
+        m = mpc_memo_find(i, p);
+      
+        if (m) {
+          i->pos = m->end;
+          i->last = m->last;
+          if (i->type == MPC_INPUT_FILE) { fseek(i->file, i->pos, SEEK_SET); }
+          r->error = NULL;
+          for (j = 0; j < m->fails_num; j++) { r->error = mpc_parse_fail(i, &m->fails[j]); }
+          if (m->success) {
+            MPC_SUCCESS(mpc_parse_copy(i, p->data.packrat.cf, m->output));
+          } else {
+            MPC_FAILURE(m->error == &mpc_err_kept ? r->error : m->error);
+          }
+        }
+      
+        mpc_parse_push(i, p);
+        mpc_parse_pending(i);
+        MPC_ENTER(p->data.packrat.x);
+    
+      case MPC_TYPE_DFA:
+        if (mpc_input_span(i) && i->backtrack > 0 && !i->exact) {
+          MPC_PRIMITIVE(mpc_input_dfa(i, p->data.dfa.trans, p->data.dfa.accept, p->data.dfa.loops, (char**)&r->output));
+        }
+        MPC_ENTER(p->data.dfa.x);
+    
+      case MPC_TYPE_TOKEN:
+        if (mpc_input_span(i) && i->backtrack > 0 && !i->exact) {
+          MPC_PRIMITIVE(mpc_parse_token(i, p, &r->output));
+        }
+        MPC_ENTER(p->data.token.x);
+    
+      /*
+      ** An arena parser only changes anything when
+      ** a parse starts from it, so anywhere else it
+      ** is passed straight through.
+      */
+    
+      case MPC_TYPE_ARENA:
+        MPC_ENTER(p->data.arena.x);
+    
+      case MPC_TYPE_PREDICT:
+        mpc_input_backtrack_disable(i);
+        mpc_parse_push(i, p);
+        MPC_ENTER(p->data.predict.x);
+    
+      /* Optional Parsers */
+    
+      case MPC_TYPE_NOT:
+        mpc_input_mark(i);
+        mpc_input_suppress_enable(i);
+        mpc_parse_push(i, p);
+        MPC_ENTER(p->data.not.x);
+    
+      case MPC_TYPE_MAYBE:
+        mpc_parse_push(i, p);
+        MPC_ENTER(p->data.not.x);
+    
+      /* Repeat Parsers */
+    
+      case MPC_TYPE_MANY:
+      case MPC_TYPE_MANY1:
+        f = mpc_parse_push(i, p);
+        mpc_parse_capture(i, f, p->data.repeat.span);
+        if (mpc_parse_class_run(i, p, &r->output)) {
+          mpc_parse_value(i, r->output);
+          f->index++;
+        }
+        MPC_ENTER(p->data.repeat.x);
+    
+      case MPC_TYPE_COUNT:
+        if (p->data.repeat.n == 0) { MPC_SUCCESS(mpc_parse_fold(i, p->data.repeat.f, 0, NULL)); }
+        f = mpc_parse_push(i, p);
+        mpc_parse_capture(i, f, p->data.repeat.span);
+        MPC_ENTER(p->data.repeat.x);
+    
+      /* Combinatory Parsers */
+    
+      /*
+      ** With a dispatch table the next character
+      ** picks the only alternative that could match,
+      ** and its frame index is marked negative so
+      ** no others are tried after. The ones skipped
+      ** would have failed without consuming anything
+      ** but their errors are lost, so as with a DFA
+      ** a failed parse is rerun exactly.
+      */
+    
+      case MPC_TYPE_OR:
+        if (p->data.or.n == 0) { MPC_SUCCESS(NULL); }
+        if (p->data.or.first && mpc_input_span(i) && !i->exact) {
+          j = p->data.or.first[(unsigned char)mpc_input_peekc(i)];
+          if (j != MPC_OR_ALL) {
+            if (!i->suppress) { i->inexact = 1; }
+            if (j == MPC_OR_NONE) { MPC_FAILURE(NULL); }
+            f = mpc_parse_push(i, p);
+            f->index = -1;
+            MPC_ENTER(p->data.or.xs[j]);
+          }
+        }
+        mpc_parse_push(i, p);
+        MPC_ENTER(p->data.or.xs[0]);
+    
+      case MPC_TYPE_AND:
+        if (p->data.and.n == 0) { MPC_SUCCESS(NULL); }
+        if (!p->data.and.nomark) { mpc_input_mark(i); }
+        f = mpc_parse_push(i, p);
+        mpc_parse_capture(i, f, p->data.and.span);
+        MPC_ENTER(p->data.and.xs[0]);
+    
+      /* End */
+    
+      default:
+      
+        MPC_FAILURE(mpc_parse_failure(i, "Unknown Parser Type Id!"));
+    }
+    
+  }
+  
+}
+
+/*
+** Passes the result `x`, `r` of a child to the
+** frame on top of the stack. Returns the result
+** of the frame if it is done with, having popped
+** it, or asks for the next child in `i->call`.
+*/
+
+static int mpc_parse_leave(mpc_input_t *i, int x, mpc_result_t *r) {
+  
+  mpc_frame_t *f = &i->frames[i->frames_num-1];
+  mpc_parser_t *p = f->parser;
+  mpc_pending_t *n;
+  mpc_memo_t m;
+  int j;
+  
+  switch (p->type) {
+    
+    case MPC_TYPE_APPLY:
+      i->frames_num--;
+      if (x) { MPC_SUCCESS(mpc_parse_apply(i, p->data.apply.f, r->output)); }
+      MPC_FAILURE(r->error);
+    
+    case MPC_TYPE_APPLY_TO:
+      i->frames_num--;
+      if (x) { MPC_SUCCESS(mpc_parse_apply_to(i, p->data.apply_to.f, r->output, p->data.apply_to.d)); }
+      MPC_FAILURE(r->error);
     
     case MPC_TYPE_EXPECT:
-      p->data.expect.x = mpc_copy(a->data.expect.x);
-      p->data.expect.m = malloc(strlen(a->data.expect.m)+1);
-      strcpy(p->data.expect.m, a->data.expect.m);
-      break;
+      i->frames_num--;
+      mpc_input_suppress_disable(i);
+      if (x) { MPC_SUCCESS(r->output); }
+      MPC_FAILURE(mpc_parse_expected(i, p->data.expect.m));
+    
+    case MPC_TYPE_PACKRAT:
       
+      /*
+      ** The records kept since it started, which
+      ** are all it needs to replay, are the ones
+      ** from where it started unless they have all
+      ** been dropped for farther ones since.
+      */
+      
+      n = &i->pending[--i->pending_num];
+      j = n->fails_resets == i->fails_resets ? n->fails : 0;
+      m.parser = p;
+      m.pos = n->pos;
+      m.suppress = i->suppress > 0;
+      m.success = x;
+      m.end = i->pos;
+      m.last = i->last;
+      m.output = x ? mpc_parse_copy(i, p->data.packrat.cf, r->output) : NULL;
+      m.error = x ? NULL : r->error;
+      m.fails_num = i->fails_num - j;
+      m.fails = mpc_malloc(i, sizeof(mpc_fail_t) * (m.fails_num + 1));
+      memcpy(m.fails, i->fails + j, sizeof(mpc_fail_t) * m.fails_num);
+      mpc_memo_add(i, &m);
+      
+      i->frames_num--;
+      return x;
+    
+    case MPC_TYPE_PREDICT:
+      i->frames_num--;
+      mpc_input_backtrack_enable(i);
+      return x;
+    
+    /* TODO: Update Not Error Message */
+    
+    case MPC_TYPE_NOT:
+      i->frames_num--;
+      if (x) {
+        mpc_input_rewind(i);
+        mpc_input_suppress_disable(i);
+        mpc_parse_dtor(i, p->data.not.dx, r->output);
+        MPC_FAILURE(mpc_parse_expected(i, "opposite"));
+      } else {
+        mpc_input_unmark(i);
+        mpc_input_suppress_disable(i);
+        MPC_SUCCESS(mpc_parse_lift(i, p->data.not.lf));
+      }
+    
+    case MPC_TYPE_MAYBE:
+      i->frames_num--;
+      if (x) { MPC_SUCCESS(r->output); }
+      MPC_SUCCESS(mpc_parse_lift(i, p->data.not.lf));
+    
     case MPC_TYPE_MANY:
     case MPC_TYPE_MANY1:
+      
+      if (x) {
+        mpc_parse_value(i, r->output);
+        f->index++;
+        MPC_CALL(p->data.repeat.x);
+      }
+      
+      if (p->type == MPC_TYPE_MANY1 && f->index == 0) {
+        i->frames_num--;
+        if (f->capture >= 0) { i->capture = 0; }
+        MPC_FAILURE(mpc_parse_repeat(i, r->error, "one or more of "));
+      }
+      
+      i->frames_num--;
+      i->values_num = f->values;
+      MPC_SUCCESS(mpc_parse_captured(i, f, p->data.repeat.f));
+    
     case MPC_TYPE_COUNT:
-      p->data.repeat.x = mpc_copy(a->data.repeat.x);
-      break;
+      
+      if (x) {
+        mpc_parse_value(i, r->output);
+        f->index++;
+        if (f->index != p->data.repeat.n) { MPC_CALL(p->data.repeat.x); }
+        i->frames_num--;
+        i->values_num = f->values;
+        MPC_SUCCESS(mpc_parse_captured(i, f, p->data.repeat.f));
+      }
+      
+      i->frames_num--;
+      i->values_num = f->values;
+      if (f->capture >= 0) { i->capture = 0; }
+      for (j = 0; j < f->index; j++) {
+        mpc_parse_dtor(i, p->data.repeat.dx, i->values[f->values + j]);
+      }
+      MPC_FAILURE(mpc_parse_count(i, r->error, p->data.repeat.n));
     
     case MPC_TYPE_OR:
-      p->data.or.xs = malloc(a->data.or.n * sizeof(mpc_parser_t*));
-      for (i = 0; i < a->data.or.n; i++) {
-        p->data.or.xs[i] = mpc_copy(a->data.or.xs[i]);
+      
+      if (x) {
+        i->frames_num--;
+        MPC_SUCCESS(r->output);
       }
-    break;
+      
+      if (f->index >= 0 && ++f->index != p->data.or.n) { MPC_CALL(p->data.or.xs[f->index]); }
+      
+      i->frames_num--;
+      MPC_FAILURE(NULL);
+    
     case MPC_TYPE_AND:
-      p->data.and.xs = malloc(a->data.and.n * sizeof(mpc_parser_t*));
-      for (i = 0; i < a->data.and.n; i++) {
-        p->data.and.xs[i] = mpc_copy(a->data.and.xs[i]);
+      
+      if (x) {
+        mpc_parse_value(i, r->output);
+        f->index++;
+        if (f->index != p->data.and.n) { MPC_CALL(p->data.and.xs[f->index]); }
+        if (!p->data.and.nomark) { mpc_input_unmark(i); }
+        i->frames_num--;
+        i->values_num = f->values;
+        MPC_SUCCESS(mpc_parse_captured(i, f, p->data.and.f));
       }
-      p->data.and.dxs = malloc((a->data.and.n-1) * sizeof(mpc_dtor_t));
-      for (i = 0; i < a->data.and.n-1; i++) {
-        p->data.and.dxs[i] = a->data.and.dxs[i];
+      
+      if (!p->data.and.nomark) { mpc_input_rewind(i); }
+      i->frames_num--;
+      i->values_num = f->values;
+      if (f->capture >= 0) { i->capture = 0; }
+      for (j = 0; j < f->index; j++) {
+        mpc_parse_dtor(i, p->data.and.dxs[j], i->values[f->values + j]);
       }
-    break;
+      MPC_FAILURE(r->error);
     
-    default: break;
+    default:
+      i->frames_num--;
+      MPC_FAILURE(mpc_parse_failure(i, "Unknown Parser Type Id!"));
   }
+  
+}
 
+#undef MPC_SUCCESS
+#undef MPC_FAILURE
+#undef MPC_PRIMITIVE
+#undef MPC_ENTER
+#undef MPC_CALL
+
+/*
+** Runs the driver from wherever it left off
+** until the parser started in `i->call` has a
+** result, or the push input it is reading from
+** runs out.
+*/
+
+static int mpc_parse_run(mpc_input_t *i, mpc_result_t *r) {
+  
+  int x = mpc_parse_enter(i, i->call, r);
+  if (i->profile && x != MPC_PARSE_STARVED) { mpc_profile_leave(i, x); }
+  
+  while (x != MPC_PARSE_STARVED && i->frames_num > 0) {
+    x = mpc_parse_leave(i, x, r);
+    if (x == MPC_PARSE_CALL) { x = mpc_parse_enter(i, i->call, r); }
+    if (i->profile && x != MPC_PARSE_STARVED) { mpc_profile_leave(i, x); }
+  }
+  
+  return x;
   
-  return p;
 }
 
-mpc_parser_t *mpc_undefine(mpc_parser_t *p) {
-  mpc_undefine_unretained(p, 1);
-  p->type = MPC_TYPE_UNDEFINED;
-  return p;
+static void mpc_parse_start(mpc_input_t *i, mpc_parser_t *p) {
+  mpc_fail_t unknown;
+  i->parser = p;
+  i->call = p;
+  i->start = i->pos;
+  i->start_last = i->last;
+  i->frames_num = 0;
+  i->values_num = 0;
+  i->pending_num = 0;
+  i->profile_num = 0;
+  i->inexact = 0;
+  i->capture = 0;
+  i->fails_num = 0;
+  i->fails_resets = 0;
+  unknown.pos = -1;
+  unknown.recieved = ' ';
+  unknown.expected = NULL;
+  unknown.failure = "Unknown Error";
+  mpc_parse_fail(i, &unknown);
+  if (i->ast_arena) { mpc_ast_arena_delete(i->ast_arena); }
+  i->ast_arena = p->type == MPC_TYPE_ARENA ? mpc_ast_arena_new() : NULL;
 }
 
-mpc_parser_t *mpc_define(mpc_parser_t *p, mpc_parser_t *a) {
+/*
+** If a parse that went through a DFA fails the
+** errors it skipped might matter, so the input
+** is rewound and parsed again with only the
+** combinators to get exactly the same message.
+*/
+
+static int mpc_parse_finish(mpc_input_t *i, mpc_result_t *r) {
+  
+  mpc_profile_t *profile;
+  int x = mpc_parse_run(i, r);
+  if (x == MPC_PARSE_STARVED) { return x; }
+  
+  mpc_memo_clear(i);
+  
+  /*
+  ** A failure is profiled once, so the
+  ** exact rerun isn't counted again.
+  */
+  
+  if (!x && i->inexact) {
+    profile = i->profile;
+    i->profile = NULL;
+    i->pos = i->start;
+    i->last = i->start_last;
+    mpc_parse_start(i, i->parser);
+    i->exact = 1;
+    x = mpc_parse_run(i, r);
+    mpc_memo_clear(i);
+    i->exact = 0;
+    i->profile = profile;
+  }
   
-  if (p->retained) {
-    p->type = a->type;
-    p->data = a->data;
+  if (x) {
+    r->output = mpc_export(i, r->output);
   } else {
-    mpc_parser_t *a2 = mpc_failf("Attempt to assign to Unretained Parser!");
-    p->type = a2->type;
-    p->data = a2->data;
-    free(a2);
+    r->error = mpc_parse_error(i);
   }
   
-  free(a);
-  return p;  
+  if (i->ast_arena) {
+    if (x && r->output) { mpc_ast_arena_root(i->ast_arena, r->output); }
+    else { mpc_ast_arena_delete(i->ast_arena); }
+    i->ast_arena = NULL;
+  }
+  
+  i->fails_num = 0;
+  mpc_mem_reset(i);
+  return x;
 }
 
-void mpc_cleanup(int n, ...) {
-  int i;
-  mpc_parser_t **list = malloc(sizeof(mpc_parser_t*) * n);
-  
-  va_list va;
-  va_start(va, n);
-  for (i = 0; i < n; i++) { list[i] = va_arg(va, mpc_parser_t*); }
-  for (i = 0; i < n; i++) { mpc_undefine(list[i]); }
-  for (i = 0; i < n; i++) { mpc_delete(list[i]); }  
-  va_end(va);  
+int mpc_parse_input(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r) {
+  mpc_parse_start(i, p);
+  return mpc_parse_finish(i, r);
+}
 
-  free(list);
+int mpc_parse(const char *filename, const char *string, mpc_parser_t *p, mpc_result_t *r) {
+  int x;
+  mpc_input_t *i = mpc_input_new_string(filename, string);
+  x = mpc_parse_input(i, p, r);
+  mpc_input_delete(i);
+  return x;
 }
 
-mpc_parser_t *mpc_pass(void) {
-  mpc_parser_t *p = mpc_undefined();
-  p->type = MPC_TYPE_PASS;
-  return p;
+/*
+** A context is a string input kept from one
+** parse to the next.
+*/
+
+struct mpc_context_t {
+  mpc_input_t *input;
+};
+
+mpc_context_t *mpc_context_new(void) {
+  mpc_context_t *c = malloc(sizeof(mpc_context_t));
+  c->input = NULL;
+  return c;
 }
 
-mpc_parser_t *mpc_fail(const char *m) {
-  mpc_parser_t *p = mpc_undefined();
-  p->type = MPC_TYPE_FAIL;
-  p->data.fail.m = malloc(strlen(m) + 1);
-  strcpy(p->data.fail.m, m);
-  return p;
+void mpc_context_delete(mpc_context_t *c) {
+  if (c->input) { mpc_input_delete(c->input); }
+  free(c);
 }
 
-/*
-** As `snprintf` is not ANSI standard this 
-** function `mpc_failf` should be considered
-** unsafe.
-**
-** You have a few options if this is going to be
-** trouble.
-**
-** - Ensure the format string does not exceed
-**   the buffer length using precision specifiers
-**   such as `%.512s`.
-**
-** - Patch this function in your code base to 
-**   use `snprintf` or whatever variant your
-**   system supports.
-**
-** - Avoid it altogether.
-**
-*/
-
-mpc_parser_t *mpc_failf(const char *fmt, ...) {
-  
-  va_list va;
-  char *buffer;
-
-  mpc_parser_t *p = mpc_undefined();
-  p->type = MPC_TYPE_FAIL;
-  
-  va_start(va, fmt);
-  buffer = malloc(2048);
-  vsprintf(buffer, fmt, va);
-  va_end(va);
-  
-  buffer = realloc(buffer, strlen(buffer) + 1);
-  p->data.fail.m = buffer;
-  return p;
-
+int mpc_parse_context(mpc_context_t *c, const char *filename, const char *string, mpc_parser_t *p, mpc_result_t *r) {
+  if (c->input) {
+    mpc_input_reuse_string(c->input, filename, string);
+  } else {
+    c->input = mpc_input_new_string(filename, string);
+  }
+  return mpc_parse_input(c->input, p, r);
 }
 
-mpc_parser_t *mpc_lift_val(mpc_val_t *x) {
-  mpc_parser_t *p = mpc_undefined();
-  p->type = MPC_TYPE_LIFT_VAL;
-  p->data.lift.x = x;
-  return p;
+int mpc_parse_profile(const char *filename, const char *string, mpc_parser_t *p, mpc_result_t *r, mpc_profile_t *f) {
+  int x;
+  mpc_input_t *i = mpc_input_new_string(filename, string);
+  i->profile = f;
+  x = mpc_parse_input(i, p, r);
+  mpc_input_delete(i);
+  return x;
 }
 
-mpc_parser_t *mpc_lift(mpc_ctor_t lf) {
-  mpc_parser_t *p = mpc_undefined();
-  p->type = MPC_TYPE_LIFT;
-  p->data.lift.lf = lf;
-  return p;
+int mpc_nparse(const char *filename, const char *string, size_t length, mpc_parser_t *p, mpc_result_t *r) {
+  int x;
+  mpc_input_t *i = mpc_input_new_nstring(filename, string, length);
+  x = mpc_parse_input(i, p, r);
+  mpc_input_delete(i);
+  return x;
 }
 
-mpc_parser_t *mpc_anchor(int(*f)(char,char)) {
-  mpc_parser_t *p = mpc_undefined();
-  p->type = MPC_TYPE_ANCHOR;
-  p->data.anchor.f = f;
-  return mpc_expect(p, "anchor");
+int mpc_parse_file(const char *filename, FILE *file, mpc_parser_t *p, mpc_result_t *r) {
+  int x;
+  mpc_input_t *i = mpc_input_new_file(filename, file);
+  x = mpc_parse_input(i, p, r);
+  mpc_input_delete(i);
+  return x;
 }
 
-mpc_parser_t *mpc_state(void) {
-  mpc_parser_t *p = mpc_undefined();
-  p->type = MPC_TYPE_STATE;
-  return p;
+int mpc_parse_pipe(const char *filename, FILE *pipe, mpc_parser_t *p, mpc_result_t *r) {
+  int x;
+  mpc_input_t *i = mpc_input_new_pipe(filename, pipe);
+  x = mpc_parse_input(i, p, r);
+  mpc_input_delete(i);
+  return x;
 }
 
-mpc_parser_t *mpc_expect(mpc_parser_t *a, const char *expected) {
-  mpc_parser_t *p = mpc_undefined();
-  p->type = MPC_TYPE_EXPECT;
-  p->data.expect.x = a;
-  p->data.expect.m = malloc(strlen(expected) + 1);
-  strcpy(p->data.expect.m, expected);
-  return p;
+int mpc_parse_contents(const char *filename, mpc_parser_t *p, mpc_result_t *r) {
+  
+  FILE *f = fopen(filename, "rb");
+  int res;
+  
+  if (f == NULL) {
+    r->output = NULL;
+    r->error = mpc_err_file(filename, "Unable to open file!");
+    return 0;
+  }
+  
+  res = mpc_parse_file(filename, f, p, r);
+  fclose(f);
+  return res;
 }
 
 /*
-** As `snprintf` is not ANSI standard this 
-** function `mpc_expectf` should be considered
-** unsafe.
+** Push Parsing
 **
-** You have a few options if this is going to be
-** trouble.
-**
-** - Ensure the format string does not exceed
-**   the buffer length using precision specifiers
-**   such as `%.512s`.
-**
-** - Patch this function in your code base to 
-**   use `snprintf` or whatever variant your
-**   system supports.
-**
-** - Avoid it altogether.
+** A push parser is fed input in chunks. Each
+** call returns `MPC_PUSH_INCOMPLETE` while the
+** parser is still waiting for more input, or
+** the result once it has finished. Input left
+** over after a successful parse is kept, and the
+** next call starts a new parse on it, so one
+** push parser can read a stream of forms. After
+** a failure the rest of the buffered input is
+** skipped.
 **
+** When the parse runs out of input the driver
+** returns with its frames left on the stack and
+** picks up from the same point on the next feed.
 */
 
-mpc_parser_t *mpc_expectf(mpc_parser_t *a, const char *fmt, ...) {
-  va_list va;
-  char *buffer;
+static void mpc_push_skip(mpc_input_t *i) {
+  i->pos = i->buffer_hi;
+}
 
-  mpc_parser_t *p = mpc_undefined();
-  p->type = MPC_TYPE_EXPECT;
+static int mpc_push_step(mpc_push_t *s, mpc_result_t *r) {
   
-  va_start(va, fmt);
-  buffer = malloc(2048);
-  vsprintf(buffer, fmt, va);
-  va_end(va);
+  int x;
+  mpc_input_t *i = s->input;
   
-  buffer = realloc(buffer, strlen(buffer) + 1);
-  p->data.expect.x = a;
-  p->data.expect.m = buffer;
-  return p;
-}
-
-/*
-** Basic Parsers
-*/
-
-mpc_parser_t *mpc_any(void) {
-  mpc_parser_t *p = mpc_undefined();
-  p->type = MPC_TYPE_ANY;
-  return mpc_expect(p, "any character");
-}
-
-mpc_parser_t *mpc_char(char c) {
-  mpc_parser_t *p = mpc_undefined();
-  p->type = MPC_TYPE_SINGLE;
-  p->data.single.x = c;
-  return mpc_expectf(p, "'%c'", c);
-}
-
-mpc_parser_t *mpc_range(char s, char e) {
-  mpc_parser_t *p = mpc_undefined();
-  p->type = MPC_TYPE_RANGE;
-  p->data.range.x = s;
-  p->data.range.y = e;
-  return mpc_expectf(p, "character between '%c' and '%c'", s, e);
+  if (!s->running) {
+    if (!s->ended && i->pos >= i->buffer_hi) { return MPC_PUSH_INCOMPLETE; }
+    i->last = '\0';
+    s->running = 1;
+    mpc_parse_start(i, s->parser);
+  }
+  
+  x = mpc_parse_finish(i, r);
+  if (x == MPC_PARSE_STARVED) { return MPC_PUSH_INCOMPLETE; }
+  
+  s->running = 0;
+  if (!x) { mpc_push_skip(i); }
+  return x ? MPC_PUSH_SUCCESS : MPC_PUSH_FAILURE;
 }
 
-mpc_parser_t *mpc_oneof(const char *s) {
-  mpc_parser_t *p = mpc_undefined();
-  p->type = MPC_TYPE_ONEOF;
-  p->data.string.x = malloc(strlen(s) + 1);
-  strcpy(p->data.string.x, s);
-  return mpc_expectf(p, "one of '%s'", s);
+mpc_push_t *mpc_push_new(const char *filename, mpc_parser_t *p, mpc_dtor_t d) {
+  mpc_push_t *s = malloc(sizeof(mpc_push_t));
+  s->input = mpc_input_new_push(filename, s);
+  s->parser = p;
+  s->destructor = d;
+  s->ended = 0;
+  s->running = 0;
+  return s;
 }
 
-mpc_parser_t *mpc_noneof(const char *s) {
-  mpc_parser_t *p = mpc_undefined();
-  p->type = MPC_TYPE_NONEOF;
-  p->data.string.x = malloc(strlen(s) + 1);
-  strcpy(p->data.string.x, s);
-  return mpc_expectf(p, "none of '%s'", s);
-
+int mpc_push_feed(mpc_push_t *s, const char *chunk, size_t length, mpc_result_t *r) {
+  if (chunk) { mpc_input_buffer_append(s->input, chunk, (long)length); }
+  return mpc_push_step(s, r);
 }
 
-mpc_parser_t *mpc_satisfy(int(*f)(char)) {
-  mpc_parser_t *p = mpc_undefined();
-  p->type = MPC_TYPE_SATISFY;
-  p->data.satisfy.f = f;
-  return mpc_expectf(p, "character satisfying function %p", f);
+int mpc_push_end(mpc_push_t *s, mpc_result_t *r) {
+  s->ended = 1;
+  return mpc_push_step(s, r);
 }
 
-mpc_parser_t *mpc_string(const char *s) {
-  mpc_parser_t *p = mpc_undefined();
-  p->type = MPC_TYPE_STRING;
-  p->data.string.x = malloc(strlen(s) + 1);
-  strcpy(p->data.string.x, s);
-  return mpc_expectf(p, "\"%s\"", s);
+void mpc_push_delete(mpc_push_t *s) {
+  
+  mpc_result_t r;
+  
+  if (s->running) {
+    s->ended = 1;
+    if (mpc_push_step(s, &r) == MPC_PUSH_SUCCESS) {
+      if (s->destructor) { s->destructor(r.output); }
+    } else {
+      mpc_err_delete(r.error);
+    }
+  }
+  
+  mpc_input_delete(s->input);
+  free(s);
 }
 
 /*
-** Core Parsers
+** Building a Parser
 */
 
-mpc_parser_t *mpc_apply(mpc_parser_t *a, mpc_apply_t f) {
-  mpc_parser_t *p = mpc_undefined();
-  p->type = MPC_TYPE_APPLY;
-  p->data.apply.x = a;
-  p->data.apply.f = f;
-  return p;
-}
-
-mpc_parser_t *mpc_apply_to(mpc_parser_t *a, mpc_apply_to_t f, void *x) {
-  mpc_parser_t *p = mpc_undefined();
-  p->type = MPC_TYPE_APPLY_TO;
-  p->data.apply_to.x = a;
-  p->data.apply_to.f = f;
-  p->data.apply_to.d = x;
-  return p;
-}
-
-mpc_parser_t *mpc_predictive(mpc_parser_t *a) {
-  mpc_parser_t *p = mpc_undefined();
-  p->type = MPC_TYPE_PREDICT;
-  p->data.predict.x = a;
-  return p;
-}
-
-mpc_parser_t *mpc_not_lift(mpc_parser_t *a, mpc_dtor_t da, mpc_ctor_t lf) {
-  mpc_parser_t *p = mpc_undefined();
-  p->type = MPC_TYPE_NOT;
-  p->data.not.x = a;
-  p->data.not.dx = da;
-  p->data.not.lf = lf;
-  return p;
-}
-
-mpc_parser_t *mpc_not(mpc_parser_t *a, mpc_dtor_t da) {
-  return mpc_not_lift(a, da, mpcf_ctor_null);
-}
-
-mpc_parser_t *mpc_maybe_lift(mpc_parser_t *a, mpc_ctor_t lf) {
-  mpc_parser_t *p = mpc_undefined();
-  p->type = MPC_TYPE_MAYBE;
-  p->data.not.x = a;
-  p->data.not.lf = lf;
-  return p;
-}
+static void mpc_undefine_unretained(mpc_parser_t *p, int force);
 
-mpc_parser_t *mpc_maybe(mpc_parser_t *a) {
-  return mpc_maybe_lift(a, mpcf_ctor_null);
+static void mpc_undefine_or(mpc_parser_t *p) {
+  
+  int i;
+  for (i = 0; i < p->data.or.n; i++) {
+    mpc_undefine_unretained(p->data.or.xs[i], 0);
+  }
+  free(p->data.or.xs);
+  free(p->data.or.first);
+  
 }
 
-mpc_parser_t *mpc_many(mpc_fold_t f, mpc_parser_t *a) {
-  mpc_parser_t *p = mpc_undefined();
-  p->type = MPC_TYPE_MANY;
-  p->data.repeat.x = a;
-  p->data.repeat.f = f;
-  return p;
+static void mpc_undefine_and(mpc_parser_t *p) {
+  
+  int i;
+  for (i = 0; i < p->data.and.n; i++) {
+    mpc_undefine_unretained(p->data.and.xs[i], 0);
+  }
+  free(p->data.and.xs);
+  free(p->data.and.dxs);
+  
 }
 
-mpc_parser_t *mpc_many1(mpc_fold_t f, mpc_parser_t *a) {
-  mpc_parser_t *p = mpc_undefined();
-  p->type = MPC_TYPE_MANY1;
-  p->data.repeat.x = a;
-  p->data.repeat.f = f;
-  return p;
+static void mpc_undefine_unretained(mpc_parser_t *p, int force) {
+  
+  int i;
+  
+  if (p->retained && !force) { return; }
+  
+  switch (p->type) {
+    
+    case MPC_TYPE_FAIL: free(p->data.fail.m); break;
+    
+    case MPC_TYPE_ONEOF: 
+    case MPC_TYPE_NONEOF:
+      free(p->data.oneof.x);
+      free(p->data.oneof.c);
+      break;
+    
+    case MPC_TYPE_STRING:
+      free(p->data.string.x); 
+      break;
+    
+    case MPC_TYPE_APPLY:    mpc_undefine_unretained(p->data.apply.x, 0);    break;
+    case MPC_TYPE_APPLY_TO: mpc_undefine_unretained(p->data.apply_to.x, 0); break;
+    case MPC_TYPE_PREDICT:  mpc_undefine_unretained(p->data.predict.x, 0);  break;
+    case MPC_TYPE_PACKRAT:  mpc_undefine_unretained(p->data.packrat.x, 0);  break;
+    case MPC_TYPE_ARENA:    mpc_undefine_unretained(p->data.arena.x, 0);    break;
+    
+    case MPC_TYPE_DFA:
+      mpc_undefine_unretained(p->data.dfa.x, 0);
+      for (i = 0; i < p->data.dfa.n; i++) { free(p->data.dfa.loops[i]); }
+      free(p->data.dfa.trans);
+      free(p->data.dfa.accept);
+      free(p->data.dfa.loops);
+      break;
+    
+    case MPC_TYPE_TOKEN:
+      mpc_undefine_unretained(p->data.token.x, 0);
+      free(p->data.token.c);
+      break;
+    
+    case MPC_TYPE_MAYBE:
+    case MPC_TYPE_NOT:
+      mpc_undefine_unretained(p->data.not.x, 0);
+      break;
+    
+    case MPC_TYPE_EXPECT:
+      mpc_undefine_unretained(p->data.expect.x, 0);
+      free(p->data.expect.m);
+      break;
+      
+    case MPC_TYPE_MANY:
+    case MPC_TYPE_MANY1:
+    case MPC_TYPE_COUNT:
+      mpc_undefine_unretained(p->data.repeat.x, 0);
+      break;
+    
+    case MPC_TYPE_OR:  mpc_undefine_or(p);  break;
+    case MPC_TYPE_AND: mpc_undefine_and(p); break;
+    
+    default: break;
+  }
+  
+  if (!force) {
+    free(p->name);
+    free(p);
+  }
+  
 }
 
-mpc_parser_t *mpc_count(int n, mpc_fold_t f, mpc_parser_t *a, mpc_dtor_t da) {
-  mpc_parser_t *p = mpc_undefined();
-  p->type = MPC_TYPE_COUNT;
-  p->data.repeat.n = n;
-  p->data.repeat.f = f;
-  p->data.repeat.x = a;
-  p->data.repeat.dx = da;
-  return p;
+void mpc_delete(mpc_parser_t *p) {
+  if (p->retained) {
+
+    if (p->type != MPC_TYPE_UNDEFINED) {
+      mpc_undefine_unretained(p, 0);
+    } 
+    
+    free(p->name);
+    free(p);
+  
+  } else {
+    mpc_undefine_unretained(p, 0);  
+  }
 }
 
-mpc_parser_t *mpc_or(int n, ...) {
+static void mpc_soft_delete(mpc_val_t *x) {
+  mpc_undefine_unretained(x, 0);
+}
 
-  int i;
-  va_list va;
+static mpc_parser_t *mpc_undefined(void) {
+  mpc_parser_t *p = calloc(1, sizeof(mpc_parser_t));
+  p->retained = 0;
+  p->type = MPC_TYPE_UNDEFINED;
+  p->name = NULL;
+  p->id = -1;
+  p->action = NULL;
+  p->action_dtor = NULL;
+  return p;
+}
 
+mpc_parser_t *mpc_new(const char *name) {
   mpc_parser_t *p = mpc_undefined();
+  p->retained = 1;
+  p->name = realloc(p->name, strlen(name) + 1);
+  strcpy(p->name, name);
+  return p;
+}
+
+mpc_parser_t *mpc_copy(mpc_parser_t *a) {
+  int i = 0;
+  mpc_parser_t *p;
   
-  p->type = MPC_TYPE_OR;
-  p->data.or.n = n;
-  p->data.or.xs = malloc(sizeof(mpc_parser_t*) * n);
+  if (a->retained) { return a; }
   
-  va_start(va, n);  
-  for (i = 0; i < n; i++) {
-    p->data.or.xs[i] = va_arg(va, mpc_parser_t*);
+  p = mpc_undefined();
+  p->retained = a->retained;
+  p->type = a->type;
+  p->data = a->data;
+  
+  if (a->name) {
+    p->name = malloc(strlen(a->name)+1);
+    strcpy(p->name, a->name);
   }
-  va_end(va);
+  
+  switch (a->type) {
+    
+    case MPC_TYPE_FAIL:
+      p->data.fail.m = malloc(strlen(a->data.fail.m)+1);
+      strcpy(p->data.fail.m, a->data.fail.m);
+    break;
+    
+    case MPC_TYPE_ONEOF: 
+    case MPC_TYPE_NONEOF:
+      p->data.oneof.x = malloc(strlen(a->data.oneof.x)+1);
+      strcpy(p->data.oneof.x, a->data.oneof.x);
+      p->data.oneof.c = mpc_class_copy(a->data.oneof.c);
+      break;
+    
+    case MPC_TYPE_STRING:
+      p->data.string.x = malloc(strlen(a->data.string.x)+1);
+      strcpy(p->data.string.x, a->data.string.x);
+      break;
+    
+    case MPC_TYPE_APPLY:    p->data.apply.x    = mpc_copy(a->data.apply.x);    break;
+    case MPC_TYPE_APPLY_TO: p->data.apply_to.x = mpc_copy(a->data.apply_to.x); break;
+    case MPC_TYPE_PREDICT:  p->data.predict.x  = mpc_copy(a->data.predict.x);  break;
+    case MPC_TYPE_PACKRAT:  p->data.packrat.x  = mpc_copy(a->data.packrat.x);  break;
+    case MPC_TYPE_ARENA:    p->data.arena.x    = mpc_copy(a->data.arena.x);    break;
+    
+    case MPC_TYPE_DFA:
+      p->data.dfa.x = mpc_copy(a->data.dfa.x);
+      p->data.dfa.trans = malloc(sizeof(int) * 256 * a->data.dfa.n);
+      memcpy(p->data.dfa.trans, a->data.dfa.trans, sizeof(int) * 256 * a->data.dfa.n);
+      p->data.dfa.accept = malloc(a->data.dfa.n);
+      memcpy(p->data.dfa.accept, a->data.dfa.accept, a->data.dfa.n);
+      p->data.dfa.loops = malloc(sizeof(mpc_class_t*) * a->data.dfa.n);
+      for (i = 0; i < a->data.dfa.n; i++) {
+        p->data.dfa.loops[i] = a->data.dfa.loops[i] ? mpc_class_copy(a->data.dfa.loops[i]) : NULL;
+      }
+      break;
+    
+    case MPC_TYPE_TOKEN:
+      p->data.token.x = mpc_copy(a->data.token.x);
+      p->data.token.c = mpc_class_copy(a->data.token.c);
+      break;
+    
+    case MPC_TYPE_MAYBE:
+    case MPC_TYPE_NOT:
+      p->data.not.x = mpc_copy(a->data.not.x);
+      break;
+    
+    case MPC_TYPE_EXPECT:
+      p->data.expect.x = mpc_copy(a->data.expect.x);
+      p->data.expect.m = malloc(strlen(a->data.expect.m)+1);
+      strcpy(p->data.expect.m, a->data.expect.m);
+      break;
+      
+    case MPC_TYPE_MANY:
+    case MPC_TYPE_MANY1:
+    case MPC_TYPE_COUNT:
+      p->data.repeat.x = mpc_copy(a->data.repeat.x);
+      break;
+    
+    case MPC_TYPE_OR:
+      p->data.or.xs = malloc(a->data.or.n * sizeof(mpc_parser_t*));
+      for (i = 0; i < a->data.or.n; i++) {
+        p->data.or.xs[i] = mpc_copy(a->data.or.xs[i]);
+      }
+      if (a->data.or.first) {
+        p->data.or.first = malloc(256);
+        memcpy(p->data.or.first, a->data.or.first, 256);
+      }
+    break;
+    case MPC_TYPE_AND:
+      p->data.and.xs = malloc(a->data.and.n * sizeof(mpc_parser_t*));
+      for (i = 0; i < a->data.and.n; i++) {
+        p->data.and.xs[i] = mpc_copy(a->data.and.xs[i]);
+      }
+      p->data.and.dxs = malloc((a->data.and.n-1) * sizeof(mpc_dtor_t));
+      for (i = 0; i < a->data.and.n-1; i++) {
+        p->data.and.dxs[i] = a->data.and.dxs[i];
+      }
+    break;
+    
+    default: break;
+  }
+
   
   return p;
 }
 
-mpc_parser_t *mpc_and(int n, mpc_fold_t f, ...) {
-
-  int i;
-  va_list va;
+mpc_parser_t *mpc_undefine(mpc_parser_t *p) {
+  mpc_undefine_unretained(p, 1);
+  p->type = MPC_TYPE_UNDEFINED;
+  return p;
+}
 
-  mpc_parser_t *p = mpc_undefined();
+mpc_parser_t *mpc_define(mpc_parser_t *p, mpc_parser_t *a) {
   
-  p->type = MPC_TYPE_AND;
-  p->data.and.n = n;
-  p->data.and.f = f;
-  p->data.and.xs = malloc(sizeof(mpc_parser_t*) * n);
-  p->data.and.dxs = malloc(sizeof(mpc_dtor_t) * (n-1));
-
-  va_start(va, f);  
-  for (i = 0; i < n; i++) {
-    p->data.and.xs[i] = va_arg(va, mpc_parser_t*);
+  if (p->retained) {
+    p->type = a->type;
+    p->data = a->data;
+  } else {
+    mpc_parser_t *a2 = mpc_failf("Attempt to assign to Unretained Parser!");
+    p->type = a2->type;
+    p->data = a2->data;
+    free(a2);
   }
-  for (i = 0; i < (n-1); i++) {
-    p->data.and.dxs[i] = va_arg(va, mpc_dtor_t);
-  }  
-  va_end(va);
   
-  return p;
+  free(a);
+  return p;  
 }
 
-/*
-** Common Parsers
-*/
-
-static int mpc_soi_anchor(char prev, char next) { (void) next; return (prev == '\0'); }
-static int mpc_eoi_anchor(char prev, char next) { (void) prev; return (next == '\0'); }
-
-mpc_parser_t *mpc_soi(void) { return mpc_expect(mpc_anchor(mpc_soi_anchor), "start of input"); }
-mpc_parser_t *mpc_eoi(void) { return mpc_expect(mpc_anchor(mpc_eoi_anchor), "end of input"); }
+void mpc_cleanup(int n, ...) {
+  int i;
+  mpc_parser_t **list = malloc(sizeof(mpc_parser_t*) * n);
+  
+  va_list va;
+  va_start(va, n);
+  for (i = 0; i < n; i++) { list[i] = va_arg(va, mpc_parser_t*); }
+  for (i = 0; i < n; i++) { mpc_undefine(list[i]); }
+  for (i = 0; i < n; i++) { mpc_delete(list[i]); }  
+  va_end(va);  
 
-static int mpc_boundary_anchor(char prev, char next) {
-  const char* word = "abcdefghijklmnopqrstuvwxyz"
-                     "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
-                     "0123456789_";
-  if ( strchr(word, next) &&  prev == '\0') { return 1; }
-  if ( strchr(word, prev) &&  next == '\0') { return 1; }
-  if ( strchr(word, next) && !strchr(word, prev)) { return 1; }
-  if (!strchr(word, next) &&  strchr(word, prev)) { return 1; }
-  return 0;
+  free(list);
 }
 
-mpc_parser_t *mpc_boundary(void) { return mpc_expect(mpc_anchor(mpc_boundary_anchor), "boundary"); }
+mpc_parser_t *mpc_pass(void) {
+  mpc_parser_t *p = mpc_undefined();
+  p->type = MPC_TYPE_PASS;
+  return p;
+}
 
-mpc_parser_t *mpc_whitespace(void) { return mpc_expect(mpc_oneof(" \f\n\r\t\v"), "whitespace"); }
-mpc_parser_t *mpc_whitespaces(void) { return mpc_expect(mpc_many(mpcf_strfold, mpc_whitespace()), "spaces"); }
-mpc_parser_t *mpc_blank(void) { return mpc_expect(mpc_apply(mpc_whitespaces(), mpcf_free), "whitespace"); }
-
-mpc_parser_t *mpc_newline(void) { return mpc_expect(mpc_char('\n'), "newline"); }
-mpc_parser_t *mpc_tab(void) { return mpc_expect(mpc_char('\t'), "tab"); }
-mpc_parser_t *mpc_escape(void) { return mpc_and(2, mpcf_strfold, mpc_char('\\'), mpc_any(), free); }
-
-mpc_parser_t *mpc_digit(void) { return mpc_expect(mpc_oneof("0123456789"), "digit"); }
-mpc_parser_t *mpc_hexdigit(void) { return mpc_expect(mpc_oneof("0123456789ABCDEFabcdef"), "hex digit"); }
-mpc_parser_t *mpc_octdigit(void) { return mpc_expect(mpc_oneof("01234567"), "oct digit"); }
-mpc_parser_t *mpc_digits(void) { return mpc_expect(mpc_many1(mpcf_strfold, mpc_digit()), "digits"); }
-mpc_parser_t *mpc_hexdigits(void) { return mpc_expect(mpc_many1(mpcf_strfold, mpc_hexdigit()), "hex digits"); }
-mpc_parser_t *mpc_octdigits(void) { return mpc_expect(mpc_many1(mpcf_strfold, mpc_octdigit()), "oct digits"); }
-
-mpc_parser_t *mpc_lower(void) { return mpc_expect(mpc_oneof("abcdefghijklmnopqrstuvwxyz"), "lowercase letter"); }
-mpc_parser_t *mpc_upper(void) { return mpc_expect(mpc_oneof("ABCDEFGHIJKLMNOPQRSTUVWXYZ"), "uppercase letter"); }
-mpc_parser_t *mpc_alpha(void) { return mpc_expect(mpc_oneof("abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ"), "letter"); }
-mpc_parser_t *mpc_underscore(void) { return mpc_expect(mpc_char('_'), "underscore"); }
-mpc_parser_t *mpc_alphanum(void) { return mpc_expect(mpc_or(3, mpc_alpha(), mpc_digit(), mpc_underscore()), "alphanumeric"); }
-
-mpc_parser_t *mpc_int(void) { return mpc_expect(mpc_apply(mpc_digits(), mpcf_int), "integer"); }
-mpc_parser_t *mpc_hex(void) { return mpc_expect(mpc_apply(mpc_hexdigits(), mpcf_hex), "hexadecimal"); }
-mpc_parser_t *mpc_oct(void) { return mpc_expect(mpc_apply(mpc_octdigits(), mpcf_oct), "octadecimal"); }
-mpc_parser_t *mpc_number(void) { return mpc_expect(mpc_or(3, mpc_int(), mpc_hex(), mpc_oct()), "number"); }
+mpc_parser_t *mpc_fail(const char *m) {
+  mpc_parser_t *p = mpc_undefined();
+  p->type = MPC_TYPE_FAIL;
+  p->data.fail.m = malloc(strlen(m) + 1);
+  strcpy(p->data.fail.m, m);
+  return p;
+}
 
-mpc_parser_t *mpc_real(void) {
+/*
+** As `snprintf` is not ANSI standard this 
+** function `mpc_failf` should be considered
+** unsafe.
+**
+** You have a few options if this is going to be
+** trouble.
+**
+** - Ensure the format string does not exceed
+**   the buffer length using precision specifiers
+**   such as `%.512s`.
+**
+** - Patch this function in your code base to 
+**   use `snprintf` or whatever variant your
+**   system supports.
+**
+** - Avoid it altogether.
+**
+*/
 
-  /* [+-]?\d+(\.\d+)?([eE][+-]?[0-9]+)? */
+mpc_parser_t *mpc_failf(const char *fmt, ...) {
   
-  mpc_parser_t *p0, *p1, *p2, *p30, *p31, *p32, *p3;
+  va_list va;
+  char *buffer;
+
+  mpc_parser_t *p = mpc_undefined();
+  p->type = MPC_TYPE_FAIL;
   
-  p0 = mpc_maybe_lift(mpc_oneof("+-"), mpcf_ctor_str);
-  p1 = mpc_digits();
-  p2 = mpc_maybe_lift(mpc_and(2, mpcf_strfold, mpc_char('.'), mpc_digits(), free), mpcf_ctor_str);
-  p30 = mpc_oneof("eE");
-  p31 = mpc_maybe_lift(mpc_oneof("+-"), mpcf_ctor_str);
-  p32 = mpc_digits();
-  p3 = mpc_maybe_lift(mpc_and(3, mpcf_strfold, p30, p31, p32, free, free), mpcf_ctor_str);
+  va_start(va, fmt);
+  buffer = malloc(2048);
+  vsprintf(buffer, fmt, va);
+  va_end(va);
   
-  return mpc_expect(mpc_and(4, mpcf_strfold, p0, p1, p2, p3, free, free, free), "real");
+  buffer = realloc(buffer, strlen(buffer) + 1);
+  p->data.fail.m = buffer;
+  return p;
 
 }
 
-mpc_parser_t *mpc_float(void) {
-  return mpc_expect(mpc_apply(mpc_real(), mpcf_float), "float");
+mpc_parser_t *mpc_lift_val(mpc_val_t *x) {
+  mpc_parser_t *p = mpc_undefined();
+  p->type = MPC_TYPE_LIFT_VAL;
+  p->data.lift.x = x;
+  return p;
 }
 
-mpc_parser_t *mpc_char_lit(void) {
-  return mpc_expect(mpc_between(mpc_or(2, mpc_escape(), mpc_any()), free, "'", "'"), "char");
+mpc_parser_t *mpc_lift(mpc_ctor_t lf) {
+  mpc_parser_t *p = mpc_undefined();
+  p->type = MPC_TYPE_LIFT;
+  p->data.lift.lf = lf;
+  return p;
 }
 
-mpc_parser_t *mpc_string_lit(void) {
-  mpc_parser_t *strchar = mpc_or(2, mpc_escape(), mpc_noneof("\""));
-  return mpc_expect(mpc_between(mpc_many(mpcf_strfold, strchar), free, "\"", "\""), "string");
+mpc_parser_t *mpc_anchor(int(*f)(char,char)) {
+  mpc_parser_t *p = mpc_undefined();
+  p->type = MPC_TYPE_ANCHOR;
+  p->data.anchor.f = f;
+  return mpc_expect(p, "anchor");
 }
 
-mpc_parser_t *mpc_regex_lit(void) {  
-  mpc_parser_t *regexchar = mpc_or(2, mpc_escape(), mpc_noneof("/"));
-  return mpc_expect(mpc_between(mpc_many(mpcf_strfold, regexchar), free, "/", "/"), "regex");
+mpc_parser_t *mpc_state(void) {
+  mpc_parser_t *p = mpc_undefined();
+  p->type = MPC_TYPE_STATE;
+  return p;
 }
 
-mpc_parser_t *mpc_ident(void) {
-  mpc_parser_t *p0, *p1; 
-  p0 = mpc_or(2, mpc_alpha(), mpc_underscore());
-  p1 = mpc_many(mpcf_strfold, mpc_alphanum()); 
-  return mpc_and(2, mpcf_strfold, p0, p1, free);
+mpc_parser_t *mpc_expect(mpc_parser_t *a, const char *expected) {
+  mpc_parser_t *p = mpc_undefined();
+  p->type = MPC_TYPE_EXPECT;
+  p->data.expect.x = a;
+  p->data.expect.m = malloc(strlen(expected) + 1);
+  strcpy(p->data.expect.m, expected);
+  return p;
 }
 
 /*
-** Useful Parsers
+** As `snprintf` is not ANSI standard this 
+** function `mpc_expectf` should be considered
+** unsafe.
+**
+** You have a few options if this is going to be
+** trouble.
+**
+** - Ensure the format string does not exceed
+**   the buffer length using precision specifiers
+**   such as `%.512s`.
+**
+** - Patch this function in your code base to 
+**   use `snprintf` or whatever variant your
+**   system supports.
+**
+** - Avoid it altogether.
+**
 */
 
-mpc_parser_t *mpc_startwith(mpc_parser_t *a) { return mpc_and(2, mpcf_snd, mpc_soi(), a, mpcf_dtor_null); }
-mpc_parser_t *mpc_endwith(mpc_parser_t *a, mpc_dtor_t da) { return mpc_and(2, mpcf_fst, a, mpc_eoi(), da); }
-mpc_parser_t *mpc_whole(mpc_parser_t *a, mpc_dtor_t da) { return mpc_and(3, mpcf_snd, mpc_soi(), a, mpc_eoi(), mpcf_dtor_null, da); }
+mpc_parser_t *mpc_expectf(mpc_parser_t *a, const char *fmt, ...) {
+  va_list va;
+  char *buffer;
 
-mpc_parser_t *mpc_stripl(mpc_parser_t *a) { return mpc_and(2, mpcf_snd, mpc_blank(), a, mpcf_dtor_null); }
-mpc_parser_t *mpc_stripr(mpc_parser_t *a) { return mpc_and(2, mpcf_fst, a, mpc_blank(), mpcf_dtor_null); }
-mpc_parser_t *mpc_strip(mpc_parser_t *a) { return mpc_and(3, mpcf_snd, mpc_blank(), a, mpc_blank(), mpcf_dtor_null, mpcf_dtor_null); }
-mpc_parser_t *mpc_tok(mpc_parser_t *a) { return mpc_and(2, mpcf_fst, a, mpc_blank(), mpcf_dtor_null); }
-mpc_parser_t *mpc_sym(const char *s) { return mpc_tok(mpc_string(s)); }
+  mpc_parser_t *p = mpc_undefined();
+  p->type = MPC_TYPE_EXPECT;
+  
+  va_start(va, fmt);
+  buffer = malloc(2048);
+  vsprintf(buffer, fmt, va);
+  va_end(va);
+  
+  buffer = realloc(buffer, strlen(buffer) + 1);
+  p->data.expect.x = a;
+  p->data.expect.m = buffer;
+  return p;
+}
 
-mpc_parser_t *mpc_total(mpc_parser_t *a, mpc_dtor_t da) { return mpc_whole(mpc_strip(a), da); }
+/*
+** Basic Parsers
+*/
 
-mpc_parser_t *mpc_between(mpc_parser_t *a, mpc_dtor_t ad, const char *o, const char *c) {
-  return mpc_and(3, mpcf_snd_free,
-    mpc_string(o), a, mpc_string(c),
-    free, ad);
+mpc_parser_t *mpc_any(void) {
+  mpc_parser_t *p = mpc_undefined();
+  p->type = MPC_TYPE_ANY;
+  return mpc_expect(p, "any character");
 }
 
-mpc_parser_t *mpc_parens(mpc_parser_t *a, mpc_dtor_t ad)   { return mpc_between(a, ad, "(", ")"); }
-mpc_parser_t *mpc_braces(mpc_parser_t *a, mpc_dtor_t ad)   { return mpc_between(a, ad, "<", ">"); }
-mpc_parser_t *mpc_brackets(mpc_parser_t *a, mpc_dtor_t ad) { return mpc_between(a, ad, "{", "}"); }
-mpc_parser_t *mpc_squares(mpc_parser_t *a, mpc_dtor_t ad)  { return mpc_between(a, ad, "[", "]"); }
+mpc_parser_t *mpc_char(char c) {
+  mpc_parser_t *p = mpc_undefined();
+  p->type = MPC_TYPE_SINGLE;
+  p->data.single.x = c;
+  return mpc_expectf(p, "'%c'", c);
+}
 
-mpc_parser_t *mpc_tok_between(mpc_parser_t *a, mpc_dtor_t ad, const char *o, const char *c) {
-  return mpc_and(3, mpcf_snd_free,
-    mpc_sym(o), mpc_tok(a), mpc_sym(c),
-    free, ad);
+mpc_parser_t *mpc_range(char s, char e) {
+  mpc_parser_t *p = mpc_undefined();
+  p->type = MPC_TYPE_RANGE;
+  p->data.range.x = s;
+  p->data.range.y = e;
+  return mpc_expectf(p, "character between '%c' and '%c'", s, e);
 }
 
-mpc_parser_t *mpc_tok_parens(mpc_parser_t *a, mpc_dtor_t ad)   { return mpc_tok_between(a, ad, "(", ")"); }
-mpc_parser_t *mpc_tok_braces(mpc_parser_t *a, mpc_dtor_t ad)   { return mpc_tok_between(a, ad, "<", ">"); }
-mpc_parser_t *mpc_tok_brackets(mpc_parser_t *a, mpc_dtor_t ad) { return mpc_tok_between(a, ad, "{", "}"); }
-mpc_parser_t *mpc_tok_squares(mpc_parser_t *a, mpc_dtor_t ad)  { return mpc_tok_between(a, ad, "[", "]"); }
+mpc_parser_t *mpc_oneof(const char *s) {
+  mpc_parser_t *p = mpc_undefined();
+  p->type = MPC_TYPE_ONEOF;
+  p->data.oneof.x = malloc(strlen(s) + 1);
+  strcpy(p->data.oneof.x, s);
+  p->data.oneof.c = mpc_class_new(s, 0);
+  return mpc_expectf(p, "one of '%s'", s);
+}
 
-/*
-** Regular Expression Parsers
-*/
+mpc_parser_t *mpc_noneof(const char *s) {
+  mpc_parser_t *p = mpc_undefined();
+  p->type = MPC_TYPE_NONEOF;
+  p->data.oneof.x = malloc(strlen(s) + 1);
+  strcpy(p->data.oneof.x, s);
+  p->data.oneof.c = mpc_class_new(s, 1);
+  return mpc_expectf(p, "none of '%s'", s);
+
+}
+
+mpc_parser_t *mpc_satisfy(int(*f)(char)) {
+  mpc_parser_t *p = mpc_undefined();
+  p->type = MPC_TYPE_SATISFY;
+  p->data.satisfy.f = f;
+  return mpc_expectf(p, "character satisfying function %p", f);
+}
+
+mpc_parser_t *mpc_string(const char *s) {
+  mpc_parser_t *p = mpc_undefined();
+  p->type = MPC_TYPE_STRING;
+  p->data.string.x = malloc(strlen(s) + 1);
+  strcpy(p->data.string.x, s);
+  return mpc_expectf(p, "\"%s\"", s);
+}
 
 /*
-** So here is a cute bootstrapping.
-**
-** I'm using the previously defined
-** mpc constructs and functions to
-** parse the user regex string and
-** construct a parser from it.
-**
-** As it turns out lots of the standard
-** mpc functions look a lot like `fold`
-** functions and so can be used indirectly
-** by many of the parsing functions to build
-** a parser directly - as we are parsing.
-**
-** This is certainly something that
-** would be less elegant/interesting 
-** in a two-phase parser which first
-** builds an AST and then traverses it
-** to generate the object.
-**
-** This whole thing acts as a great
-** case study for how trivial it can be
-** to write a great parser in a few
-** lines of code using mpc.
+** Core Parsers
 */
 
-/*
-**
-**  ### Regular Expression Grammar
-**
-**      <regex> : <term> | (<term> "|" <regex>)
-**     
-**      <term> : <factor>*
-**
-**      <factor> : <base>
-**               | <base> "*"
-**               | <base> "+"
-**               | <base> "?"
-**               | <base> "{" <digits> "}"
-**           
-**      <base> : <char>
-**             | "\" <char>
-**             | "(" <regex> ")"
-**             | "[" <range> "]"
-*/
+mpc_parser_t *mpc_apply(mpc_parser_t *a, mpc_apply_t f) {
+  mpc_parser_t *p = mpc_undefined();
+  p->type = MPC_TYPE_APPLY;
+  p->data.apply.x = a;
+  p->data.apply.f = f;
+  return p;
+}
 
-static mpc_val_t *mpcf_re_or(int n, mpc_val_t **xs) {
-  (void) n;
-  if (xs[1] == NULL) { return xs[0]; }
-  else { return mpc_or(2, xs[0], xs[1]); }
+mpc_parser_t *mpc_apply_to(mpc_parser_t *a, mpc_apply_to_t f, void *x) {
+  mpc_parser_t *p = mpc_undefined();
+  p->type = MPC_TYPE_APPLY_TO;
+  p->data.apply_to.x = a;
+  p->data.apply_to.f = f;
+  p->data.apply_to.d = x;
+  return p;
 }
 
-static mpc_val_t *mpcf_re_and(int n, mpc_val_t **xs) {
-  int i;
-  mpc_parser_t *p = mpc_lift(mpcf_ctor_str);
-  for (i = 0; i < n; i++) {
-    p = mpc_and(2, mpcf_strfold, p, xs[i], free);
-  }
+mpc_parser_t *mpc_predictive(mpc_parser_t *a) {
+  mpc_parser_t *p = mpc_undefined();
+  p->type = MPC_TYPE_PREDICT;
+  p->data.predict.x = a;
   return p;
 }
 
-static mpc_val_t *mpcf_re_repeat(int n, mpc_val_t **xs) {
-  int num;
-  (void) n;
-  if (xs[1] == NULL) { return xs[0]; }
-  switch(((char*)xs[1])[0])
-  {
-    case '*': { free(xs[1]); return mpc_many(mpcf_strfold, xs[0]); }; break;
-    case '+': { free(xs[1]); return mpc_many1(mpcf_strfold, xs[0]); }; break;
-    case '?': { free(xs[1]); return mpc_maybe_lift(xs[0], mpcf_ctor_str); }; break;
-    default:
-      num = *(int*)xs[1];
-      free(xs[1]);
-  }
-  
-  return mpc_count(num, mpcf_strfold, xs[0], free);
+mpc_parser_t *mpc_packrat(mpc_parser_t *a, mpc_apply_t cf, mpc_dtor_t da) {
+  mpc_parser_t *p = mpc_undefined();
+  p->type = MPC_TYPE_PACKRAT;
+  p->data.packrat.x = a;
+  p->data.packrat.cf = cf;
+  p->data.packrat.dx = da;
+  return p;
 }
 
-static mpc_parser_t *mpc_re_escape_char(char c) {
-  switch (c) {
-    case 'a': return mpc_char('\a');
-    case 'f': return mpc_char('\f');
-    case 'n': return mpc_char('\n');
-    case 'r': return mpc_char('\r');
-    case 't': return mpc_char('\t');
-    case 'v': return mpc_char('\v');
-    case 'b': return mpc_and(2, mpcf_snd, mpc_boundary(), mpc_lift(mpcf_ctor_str), free);
-    case 'B': return mpc_not_lift(mpc_boundary(), free, mpcf_ctor_str);
-    case 'A': return mpc_and(2, mpcf_snd, mpc_soi(), mpc_lift(mpcf_ctor_str), free);
-    case 'Z': return mpc_and(2, mpcf_snd, mpc_eoi(), mpc_lift(mpcf_ctor_str), free);
-    case 'd': return mpc_digit();
-    case 'D': return mpc_not_lift(mpc_digit(), free, mpcf_ctor_str);
-    case 's': return mpc_whitespace();
-    case 'S': return mpc_not_lift(mpc_whitespace(), free, mpcf_ctor_str);
-    case 'w': return mpc_alphanum();
-    case 'W': return mpc_not_lift(mpc_alphanum(), free, mpcf_ctor_str);
-    default: return NULL;
-  }
+mpc_parser_t *mpc_not_lift(mpc_parser_t *a, mpc_dtor_t da, mpc_ctor_t lf) {
+  mpc_parser_t *p = mpc_undefined();
+  p->type = MPC_TYPE_NOT;
+  p->data.not.x = a;
+  p->data.not.dx = da;
+  p->data.not.lf = lf;
+  return p;
 }
 
-static mpc_val_t *mpcf_re_escape(mpc_val_t *x) {
-  
-  char *s = x;
-  mpc_parser_t *p;
-  
-  /* Regex Special Characters */
-  if (s[0] == '.') { free(s); return mpc_any(); }
-  if (s[0] == '^') { free(s); return mpc_and(2, mpcf_snd, mpc_soi(), mpc_lift(mpcf_ctor_str), free); }
-  if (s[0] == '$') { free(s); return mpc_and(2, mpcf_snd, mpc_eoi(), mpc_lift(mpcf_ctor_str), free); }
-  
-  /* Regex Escape */
-  if (s[0] == '\\') {
-    p = mpc_re_escape_char(s[1]);
-    p = (p == NULL) ? mpc_char(s[1]) : p;
-    free(s);
-    return p;
-  }
-  
-  /* Regex Standard */
-  p = mpc_char(s[0]);
-  free(s);
+mpc_parser_t *mpc_not(mpc_parser_t *a, mpc_dtor_t da) {
+  return mpc_not_lift(a, da, mpcf_ctor_null);
+}
+
+mpc_parser_t *mpc_maybe_lift(mpc_parser_t *a, mpc_ctor_t lf) {
+  mpc_parser_t *p = mpc_undefined();
+  p->type = MPC_TYPE_MAYBE;
+  p->data.not.x = a;
+  p->data.not.lf = lf;
   return p;
 }
 
-static const char *mpc_re_range_escape_char(char c) {
-  switch (c) {
-    case '-': return "-";
-    case 'a': return "\a";
-    case 'f': return "\f";
-    case 'n': return "\n";
-    case 'r': return "\r";
-    case 't': return "\t";
-    case 'v': return "\v";
-    case 'b': return "\b";
-    case 'd': return "0123456789";
-    case 's': return " \f\n\r\t\v";
-    case 'w': return "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_";
-    default: return NULL;
-  }
+mpc_parser_t *mpc_maybe(mpc_parser_t *a) {
+  return mpc_maybe_lift(a, mpcf_ctor_null);
 }
 
-static mpc_val_t *mpcf_re_range(mpc_val_t *x) {
-  
-  mpc_parser_t *out;
-  size_t i, j;
-  size_t start, end;
-  const char *tmp = NULL;
-  const char *s = x;
-  int comp = s[0] == '^' ? 1 : 0;
-  char *range = calloc(1,1);
-  
-  if (s[0] == '\0') { free(x); return mpc_fail("Invalid Regex Range Expression"); } 
-  if (s[0] == '^' && 
-      s[1] == '\0') { free(x); return mpc_fail("Invalid Regex Range Expression"); }
+mpc_parser_t *mpc_many(mpc_fold_t f, mpc_parser_t *a) {
+  mpc_parser_t *p = mpc_undefined();
+  p->type = MPC_TYPE_MANY;
+  p->data.repeat.x = a;
+  p->data.repeat.f = f;
+  return p;
+}
+
+mpc_parser_t *mpc_many1(mpc_fold_t f, mpc_parser_t *a) {
+  mpc_parser_t *p = mpc_undefined();
+  p->type = MPC_TYPE_MANY1;
+  p->data.repeat.x = a;
+  p->data.repeat.f = f;
+  return p;
+}
+
+mpc_parser_t *mpc_count(int n, mpc_fold_t f, mpc_parser_t *a, mpc_dtor_t da) {
+  mpc_parser_t *p = mpc_undefined();
+  p->type = MPC_TYPE_COUNT;
+  p->data.repeat.n = n;
+  p->data.repeat.f = f;
+  p->data.repeat.x = a;
+  p->data.repeat.dx = da;
+  return p;
+}
+
+mpc_parser_t *mpc_or(int n, ...) {
+
+  int i;
+  va_list va;
+
+  mpc_parser_t *p = mpc_undefined();
   
-  for (i = comp; i < strlen(s); i++){
-    
-    /* Regex Range Escape */
-    if (s[i] == '\\') {
-      tmp = mpc_re_range_escape_char(s[i+1]);
-      if (tmp != NULL) {
-        range = realloc(range, strlen(range) + strlen(tmp) + 1);
-        strcat(range, tmp);
-      } else {
-        range = realloc(range, strlen(range) + 1 + 1);
-        range[strlen(range) + 1] = '\0';
-        range[strlen(range) + 0] = s[i+1];      
-      }
-      i++;
-    }
-    
-    /* Regex Range...Range */
-    else if (s[i] == '-') {
-      if (s[i+1] == '\0' || i == 0) {
-          range = realloc(range, strlen(range) + strlen("-") + 1);
-          strcat(range, "-");
-      } else {
-        start = s[i-1]+1;
-        end = s[i+1]-1;
-        for (j = start; j <= end; j++) {
-          range = realloc(range, strlen(range) + 1 + 1 + 1);
-          range[strlen(range) + 1] = '\0';
-          range[strlen(range) + 0] = (char)j;
-        }        
-      }
-    }
-    
-    /* Regex Range Normal */
-    else {
-      range = realloc(range, strlen(range) + 1 + 1);
-      range[strlen(range) + 1] = '\0';
-      range[strlen(range) + 0] = s[i];
-    }
+  p->type = MPC_TYPE_OR;
+  p->data.or.n = n;
+  p->data.or.xs = malloc(sizeof(mpc_parser_t*) * n);
   
+  va_start(va, n);  
+  for (i = 0; i < n; i++) {
+    p->data.or.xs[i] = va_arg(va, mpc_parser_t*);
   }
+  va_end(va);
   
-  out = comp == 1 ? mpc_noneof(range) : mpc_oneof(range);
-  
-  free(x);
-  free(range);
-  
-  return out;
+  return p;
 }
 
-mpc_parser_t *mpc_re(const char *re) {
-  
-  char *err_msg;
-  mpc_parser_t *err_out;
-  mpc_result_t r;
-  mpc_parser_t *Regex, *Term, *Factor, *Base, *Range, *RegexEnclose; 
-  
-  Regex  = mpc_new("regex");
-  Term   = mpc_new("term");
-  Factor = mpc_new("factor");
-  Base   = mpc_new("base");
-  Range  = mpc_new("range");
-  
-  mpc_define(Regex, mpc_and(2, mpcf_re_or,
-    Term, 
-    mpc_maybe(mpc_and(2, mpcf_snd_free, mpc_char('|'), Regex, free)),
-    (mpc_dtor_t)mpc_delete
-  ));
-  
-  mpc_define(Term, mpc_many(mpcf_re_and, Factor));
+mpc_parser_t *mpc_and(int n, mpc_fold_t f, ...) {
+
+  int i;
+  va_list va;
+
+  mpc_parser_t *p = mpc_undefined();
   
-  mpc_define(Factor, mpc_and(2, mpcf_re_repeat,
-    Base,
-    mpc_or(5,
-      mpc_char('*'), mpc_char('+'), mpc_char('?'),
-      mpc_brackets(mpc_int(), free),
-      mpc_pass()),
-    (mpc_dtor_t)mpc_delete
-  ));
-  
-  mpc_define(Base, mpc_or(4,
-    mpc_parens(Regex, (mpc_dtor_t)mpc_delete),
-    mpc_squares(Range, (mpc_dtor_t)mpc_delete),
-    mpc_apply(mpc_escape(), mpcf_re_escape),
-    mpc_apply(mpc_noneof(")|"), mpcf_re_escape)
-  ));
-  
-  mpc_define(Range, mpc_apply(
-    mpc_many(mpcf_strfold, mpc_or(2, mpc_escape(), mpc_noneof("]"))),
-    mpcf_re_range
-  ));
-  
-  RegexEnclose = mpc_whole(mpc_predictive(Regex), (mpc_dtor_t)mpc_delete);
-  
-  mpc_optimise(RegexEnclose);
-  mpc_optimise(Regex);
-  mpc_optimise(Term);
-  mpc_optimise(Factor);
-  mpc_optimise(Base);
-  mpc_optimise(Range);
-  
-  if(!mpc_parse("<mpc_re_compiler>", re, RegexEnclose, &r)) {
-    err_msg = mpc_err_string(r.error);
-    err_out = mpc_failf("Invalid Regex: %s", err_msg);
-    mpc_err_delete(r.error);  
-    free(err_msg);
-    r.output = err_out;
-  }
-  
-  mpc_cleanup(6, RegexEnclose, Regex, Term, Factor, Base, Range);
-  
-  mpc_optimise(r.output);
-  
-  return r.output;
+  p->type = MPC_TYPE_AND;
+  p->data.and.n = n;
+  p->data.and.f = f;
+  p->data.and.xs = malloc(sizeof(mpc_parser_t*) * n);
+  p->data.and.dxs = malloc(sizeof(mpc_dtor_t) * (n-1));
+
+  va_start(va, f);  
+  for (i = 0; i < n; i++) {
+    p->data.and.xs[i] = va_arg(va, mpc_parser_t*);
+  }
+  for (i = 0; i < (n-1); i++) {
+    p->data.and.dxs[i] = va_arg(va, mpc_dtor_t);
+  }  
+  va_end(va);
   
+  return p;
 }
 
 /*
-** Common Fold Functions
+** Common Parsers
 */
 
-void mpcf_dtor_null(mpc_val_t *x) { (void) x; return; }
-
-mpc_val_t *mpcf_ctor_null(void) { return NULL; }
-mpc_val_t *mpcf_ctor_str(void) { return calloc(1, 1); }
-mpc_val_t *mpcf_free(mpc_val_t *x) { free(x); return NULL; }
-
-mpc_val_t *mpcf_int(mpc_val_t *x) {
-  int *y = malloc(sizeof(int));
-  *y = strtol(x, NULL, 10);
-  free(x);
-  return y;
-}
-
-mpc_val_t *mpcf_hex(mpc_val_t *x) {
-  int *y = malloc(sizeof(int));
-  *y = strtol(x, NULL, 16);
-  free(x);
-  return y;
-}
+static int mpc_soi_anchor(char prev, char next) { (void) next; return (prev == '\0'); }
+static int mpc_eoi_anchor(char prev, char next) { (void) prev; return (next == '\0'); }
 
-mpc_val_t *mpcf_oct(mpc_val_t *x) {
-  int *y = malloc(sizeof(int));
-  *y = strtol(x, NULL, 8);
-  free(x);
-  return y;
-}
+mpc_parser_t *mpc_soi(void) { return mpc_expect(mpc_anchor(mpc_soi_anchor), "start of input"); }
+mpc_parser_t *mpc_eoi(void) { return mpc_expect(mpc_anchor(mpc_eoi_anchor), "end of input"); }
 
-mpc_val_t *mpcf_float(mpc_val_t *x) {
-  float *y = malloc(sizeof(float));
-  *y = strtod(x, NULL);
-  free(x);
-  return y;
+static int mpc_boundary_anchor(char prev, char next) {
+  const char* word = "abcdefghijklmnopqrstuvwxyz"
+                     "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+                     "0123456789_";
+  if ( strchr(word, next) &&  prev == '\0') { return 1; }
+  if ( strchr(word, prev) &&  next == '\0') { return 1; }
+  if ( strchr(word, next) && !strchr(word, prev)) { return 1; }
+  if (!strchr(word, next) &&  strchr(word, prev)) { return 1; }
+  return 0;
 }
 
-mpc_val_t *mpcf_strtriml(mpc_val_t *x) {
-  char *s = x;
-  while (isspace(*s)) {
-    memmove(s, s+1, strlen(s));
-  }
-  return s;
-}
+mpc_parser_t *mpc_boundary(void) { return mpc_expect(mpc_anchor(mpc_boundary_anchor), "boundary"); }
 
-mpc_val_t *mpcf_strtrimr(mpc_val_t *x) {
-  char *s = x;
-  size_t l = strlen(s);
-  while (isspace(s[l-1])) {
-    s[l-1] = '\0'; l--;
-  }
-  return s;
-}
+mpc_parser_t *mpc_whitespace(void) { return mpc_expect(mpc_oneof(" \f\n\r\t\v"), "whitespace"); }
+mpc_parser_t *mpc_whitespaces(void) { return mpc_expect(mpc_many(mpcf_strfold, mpc_whitespace()), "spaces"); }
+mpc_parser_t *mpc_blank(void) { return mpc_expect(mpc_apply(mpc_whitespaces(), mpcf_free), "whitespace"); }
 
-mpc_val_t *mpcf_strtrim(mpc_val_t *x) {
-  return mpcf_strtriml(mpcf_strtrimr(x));
-}
+mpc_parser_t *mpc_newline(void) { return mpc_expect(mpc_char('\n'), "newline"); }
+mpc_parser_t *mpc_tab(void) { return mpc_expect(mpc_char('\t'), "tab"); }
+mpc_parser_t *mpc_escape(void) { return mpc_and(2, mpcf_strfold, mpc_char('\\'), mpc_any(), free); }
 
-static const char mpc_escape_input_c[]  = {
-  '\a', '\b', '\f', '\n', '\r',
-  '\t', '\v', '\\', '\'', '\"', '\0'};
-    
-static const char *mpc_escape_output_c[] = {
-  "\\a", "\\b", "\\f", "\\n", "\\r", "\\t", 
-  "\\v", "\\\\", "\\'", "\\\"", "\\0", NULL};
+mpc_parser_t *mpc_digit(void) { return mpc_expect(mpc_oneof("0123456789"), "digit"); }
+mpc_parser_t *mpc_hexdigit(void) { return mpc_expect(mpc_oneof("0123456789ABCDEFabcdef"), "hex digit"); }
+mpc_parser_t *mpc_octdigit(void) { return mpc_expect(mpc_oneof("01234567"), "oct digit"); }
+mpc_parser_t *mpc_digits(void) { return mpc_expect(mpc_many1(mpcf_strfold, mpc_digit()), "digits"); }
+mpc_parser_t *mpc_hexdigits(void) { return mpc_expect(mpc_many1(mpcf_strfold, mpc_hexdigit()), "hex digits"); }
+mpc_parser_t *mpc_octdigits(void) { return mpc_expect(mpc_many1(mpcf_strfold, mpc_octdigit()), "oct digits"); }
 
-static const char mpc_escape_input_raw_re[] = { '/' };
-static const char *mpc_escape_output_raw_re[] = { "\\/", NULL };
+mpc_parser_t *mpc_lower(void) { return mpc_expect(mpc_oneof("abcdefghijklmnopqrstuvwxyz"), "lowercase letter"); }
+mpc_parser_t *mpc_upper(void) { return mpc_expect(mpc_oneof("ABCDEFGHIJKLMNOPQRSTUVWXYZ"), "uppercase letter"); }
+mpc_parser_t *mpc_alpha(void) { return mpc_expect(mpc_oneof("abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ"), "letter"); }
+mpc_parser_t *mpc_underscore(void) { return mpc_expect(mpc_char('_'), "underscore"); }
+mpc_parser_t *mpc_alphanum(void) { return mpc_expect(mpc_or(3, mpc_alpha(), mpc_digit(), mpc_underscore()), "alphanumeric"); }
 
-static const char mpc_escape_input_raw_cstr[] = { '"' };
-static const char *mpc_escape_output_raw_cstr[] = { "\\\"", NULL };
+mpc_parser_t *mpc_int(void) { return mpc_expect(mpc_apply(mpc_digits(), mpcf_int), "integer"); }
+mpc_parser_t *mpc_hex(void) { return mpc_expect(mpc_apply(mpc_hexdigits(), mpcf_hex), "hexadecimal"); }
+mpc_parser_t *mpc_oct(void) { return mpc_expect(mpc_apply(mpc_octdigits(), mpcf_oct), "octadecimal"); }
+mpc_parser_t *mpc_number(void) { return mpc_expect(mpc_or(3, mpc_int(), mpc_hex(), mpc_oct()), "number"); }
 
-static const char mpc_escape_input_raw_cchar[] = { '\'' };
-static const char *mpc_escape_output_raw_cchar[] = { "\\'", NULL };
+mpc_parser_t *mpc_real(void) {
 
-static mpc_val_t *mpcf_escape_new(mpc_val_t *x, const char *input, const char **output) {
-  
-  int i;
-  int found;
-  char buff[2];
-  char *s = x;
-  char *y = calloc(1, 1);
+  /* [+-]?\d+(\.\d+)?([eE][+-]?[0-9]+)? */
   
-  while (*s) {
-    
-    i = 0;
-    found = 0;
-
-    while (output[i]) {
-      if (*s == input[i]) {
-        y = realloc(y, strlen(y) + strlen(output[i]) + 1);
-        strcat(y, output[i]);
-        found = 1;
-        break;
-      }
-      i++;
-    }
-    
-    if (!found) {
-      y = realloc(y, strlen(y) + 2);
-      buff[0] = *s; buff[1] = '\0';
-      strcat(y, buff);
-    }
-    
-    s++;
-  }
+  mpc_parser_t *p0, *p1, *p2, *p30, *p31, *p32, *p3;
   
+  p0 = mpc_maybe_lift(mpc_oneof("+-"), mpcf_ctor_str);
+  p1 = mpc_digits();
+  p2 = mpc_maybe_lift(mpc_and(2, mpcf_strfold, mpc_char('.'), mpc_digits(), free), mpcf_ctor_str);
+  p30 = mpc_oneof("eE");
+  p31 = mpc_maybe_lift(mpc_oneof("+-"), mpcf_ctor_str);
+  p32 = mpc_digits();
+  p3 = mpc_maybe_lift(mpc_and(3, mpcf_strfold, p30, p31, p32, free, free), mpcf_ctor_str);
   
-  return y;
-}
+  return mpc_expect(mpc_and(4, mpcf_strfold, p0, p1, p2, p3, free, free, free), "real");
 
-static mpc_val_t *mpcf_unescape_new(mpc_val_t *x, const char *input, const char **output) {
-  
-  int i;
-  int found = 0;
-  char buff[2];
-  char *s = x;
-  char *y = calloc(1, 1);
-  
-  while (*s) {
-    
-    i = 0;
-    found = 0;
-    
-    while (output[i]) {
-      if ((*(s+0)) == output[i][0] &&
-          (*(s+1)) == output[i][1]) {
-        y = realloc(y, strlen(y) + 1 + 1);
-        buff[0] = input[i]; buff[1] = '\0';
-        strcat(y, buff);
-        found = 1;
-        s++;
-        break;
-      }
-      i++;
-    }
-    
-    if (!found) {
-      y = realloc(y, strlen(y) + 1 + 1);
-      buff[0] = *s; buff[1] = '\0';
-      strcat(y, buff);
-    }
-    
-    if (*s == '\0') { break; }
-    else { s++; }
-  }
-  
-  return y;
-  
 }
 
-mpc_val_t *mpcf_escape(mpc_val_t *x) {
-  mpc_val_t *y = mpcf_escape_new(x, mpc_escape_input_c, mpc_escape_output_c);
-  free(x);
-  return y;
+mpc_parser_t *mpc_float(void) {
+  return mpc_expect(mpc_apply(mpc_real(), mpcf_float), "float");
 }
 
-mpc_val_t *mpcf_unescape(mpc_val_t *x) {
-  mpc_val_t *y = mpcf_unescape_new(x, mpc_escape_input_c, mpc_escape_output_c);
-  free(x);
-  return y;
+mpc_parser_t *mpc_char_lit(void) {
+  return mpc_expect(mpc_between(mpc_or(2, mpc_escape(), mpc_any()), free, "'", "'"), "char");
 }
 
-mpc_val_t *mpcf_escape_regex(mpc_val_t *x) {
-  mpc_val_t *y = mpcf_escape_new(x, mpc_escape_input_raw_re, mpc_escape_output_raw_re);
-  free(x);
-  return y;  
+mpc_parser_t *mpc_string_lit(void) {
+  mpc_parser_t *strchar = mpc_or(2, mpc_escape(), mpc_noneof("\""));
+  return mpc_expect(mpc_between(mpc_many(mpcf_strfold, strchar), free, "\"", "\""), "string");
 }
 
-mpc_val_t *mpcf_unescape_regex(mpc_val_t *x) {
-  mpc_val_t *y = mpcf_unescape_new(x, mpc_escape_input_raw_re, mpc_escape_output_raw_re);
-  free(x);
-  return y;  
+mpc_parser_t *mpc_regex_lit(void) {  
+  mpc_parser_t *regexchar = mpc_or(2, mpc_escape(), mpc_noneof("/"));
+  return mpc_expect(mpc_between(mpc_many(mpcf_strfold, regexchar), free, "/", "/"), "regex");
 }
 
-mpc_val_t *mpcf_escape_string_raw(mpc_val_t *x) {
-  mpc_val_t *y = mpcf_escape_new(x, mpc_escape_input_raw_cstr, mpc_escape_output_raw_cstr);
-  free(x);
-  return y;
+mpc_parser_t *mpc_ident(void) {
+  mpc_parser_t *p0, *p1; 
+  p0 = mpc_or(2, mpc_alpha(), mpc_underscore());
+  p1 = mpc_many(mpcf_strfold, mpc_alphanum()); 
+  return mpc_and(2, mpcf_strfold, p0, p1, free);
 }
 
-mpc_val_t *mpcf_unescape_string_raw(mpc_val_t *x) {
-  mpc_val_t *y = mpcf_unescape_new(x, mpc_escape_input_raw_cstr, mpc_escape_output_raw_cstr);
-  free(x);
-  return y;
-}
+/*
+** Useful Parsers
+*/
 
-mpc_val_t *mpcf_escape_char_raw(mpc_val_t *x) {
-  mpc_val_t *y = mpcf_escape_new(x, mpc_escape_input_raw_cchar, mpc_escape_output_raw_cchar);
-  free(x);
-  return y;
+mpc_parser_t *mpc_startwith(mpc_parser_t *a) { return mpc_and(2, mpcf_snd, mpc_soi(), a, mpcf_dtor_null); }
+mpc_parser_t *mpc_endwith(mpc_parser_t *a, mpc_dtor_t da) { return mpc_and(2, mpcf_fst, a, mpc_eoi(), da); }
+mpc_parser_t *mpc_whole(mpc_parser_t *a, mpc_dtor_t da) { return mpc_and(3, mpcf_snd, mpc_soi(), a, mpc_eoi(), mpcf_dtor_null, da); }
+
+mpc_parser_t *mpc_stripl(mpc_parser_t *a) { return mpc_and(2, mpcf_snd, mpc_blank(), a, mpcf_dtor_null); }
+mpc_parser_t *mpc_stripr(mpc_parser_t *a) { return mpc_and(2, mpcf_fst, a, mpc_blank(), mpcf_dtor_null); }
+mpc_parser_t *mpc_strip(mpc_parser_t *a) { return mpc_and(3, mpcf_snd, mpc_blank(), a, mpc_blank(), mpcf_dtor_null, mpcf_dtor_null); }
+mpc_parser_t *mpc_tok(mpc_parser_t *a) { return mpc_and(2, mpcf_fst, a, mpc_blank(), mpcf_dtor_null); }
+mpc_parser_t *mpc_sym(const char *s) { return mpc_tok(mpc_string(s)); }
+
+mpc_parser_t *mpc_total(mpc_parser_t *a, mpc_dtor_t da) { return mpc_whole(mpc_strip(a), da); }
+
+mpc_parser_t *mpc_between(mpc_parser_t *a, mpc_dtor_t ad, const char *o, const char *c) {
+  return mpc_and(3, mpcf_snd_free,
+    mpc_string(o), a, mpc_string(c),
+    free, ad);
 }
 
-mpc_val_t *mpcf_unescape_char_raw(mpc_val_t *x) {
-  mpc_val_t *y = mpcf_unescape_new(x, mpc_escape_input_raw_cchar, mpc_escape_output_raw_cchar);
-  free(x);
-  return y;
+mpc_parser_t *mpc_parens(mpc_parser_t *a, mpc_dtor_t ad)   { return mpc_between(a, ad, "(", ")"); }
+mpc_parser_t *mpc_braces(mpc_parser_t *a, mpc_dtor_t ad)   { return mpc_between(a, ad, "<", ">"); }
+mpc_parser_t *mpc_brackets(mpc_parser_t *a, mpc_dtor_t ad) { return mpc_between(a, ad, "{", "}"); }
+mpc_parser_t *mpc_squares(mpc_parser_t *a, mpc_dtor_t ad)  { return mpc_between(a, ad, "[", "]"); }
+
+mpc_parser_t *mpc_tok_between(mpc_parser_t *a, mpc_dtor_t ad, const char *o, const char *c) {
+  return mpc_and(3, mpcf_snd_free,
+    mpc_sym(o), mpc_tok(a), mpc_sym(c),
+    free, ad);
 }
 
-mpc_val_t *mpcf_null(int n, mpc_val_t** xs) { (void) n; (void) xs; return NULL; }
-mpc_val_t *mpcf_fst(int n, mpc_val_t **xs) { (void) n; return xs[0]; }
-mpc_val_t *mpcf_snd(int n, mpc_val_t **xs) { (void) n; return xs[1]; }
-mpc_val_t *mpcf_trd(int n, mpc_val_t **xs) { (void) n; return xs[2]; }
+mpc_parser_t *mpc_tok_parens(mpc_parser_t *a, mpc_dtor_t ad)   { return mpc_tok_between(a, ad, "(", ")"); }
+mpc_parser_t *mpc_tok_braces(mpc_parser_t *a, mpc_dtor_t ad)   { return mpc_tok_between(a, ad, "<", ">"); }
+mpc_parser_t *mpc_tok_brackets(mpc_parser_t *a, mpc_dtor_t ad) { return mpc_tok_between(a, ad, "{", "}"); }
+mpc_parser_t *mpc_tok_squares(mpc_parser_t *a, mpc_dtor_t ad)  { return mpc_tok_between(a, ad, "[", "]"); }
 
-static mpc_val_t *mpcf_nth_free(int n, mpc_val_t **xs, int x) {
+/*
+** Regular Expression Parsers
+*/
+
+/*
+** So here is a cute bootstrapping.
+**
+** I'm using the previously defined
+** mpc constructs and functions to
+** parse the user regex string and
+** construct a parser from it.
+**
+** As it turns out lots of the standard
+** mpc functions look a lot like `fold`
+** functions and so can be used indirectly
+** by many of the parsing functions to build
+** a parser directly - as we are parsing.
+**
+** This is certainly something that
+** would be less elegant/interesting 
+** in a two-phase parser which first
+** builds an AST and then traverses it
+** to generate the object.
+**
+** This whole thing acts as a great
+** case study for how trivial it can be
+** to write a great parser in a few
+** lines of code using mpc.
+*/
+
+/*
+**
+**  ### Regular Expression Grammar
+**
+**      <regex> : <term> | (<term> "|" <regex>)
+**     
+**      <term> : <factor>*
+**
+**      <factor> : <base>
+**               | <base> "*"
+**               | <base> "+"
+**               | <base> "?"
+**               | <base> "{" <digits> "}"
+**           
+**      <base> : <char>
+**             | "\" <char>
+**             | "(" <regex> ")"
+**             | "[" <range> "]"
+*/
+
+static mpc_val_t *mpcf_re_or(int n, mpc_val_t **xs) {
+  (void) n;
+  if (xs[1] == NULL) { return xs[0]; }
+  else { return mpc_or(2, xs[0], xs[1]); }
+}
+
+static mpc_val_t *mpcf_re_and(int n, mpc_val_t **xs) {
   int i;
+  mpc_parser_t *p = mpc_lift(mpcf_ctor_str);
   for (i = 0; i < n; i++) {
-    if (i != x) { free(xs[i]); }
+    p = mpc_and(2, mpcf_strfold, p, xs[i], free);
   }
-  return xs[x];
+  return p;
 }
- 
-mpc_val_t *mpcf_fst_free(int n, mpc_val_t **xs) { return mpcf_nth_free(n, xs, 0); }
-mpc_val_t *mpcf_snd_free(int n, mpc_val_t **xs) { return mpcf_nth_free(n, xs, 1); }
-mpc_val_t *mpcf_trd_free(int n, mpc_val_t **xs) { return mpcf_nth_free(n, xs, 2); }
 
-mpc_val_t *mpcf_strfold(int n, mpc_val_t **xs) {
-  int i;
-  size_t l = 0;
+static mpc_val_t *mpcf_re_repeat(int n, mpc_val_t **xs) {
+  int num;
+  (void) n;
+  if (xs[1] == NULL) { return xs[0]; }
+  switch(((char*)xs[1])[0])
+  {
+    case '*': { free(xs[1]); return mpc_many(mpcf_strfold, xs[0]); }; break;
+    case '+': { free(xs[1]); return mpc_many1(mpcf_strfold, xs[0]); }; break;
+    case '?': { free(xs[1]); return mpc_maybe_lift(xs[0], mpcf_ctor_str); }; break;
+    default:
+      num = *(int*)xs[1];
+      free(xs[1]);
+  }
   
-  if (n == 0) { return calloc(1, 1); }
+  return mpc_count(num, mpcf_strfold, xs[0], free);
+}
+
+static mpc_parser_t *mpc_re_escape_char(char c) {
+  switch (c) {
+    case 'a': return mpc_char('\a');
+    case 'f': return mpc_char('\f');
+    case 'n': return mpc_char('\n');
+    case 'r': return mpc_char('\r');
+    case 't': return mpc_char('\t');
+    case 'v': return mpc_char('\v');
+    case 'b': return mpc_and(2, mpcf_snd, mpc_boundary(), mpc_lift(mpcf_ctor_str), free);
+    case 'B': return mpc_not_lift(mpc_boundary(), free, mpcf_ctor_str);
+    case 'A': return mpc_and(2, mpcf_snd, mpc_soi(), mpc_lift(mpcf_ctor_str), free);
+    case 'Z': return mpc_and(2, mpcf_snd, mpc_eoi(), mpc_lift(mpcf_ctor_str), free);
+    case 'd': return mpc_digit();
+    case 'D': return mpc_not_lift(mpc_digit(), free, mpcf_ctor_str);
+    case 's': return mpc_whitespace();
+    case 'S': return mpc_not_lift(mpc_whitespace(), free, mpcf_ctor_str);
+    case 'w': return mpc_alphanum();
+    case 'W': return mpc_not_lift(mpc_alphanum(), free, mpcf_ctor_str);
+    default: return NULL;
+  }
+}
+
+static mpc_val_t *mpcf_re_escape(mpc_val_t *x) {
   
-  for (i = 0; i < n; i++) { l += strlen(xs[i]); }
+  char *s = x;
+  mpc_parser_t *p;
   
-  xs[0] = realloc(xs[0], l + 1);
+  /* Regex Special Characters */
+  if (s[0] == '.') { free(s); return mpc_any(); }
+  if (s[0] == '^') { free(s); return mpc_and(2, mpcf_snd, mpc_soi(), mpc_lift(mpcf_ctor_str), free); }
+  if (s[0] == '$') { free(s); return mpc_and(2, mpcf_snd, mpc_eoi(), mpc_lift(mpcf_ctor_str), free); }
   
-  for (i = 1; i < n; i++) {
-    strcat(xs[0], xs[i]); free(xs[i]);
+  /* Regex Escape */
+  if (s[0] == '\\') {
+    p = mpc_re_escape_char(s[1]);
+    p = (p == NULL) ? mpc_char(s[1]) : p;
+    free(s);
+    return p;
   }
   
-  return xs[0];
+  /* Regex Standard */
+  p = mpc_char(s[0]);
+  free(s);
+  return p;
 }
 
-mpc_val_t *mpcf_maths(int n, mpc_val_t **xs) {
-  int **vs = (int**)xs;
-  (void) n;
-  
-  switch(((char*)xs[1])[0])
-  {
-    case '*': { *vs[0] *= *vs[2]; }; break;
-    case '/': { *vs[0] /= *vs[2]; }; break;
-    case '%': { *vs[0] %= *vs[2]; }; break;
-    case '+': { *vs[0] += *vs[2]; }; break;
-    case '-': { *vs[0] -= *vs[2]; }; break;
-    default: break;
+static const char *mpc_re_range_escape_char(char c) {
+  switch (c) {
+    case '-': return "-";
+    case 'a': return "\a";
+    case 'f': return "\f";
+    case 'n': return "\n";
+    case 'r': return "\r";
+    case 't': return "\t";
+    case 'v': return "\v";
+    case 'b': return "\b";
+    case 'd': return "0123456789";
+    case 's': return " \f\n\r\t\v";
+    case 'w': return "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_";
+    default: return NULL;
   }
-  
-  free(xs[1]); free(xs[2]);
-  
-  return xs[0];
 }
 
 /*
-** Printing
+** The expanded range is kept as a string only for
+** error messages and printing - matching uses the
+** bitmap `mpc_oneof` and `mpc_noneof` build from it.
 */
 
-static void mpc_print_unretained(mpc_parser_t *p, int force) {
+static void mpc_re_range_push(char **range, size_t *len, size_t *slots, const char *c, size_t n) {
+  while (*len + n + 1 > *slots) {
+    *slots *= 2;
+    *range = realloc(*range, *slots);
+  }
+  memcpy(*range + *len, c, n);
+  *len += n;
+  (*range)[*len] = '\0';
+}
+
+static mpc_val_t *mpcf_re_range(mpc_val_t *x) {
   
-  /* TODO: Print Everything Escaped */
+  mpc_parser_t *out;
+  size_t i, len = 0, slots = 32;
+  int j, start, end;
+  char c;
+  const char *tmp = NULL;
+  const char *s = x;
+  int comp = s[0] == '^' ? 1 : 0;
+  size_t n = strlen(s);
+  char *range;
   
-  int i;
-  char *s, *e;
-  char buff[2];
+  if (s[0] == '\0') { free(x); return mpc_fail("Invalid Regex Range Expression"); } 
+  if (s[0] == '^' && 
+      s[1] == '\0') { free(x); return mpc_fail("Invalid Regex Range Expression"); }
   
-  if (p->retained && !force) {;
-    if (p->name) { printf("<%s>", p->name); }
-    else { printf("<anon>"); }
-    return;
-  }
+  range = calloc(1, slots);
+  
+  for (i = comp; i < n; i++){
+    
+    /* Regex Range Escape */
+    if (s[i] == '\\') {
+      tmp = mpc_re_range_escape_char(s[i+1]);
+      if (tmp != NULL) {
+        mpc_re_range_push(&range, &len, &slots, tmp, strlen(tmp));
+      } else {
+        mpc_re_range_push(&range, &len, &slots, s + i + 1, 1);
+      }
+      i++;
+    }
+    
+    /* Regex Range...Range */
+    else if (s[i] == '-') {
+      if (s[i+1] == '\0' || i == 0) {
+        mpc_re_range_push(&range, &len, &slots, "-", 1);
+      } else {
+        start = (unsigned char)s[i-1]+1;
+        end = (unsigned char)s[i+1]-1;
+        for (j = start; j <= end; j++) {
+          c = (char)j;
+          mpc_re_range_push(&range, &len, &slots, &c, 1);
+        }        
+      }
+    }
+    
+    /* Regex Range Normal */
+    else {
+      mpc_re_range_push(&range, &len, &slots, s + i, 1);
+    }
   
-  if (p->type == MPC_TYPE_UNDEFINED) { printf("<?>"); }
-  if (p->type == MPC_TYPE_PASS)   { printf("<:>"); }
-  if (p->type == MPC_TYPE_FAIL)   { printf("<!>"); }
-  if (p->type == MPC_TYPE_LIFT)   { printf("<#>"); }
-  if (p->type == MPC_TYPE_STATE)  { printf("<S>"); }
-  if (p->type == MPC_TYPE_ANCHOR) { printf("<@>"); }
-  if (p->type == MPC_TYPE_EXPECT) {
-    printf("%s", p->data.expect.m);
-    /*mpc_print_unretained(p->data.expect.x, 0);*/
   }
   
-  if (p->type == MPC_TYPE_ANY) { printf("<.>"); }
-  if (p->type == MPC_TYPE_SATISFY) { printf("<f>"); }
-
-  if (p->type == MPC_TYPE_SINGLE) {
-    buff[0] = p->data.single.x; buff[1] = '\0';
-    s = mpcf_escape_new(
-      buff,
-      mpc_escape_input_c,
-      mpc_escape_output_c);
-    printf("'%s'", s);
-    free(s);
-  }
-  
-  if (p->type == MPC_TYPE_RANGE) {
-    buff[0] = p->data.range.x; buff[1] = '\0';
-    s = mpcf_escape_new(
-      buff,
-      mpc_escape_input_c,
-      mpc_escape_output_c);
-    buff[0] = p->data.range.y; buff[1] = '\0';
-    e = mpcf_escape_new(
-      buff,
-      mpc_escape_input_c,
-      mpc_escape_output_c);
-    printf("[%s-%s]", s, e);
-    free(s);
-    free(e);
-  }
-  
-  if (p->type == MPC_TYPE_ONEOF) {
-    s = mpcf_escape_new(
-      p->data.string.x,
-      mpc_escape_input_c,
-      mpc_escape_output_c);
-    printf("[%s]", s);
-    free(s);
-  }
-  
-  if (p->type == MPC_TYPE_NONEOF) {
-    s = mpcf_escape_new(
-      p->data.string.x,
-      mpc_escape_input_c,
-      mpc_escape_output_c);
-    printf("[^%s]", s);
-    free(s);
-  }
-  
-  if (p->type == MPC_TYPE_STRING) {
-    s = mpcf_escape_new(
-      p->data.string.x,
-      mpc_escape_input_c,
-      mpc_escape_output_c);
-    printf("\"%s\"", s);
-    free(s);
-  }
-  
-  if (p->type == MPC_TYPE_APPLY)    { mpc_print_unretained(p->data.apply.x, 0); }
-  if (p->type == MPC_TYPE_APPLY_TO) { mpc_print_unretained(p->data.apply_to.x, 0); }
-  if (p->type == MPC_TYPE_PREDICT)  { mpc_print_unretained(p->data.predict.x, 0); }
-
-  if (p->type == MPC_TYPE_NOT)   { mpc_print_unretained(p->data.not.x, 0); printf("!"); }
-  if (p->type == MPC_TYPE_MAYBE) { mpc_print_unretained(p->data.not.x, 0); printf("?"); }
-
-  if (p->type == MPC_TYPE_MANY)  { mpc_print_unretained(p->data.repeat.x, 0); printf("*"); }
-  if (p->type == MPC_TYPE_MANY1) { mpc_print_unretained(p->data.repeat.x, 0); printf("+"); }
-  if (p->type == MPC_TYPE_COUNT) { mpc_print_unretained(p->data.repeat.x, 0); printf("{%i}", p->data.repeat.n); }
-  
-  if (p->type == MPC_TYPE_OR) {
-    printf("(");
-    for(i = 0; i < p->data.or.n-1; i++) {
-      mpc_print_unretained(p->data.or.xs[i], 0);
-      printf(" | ");
-    }
-    mpc_print_unretained(p->data.or.xs[p->data.or.n-1], 0);
-    printf(")");
-  }
+  out = comp == 1 ? mpc_noneof(range) : mpc_oneof(range);
   
-  if (p->type == MPC_TYPE_AND) {
-    printf("(");
-    for(i = 0; i < p->data.and.n-1; i++) {
-      mpc_print_unretained(p->data.and.xs[i], 0);
-      printf(" ");
-    }
-    mpc_print_unretained(p->data.and.xs[p->data.and.n-1], 0);
-    printf(")");
-  }
+  free(x);
+  free(range);
   
-}
-
-void mpc_print(mpc_parser_t *p) {
-  mpc_print_unretained(p, 1);
-  printf("\n");
+  return out;
 }
 
 /*
-** Testing
+** Once a regex has been built from combinators
+** we try to compile it to a DFA using the
+** Glushkov construction, where every character
+** matching parser is a state and the edges go
+** to the parsers that may follow it.
+**
+** This is only done when the result is already
+** deterministic - every state can tell which
+** edge to take from the next character alone.
+** For those expressions the greedy, ordered
+** choices made by the combinators always agree
+** with taking the longest match. Alternatives
+** which match nothing (other than the last) and
+** repetitions of things that may match nothing
+** could still disagree so they are left alone,
+** as is anything using anchors or negation.
+** Counted repetition is also left alone as it
+** does not rewind when it fails part way.
 */
 
+enum {
+  MPC_RE_DFA_STATES_MAX = 256
+};
+
+typedef struct {
+  unsigned char x[MPC_RE_DFA_STATES_MAX / 8];
+} mpc_re_set_t;
+
+typedef struct {
+  int nullable;
+  mpc_re_set_t first;
+  mpc_re_set_t last;
+} mpc_re_info_t;
+
+typedef struct {
+  int n;
+  mpc_re_set_t classes[MPC_RE_DFA_STATES_MAX];
+  mpc_re_set_t follow[MPC_RE_DFA_STATES_MAX];
+} mpc_re_glushkov_t;
+
+static int mpc_re_set_has(const mpc_re_set_t *s, int j) { return (s->x[j / 8] >> (j % 8)) & 1; }
+static void mpc_re_set_add(mpc_re_set_t *s, int j) { s->x[j / 8] |= (unsigned char)(1 << (j % 8)); }
+
+static void mpc_re_set_union(mpc_re_set_t *s, const mpc_re_set_t *t) {
+  int j;
+  for (j = 0; j < MPC_RE_DFA_STATES_MAX / 8; j++) { s->x[j] |= t->x[j]; }
+}
+
 /*
-** These functions are slightly unwieldy and
-** also the whole of the testing suite for mpc
-** mpc is pretty shaky.
-**
-** It could do with a lot more tests and more
-** precision. Currently I am only really testing
-** changes off of the examples.
-**
+** Characters accepted by a single character
+** parser, following exactly what the matching
+** `mpc_input_*` function would do for each byte.
 */
 
-int mpc_test_fail(mpc_parser_t *p, const char *s, const void *d,
-  int(*tester)(const void*, const void*),
-  mpc_dtor_t destructor,
-  void(*printer)(const void*)) {
-  mpc_result_t r;
-  (void) printer;
-  if (mpc_parse("<test>", s, p, &r)) {
-
-    if (tester(r.output, d)) {
-      destructor(r.output);
-      return 0;
-    } else {
-      destructor(r.output);
-      return 1;
-    }
+static int mpc_re_class(mpc_parser_t *p, mpc_re_set_t *c) {
   
-  } else {
-    mpc_err_delete(r.error);
-    return 1;
+  int j;
+  char x;
+  
+  memset(c, 0, sizeof(mpc_re_set_t));
+  
+  for (j = 0; j < 256; j++) {
+    x = (char)j;
+    switch (p->type) {
+      case MPC_TYPE_ANY:    mpc_re_set_add(c, j); break;
+      case MPC_TYPE_SINGLE: if (x == p->data.single.x) { mpc_re_set_add(c, j); } break;
+      case MPC_TYPE_RANGE:  if (x >= p->data.range.x && x <= p->data.range.y) { mpc_re_set_add(c, j); } break;
+      case MPC_TYPE_ONEOF:
+      case MPC_TYPE_NONEOF: if (mpc_class_has(p->data.oneof.c, x)) { mpc_re_set_add(c, j); } break;
+      default: return 0;
+    }
   }
   
+  return 1;
 }
 
-int mpc_test_pass(mpc_parser_t *p, const char *s, const void *d,
-  int(*tester)(const void*, const void*), 
-  mpc_dtor_t destructor, 
-  void(*printer)(const void*)) {
+static void mpc_re_link(mpc_re_glushkov_t *g, const mpc_re_set_t *from, const mpc_re_set_t *to) {
+  int j;
+  for (j = 1; j <= g->n; j++) {
+    if (mpc_re_set_has(from, j)) { mpc_re_set_union(&g->follow[j], to); }
+  }
+}
 
-  mpc_result_t r;  
-  if (mpc_parse("<test>", s, p, &r)) {
+static int mpc_re_positions(mpc_re_glushkov_t *g, mpc_parser_t *p, mpc_re_info_t *r) {
+  
+  int j;
+  mpc_re_info_t x;
+  
+  memset(r, 0, sizeof(mpc_re_info_t));
+  
+  switch (p->type) {
     
-    if (tester(r.output, d)) {
-      destructor(r.output);
+    case MPC_TYPE_EXPECT:
+      return mpc_re_positions(g, p->data.expect.x, r);
+    
+    case MPC_TYPE_PASS:
+      r->nullable = 1;
       return 1;
-    } else {
-      printf("Got "); printer(r.output); printf("\n");
-      printf("Expected "); printer(d); printf("\n");
-      destructor(r.output);
-      return 0;
-    }
     
-  } else {    
-    mpc_err_print(r.error);
-    mpc_err_delete(r.error);
-    return 0;
+    case MPC_TYPE_LIFT:
+      r->nullable = 1;
+      return p->data.lift.lf == mpcf_ctor_str;
+    
+    case MPC_TYPE_ANY:
+    case MPC_TYPE_SINGLE:
+    case MPC_TYPE_RANGE:
+    case MPC_TYPE_ONEOF:
+    case MPC_TYPE_NONEOF:
+      if (g->n + 1 >= MPC_RE_DFA_STATES_MAX) { return 0; }
+      g->n++;
+      mpc_re_class(p, &g->classes[g->n]);
+      mpc_re_set_add(&r->first, g->n);
+      mpc_re_set_add(&r->last, g->n);
+      return 1;
+    
+    case MPC_TYPE_STRING:
+      r->nullable = 1;
+      for (j = 0; p->data.string.x[j]; j++) {
+        if (g->n + 1 >= MPC_RE_DFA_STATES_MAX) { return 0; }
+        g->n++;
+        memset(&g->classes[g->n], 0, sizeof(mpc_re_set_t));
+        mpc_re_set_add(&g->classes[g->n], (unsigned char)p->data.string.x[j]);
+        memset(&x.first, 0, sizeof(mpc_re_set_t));
+        mpc_re_set_add(&x.first, g->n);
+        mpc_re_link(g, &r->last, &x.first);
+        if (r->nullable) { mpc_re_set_add(&r->first, g->n); }
+        memcpy(&r->last, &x.first, sizeof(mpc_re_set_t));
+        r->nullable = 0;
+      }
+      return 1;
+    
+    case MPC_TYPE_MAYBE:
+      if (p->data.not.lf != mpcf_ctor_str) { return 0; }
+      if (!mpc_re_positions(g, p->data.not.x, r)) { return 0; }
+      r->nullable = 1;
+      return 1;
+    
+    case MPC_TYPE_MANY:
+    case MPC_TYPE_MANY1:
+      if (p->data.repeat.f != mpcf_strfold) { return 0; }
+      if (!mpc_re_positions(g, p->data.repeat.x, r) || r->nullable) { return 0; }
+      mpc_re_link(g, &r->last, &r->first);
+      r->nullable = p->type == MPC_TYPE_MANY;
+      return 1;
     
+    case MPC_TYPE_AND:
+      
+      if (p->data.and.f != mpcf_strfold) { return 0; }
+      
+      r->nullable = 1;
+      for (j = 0; j < p->data.and.n; j++) {
+        if (!mpc_re_positions(g, p->data.and.xs[j], &x)) { return 0; }
+        mpc_re_link(g, &r->last, &x.first);
+        if (r->nullable) { mpc_re_set_union(&r->first, &x.first); }
+        if (!x.nullable) { memset(&r->last, 0, sizeof(mpc_re_set_t)); }
+        mpc_re_set_union(&r->last, &x.last);
+        r->nullable = r->nullable && x.nullable;
+      }
+      return 1;
+    
+    case MPC_TYPE_OR:
+      for (j = 0; j < p->data.or.n; j++) {
+        if (!mpc_re_positions(g, p->data.or.xs[j], &x)) { return 0; }
+        if (x.nullable && j != p->data.or.n-1) { return 0; }
+        mpc_re_set_union(&r->first, &x.first);
+        mpc_re_set_union(&r->last, &x.last);
+        r->nullable = r->nullable || x.nullable;
+      }
+      return 1;
+    
+    default: return 0;
   }
   
 }
 
-
-/*
-** AST
-*/
-
-void mpc_ast_delete(mpc_ast_t *a) {
+static int mpc_re_edges(mpc_re_glushkov_t *g, const mpc_re_set_t *to, int *trans) {
   
-  int i;
+  int j, c;
   
-  if (a == NULL) { return; }
+  for (c = 0; c < 256; c++) { trans[c] = -1; }
   
-  for (i = 0; i < a->children_num; i++) {
-    mpc_ast_delete(a->children[i]);
+  for (j = 1; j <= g->n; j++) {
+    if (!mpc_re_set_has(to, j)) { continue; }
+    for (c = 0; c < 256; c++) {
+      if (!mpc_re_set_has(&g->classes[j], c)) { continue; }
+      if (trans[c] != -1) { return 0; }
+      trans[c] = j;
+    }
   }
   
-  free(a->children);
-  free(a->tag);
-  free(a->contents);
-  free(a);
-  
-}
-
-static void mpc_ast_delete_no_children(mpc_ast_t *a) {
-  free(a->children);
-  free(a->tag);
-  free(a->contents);
-  free(a);
+  return 1;
 }
 
-mpc_ast_t *mpc_ast_new(const char *tag, const char *contents) {
+static mpc_parser_t *mpc_re_dfa(mpc_parser_t *a) {
   
-  mpc_ast_t *a = malloc(sizeof(mpc_ast_t));
+  int j, c;
+  mpc_re_info_t r;
+  mpc_parser_t *p;
+  int *trans;
+  char *accept;
+  mpc_class_t **loops;
+  mpc_re_glushkov_t *g = calloc(1, sizeof(mpc_re_glushkov_t));
   
-  a->tag = malloc(strlen(tag) + 1);
-  strcpy(a->tag, tag);
+  if (!mpc_re_positions(g, a, &r)) { free(g); return a; }
   
-  a->contents = malloc(strlen(contents) + 1);
-  strcpy(a->contents, contents);
+  trans = malloc(sizeof(int) * 256 * (g->n + 1));
+  accept = malloc(g->n + 1);
+  loops = calloc(g->n + 1, sizeof(mpc_class_t*));
   
-  a->state = mpc_state_new();
+  for (j = 0; j <= g->n; j++) {
+    if (!mpc_re_edges(g, j == 0 ? &r.first : &g->follow[j], trans + j * 256)) {
+      free(trans); free(accept); free(loops); free(g);
+      return a;
+    }
+    accept[j] = (char)(j == 0 ? r.nullable : mpc_re_set_has(&r.last, j));
+  }
   
-  a->children_num = 0;
-  a->children = NULL;
-  return a;
+  /* Classes of characters each state loops on */
+  for (j = 1; j <= g->n; j++) {
+    for (c = 0; c < 256; c++) {
+      if (trans[j * 256 + c] != j) { continue; }
+      if (!loops[j]) { loops[j] = calloc(1, sizeof(mpc_class_t)); }
+      mpc_class_add(loops[j], c);
+    }
+    if (loops[j]) { mpc_class_index(loops[j]); }
+  }
   
+  p = mpc_undefined();
+  p->type = MPC_TYPE_DFA;
+  p->data.dfa.x = a;
+  p->data.dfa.n = g->n + 1;
+  p->data.dfa.trans = trans;
+  p->data.dfa.accept = accept;
+  p->data.dfa.loops = loops;
+  
+  free(g);
+  return p;
 }
 
-mpc_ast_t *mpc_ast_build(int n, const char *tag, ...) {
-  
-  mpc_ast_t *a = mpc_ast_new(tag, "");
+mpc_parser_t *mpc_re(const char *re) {
   
-  int i;
-  va_list va;
-  va_start(va, tag);
+  char *err_msg;
+  mpc_parser_t *err_out;
+  mpc_result_t r;
+  mpc_parser_t *Regex, *Term, *Factor, *Base, *Range, *RegexEnclose; 
   
-  for (i = 0; i < n; i++) {
-    mpc_ast_add_child(a, va_arg(va, mpc_ast_t*));
-  }
+  Regex  = mpc_new("regex");
+  Term   = mpc_new("term");
+  Factor = mpc_new("factor");
+  Base   = mpc_new("base");
+  Range  = mpc_new("range");
   
-  va_end(va);
+  mpc_define(Regex, mpc_and(2, mpcf_re_or,
+    Term, 
+    mpc_maybe(mpc_and(2, mpcf_snd_free, mpc_char('|'), Regex, free)),
+    (mpc_dtor_t)mpc_delete
+  ));
   
-  return a;
+  mpc_define(Term, mpc_many(mpcf_re_and, Factor));
   
-}
-
-mpc_ast_t *mpc_ast_add_root(mpc_ast_t *a) {
+  mpc_define(Factor, mpc_and(2, mpcf_re_repeat,
+    Base,
+    mpc_or(5,
+      mpc_char('*'), mpc_char('+'), mpc_char('?'),
+      mpc_brackets(mpc_int(), free),
+      mpc_pass()),
+    (mpc_dtor_t)mpc_delete
+  ));
+  
+  mpc_define(Base, mpc_or(4,
+    mpc_parens(Regex, (mpc_dtor_t)mpc_delete),
+    mpc_squares(Range, (mpc_dtor_t)mpc_delete),
+    mpc_apply(mpc_escape(), mpcf_re_escape),
+    mpc_apply(mpc_noneof(")|"), mpcf_re_escape)
+  ));
+  
+  mpc_define(Range, mpc_apply(
+    mpc_many(mpcf_strfold, mpc_or(2, mpc_escape(), mpc_noneof("]"))),
+    mpcf_re_range
+  ));
+  
+  RegexEnclose = mpc_whole(mpc_predictive(Regex), (mpc_dtor_t)mpc_delete);
+  
+  mpc_optimise(RegexEnclose);
+  mpc_optimise(Regex);
+  mpc_optimise(Term);
+  mpc_optimise(Factor);
+  mpc_optimise(Base);
+  mpc_optimise(Range);
+  
+  if(!mpc_parse("<mpc_re_compiler>", re, RegexEnclose, &r)) {
+    err_msg = mpc_err_string(r.error);
+    err_out = mpc_failf("Invalid Regex: %s", err_msg);
+    mpc_err_delete(r.error);  
+    free(err_msg);
+    r.output = err_out;
+  }
+  
+  mpc_cleanup(6, RegexEnclose, Regex, Term, Factor, Base, Range);
+  
+  mpc_optimise(r.output);
+  
+  return mpc_re_dfa(r.output);
+  
+}
 
-  mpc_ast_t *r;
+/*
+** Common Fold Functions
+*/
 
-  if (a == NULL) { return a; }
-  if (a->children_num == 0) { return a; }
-  if (a->children_num == 1) { return a; }
+void mpcf_dtor_null(mpc_val_t *x) { (void) x; return; }
 
-  r = mpc_ast_new(">", "");
-  mpc_ast_add_child(r, a);
-  return r;
-}
+mpc_val_t *mpcf_ctor_null(void) { return NULL; }
+mpc_val_t *mpcf_ctor_str(void) { return calloc(1, 1); }
+mpc_val_t *mpcf_free(mpc_val_t *x) { free(x); return NULL; }
 
-int mpc_ast_eq(mpc_ast_t *a, mpc_ast_t *b) {
-  
-  int i;
+mpc_val_t *mpcf_int(mpc_val_t *x) {
+  int *y = malloc(sizeof(int));
+  *y = strtol(x, NULL, 10);
+  free(x);
+  return y;
+}
 
-  if (strcmp(a->tag, b->tag) != 0) { return 0; }
-  if (strcmp(a->contents, b->contents) != 0) { return 0; }
-  if (a->children_num != b->children_num) { return 0; }
-  
-  for (i = 0; i < a->children_num; i++) {
-    if (!mpc_ast_eq(a->children[i], b->children[i])) { return 0; }
-  }
-  
-  return 1;
+mpc_val_t *mpcf_hex(mpc_val_t *x) {
+  int *y = malloc(sizeof(int));
+  *y = strtol(x, NULL, 16);
+  free(x);
+  return y;
 }
 
-mpc_ast_t *mpc_ast_add_child(mpc_ast_t *r, mpc_ast_t *a) {
-  r->children_num++;
-  r->children = realloc(r->children, sizeof(mpc_ast_t*) * r->children_num);
-  r->children[r->children_num-1] = a;
-  return r;
+mpc_val_t *mpcf_oct(mpc_val_t *x) {
+  int *y = malloc(sizeof(int));
+  *y = strtol(x, NULL, 8);
+  free(x);
+  return y;
 }
 
-mpc_ast_t *mpc_ast_add_tag(mpc_ast_t *a, const char *t) {
-  if (a == NULL) { return a; }
-  a->tag = realloc(a->tag, strlen(t) + 1 + strlen(a->tag) + 1);
-  memmove(a->tag + strlen(t) + 1, a->tag, strlen(a->tag)+1);
-  memmove(a->tag, t, strlen(t));
-  memmove(a->tag + strlen(t), "|", 1);
-  return a;
+mpc_val_t *mpcf_float(mpc_val_t *x) {
+  float *y = malloc(sizeof(float));
+  *y = strtod(x, NULL);
+  free(x);
+  return y;
 }
 
-mpc_ast_t *mpc_ast_add_root_tag(mpc_ast_t *a, const char *t) {
-  if (a == NULL) { return a; }
-  a->tag = realloc(a->tag, (strlen(t)-1) + strlen(a->tag) + 1);
-  memmove(a->tag + (strlen(t)-1), a->tag, strlen(a->tag)+1);
-  memmove(a->tag, t, (strlen(t)-1));
-  return a;
+mpc_val_t *mpcf_strtriml(mpc_val_t *x) {
+  char *s = x;
+  while (isspace(*s)) {
+    memmove(s, s+1, strlen(s));
+  }
+  return s;
 }
 
-mpc_ast_t *mpc_ast_tag(mpc_ast_t *a, const char *t) {
-  a->tag = realloc(a->tag, strlen(t) + 1);
-  strcpy(a->tag, t);
-  return a;
+mpc_val_t *mpcf_strtrimr(mpc_val_t *x) {
+  char *s = x;
+  size_t l = strlen(s);
+  while (isspace(s[l-1])) {
+    s[l-1] = '\0'; l--;
+  }
+  return s;
 }
 
-mpc_ast_t *mpc_ast_state(mpc_ast_t *a, mpc_state_t s) {
-  if (a == NULL) { return a; }
-  a->state = s;
-  return a;
+mpc_val_t *mpcf_strtrim(mpc_val_t *x) {
+  return mpcf_strtriml(mpcf_strtrimr(x));
 }
 
-static void mpc_ast_print_depth(mpc_ast_t *a, int d, FILE *fp) {
+static const char mpc_escape_input_c[]  = {
+  '\a', '\b', '\f', '\n', '\r',
+  '\t', '\v', '\\', '\'', '\"', '\0'};
+    
+static const char *mpc_escape_output_c[] = {
+  "\\a", "\\b", "\\f", "\\n", "\\r", "\\t", 
+  "\\v", "\\\\", "\\'", "\\\"", "\\0", NULL};
+
+static const char mpc_escape_input_raw_re[] = { '/' };
+static const char *mpc_escape_output_raw_re[] = { "\\/", NULL };
+
+static const char mpc_escape_input_raw_cstr[] = { '"' };
+static const char *mpc_escape_output_raw_cstr[] = { "\\\"", NULL };
+
+static const char mpc_escape_input_raw_cchar[] = { '\'' };
+static const char *mpc_escape_output_raw_cchar[] = { "\\'", NULL };
+
+static mpc_val_t *mpcf_escape_new(mpc_val_t *x, const char *input, const char **output) {
   
   int i;
+  int found;
+  char buff[2];
+  char *s = x;
+  char *y = calloc(1, 1);
   
-  if (a == NULL) {
-    fprintf(fp, "NULL\n");
-    return;
+  while (*s) {
+    
+    i = 0;
+    found = 0;
+
+    while (output[i]) {
+      if (*s == input[i]) {
+        y = realloc(y, strlen(y) + strlen(output[i]) + 1);
+        strcat(y, output[i]);
+        found = 1;
+        break;
+      }
+      i++;
+    }
+    
+    if (!found) {
+      y = realloc(y, strlen(y) + 2);
+      buff[0] = *s; buff[1] = '\0';
+      strcat(y, buff);
+    }
+    
+    s++;
   }
   
-  for (i = 0; i < d; i++) { fprintf(fp, "  "); }
   
-  if (strlen(a->contents)) {
-    fprintf(fp, "%s:%lu:%lu '%s'\n", a->tag, 
-      (long unsigned int)(a->state.row+1),
-      (long unsigned int)(a->state.col+1),
-      a->contents);
-  } else {
-    fprintf(fp, "%s \n", a->tag);
-  }
+  return y;
+}
+
+static mpc_val_t *mpcf_unescape_new(mpc_val_t *x, const char *input, const char **output) {
   
-  for (i = 0; i < a->children_num; i++) {
-    mpc_ast_print_depth(a->children[i], d+1, fp);
+  int i;
+  int found = 0;
+  char buff[2];
+  char *s = x;
+  char *y = calloc(1, 1);
+  
+  while (*s) {
+    
+    i = 0;
+    found = 0;
+    
+    while (output[i]) {
+      if ((*(s+0)) == output[i][0] &&
+          (*(s+1)) == output[i][1]) {
+        y = realloc(y, strlen(y) + 1 + 1);
+        buff[0] = input[i]; buff[1] = '\0';
+        strcat(y, buff);
+        found = 1;
+        s++;
+        break;
+      }
+      i++;
+    }
+    
+    if (!found) {
+      y = realloc(y, strlen(y) + 1 + 1);
+      buff[0] = *s; buff[1] = '\0';
+      strcat(y, buff);
+    }
+    
+    if (*s == '\0') { break; }
+    else { s++; }
   }
   
+  return y;
+  
 }
 
-void mpc_ast_print(mpc_ast_t *a) {
-  mpc_ast_print_depth(a, 0, stdout);
+mpc_val_t *mpcf_escape(mpc_val_t *x) {
+  mpc_val_t *y = mpcf_escape_new(x, mpc_escape_input_c, mpc_escape_output_c);
+  free(x);
+  return y;
 }
 
-void mpc_ast_print_to(mpc_ast_t *a, FILE *fp) {
-  mpc_ast_print_depth(a, 0, fp);
+mpc_val_t *mpcf_unescape(mpc_val_t *x) {
+  mpc_val_t *y = mpcf_unescape_new(x, mpc_escape_input_c, mpc_escape_output_c);
+  free(x);
+  return y;
 }
 
-int mpc_ast_get_index(mpc_ast_t *ast, const char *tag) {
-  return mpc_ast_get_index_lb(ast, tag, 0);
+mpc_val_t *mpcf_escape_regex(mpc_val_t *x) {
+  mpc_val_t *y = mpcf_escape_new(x, mpc_escape_input_raw_re, mpc_escape_output_raw_re);
+  free(x);
+  return y;  
 }
 
-int mpc_ast_get_index_lb(mpc_ast_t *ast, const char *tag, int lb) {
-  int i;
+mpc_val_t *mpcf_unescape_regex(mpc_val_t *x) {
+  mpc_val_t *y = mpcf_unescape_new(x, mpc_escape_input_raw_re, mpc_escape_output_raw_re);
+  free(x);
+  return y;  
+}
 
-  for(i=lb; i<ast->children_num; i++) {
-    if(strcmp(ast->children[i]->tag, tag) == 0) {
-      return i;
-    }
-  }
-
-  return -1;
+mpc_val_t *mpcf_escape_string_raw(mpc_val_t *x) {
+  mpc_val_t *y = mpcf_escape_new(x, mpc_escape_input_raw_cstr, mpc_escape_output_raw_cstr);
+  free(x);
+  return y;
 }
 
-mpc_ast_t *mpc_ast_get_child(mpc_ast_t *ast, const char *tag) {
-  return mpc_ast_get_child_lb(ast, tag, 0);
+mpc_val_t *mpcf_unescape_string_raw(mpc_val_t *x) {
+  mpc_val_t *y = mpcf_unescape_new(x, mpc_escape_input_raw_cstr, mpc_escape_output_raw_cstr);
+  free(x);
+  return y;
 }
 
-mpc_ast_t *mpc_ast_get_child_lb(mpc_ast_t *ast, const char *tag, int lb) {
-  int i;
-
-  for(i=lb; i<ast->children_num; i++) {
-    if(strcmp(ast->children[i]->tag, tag) == 0) {
-      return ast->children[i];
-    }
-  }
-
-  return NULL;
+mpc_val_t *mpcf_escape_char_raw(mpc_val_t *x) {
+  mpc_val_t *y = mpcf_escape_new(x, mpc_escape_input_raw_cchar, mpc_escape_output_raw_cchar);
+  free(x);
+  return y;
 }
 
-mpc_ast_trav_t *mpc_ast_traverse_start(mpc_ast_t *ast,
-                                       mpc_ast_trav_order_t order)
-{
-  mpc_ast_trav_t *trav, *n_trav;
-  mpc_ast_t *cnode = ast;
-
-  /* Create the traversal structure */
-  trav = malloc(sizeof(mpc_ast_trav_t));
-  trav->curr_node = cnode;
-  trav->parent = NULL;
-  trav->curr_child = 0;
-  trav->order = order;
-
-  /* Get start node */
-  switch(order) {
-    case mpc_ast_trav_order_pre:
-      /* Nothing else is needed for pre order start */
-      break;
-
-    case mpc_ast_trav_order_post:
-      while(cnode->children_num > 0) {
-        cnode = cnode->children[0];
-
-        n_trav = malloc(sizeof(mpc_ast_trav_t));
-        n_trav->curr_node = cnode;
-        n_trav->parent = trav;
-        n_trav->curr_child = 0;
-        n_trav->order = order;
-
-        trav = n_trav;
-      }
-
-      break;
-
-    default:
-      /* Unreachable, but compiler complaints */
-      break;
-  }
-
-  return trav;
+mpc_val_t *mpcf_unescape_char_raw(mpc_val_t *x) {
+  mpc_val_t *y = mpcf_unescape_new(x, mpc_escape_input_raw_cchar, mpc_escape_output_raw_cchar);
+  free(x);
+  return y;
 }
 
-mpc_ast_t *mpc_ast_traverse_next(mpc_ast_trav_t **trav) {
-  mpc_ast_trav_t *n_trav, *to_free;
-  mpc_ast_t *ret = NULL;
-  int cchild;
-
-  /* The end of traversal was reached */
-  if(*trav == NULL) return NULL;
-
-  switch((*trav)->order) {
-    case mpc_ast_trav_order_pre:
-      ret = (*trav)->curr_node;
-
-      /* If there aren't any more children, go up */
-      while(*trav != NULL &&
-        (*trav)->curr_child >= (*trav)->curr_node->children_num)
-      {
-        to_free = *trav;
-        *trav = (*trav)->parent;
-        free(to_free);
-      }
-
-      /* If trav is NULL, the end was reached */
-      if(*trav == NULL) {
-        break;
-      }
-
-      /* Go to next child */
-      n_trav = malloc(sizeof(mpc_ast_trav_t));
-
-      cchild = (*trav)->curr_child;
-      n_trav->curr_node = (*trav)->curr_node->children[cchild];
-      n_trav->parent = *trav;
-      n_trav->curr_child = 0;
-      n_trav->order = (*trav)->order;
-
-      (*trav)->curr_child++;
-      *trav = n_trav;
-
-      break;
-
-    case mpc_ast_trav_order_post:
-      ret = (*trav)->curr_node;
-
-      /* Move up tree to the parent If the parent doesn't have any more nodes,
-       * then this is the current node. If it does, move down to its left most
-       * child. Also, free the previous traversal node */
-      to_free = *trav;
-      *trav = (*trav)->parent;
-      free(to_free);
-
-      if(*trav == NULL)
-        break;
-
-      /* Next child */
-      (*trav)->curr_child++;
-
-      /* If there aren't any more children, this is the next node */
-      if((*trav)->curr_child >= (*trav)->curr_node->children_num) {
-        break;
-      }
-
-      /* If there are still more children, find the leftmost child from this
-       * node */
-      while((*trav)->curr_node->children_num > 0) {
-        n_trav = malloc(sizeof(mpc_ast_trav_t));
-
-        cchild = (*trav)->curr_child;
-        n_trav->curr_node = (*trav)->curr_node->children[cchild];
-        n_trav->parent = *trav;
-        n_trav->curr_child = 0;
-        n_trav->order = (*trav)->order;
-
-        *trav = n_trav;
-      }
+mpc_val_t *mpcf_null(int n, mpc_val_t** xs) { (void) n; (void) xs; return NULL; }
+mpc_val_t *mpcf_fst(int n, mpc_val_t **xs) { (void) n; return xs[0]; }
+mpc_val_t *mpcf_snd(int n, mpc_val_t **xs) { (void) n; return xs[1]; }
+mpc_val_t *mpcf_trd(int n, mpc_val_t **xs) { (void) n; return xs[2]; }
 
-    default:
-      /* Unreachable, but compiler complaints */
-      break;
+static mpc_val_t *mpcf_nth_free(int n, mpc_val_t **xs, int x) {
+  int i;
+  for (i = 0; i < n; i++) {
+    if (i != x) { free(xs[i]); }
   }
-
-  return ret;
+  return xs[x];
 }
+ 
+mpc_val_t *mpcf_fst_free(int n, mpc_val_t **xs) { return mpcf_nth_free(n, xs, 0); }
+mpc_val_t *mpcf_snd_free(int n, mpc_val_t **xs) { return mpcf_nth_free(n, xs, 1); }
+mpc_val_t *mpcf_trd_free(int n, mpc_val_t **xs) { return mpcf_nth_free(n, xs, 2); }
 
-void mpc_ast_traverse_free(mpc_ast_trav_t **trav) {
-  mpc_ast_trav_t *n_trav;
-
-  /* Go through parents until all are free */
-  while(*trav != NULL) {
-      n_trav = (*trav)->parent;
-      free(*trav);
-      *trav = n_trav;
+mpc_val_t *mpcf_strfold(int n, mpc_val_t **xs) {
+  int i;
+  size_t l = 0, k, m;
+  
+  if (n == 0) { return calloc(1, 1); }
+  
+  for (i = 0; i < n; i++) { l += strlen(xs[i]); }
+  
+  k = strlen(xs[0]);
+  xs[0] = realloc(xs[0], l + 1);
+  
+  for (i = 1; i < n; i++) {
+    m = strlen(xs[i]);
+    memcpy((char*)xs[0] + k, xs[i], m + 1);
+    k += m; free(xs[i]);
   }
+  
+  return xs[0];
 }
 
-mpc_val_t *mpcf_fold_ast(int n, mpc_val_t **xs) {
+mpc_val_t *mpcf_maths(int n, mpc_val_t **xs) {
+  int **vs = (int**)xs;
+  (void) n;
   
-  int i, j;
-  mpc_ast_t** as = (mpc_ast_t**)xs;
-  mpc_ast_t *r;
+  switch(((char*)xs[1])[0])
+  {
+    case '*': { *vs[0] *= *vs[2]; }; break;
+    case '/': { *vs[0] /= *vs[2]; }; break;
+    case '%': { *vs[0] %= *vs[2]; }; break;
+    case '+': { *vs[0] += *vs[2]; }; break;
+    case '-': { *vs[0] -= *vs[2]; }; break;
+    default: break;
+  }
   
-  if (n == 0) { return NULL; }
-  if (n == 1) { return xs[0]; }
-  if (n == 2 && xs[1] == NULL) { return xs[0]; }
-  if (n == 2 && xs[0] == NULL) { return xs[1]; }
+  free(xs[1]); free(xs[2]);
   
-  r = mpc_ast_new(">", "");
+  return xs[0];
+}
+
+/*
+** Printing
+*/
+
+static void mpc_print_unretained(mpc_parser_t *p, int force) {
   
-  for (i = 0; i < n; i++) {
-    
-    if (as[i] == NULL) { continue; }
-    
-    if        (as[i] && as[i]->children_num == 0) {
-      mpc_ast_add_child(r, as[i]);
-    } else if (as[i] && as[i]->children_num == 1) {
-      mpc_ast_add_child(r, mpc_ast_add_root_tag(as[i]->children[0], as[i]->tag));
-      mpc_ast_delete_no_children(as[i]);
-    } else if (as[i] && as[i]->children_num >= 2) {
-      for (j = 0; j < as[i]->children_num; j++) {
-        mpc_ast_add_child(r, as[i]->children[j]);
-      }
-      mpc_ast_delete_no_children(as[i]);
-    }
+  /* TODO: Print Everything Escaped */
+  
+  int i;
+  char *s, *e;
+  char buff[2];
   
+  if (p->retained && !force) {;
+    if (p->name) { printf("<%s>", p->name); }
+    else { printf("<anon>"); }
+    return;
   }
   
-  if (r->children_num) {
-    r->state = r->children[0]->state;
+  if (p->type == MPC_TYPE_UNDEFINED) { printf("<?>"); }
+  if (p->type == MPC_TYPE_PASS)   { printf("<:>"); }
+  if (p->type == MPC_TYPE_FAIL)   { printf("<!>"); }
+  if (p->type == MPC_TYPE_LIFT)   { printf("<#>"); }
+  if (p->type == MPC_TYPE_STATE)  { printf("<S>"); }
+  if (p->type == MPC_TYPE_ANCHOR) { printf("<@>"); }
+  if (p->type == MPC_TYPE_EXPECT) {
+    printf("%s", p->data.expect.m);
+    /*mpc_print_unretained(p->data.expect.x, 0);*/
   }
   
-  return r;
-}
-
-mpc_val_t *mpcf_str_ast(mpc_val_t *c) {
-  mpc_ast_t *a = mpc_ast_new("", c);
-  free(c);
-  return a;
-}
+  if (p->type == MPC_TYPE_ANY) { printf("<.>"); }
+  if (p->type == MPC_TYPE_SATISFY) { printf("<f>"); }
 
-mpc_val_t *mpcf_state_ast(int n, mpc_val_t **xs) {
-  mpc_state_t *s = ((mpc_state_t**)xs)[0];
-  mpc_ast_t *a = ((mpc_ast_t**)xs)[1];
-  (void)n;
-  a = mpc_ast_state(a, *s);
-  free(s);
-  return a;
-}
-
-mpc_parser_t *mpca_state(mpc_parser_t *a) {
-  return mpc_and(2, mpcf_state_ast, mpc_state(), a, free);
-}
+  if (p->type == MPC_TYPE_SINGLE) {
+    buff[0] = p->data.single.x; buff[1] = '\0';
+    s = mpcf_escape_new(
+      buff,
+      mpc_escape_input_c,
+      mpc_escape_output_c);
+    printf("'%s'", s);
+    free(s);
+  }
+  
+  if (p->type == MPC_TYPE_RANGE) {
+    buff[0] = p->data.range.x; buff[1] = '\0';
+    s = mpcf_escape_new(
+      buff,
+      mpc_escape_input_c,
+      mpc_escape_output_c);
+    buff[0] = p->data.range.y; buff[1] = '\0';
+    e = mpcf_escape_new(
+      buff,
+      mpc_escape_input_c,
+      mpc_escape_output_c);
+    printf("[%s-%s]", s, e);
+    free(s);
+    free(e);
+  }
+  
+  if (p->type == MPC_TYPE_ONEOF) {
+    s = mpcf_escape_new(
+      p->data.oneof.x,
+      mpc_escape_input_c,
+      mpc_escape_output_c);
+    printf("[%s]", s);
+    free(s);
+  }
+  
+  if (p->type == MPC_TYPE_NONEOF) {
+    s = mpcf_escape_new(
+      p->data.oneof.x,
+      mpc_escape_input_c,
+      mpc_escape_output_c);
+    printf("[^%s]", s);
+    free(s);
+  }
+  
+  if (p->type == MPC_TYPE_STRING) {
+    s = mpcf_escape_new(
+      p->data.string.x,
+      mpc_escape_input_c,
+      mpc_escape_output_c);
+    printf("\"%s\"", s);
+    free(s);
+  }
+  
+  if (p->type == MPC_TYPE_APPLY)    { mpc_print_unretained(p->data.apply.x, 0); }
+  if (p->type == MPC_TYPE_APPLY_TO) { mpc_print_unretained(p->data.apply_to.x, 0); }
+  if (p->type == MPC_TYPE_PREDICT)  { mpc_print_unretained(p->data.predict.x, 0); }
+  if (p->type == MPC_TYPE_PACKRAT)  { mpc_print_unretained(p->data.packrat.x, 0); }
+  if (p->type == MPC_TYPE_ARENA)    { mpc_print_unretained(p->data.arena.x, 0); }
+  if (p->type == MPC_TYPE_DFA)      { mpc_print_unretained(p->data.dfa.x, 0); }
+  if (p->type == MPC_TYPE_TOKEN)    { mpc_print_unretained(p->data.token.x, 0); }
 
-mpc_parser_t *mpca_tag(mpc_parser_t *a, const char *t) {
-  return mpc_apply_to(a, (mpc_apply_to_t)mpc_ast_tag, (void*)t);
-}
+  if (p->type == MPC_TYPE_NOT)   { mpc_print_unretained(p->data.not.x, 0); printf("!"); }
+  if (p->type == MPC_TYPE_MAYBE) { mpc_print_unretained(p->data.not.x, 0); printf("?"); }
 
-mpc_parser_t *mpca_add_tag(mpc_parser_t *a, const char *t) {
-  return mpc_apply_to(a, (mpc_apply_to_t)mpc_ast_add_tag, (void*)t);
+  if (p->type == MPC_TYPE_MANY)  { mpc_print_unretained(p->data.repeat.x, 0); printf("*"); }
+  if (p->type == MPC_TYPE_MANY1) { mpc_print_unretained(p->data.repeat.x, 0); printf("+"); }
+  if (p->type == MPC_TYPE_COUNT) { mpc_print_unretained(p->data.repeat.x, 0); printf("{%i}", p->data.repeat.n); }
+  
+  if (p->type == MPC_TYPE_OR) {
+    printf("(");
+    for(i = 0; i < p->data.or.n-1; i++) {
+      mpc_print_unretained(p->data.or.xs[i], 0);
+      printf(" | ");
+    }
+    mpc_print_unretained(p->data.or.xs[p->data.or.n-1], 0);
+    printf(")");
+  }
+  
+  if (p->type == MPC_TYPE_AND) {
+    printf("(");
+    for(i = 0; i < p->data.and.n-1; i++) {
+      mpc_print_unretained(p->data.and.xs[i], 0);
+      printf(" ");
+    }
+    mpc_print_unretained(p->data.and.xs[p->data.and.n-1], 0);
+    printf(")");
+  }
+  
 }
 
-mpc_parser_t *mpca_root(mpc_parser_t *a) {
-  return mpc_apply(a, (mpc_apply_t)mpc_ast_add_root);
+void mpc_print(mpc_parser_t *p) {
+  mpc_print_unretained(p, 1);
+  printf("\n");
 }
 
-mpc_parser_t *mpca_not(mpc_parser_t *a) { return mpc_not(a, (mpc_dtor_t)mpc_ast_delete); }
-mpc_parser_t *mpca_maybe(mpc_parser_t *a) { return mpc_maybe(a); }
-mpc_parser_t *mpca_many(mpc_parser_t *a) { return mpc_many(mpcf_fold_ast, a); }
-mpc_parser_t *mpca_many1(mpc_parser_t *a) { return mpc_many1(mpcf_fold_ast, a); }
-mpc_parser_t *mpca_count(int n, mpc_parser_t *a) { return mpc_count(n, mpcf_fold_ast, a, (mpc_dtor_t)mpc_ast_delete); }
+/*
+** Testing
+*/
 
-mpc_parser_t *mpca_or(int n, ...) {
+/*
+** These functions are slightly unwieldy and
+** also the whole of the testing suite for mpc
+** mpc is pretty shaky.
+**
+** It could do with a lot more tests and more
+** precision. Currently I am only really testing
+** changes off of the examples.
+**
+*/
 
-  int i;
-  va_list va;
+int mpc_test_fail(mpc_parser_t *p, const char *s, const void *d,
+  int(*tester)(const void*, const void*),
+  mpc_dtor_t destructor,
+  void(*printer)(const void*)) {
+  mpc_result_t r;
+  (void) printer;
+  if (mpc_parse("<test>", s, p, &r)) {
 
-  mpc_parser_t *p = mpc_undefined();
-  
-  p->type = MPC_TYPE_OR;
-  p->data.or.n = n;
-  p->data.or.xs = malloc(sizeof(mpc_parser_t*) * n);
+    if (tester(r.output, d)) {
+      destructor(r.output);
+      return 0;
+    } else {
+      destructor(r.output);
+      return 1;
+    }
   
-  va_start(va, n);  
-  for (i = 0; i < n; i++) {
-    p->data.or.xs[i] = va_arg(va, mpc_parser_t*);
+  } else {
+    mpc_err_delete(r.error);
+    return 1;
   }
-  va_end(va);
-  
-  return p;
   
 }
 
-mpc_parser_t *mpca_and(int n, ...) {
-  
-  int i;
-  va_list va;
-  
-  mpc_parser_t *p = mpc_undefined();
-  
-  p->type = MPC_TYPE_AND;
-  p->data.and.n = n;
-  p->data.and.f = mpcf_fold_ast;
-  p->data.and.xs = malloc(sizeof(mpc_parser_t*) * n);
-  p->data.and.dxs = malloc(sizeof(mpc_dtor_t) * (n-1));
-  
-  va_start(va, n);
-  for (i = 0; i < n; i++) {
-    p->data.and.xs[i] = va_arg(va, mpc_parser_t*);
+int mpc_test_pass(mpc_parser_t *p, const char *s, const void *d,
+  int(*tester)(const void*, const void*), 
+  mpc_dtor_t destructor, 
+  void(*printer)(const void*)) {
+
+  mpc_result_t r;  
+  if (mpc_parse("<test>", s, p, &r)) {
+    
+    if (tester(r.output, d)) {
+      destructor(r.output);
+      return 1;
+    } else {
+      printf("Got "); printer(r.output); printf("\n");
+      printf("Expected "); printer(d); printf("\n");
+      destructor(r.output);
+      return 0;
+    }
+    
+  } else {    
+    mpc_err_print(r.error);
+    mpc_err_delete(r.error);
+    return 0;
+    
   }
-  for (i = 0; i < (n-1); i++) {
-    p->data.and.dxs[i] = (mpc_dtor_t)mpc_ast_delete;
-  }    
-  va_end(va);
   
-  return p;  
 }
 
-mpc_parser_t *mpca_total(mpc_parser_t *a) { return mpc_total(a, (mpc_dtor_t)mpc_ast_delete); }
-
-/*
-** Grammar Parser
-*/
 
 /*
-** This is another interesting bootstrapping.
-**
-** Having a general purpose AST type allows
-** users to specify the grammar alone and
-** let all fold rules be automatically taken
-** care of by existing functions.
-**
-** You don't get to control the type spat
-** out but this means you can make a nice
-** parser to take in some grammar in nice
-** syntax and spit out a parser that works.
-**
-** The grammar for this looks surprisingly
-** like regex but the main difference is that
-** it is now whitespace insensitive and the
-** base type takes literals of some form.
+** AST
 */
 
 /*
-**
-**  ### Grammar Grammar
-**
-**      <grammar> : (<term> "|" <grammar>) | <term>
-**     
-**      <term> : <factor>*
-**
-**      <factor> : <base>
-**               | <base> "*"
-**               | <base> "+"
-**               | <base> "?"
-**               | <base> "{" <digits> "}"
-**           
-**      <base> : "<" (<digits> | <ident>) ">"
-**             | <string_lit>
-**             | <char_lit>
-**             | <regex_lit>
-**             | "(" <grammar> ")"
+** Every node carries a hidden header naming the
+** arena it was allocated from, if any. Nodes from
+** `mpc_ast_new` have none and own their tag,
+** contents and children. Nodes in an arena share
+** interned tags, and the whole arena is released
+** in one go when the root of its tree is deleted.
+** Deleting any other node of an arena tree does
+** nothing. A node outside an arena may also be
+** shared by more than one tree, in which case it
+** counts the other trees and deleting it only
+** drops one of them.
 */
 
 typedef struct {
-  va_list *va;
-  int parsers_num;
-  mpc_parser_t **parsers;
-  int flags;
-} mpca_grammar_st_t;
+  mpc_ast_t ast;
+  mpc_ast_arena_t *arena;
+  int refs;
+} mpc_ast_node_t;
 
-static mpc_val_t *mpcaf_grammar_or(int n, mpc_val_t **xs) {
-  (void) n;
-  if (xs[1] == NULL) { return xs[0]; }
-  else { return mpca_or(2, xs[0], xs[1]); }
-}
+enum {
+  MPC_AST_TAGS_MIN = 64,
+  MPC_AST_TAG_BUFFER = 256
+};
 
-static mpc_val_t *mpcaf_grammar_and(int n, mpc_val_t **xs) {
-  int i;
-  mpc_parser_t *p = mpc_pass();  
-  for (i = 0; i < n; i++) {
-    if (xs[i] != NULL) { p = mpca_and(2, p, xs[i]); }
+typedef struct {
+  const char *t;
+  const char *u;
+  char *s;
+} mpc_ast_join_t;
+
+struct mpc_ast_arena_t {
+  mpc_mem_chunk_t *chunks;
+  mpc_mem_t *bump;
+  mpc_mem_t *end;
+  mpc_ast_t *root;
+  int tags_num;
+  int tags_slots;
+  char **tags;
+  int joins_num;
+  int joins_slots;
+  mpc_ast_join_t *joins;
+};
+
+static mpc_ast_arena_t *mpc_ast_arena_of(mpc_ast_t *a) {
+  return ((mpc_ast_node_t*)a)->arena;
+}
+
+static mpc_ast_arena_t *mpc_ast_arena_new(void) {
+  mpc_ast_arena_t *m = malloc(sizeof(mpc_ast_arena_t));
+  m->chunks = NULL;
+  m->bump = NULL;
+  m->end = NULL;
+  m->root = NULL;
+  m->tags_num = 0;
+  m->tags_slots = 0;
+  m->tags = NULL;
+  m->joins_num = 0;
+  m->joins_slots = 0;
+  m->joins = NULL;
+  return m;
+}
+
+static void mpc_ast_arena_delete(mpc_ast_arena_t *m) {
+  mpc_mem_chunk_t *c, *n;
+  for (c = m->chunks; c; c = n) {
+    n = c->next;
+    free(c);
   }
-  return p;
+  free(m->tags);
+  free(m->joins);
+  free(m);
 }
 
-static mpc_val_t *mpcaf_grammar_repeat(int n, mpc_val_t **xs) { 
-  int num;
+static void *mpc_ast_arena_malloc(mpc_ast_arena_t *m, size_t n) {
+  
+  mpc_mem_t *b;
+  mpc_mem_chunk_t *c;
+  size_t size, k = (n + sizeof(mpc_mem_t) - 1) / sizeof(mpc_mem_t);
+  
+  if ((size_t)(m->end - m->bump) < k) {
+    
+    size = m->chunks
+      ? (size_t)(m->chunks->end - m->chunks->data) * 2
+      : MPC_MEM_CHUNK_MIN;
+    
+    while (size < k) { size *= 2; }
+    
+    c = malloc(sizeof(mpc_mem_chunk_t) + sizeof(mpc_mem_t) * (size - 1));
+    c->next = m->chunks;
+    c->end = c->data + size;
+    m->chunks = c;
+    m->bump = c->data;
+    m->end = c->end;
+  }
+  
+  b = m->bump;
+  m->bump += k;
+  return b;
+}
+
+static unsigned long mpc_ast_arena_hash(const char *t) {
+  unsigned long h = 5381;
+  while (*t) { h = h * 33 + (unsigned char)*t++; }
+  return h;
+}
+
+static char *mpc_ast_arena_intern(mpc_ast_arena_t *m, const char *t) {
+  
+  int j, k, slots;
+  char **tags, *s;
+  
+  if (m->tags_num * 2 >= m->tags_slots) {
+    
+    slots = m->tags_slots ? m->tags_slots * 2 : MPC_AST_TAGS_MIN;
+    tags = calloc(slots, sizeof(char*));
+    
+    for (j = 0; j < m->tags_slots; j++) {
+      if (!m->tags[j]) { continue; }
+      k = (int)(mpc_ast_arena_hash(m->tags[j]) & (unsigned long)(slots-1));
+      while (tags[k]) { k = (k+1) & (slots-1); }
+      tags[k] = m->tags[j];
+    }
+    
+    free(m->tags);
+    m->tags = tags;
+    m->tags_slots = slots;
+  }
+  
+  j = (int)(mpc_ast_arena_hash(t) & (unsigned long)(m->tags_slots-1));
+  
+  while (m->tags[j]) {
+    if (strcmp(m->tags[j], t) == 0) { return m->tags[j]; }
+    j = (j+1) & (m->tags_slots-1);
+  }
+  
+  s = mpc_ast_arena_malloc(m, strlen(t) + 1);
+  strcpy(s, t);
+  m->tags[j] = s;
+  m->tags_num++;
+  return s;
+}
+
+/* Interns the first `n` characters of `t`, then `sep`, then `u` */
+static char *mpc_ast_arena_join(mpc_ast_arena_t *m, const char *t, size_t n, const char *sep, const char *u) {
+  
+  char buffer[MPC_AST_TAG_BUFFER], *x, *s;
+  size_t l = n + strlen(sep) + strlen(u) + 1;
+  
+  x = l <= MPC_AST_TAG_BUFFER ? buffer : malloc(l);
+  memcpy(x, t, n);
+  strcpy(x + n, sep);
+  strcat(x + n, u);
+  
+  s = mpc_ast_arena_intern(m, x);
+  if (x != buffer) { free(x); }
+  return s;
+}
+
+/*
+** Joins made while parsing only ever combine a
+** rule name or an interned tag with another
+** interned tag, none of which can change while
+** the arena is alive. So each is remembered by
+** the addresses of its parts, and building the
+** same tag again is a single lookup.
+*/
+
+static unsigned long mpc_ast_arena_join_hash(const char *t, const char *u) {
+  unsigned long h = (unsigned long)(size_t)t >> 3;
+  h = h * 2654435761UL ^ (unsigned long)(size_t)u >> 3;
+  return h ^ (h >> 15);
+}
+
+static char *mpc_ast_arena_join_fixed(mpc_ast_arena_t *m, const char *t, size_t n, const char *sep, const char *u) {
+  
+  int j, k, slots;
+  mpc_ast_join_t *joins;
+  
+  if (m->joins_num * 2 >= m->joins_slots) {
+    
+    slots = m->joins_slots ? m->joins_slots * 2 : MPC_AST_TAGS_MIN;
+    joins = calloc(slots, sizeof(mpc_ast_join_t));
+    
+    for (j = 0; j < m->joins_slots; j++) {
+      if (!m->joins[j].t) { continue; }
+      k = (int)(mpc_ast_arena_join_hash(m->joins[j].t, m->joins[j].u) & (unsigned long)(slots-1));
+      while (joins[k].t) { k = (k+1) & (slots-1); }
+      joins[k] = m->joins[j];
+    }
+    
+    free(m->joins);
+    m->joins = joins;
+    m->joins_slots = slots;
+  }
+  
+  j = (int)(mpc_ast_arena_join_hash(t, u) & (unsigned long)(m->joins_slots-1));
+  
+  while (m->joins[j].t) {
+    if (m->joins[j].t == t && m->joins[j].u == u) { return m->joins[j].s; }
+    j = (j+1) & (m->joins_slots-1);
+  }
+  
+  m->joins[j].t = t;
+  m->joins[j].u = u;
+  m->joins[j].s = mpc_ast_arena_join(m, t, n, sep, u);
+  m->joins_num++;
+  return m->joins[j].s;
+}
+
+static mpc_ast_t *mpc_ast_arena_node(mpc_ast_arena_t *m, const char *tag, const char *contents) {
+  
+  size_t l = strlen(contents);
+  mpc_ast_node_t *n = mpc_ast_arena_malloc(m, sizeof(mpc_ast_node_t) + l + 1);
+  
+  n->arena = m;
+  n->refs = 0;
+  n->ast.tag = mpc_ast_arena_intern(m, tag);
+  n->ast.contents = (char*)(n + 1);
+  memcpy(n->ast.contents, contents, l + 1);
+  n->ast.state = mpc_state_new();
+  n->ast.rule = -1;
+  n->ast.rules = 0;
+  n->ast.children_num = 0;
+  n->ast.children = NULL;
+  return &n->ast;
+}
+
+/*
+** Children arrays in an arena are never resized
+** in place. Their capacity is implied by their
+** length, and a full array is copied into one
+** twice the size.
+*/
+
+static int mpc_ast_arena_slots(int n) {
+  int slots = 4;
+  if (n == 0) { return 0; }
+  while (slots < n) { slots *= 2; }
+  return slots;
+}
+
+static mpc_ast_t *mpc_ast_arena_copy(mpc_ast_arena_t *m, mpc_ast_t *a) {
+  
+  int i;
+  mpc_ast_t *r;
+  
+  if (a == NULL) { return a; }
+  
+  r = mpc_ast_arena_node(m, a->tag, a->contents);
+  r->state = a->state;
+  r->rule = a->rule;
+  r->rules = a->rules;
+  r->children_num = a->children_num;
+  r->children = a->children_num 
+    ? mpc_ast_arena_malloc(m, sizeof(mpc_ast_t*) * mpc_ast_arena_slots(a->children_num))
+    : NULL;
+  for (i = 0; i < a->children_num; i++) {
+    r->children[i] = mpc_ast_arena_copy(m, a->children[i]);
+  }
+  return r;
+}
+
+static mpc_ast_t *mpc_ast_arena_share(mpc_ast_arena_t *m, mpc_ast_t *a, int depth) {
+  
+  int i;
+  mpc_ast_t *r;
+  
+  if (a == NULL) { return a; }
+  if (depth == 0) { return mpc_ast_arena_of(a) == m ? a : mpc_ast_arena_copy(m, a); }
+  
+  r = mpc_ast_arena_node(m, a->tag, a->contents);
+  r->state = a->state;
+  r->rule = a->rule;
+  r->rules = a->rules;
+  r->children_num = a->children_num;
+  r->children = a->children_num 
+    ? mpc_ast_arena_malloc(m, sizeof(mpc_ast_t*) * mpc_ast_arena_slots(a->children_num))
+    : NULL;
+  for (i = 0; i < a->children_num; i++) {
+    r->children[i] = mpc_ast_arena_share(m, a->children[i], depth-1);
+  }
+  return r;
+}
+
+/*
+** Once a parse in arena mode succeeds its result
+** becomes the root that owns the arena. Anything
+** else it returned was not built in the arena.
+*/
+
+static void mpc_ast_arena_root(mpc_ast_arena_t *m, mpc_ast_t *a) {
+  if (mpc_ast_arena_of(a) == m) {
+    m->root = a;
+  } else {
+    mpc_ast_arena_delete(m);
+  }
+}
+
+/*
+** Trees from deeply nested input can be far
+** deeper than the C stack allows, so nodes are
+** deleted from a stack of pending nodes kept on
+** the heap rather than by recursion.
+*/
+
+static void mpc_ast_delete_no_children(mpc_ast_t *a);
+
+void mpc_ast_delete(mpc_ast_t *a) {
+  
+  int i, n = 0, slots = 0;
+  mpc_ast_t **pending = NULL;
+  mpc_ast_arena_t *m;
+  
+  while (a) {
+    
+    m = mpc_ast_arena_of(a);
+    
+    if (m) {
+      if (m->root == a) { mpc_ast_arena_delete(m); }
+      a = n > 0 ? pending[--n] : NULL;
+      continue;
+    }
+    
+    if (((mpc_ast_node_t*)a)->refs > 0) {
+      ((mpc_ast_node_t*)a)->refs--;
+      a = n > 0 ? pending[--n] : NULL;
+      continue;
+    }
+    
+    if (n + a->children_num > slots) {
+      slots = (n + a->children_num) * 2;
+      pending = realloc(pending, sizeof(mpc_ast_t*) * slots);
+    }
+    
+    for (i = 0; i < a->children_num; i++) {
+      pending[n++] = a->children[i];
+    }
+    
+    mpc_ast_delete_no_children(a);
+    a = n > 0 ? pending[--n] : NULL;
+  }
+  
+  free(pending);
+}
+
+static void mpc_ast_delete_no_children(mpc_ast_t *a) {
+  if (mpc_ast_arena_of(a)) { return; }
+  free(a->children);
+  free(a->tag);
+  free(a->contents);
+  free(a);
+}
+
+mpc_ast_t *mpc_ast_new(const char *tag, const char *contents) {
+  
+  mpc_ast_node_t *n = malloc(sizeof(mpc_ast_node_t));
+  mpc_ast_t *a = &n->ast;
+  
+  n->arena = NULL;
+  n->refs = 0;
+  
+  a->tag = malloc(strlen(tag) + 1);
+  strcpy(a->tag, tag);
+  
+  a->contents = malloc(strlen(contents) + 1);
+  strcpy(a->contents, contents);
+  
+  a->state = mpc_state_new();
+  
+  a->rule = -1;
+  a->rules = 0;
+  
+  a->children_num = 0;
+  a->children = NULL;
+  return a;
+  
+}
+
+mpc_ast_t *mpc_ast_build(int n, const char *tag, ...) {
+  
+  mpc_ast_t *a = mpc_ast_new(tag, "");
+  
+  int i;
+  va_list va;
+  va_start(va, tag);
+  
+  for (i = 0; i < n; i++) {
+    mpc_ast_add_child(a, va_arg(va, mpc_ast_t*));
+  }
+  
+  va_end(va);
+  
+  return a;
+  
+}
+
+mpc_ast_t *mpc_ast_add_root(mpc_ast_t *a) {
+
+  mpc_ast_t *r;
+  mpc_ast_arena_t *m;
+
+  if (a == NULL) { return a; }
+  if (a->children_num == 0) { return a; }
+  if (a->children_num == 1) { return a; }
+
+  m = mpc_ast_arena_of(a);
+  r = m ? mpc_ast_arena_node(m, ">", "") : mpc_ast_new(">", "");
+  mpc_ast_add_child(r, a);
+  if (m && m->root == a) { m->root = r; }
+  return r;
+}
+
+int mpc_ast_eq(mpc_ast_t *a, mpc_ast_t *b) {
+  
+  int i;
+
+  if (strcmp(a->tag, b->tag) != 0) { return 0; }
+  if (strcmp(a->contents, b->contents) != 0) { return 0; }
+  if (a->children_num != b->children_num) { return 0; }
+  
+  for (i = 0; i < a->children_num; i++) {
+    if (!mpc_ast_eq(a->children[i], b->children[i])) { return 0; }
+  }
+  
+  return 1;
+}
+
+mpc_ast_t *mpc_ast_add_child(mpc_ast_t *r, mpc_ast_t *a) {
+  
+  mpc_ast_t **children;
+  mpc_ast_arena_t *m = mpc_ast_arena_of(r);
+  
+  if (m) {
+    if (r->children_num == mpc_ast_arena_slots(r->children_num)) {
+      children = mpc_ast_arena_malloc(m, sizeof(mpc_ast_t*) * mpc_ast_arena_slots(r->children_num+1));
+      if (r->children_num) { memcpy(children, r->children, sizeof(mpc_ast_t*) * r->children_num); }
+      r->children = children;
+    }
+    r->children[r->children_num++] = a;
+    return r;
+  }
+  
+  r->children_num++;
+  r->children = realloc(r->children, sizeof(mpc_ast_t*) * r->children_num);
+  r->children[r->children_num-1] = a;
+  return r;
+}
+
+mpc_ast_t *mpc_ast_add_tag(mpc_ast_t *a, const char *t) {
+  if (a == NULL) { return a; }
+  if (mpc_ast_arena_of(a)) {
+    a->tag = mpc_ast_arena_join(mpc_ast_arena_of(a), t, strlen(t), "|", a->tag);
+    return a;
+  }
+  a->tag = realloc(a->tag, strlen(t) + 1 + strlen(a->tag) + 1);
+  memmove(a->tag + strlen(t) + 1, a->tag, strlen(a->tag)+1);
+  memmove(a->tag, t, strlen(t));
+  memmove(a->tag + strlen(t), "|", 1);
+  return a;
+}
+
+mpc_ast_t *mpc_ast_add_root_tag(mpc_ast_t *a, const char *t) {
+  if (a == NULL) { return a; }
+  if (mpc_ast_arena_of(a)) {
+    a->tag = mpc_ast_arena_join(mpc_ast_arena_of(a), t, strlen(t)-1, "", a->tag);
+    return a;
+  }
+  a->tag = realloc(a->tag, (strlen(t)-1) + strlen(a->tag) + 1);
+  memmove(a->tag + (strlen(t)-1), a->tag, strlen(a->tag)+1);
+  memmove(a->tag, t, (strlen(t)-1));
+  return a;
+}
+
+mpc_ast_t *mpc_ast_tag(mpc_ast_t *a, const char *t) {
+  a->rule = -1;
+  a->rules = 0;
+  if (mpc_ast_arena_of(a)) {
+    a->tag = mpc_ast_arena_intern(mpc_ast_arena_of(a), t);
+    return a;
+  }
+  a->tag = realloc(a->tag, strlen(t) + 1);
+  strcpy(a->tag, t);
+  return a;
+}
+
+mpc_ast_t *mpc_ast_state(mpc_ast_t *a, mpc_state_t s) {
+  if (a == NULL) { return a; }
+  a->state = s;
+  return a;
+}
+
+mpc_ast_t *mpc_ast_copy(mpc_ast_t *a) {
+  
+  int i;
+  mpc_ast_t *r;
+  
+  if (a == NULL) { return a; }
+  
+  r = mpc_ast_new(a->tag, a->contents);
+  r->state = a->state;
+  r->rule = a->rule;
+  r->rules = a->rules;
+  r->children_num = a->children_num;
+  r->children = a->children_num ? malloc(sizeof(mpc_ast_t*) * a->children_num) : NULL;
+  for (i = 0; i < a->children_num; i++) {
+    r->children[i] = mpc_ast_copy(a->children[i]);
+  }
+  return r;
+}
+
+/*
+** The trees kept by `mpca_packrat` only need their
+** own copies of the levels a rule referencing them
+** retags or takes apart, which are the root and
+** its children. Anything deeper is shared with the
+** trees they hand out rather than copied.
+*/
+
+static mpc_ast_t *mpc_ast_share(mpc_ast_t *a, int depth) {
+  
+  int i;
+  mpc_ast_t *r;
+  
+  if (a == NULL) { return a; }
+  if (depth == 0) { ((mpc_ast_node_t*)a)->refs++; return a; }
+  
+  r = mpc_ast_new(a->tag, a->contents);
+  r->state = a->state;
+  r->rule = a->rule;
+  r->rules = a->rules;
+  r->children_num = a->children_num;
+  r->children = a->children_num ? malloc(sizeof(mpc_ast_t*) * a->children_num) : NULL;
+  for (i = 0; i < a->children_num; i++) {
+    r->children[i] = mpc_ast_share(a->children[i], depth-1);
+  }
+  return r;
+}
+
+static mpc_val_t *mpcf_ast_share(mpc_val_t *x) {
+  return mpc_ast_share(x, 2);
+}
+
+static void mpc_ast_print_depth(mpc_ast_t *a, int d, FILE *fp) {
+  
+  int i;
+  
+  if (a == NULL) {
+    fprintf(fp, "NULL\n");
+    return;
+  }
+  
+  for (i = 0; i < d; i++) { fprintf(fp, "  "); }
+  
+  if (strlen(a->contents)) {
+    fprintf(fp, "%s:%lu:%lu '%s'\n", a->tag, 
+      (long unsigned int)(a->state.row+1),
+      (long unsigned int)(a->state.col+1),
+      a->contents);
+  } else {
+    fprintf(fp, "%s \n", a->tag);
+  }
+  
+  for (i = 0; i < a->children_num; i++) {
+    mpc_ast_print_depth(a->children[i], d+1, fp);
+  }
+  
+}
+
+void mpc_ast_print(mpc_ast_t *a) {
+  mpc_ast_print_depth(a, 0, stdout);
+}
+
+void mpc_ast_print_to(mpc_ast_t *a, FILE *fp) {
+  mpc_ast_print_depth(a, 0, fp);
+}
+
+int mpc_ast_get_index(mpc_ast_t *ast, const char *tag) {
+  return mpc_ast_get_index_lb(ast, tag, 0);
+}
+
+int mpc_ast_get_index_lb(mpc_ast_t *ast, const char *tag, int lb) {
+  int i;
+
+  for(i=lb; i<ast->children_num; i++) {
+    if(strcmp(ast->children[i]->tag, tag) == 0) {
+      return i;
+    }
+  }
+
+  return -1;
+}
+
+mpc_ast_t *mpc_ast_get_child(mpc_ast_t *ast, const char *tag) {
+  return mpc_ast_get_child_lb(ast, tag, 0);
+}
+
+mpc_ast_t *mpc_ast_get_child_lb(mpc_ast_t *ast, const char *tag, int lb) {
+  int i;
+
+  for(i=lb; i<ast->children_num; i++) {
+    if(strcmp(ast->children[i]->tag, tag) == 0) {
+      return ast->children[i];
+    }
+  }
+
+  return NULL;
+}
+
+mpc_ast_trav_t *mpc_ast_traverse_start(mpc_ast_t *ast,
+                                       mpc_ast_trav_order_t order)
+{
+  mpc_ast_trav_t *trav, *n_trav;
+  mpc_ast_t *cnode = ast;
+
+  /* Create the traversal structure */
+  trav = malloc(sizeof(mpc_ast_trav_t));
+  trav->curr_node = cnode;
+  trav->parent = NULL;
+  trav->curr_child = 0;
+  trav->order = order;
+
+  /* Get start node */
+  switch(order) {
+    case mpc_ast_trav_order_pre:
+      /* Nothing else is needed for pre order start */
+      break;
+
+    case mpc_ast_trav_order_post:
+      while(cnode->children_num > 0) {
+        cnode = cnode->children[0];
+
+        n_trav = malloc(sizeof(mpc_ast_trav_t));
+        n_trav->curr_node = cnode;
+        n_trav->parent = trav;
+        n_trav->curr_child = 0;
+        n_trav->order = order;
+
+        trav = n_trav;
+      }
+
+      break;
+
+    default:
+      /* Unreachable, but compiler complaints */
+      break;
+  }
+
+  return trav;
+}
+
+mpc_ast_t *mpc_ast_traverse_next(mpc_ast_trav_t **trav) {
+  mpc_ast_trav_t *n_trav, *to_free;
+  mpc_ast_t *ret = NULL;
+  int cchild;
+
+  /* The end of traversal was reached */
+  if(*trav == NULL) return NULL;
+
+  switch((*trav)->order) {
+    case mpc_ast_trav_order_pre:
+      ret = (*trav)->curr_node;
+
+      /* If there aren't any more children, go up */
+      while(*trav != NULL &&
+        (*trav)->curr_child >= (*trav)->curr_node->children_num)
+      {
+        to_free = *trav;
+        *trav = (*trav)->parent;
+        free(to_free);
+      }
+
+      /* If trav is NULL, the end was reached */
+      if(*trav == NULL) {
+        break;
+      }
+
+      /* Go to next child */
+      n_trav = malloc(sizeof(mpc_ast_trav_t));
+
+      cchild = (*trav)->curr_child;
+      n_trav->curr_node = (*trav)->curr_node->children[cchild];
+      n_trav->parent = *trav;
+      n_trav->curr_child = 0;
+      n_trav->order = (*trav)->order;
+
+      (*trav)->curr_child++;
+      *trav = n_trav;
+
+      break;
+
+    case mpc_ast_trav_order_post:
+      ret = (*trav)->curr_node;
+
+      /* Move up tree to the parent If the parent doesn't have any more nodes,
+       * then this is the current node. If it does, move down to its left most
+       * child. Also, free the previous traversal node */
+      to_free = *trav;
+      *trav = (*trav)->parent;
+      free(to_free);
+
+      if(*trav == NULL)
+        break;
+
+      /* Next child */
+      (*trav)->curr_child++;
+
+      /* If there aren't any more children, this is the next node */
+      if((*trav)->curr_child >= (*trav)->curr_node->children_num) {
+        break;
+      }
+
+      /* If there are still more children, find the leftmost child from this
+       * node */
+      while((*trav)->curr_node->children_num > 0) {
+        n_trav = malloc(sizeof(mpc_ast_trav_t));
+
+        cchild = (*trav)->curr_child;
+        n_trav->curr_node = (*trav)->curr_node->children[cchild];
+        n_trav->parent = *trav;
+        n_trav->curr_child = 0;
+        n_trav->order = (*trav)->order;
+
+        *trav = n_trav;
+      }
+
+    default:
+      /* Unreachable, but compiler complaints */
+      break;
+  }
+
+  return ret;
+}
+
+void mpc_ast_traverse_free(mpc_ast_trav_t **trav) {
+  mpc_ast_trav_t *n_trav;
+
+  /* Go through parents until all are free */
+  while(*trav != NULL) {
+      n_trav = (*trav)->parent;
+      free(*trav);
+      *trav = n_trav;
+  }
+}
+
+/* Folds into a node from arena `m`, or from the heap if it is `NULL` */
+static mpc_ast_t *mpc_ast_fold(mpc_ast_arena_t *m, int n, mpc_ast_t **as) {
+  
+  int i, j;
+  mpc_ast_t *r, *c;
+  
+  if (n == 0) { return NULL; }
+  if (n == 1) { return as[0]; }
+  if (n == 2 && as[1] == NULL) { return as[0]; }
+  if (n == 2 && as[0] == NULL) { return as[1]; }
+  
+  r = m ? mpc_ast_arena_node(m, ">", "") : mpc_ast_new(">", "");
+  
+  for (i = 0; i < n; i++) {
+    
+    if (as[i] == NULL) { continue; }
+    
+    if        (as[i] && as[i]->children_num == 0) {
+      mpc_ast_add_child(r, as[i]);
+    } else if (as[i] && as[i]->children_num == 1) {
+      c = as[i]->children[0];
+      if (m && mpc_ast_arena_of(c) == m && mpc_ast_arena_of(as[i]) == m) {
+        c->tag = mpc_ast_arena_join_fixed(m, as[i]->tag, strlen(as[i]->tag)-1, "", c->tag);
+      } else {
+        mpc_ast_add_root_tag(c, as[i]->tag);
+      }
+      if (c->rule < 0) { c->rule = as[i]->rule; }
+      c->rules |= as[i]->rules;
+      mpc_ast_add_child(r, c);
+      mpc_ast_delete_no_children(as[i]);
+    } else if (as[i] && as[i]->children_num >= 2) {
+      for (j = 0; j < as[i]->children_num; j++) {
+        mpc_ast_add_child(r, as[i]->children[j]);
+      }
+      mpc_ast_delete_no_children(as[i]);
+    }
+  
+  }
+  
+  if (r->children_num) {
+    r->state = r->children[0]->state;
+  }
+  
+  return r;
+}
+
+mpc_val_t *mpcf_fold_ast(int n, mpc_val_t **xs) {
+  int i;
+  mpc_ast_t **as = (mpc_ast_t**)xs;
+  for (i = 0; i < n; i++) {
+    if (as[i]) { return mpc_ast_fold(mpc_ast_arena_of(as[i]), n, as); }
+  }
+  return mpc_ast_fold(NULL, n, as);
+}
+
+mpc_val_t *mpcf_str_ast(mpc_val_t *c) {
+  mpc_ast_t *a = mpc_ast_new("", c);
+  free(c);
+  return a;
+}
+
+mpc_val_t *mpcf_state_ast(int n, mpc_val_t **xs) {
+  mpc_state_t *s = ((mpc_state_t**)xs)[0];
+  mpc_ast_t *a = ((mpc_ast_t**)xs)[1];
+  (void)n;
+  a = mpc_ast_state(a, *s);
+  free(s);
+  return a;
+}
+
+/*
+** Tags a node with the name of the grammar rule
+** `d` and records its ID. The first rule a node
+** is tagged with is the most specific one.
+*/
+
+static mpc_val_t *mpcf_ast_add_rule(mpc_val_t *x, void *d) {
+  
+  mpc_parser_t *p = d;
+  mpc_ast_t *a = x;
+  mpc_ast_arena_t *m;
+  
+  if (a == NULL) { return a; }
+  
+  m = mpc_ast_arena_of(a);
+  if (m) {
+    a->tag = mpc_ast_arena_join_fixed(m, p->name, strlen(p->name), "|", a->tag);
+  } else {
+    mpc_ast_add_tag(a, p->name);
+  }
+  
+  if (p->id < 0) { return a; }
+  if (a->rule < 0) { a->rule = p->id; }
+  if ((size_t)p->id < sizeof(unsigned long) * CHAR_BIT) { a->rules |= 1UL << p->id; }
+  return a;
+}
+
+mpc_parser_t *mpca_state(mpc_parser_t *a) {
+  return mpc_and(2, mpcf_state_ast, mpc_state(), a, free);
+}
+
+mpc_parser_t *mpca_tag(mpc_parser_t *a, const char *t) {
+  return mpc_apply_to(a, (mpc_apply_to_t)mpc_ast_tag, (void*)t);
+}
+
+mpc_parser_t *mpca_add_tag(mpc_parser_t *a, const char *t) {
+  return mpc_apply_to(a, (mpc_apply_to_t)mpc_ast_add_tag, (void*)t);
+}
+
+mpc_parser_t *mpca_root(mpc_parser_t *a) {
+  return mpc_apply(a, (mpc_apply_t)mpc_ast_add_root);
+}
+
+mpc_parser_t *mpca_not(mpc_parser_t *a) { return mpc_not(a, (mpc_dtor_t)mpc_ast_delete); }
+mpc_parser_t *mpca_maybe(mpc_parser_t *a) { return mpc_maybe(a); }
+mpc_parser_t *mpca_many(mpc_parser_t *a) { return mpc_many(mpcf_fold_ast, a); }
+mpc_parser_t *mpca_many1(mpc_parser_t *a) { return mpc_many1(mpcf_fold_ast, a); }
+mpc_parser_t *mpca_count(int n, mpc_parser_t *a) { return mpc_count(n, mpcf_fold_ast, a, (mpc_dtor_t)mpc_ast_delete); }
+
+mpc_parser_t *mpca_or(int n, ...) {
+
+  int i;
+  va_list va;
+
+  mpc_parser_t *p = mpc_undefined();
+  
+  p->type = MPC_TYPE_OR;
+  p->data.or.n = n;
+  p->data.or.xs = malloc(sizeof(mpc_parser_t*) * n);
+  
+  va_start(va, n);  
+  for (i = 0; i < n; i++) {
+    p->data.or.xs[i] = va_arg(va, mpc_parser_t*);
+  }
+  va_end(va);
+  
+  return p;
+  
+}
+
+mpc_parser_t *mpca_and(int n, ...) {
+  
+  int i;
+  va_list va;
+  
+  mpc_parser_t *p = mpc_undefined();
+  
+  p->type = MPC_TYPE_AND;
+  p->data.and.n = n;
+  p->data.and.f = mpcf_fold_ast;
+  p->data.and.xs = malloc(sizeof(mpc_parser_t*) * n);
+  p->data.and.dxs = malloc(sizeof(mpc_dtor_t) * (n-1));
+  
+  va_start(va, n);
+  for (i = 0; i < n; i++) {
+    p->data.and.xs[i] = va_arg(va, mpc_parser_t*);
+  }
+  for (i = 0; i < (n-1); i++) {
+    p->data.and.dxs[i] = (mpc_dtor_t)mpc_ast_delete;
+  }    
+  va_end(va);
+  
+  return p;  
+}
+
+mpc_parser_t *mpca_total(mpc_parser_t *a) { return mpc_total(a, (mpc_dtor_t)mpc_ast_delete); }
+mpc_parser_t *mpca_packrat(mpc_parser_t *a) { return mpc_packrat(a, mpcf_ast_share, (mpc_dtor_t)mpc_ast_delete); }
+
+mpc_parser_t *mpca_action(mpc_parser_t *a, mpc_fold_t f, mpc_dtor_t d) {
+  a->action = f;
+  a->action_dtor = d;
+  return a;
+}
+
+mpc_parser_t *mpca_arena(mpc_parser_t *a) {
+  mpc_parser_t *p = mpc_undefined();
+  p->type = MPC_TYPE_ARENA;
+  p->data.arena.x = a;
+  return p;
+}
+
+/*
+** Grammar Parser
+*/
+
+/*
+** This is another interesting bootstrapping.
+**
+** Having a general purpose AST type allows
+** users to specify the grammar alone and
+** let all fold rules be automatically taken
+** care of by existing functions.
+**
+** You don't get to control the type spat
+** out but this means you can make a nice
+** parser to take in some grammar in nice
+** syntax and spit out a parser that works.
+**
+** The grammar for this looks surprisingly
+** like regex but the main difference is that
+** it is now whitespace insensitive and the
+** base type takes literals of some form.
+*/
+
+/*
+**
+**  ### Grammar Grammar
+**
+**      <grammar> : (<term> "|" <grammar>) | <term>
+**     
+**      <term> : <factor>*
+**
+**      <factor> : <base>
+**               | <base> "*"
+**               | <base> "+"
+**               | <base> "?"
+**               | <base> "{" <digits> "}"
+**           
+**      <base> : "<" (<digits> | <ident>) ">"
+**             | <string_lit>
+**             | <char_lit>
+**             | <regex_lit>
+**             | "(" <grammar> ")"
+*/
+
+typedef struct {
+  va_list *va;
+  int parsers_num;
+  mpc_parser_t **parsers;
+  int flags;
+} mpca_grammar_st_t;
+
+static mpc_val_t *mpcaf_grammar_or(int n, mpc_val_t **xs) {
+  (void) n;
+  if (xs[1] == NULL) { return xs[0]; }
+  else { return mpca_or(2, xs[0], xs[1]); }
+}
+
+static mpc_val_t *mpcaf_grammar_and(int n, mpc_val_t **xs) {
+  int i;
+  mpc_parser_t *p = mpc_pass();  
+  for (i = 0; i < n; i++) {
+    if (xs[i] != NULL) { p = mpca_and(2, p, xs[i]); }
+  }
+  return p;
+}
+
+static mpc_val_t *mpcaf_grammar_repeat(int n, mpc_val_t **xs) { 
+  int num;
+  (void) n;
+  if (xs[1] == NULL) { return xs[0]; }
+  switch(((char*)xs[1])[0])
+  {
+    case '*': { free(xs[1]); return mpca_many(xs[0]); }; break;
+    case '+': { free(xs[1]); return mpca_many1(xs[0]); }; break;
+    case '?': { free(xs[1]); return mpca_maybe(xs[0]); }; break;
+    case '!': { free(xs[1]); return mpca_not(xs[0]); }; break;
+    default:
+      num = *((int*)xs[1]);
+      free(xs[1]);
+  }
+  return mpca_count(num, xs[0]);
+}
+
+static mpc_val_t *mpcaf_grammar_string(mpc_val_t *x, void *s) {
+  mpca_grammar_st_t *st = s;
+  char *y = mpcf_unescape(x);
+  mpc_parser_t *p = (st->flags & MPCA_LANG_WHITESPACE_SENSITIVE) ? mpc_string(y) : mpc_tok(mpc_string(y));
+  free(y);
+  return mpca_state(mpca_tag(mpc_apply(p, mpcf_str_ast), "string"));
+}
+
+static mpc_val_t *mpcaf_grammar_char(mpc_val_t *x, void *s) {
+  mpca_grammar_st_t *st = s;
+  char *y = mpcf_unescape(x);
+  mpc_parser_t *p = (st->flags & MPCA_LANG_WHITESPACE_SENSITIVE) ? mpc_char(y[0]) : mpc_tok(mpc_char(y[0]));
+  free(y);
+  return mpca_state(mpca_tag(mpc_apply(p, mpcf_str_ast), "char"));
+}
+
+static mpc_val_t *mpcaf_grammar_regex(mpc_val_t *x, void *s) {
+  mpca_grammar_st_t *st = s;
+  char *y = mpcf_unescape_regex(x);
+  mpc_parser_t *p = (st->flags & MPCA_LANG_WHITESPACE_SENSITIVE) ? mpc_re(y) : mpc_tok(mpc_re(y));
+  free(y);
+  return mpca_state(mpca_tag(mpc_apply(p, mpcf_str_ast), "regex"));
+}
+
+/* Should this just use `isdigit` instead? */
+static int is_number(const char* s) {
+  size_t i;
+  for (i = 0; i < strlen(s); i++) { if (!strchr("0123456789", s[i])) { return 0; } }
+  return 1;
+}
+
+static mpc_parser_t *mpca_grammar_find_parser(char *x, mpca_grammar_st_t *st) {
+  
+  int i;
+  mpc_parser_t *p;
+  
+  /* Case of Number */
+  if (is_number(x)) {
+
+    i = strtol(x, NULL, 10);
+    
+    while (st->parsers_num <= i) {
+      st->parsers_num++;
+      st->parsers = realloc(st->parsers, sizeof(mpc_parser_t*) * st->parsers_num);
+      st->parsers[st->parsers_num-1] = va_arg(*st->va, mpc_parser_t*);
+      if (st->parsers[st->parsers_num-1] == NULL) {
+        return mpc_failf("No Parser in position %i! Only supplied %i Parsers!", i, st->parsers_num);
+      }
+      st->parsers[st->parsers_num-1]->id = st->parsers_num-1;
+    }
+    
+    return st->parsers[st->parsers_num-1];
+  
+  /* Case of Identifier */
+  } else {
+    
+    /* Search Existing Parsers */
+    for (i = 0; i < st->parsers_num; i++) {
+      mpc_parser_t *q = st->parsers[i];
+      if (q == NULL) { return mpc_failf("Unknown Parser '%s'!", x); }
+      if (q->name && strcmp(q->name, x) == 0) { return q; }
+    }
+    
+    /* Search New Parsers */
+    while (1) {
+    
+      p = va_arg(*st->va, mpc_parser_t*);
+      
+      st->parsers_num++;
+      st->parsers = realloc(st->parsers, sizeof(mpc_parser_t*) * st->parsers_num);
+      st->parsers[st->parsers_num-1] = p;
+      
+      if (p == NULL || p->name == NULL) { return mpc_failf("Unknown Parser '%s'!", x); }
+      p->id = st->parsers_num-1;
+      if (p->name && strcmp(p->name, x) == 0) { return p; }
+      
+    }
+  
+  }  
+  
+}
+
+static mpc_val_t *mpcaf_grammar_id(mpc_val_t *x, void *s) {
+  
+  mpca_grammar_st_t *st = s;
+  mpc_parser_t *p = mpca_grammar_find_parser(x, st);
+  free(x);
+
+  if (p->name) {
+    return mpca_state(mpca_root(mpc_apply_to(p, mpcf_ast_add_rule, p)));
+  } else {
+    return mpca_state(mpca_root(p));
+  }
+}
+
+/*
+** Semantic Actions
+**
+** With `MPCA_LANG_ACTIONS` the body of each rule
+** is compiled as usual and then retargeted so it
+** builds a list rather than an AST. The list
+** holds the text of each literal it matched and
+** the value of each rule it referenced, in order,
+** along with how to delete them. A rule with an
+** action turns that list into a single value.
+*/
+
+enum {
+  MPCA_ACTION_BUFFER = 16
+};
+
+typedef struct {
+  mpc_val_t *x;
+  mpc_dtor_t d;
+} mpca_item_t;
+
+typedef struct {
+  int num;
+  mpca_item_t items[1];
+} mpca_list_t;
+
+/* Marks the items of a list which are text */
+static void mpcaf_list_text_delete(mpc_val_t *x) { free(x); }
+
+static mpca_list_t *mpca_list_new(mpc_val_t *x, mpc_dtor_t d) {
+  mpca_list_t *l = malloc(sizeof(mpca_list_t));
+  l->num = 1;
+  l->items[0].x = x;
+  l->items[0].d = d;
+  return l;
+}
+
+static void mpcaf_list_delete(mpc_val_t *x) {
+  int i;
+  mpca_list_t *l = x;
+  if (l == NULL) { return; }
+  for (i = 0; i < l->num; i++) {
+    if (l->items[i].x && l->items[i].d) { l->items[i].d(l->items[i].x); }
+  }
+  free(l);
+}
+
+static mpc_val_t *mpcaf_list_text(mpc_val_t *x) { return mpca_list_new(x, mpcaf_list_text_delete); }
+static mpc_val_t *mpcaf_list_same(mpc_val_t *x) { return x; }
+static mpc_val_t *mpcaf_list_same_to(mpc_val_t *x, void *d) { (void) d; return x; }
+
+static mpc_val_t *mpcaf_list_fold(int n, mpc_val_t **xs) {
+  
+  int i, j, num = 0;
+  mpca_list_t *l, *r;
+  
+  for (i = 0; i < n; i++) {
+    if (xs[i]) { num += ((mpca_list_t*)xs[i])->num; }
+  }
+  
+  for (i = 0; i < n && xs[i] == NULL; i++);
+  if (i == n) { return NULL; }
+  
+  l = realloc(xs[i], sizeof(mpca_list_t) + sizeof(mpca_item_t) * (num - 1));
+  
+  for (j = i+1; j < n; j++) {
+    r = xs[j];
+    if (r == NULL) { continue; }
+    memcpy(l->items + l->num, r->items, sizeof(mpca_item_t) * r->num);
+    l->num += r->num;
+    free(r);
+  }
+  
+  return l;
+}
+
+/* A reference to a rule with an action adds its value to the list */
+static mpc_val_t *mpcaf_list_rule(mpc_val_t *x, void *d) {
+  mpc_parser_t *p = d;
+  return p->action ? mpca_list_new(x, p->action_dtor) : x;
+}
+
+static mpc_val_t *mpcaf_action_values(mpc_val_t *x, void *d) {
+  
+  int i, n = 0;
+  mpc_parser_t *p = d;
+  mpca_list_t *l = x;
+  mpc_val_t *buffer[MPCA_ACTION_BUFFER], **xs, *y;
+  
+  if (l == NULL) { return p->action(0, buffer); }
+  
+  xs = l->num <= MPCA_ACTION_BUFFER ? buffer : malloc(sizeof(mpc_val_t*) * l->num);
+  
+  for (i = 0; i < l->num; i++) {
+    if (l->items[i].d == mpcaf_list_text_delete) {
+      free(l->items[i].x);
+    } else {
+      xs[n++] = l->items[i].x;
+    }
+  }
+  
+  y = p->action(n, xs);
+  if (xs != buffer) { free(xs); }
+  free(l);
+  return y;
+}
+
+static mpc_val_t *mpcaf_action_text(mpc_val_t *x, void *d) {
+  
+  int i;
+  size_t len = 0, k = 0, m;
+  mpc_parser_t *p = d;
+  mpca_list_t *l = x;
+  char *t;
+  mpc_val_t *y;
+  
+  for (i = 0; l && i < l->num; i++) { len += strlen(l->items[i].x); }
+  
+  t = malloc(len + 1);
+  t[0] = '\0';
+  for (i = 0; l && i < l->num; i++) {
+    m = strlen(l->items[i].x);
+    memcpy(t + k, l->items[i].x, m + 1);
+    k += m;
+    free(l->items[i].x);
+  }
+  
+  free(l);
+  y = t;
+  return p->action(1, &y);
+}
+
+/*
+** While parsing, the lists and the text in them
+** are kept in the memory of the input, and only
+** what is handed to an action is copied out.
+*/
+
+static mpca_list_t *mpca_input_list_new(mpc_input_t *i, mpc_val_t *x, mpc_dtor_t d) {
+  mpca_list_t *l = mpc_malloc(i, sizeof(mpca_list_t));
+  l->num = 1;
+  l->items[0].x = x;
+  l->items[0].d = d;
+  return l;
+}
+
+static void mpcaf_input_list_delete(mpc_input_t *i, mpc_val_t *x) {
+  int j;
+  mpca_list_t *l = x;
+  if (l == NULL) { return; }
+  for (j = 0; j < l->num; j++) {
+    if (l->items[j].d == mpcaf_list_text_delete) { mpc_free(i, l->items[j].x); continue; }
+    if (l->items[j].x && l->items[j].d) { l->items[j].d(l->items[j].x); }
+  }
+  mpc_free(i, l);
+}
+
+static mpc_val_t *mpcaf_input_list_text(mpc_input_t *i, mpc_val_t *x) {
+  return mpca_input_list_new(i, x, mpcaf_list_text_delete);
+}
+
+static mpc_val_t *mpcaf_input_list_fold(mpc_input_t *i, int n, mpc_val_t **xs) {
+  
+  int j, k, num = 0;
+  mpca_list_t *l, *r;
+  
+  for (j = 0; j < n; j++) {
+    if (xs[j]) { num += ((mpca_list_t*)xs[j])->num; }
+  }
+  
+  for (j = 0; j < n && xs[j] == NULL; j++);
+  if (j == n) { return NULL; }
+  
+  l = mpc_realloc(i, xs[j], sizeof(mpca_list_t) + sizeof(mpca_item_t) * (num - 1));
+  
+  for (k = j+1; k < n; k++) {
+    r = xs[k];
+    if (r == NULL) { continue; }
+    memcpy(l->items + l->num, r->items, sizeof(mpca_item_t) * r->num);
+    l->num += r->num;
+    mpc_free(i, r);
+  }
+  
+  return l;
+}
+
+static mpc_val_t *mpcaf_input_list_rule(mpc_input_t *i, mpc_val_t *x, void *d) {
+  mpc_parser_t *p = d;
+  return p->action ? mpca_input_list_new(i, x, p->action_dtor) : x;
+}
+
+static mpc_val_t *mpcaf_input_action_values(mpc_input_t *i, mpc_val_t *x, void *d) {
+  
+  int j, n = 0;
+  mpc_parser_t *p = d;
+  mpca_list_t *l = x;
+  mpc_val_t *buffer[MPCA_ACTION_BUFFER], **xs, *y;
+  
+  if (l == NULL) { return p->action(0, buffer); }
+  
+  xs = l->num <= MPCA_ACTION_BUFFER ? buffer : mpc_malloc(i, sizeof(mpc_val_t*) * l->num);
+  
+  for (j = 0; j < l->num; j++) {
+    if (l->items[j].d == mpcaf_list_text_delete) {
+      mpc_free(i, l->items[j].x);
+    } else {
+      xs[n++] = l->items[j].x;
+    }
+  }
+  
+  y = p->action(n, xs);
+  if (xs != buffer) { mpc_free(i, xs); }
+  mpc_free(i, l);
+  return y;
+}
+
+static mpc_val_t *mpcaf_input_action_text(mpc_input_t *i, mpc_val_t *x, void *d) {
+  
+  int j;
+  size_t len = 0, k = 0, m;
+  mpc_parser_t *p = d;
+  mpca_list_t *l = x;
+  char *t;
+  mpc_val_t *y;
+  
+  if (l && l->num == 1) {
+    t = mpc_export(i, l->items[0].x);
+  } else {
+    for (j = 0; l && j < l->num; j++) { len += strlen(l->items[j].x); }
+    t = malloc(len + 1);
+    t[0] = '\0';
+    for (j = 0; l && j < l->num; j++) {
+      m = strlen(l->items[j].x);
+      memcpy(t + k, l->items[j].x, m + 1);
+      k += m;
+      mpc_free(i, l->items[j].x);
+    }
+  }
+  
+  mpc_free(i, l);
+  y = t;
+  return p->action(1, &y);
+}
+
+/*
+** Replaces `p` with its child `x`, once the
+** layer `p` added has no work left to do.
+*/
+
+static void mpca_actions_collapse(mpc_parser_t *p, mpc_parser_t *x) {
+  p->type = x->type;
+  p->data = x->data;
+  free(x);
+}
+
+/*
+** Swaps the functions that build and delete ASTs
+** in a compiled rule body for those that handle
+** lists, and removes the layers that only record
+** tags and states. Returns if the body references
+** any other rules.
+*/
+
+static int mpca_actions_unretained(mpc_parser_t *p, int force) {
+  
+  int i, r = 0;
+  mpc_parser_t *x;
+  
+  if (p->retained && !force) { return 1; }
+  
+  switch (p->type) {
+    
+    case MPC_TYPE_EXPECT:  return mpca_actions_unretained(p->data.expect.x, 0);
+    case MPC_TYPE_PREDICT: return mpca_actions_unretained(p->data.predict.x, 0);
+    case MPC_TYPE_PACKRAT: return mpca_actions_unretained(p->data.packrat.x, 0);
+    case MPC_TYPE_ARENA:   return mpca_actions_unretained(p->data.arena.x, 0);
+    case MPC_TYPE_DFA:     return mpca_actions_unretained(p->data.dfa.x, 0);
+    case MPC_TYPE_TOKEN:   return mpca_actions_unretained(p->data.token.x, 0);
+    
+    case MPC_TYPE_APPLY:
+      x = p->data.apply.x;
+      r = mpca_actions_unretained(x, 0);
+      if (p->data.apply.f == mpcf_str_ast) { p->data.apply.f = mpcaf_list_text; }
+      if (p->data.apply.f == (mpc_apply_t)mpc_ast_add_root) {
+        if (x->retained) { p->data.apply.f = mpcaf_list_same; }
+        else { mpca_actions_collapse(p, x); }
+      }
+      return r;
+    
+    case MPC_TYPE_APPLY_TO:
+      x = p->data.apply_to.x;
+      r = mpca_actions_unretained(x, 0);
+      if (p->data.apply_to.f == mpcf_ast_add_rule) { p->data.apply_to.f = mpcaf_list_rule; }
+      if (p->data.apply_to.f == (mpc_apply_to_t)mpc_ast_tag
+      ||  p->data.apply_to.f == (mpc_apply_to_t)mpc_ast_add_tag) {
+        if (x->retained) { p->data.apply_to.f = mpcaf_list_same_to; }
+        else { mpca_actions_collapse(p, x); }
+      }
+      return r;
+    
+    case MPC_TYPE_NOT:
+    case MPC_TYPE_MAYBE:
+      if (p->data.not.dx == (mpc_dtor_t)mpc_ast_delete) { p->data.not.dx = mpcaf_list_delete; }
+      return mpca_actions_unretained(p->data.not.x, 0);
+    
+    case MPC_TYPE_MANY:
+    case MPC_TYPE_MANY1:
+    case MPC_TYPE_COUNT:
+      if (p->data.repeat.f == mpcf_fold_ast) { p->data.repeat.f = mpcaf_list_fold; }
+      if (p->data.repeat.dx == (mpc_dtor_t)mpc_ast_delete) { p->data.repeat.dx = mpcaf_list_delete; }
+      return mpca_actions_unretained(p->data.repeat.x, 0);
+    
+    case MPC_TYPE_OR:
+      for (i = 0; i < p->data.or.n; i++) {
+        r = mpca_actions_unretained(p->data.or.xs[i], 0) || r;
+      }
+      return r;
+    
+    case MPC_TYPE_AND:
+      
+      for (i = 0; i < p->data.and.n; i++) {
+        r = mpca_actions_unretained(p->data.and.xs[i], 0) || r;
+      }
+      
+      /* The state from `mpca_state` is not needed */
+      if (p->data.and.f == mpcf_state_ast && !p->data.and.xs[1]->retained) {
+        x = p->data.and.xs[1];
+        mpc_delete(p->data.and.xs[0]);
+        free(p->data.and.xs);
+        free(p->data.and.dxs);
+        mpca_actions_collapse(p, x);
+        return r;
+      }
+      
+      if (p->data.and.f == mpcf_fold_ast)  { p->data.and.f = mpcaf_list_fold; }
+      if (p->data.and.f == mpcf_state_ast) { p->data.and.f = mpcf_snd_free; }
+      for (i = 0; i < p->data.and.n-1; i++) {
+        if (p->data.and.dxs[i] == (mpc_dtor_t)mpc_ast_delete) { p->data.and.dxs[i] = mpcaf_list_delete; }
+      }
+      return r;
+    
+    default: return 0;
+  }
+  
+}
+
+static mpc_parser_t *mpca_actions(mpc_parser_t *a, mpc_parser_t *rule) {
+  int refs = mpca_actions_unretained(a, 1);
+  if (!rule->action) { return a; }
+  return mpc_apply_to(a, refs ? mpcaf_action_values : mpcaf_action_text, rule);
+}
+
+mpc_parser_t *mpca_grammar_st(const char *grammar, mpca_grammar_st_t *st) {
+  
+  char *err_msg;
+  mpc_parser_t *err_out;
+  mpc_result_t r;
+  mpc_parser_t *GrammarTotal, *Grammar, *Term, *Factor, *Base;
+  
+  GrammarTotal = mpc_new("grammar_total");
+  Grammar = mpc_new("grammar");
+  Term = mpc_new("term");
+  Factor = mpc_new("factor");
+  Base = mpc_new("base");
+  
+  mpc_define(GrammarTotal,
+    mpc_predictive(mpc_total(Grammar, mpc_soft_delete))
+  );
+  
+  mpc_define(Grammar, mpc_and(2, mpcaf_grammar_or,
+    Term,
+    mpc_maybe(mpc_and(2, mpcf_snd_free, mpc_sym("|"), Grammar, free)),
+    mpc_soft_delete
+  ));
+  
+  mpc_define(Term, mpc_many1(mpcaf_grammar_and, Factor));
+  
+  mpc_define(Factor, mpc_and(2, mpcaf_grammar_repeat,
+    Base,
+      mpc_or(6,
+        mpc_sym("*"),
+        mpc_sym("+"),
+        mpc_sym("?"),
+        mpc_sym("!"),
+        mpc_tok_brackets(mpc_int(), free),
+        mpc_pass()),
+    mpc_soft_delete
+  ));
+  
+  mpc_define(Base, mpc_or(5,
+    mpc_apply_to(mpc_tok(mpc_string_lit()), mpcaf_grammar_string, st),
+    mpc_apply_to(mpc_tok(mpc_char_lit()),   mpcaf_grammar_char, st),
+    mpc_apply_to(mpc_tok(mpc_regex_lit()),  mpcaf_grammar_regex, st),
+    mpc_apply_to(mpc_tok_braces(mpc_or(2, mpc_digits(), mpc_ident()), free), mpcaf_grammar_id, st),
+    mpc_tok_parens(Grammar, mpc_soft_delete)
+  ));
+  
+  mpc_optimise(GrammarTotal);
+  mpc_optimise(Grammar);
+  mpc_optimise(Factor);
+  mpc_optimise(Term);
+  mpc_optimise(Base);
+  
+  if(!mpc_parse("<mpc_grammar_compiler>", grammar, GrammarTotal, &r)) {
+    err_msg = mpc_err_string(r.error);
+    err_out = mpc_failf("Invalid Grammar: %s", err_msg);
+    mpc_err_delete(r.error);
+    free(err_msg);
+    r.output = err_out;
+  }
+  
+  mpc_cleanup(5, GrammarTotal, Grammar, Term, Factor, Base);
+  
+  mpc_optimise(r.output);
+  
+  if (st->flags & MPCA_LANG_PREDICTIVE) { r.output = mpc_predictive(r.output); }
+  if (st->flags & MPCA_LANG_ARENA) { r.output = mpca_arena(r.output); }
+  return r.output;
+  
+}
+
+mpc_parser_t *mpca_grammar(int flags, const char *grammar, ...) {
+  mpca_grammar_st_t st;
+  mpc_parser_t *res;
+  va_list va;
+  va_start(va, grammar);
+  
+  st.va = &va;
+  st.parsers_num = 0;
+  st.parsers = NULL;
+  st.flags = flags;
+  
+  res = mpca_grammar_st(grammar, &st);  
+  free(st.parsers);
+  va_end(va);
+  return res;
+}
+
+typedef struct {
+  char *ident;
+  char *name;
+  mpc_parser_t *grammar;
+} mpca_stmt_t;
+
+static mpc_val_t *mpca_stmt_afold(int n, mpc_val_t **xs) {
+  mpca_stmt_t *stmt = malloc(sizeof(mpca_stmt_t));
+  stmt->ident = ((char**)xs)[0];
+  stmt->name = ((char**)xs)[1];
+  stmt->grammar = ((mpc_parser_t**)xs)[3];
   (void) n;
-  if (xs[1] == NULL) { return xs[0]; }
-  switch(((char*)xs[1])[0])
-  {
-    case '*': { free(xs[1]); return mpca_many(xs[0]); }; break;
-    case '+': { free(xs[1]); return mpca_many1(xs[0]); }; break;
-    case '?': { free(xs[1]); return mpca_maybe(xs[0]); }; break;
-    case '!': { free(xs[1]); return mpca_not(xs[0]); }; break;
-    default:
-      num = *((int*)xs[1]);
-      free(xs[1]);
+  free(((char**)xs)[2]);
+  free(((char**)xs)[4]);
+  
+  return stmt;
+}
+
+static mpc_val_t *mpca_stmt_fold(int n, mpc_val_t **xs) {
+  
+  int i;
+  mpca_stmt_t **stmts = malloc(sizeof(mpca_stmt_t*) * (n+1));
+  
+  for (i = 0; i < n; i++) {
+    stmts[i] = xs[i];
+  }
+  stmts[n] = NULL;  
+  
+  return stmts;
+}
+
+static void mpca_stmt_list_delete(mpc_val_t *x) {
+
+  mpca_stmt_t **stmts = x;
+
+  while(*stmts) {
+    mpca_stmt_t *stmt = *stmts; 
+    free(stmt->ident);
+    free(stmt->name);
+    mpc_soft_delete(stmt->grammar);
+    free(stmt);  
+    stmts++;
+  }
+  free(x);
+
+}
+
+static void mpc_optimise_dispatch(mpc_parser_t *p, int force);
+
+/*
+** Statistics are worked out from the shape of
+** the tree alone. The calls made for each byte
+** consumed are estimated taking alternatives as
+** equally likely and repetitions as running a
+** few times. Rules used by `p` count as a single
+** call consuming a single byte, and `probe` is
+** the calls made before a parser first looks at
+** the input, which is what a failing alternative
+** is taken to cost.
+*/
+
+typedef struct {
+  int nodes;
+  int depth;
+  double calls;
+  double bytes;
+  double probe;
+} mpc_stats_t;
+
+static void mpc_stats_unretained(mpc_parser_t *p, int force, mpc_stats_t *s);
+
+static void mpca_stats_print(const char *ident, const mpc_stats_t *a, mpc_parser_t *p) {
+  mpc_stats_t b;
+  mpc_stats_unretained(p, 1, &b);
+  printf("%s: nodes %i -> %i, depth %i -> %i, calls per byte %.2f -> %.2f\n", ident,
+    a->nodes, b.nodes, a->depth, b.depth,
+    a->bytes > 0 ? a->calls / a->bytes : a->calls,
+    b.bytes > 0 ? b.calls / b.bytes : b.calls);
+}
+
+static mpc_val_t *mpca_stmt_list_apply_to(mpc_val_t *x, void *s) {
+
+  mpca_grammar_st_t *st = s;
+  mpca_stmt_t *stmt;
+  mpca_stmt_t **stmts = x;
+  mpc_parser_t *left;
+  mpc_stats_t before;
+  int i;
+
+  while(*stmts) {
+    stmt = *stmts;
+    left = mpca_grammar_find_parser(stmt->ident, st);
+    if (st->flags & MPCA_LANG_PREDICTIVE) { stmt->grammar = mpc_predictive(stmt->grammar); }
+    if (stmt->name) { stmt->grammar = mpc_expect(stmt->grammar, stmt->name); }
+    if (st->flags & MPCA_LANG_ACTIONS) {
+      if (st->flags & MPCA_LANG_STATS) { mpc_stats_unretained(stmt->grammar, 1, &before); }
+      mpc_optimise(stmt->grammar);
+      if (st->flags & MPCA_LANG_STATS) { mpca_stats_print(stmt->ident, &before, stmt->grammar); }
+      stmt->grammar = mpca_actions(stmt->grammar, left);
+    } else {
+      if (st->flags & MPCA_LANG_PACKRAT) { stmt->grammar = mpca_packrat(stmt->grammar); }
+      if (st->flags & MPCA_LANG_ARENA) { stmt->grammar = mpca_arena(stmt->grammar); }
+      if (st->flags & MPCA_LANG_STATS) { mpc_stats_unretained(stmt->grammar, 1, &before); }
+      mpc_optimise(stmt->grammar);
+      if (st->flags & MPCA_LANG_STATS) { mpca_stats_print(stmt->ident, &before, stmt->grammar); }
+    }
+    mpc_define(left, stmt->grammar);
+    free(stmt->ident);
+    free(stmt->name);
+    free(stmt);
+    stmts++;
+  }
+  
+  free(x);
+  
+  /* Rules can refer to later ones, so dispatch tables are built again once all are defined */
+  for (i = 0; i < st->parsers_num; i++) {
+    if (st->parsers[i]->type != MPC_TYPE_UNDEFINED) { mpc_optimise_dispatch(st->parsers[i], 1); }
+  }
+  
+  return NULL;
+}
+
+static mpc_err_t *mpca_lang_st(mpc_input_t *i, mpca_grammar_st_t *st) {
+  
+  mpc_result_t r;
+  mpc_err_t *e;
+  mpc_parser_t *Lang, *Stmt, *Grammar, *Term, *Factor, *Base; 
+  
+  Lang    = mpc_new("lang");
+  Stmt    = mpc_new("stmt");
+  Grammar = mpc_new("grammar");
+  Term    = mpc_new("term");
+  Factor  = mpc_new("factor");
+  Base    = mpc_new("base");
+  
+  mpc_define(Lang, mpc_apply_to(
+    mpc_total(mpc_predictive(mpc_many(mpca_stmt_fold, Stmt)), mpca_stmt_list_delete),
+    mpca_stmt_list_apply_to, st
+  ));
+  
+  mpc_define(Stmt, mpc_and(5, mpca_stmt_afold,
+    mpc_tok(mpc_ident()), mpc_maybe(mpc_tok(mpc_string_lit())), mpc_sym(":"), Grammar, mpc_sym(";"),
+    free, free, free, mpc_soft_delete
+  ));
+  
+  mpc_define(Grammar, mpc_and(2, mpcaf_grammar_or,
+      Term,
+      mpc_maybe(mpc_and(2, mpcf_snd_free, mpc_sym("|"), Grammar, free)),
+      mpc_soft_delete
+  ));
+  
+  mpc_define(Term, mpc_many1(mpcaf_grammar_and, Factor));
+  
+  mpc_define(Factor, mpc_and(2, mpcaf_grammar_repeat,
+    Base,
+      mpc_or(6,
+        mpc_sym("*"),
+        mpc_sym("+"),
+        mpc_sym("?"),
+        mpc_sym("!"),
+        mpc_tok_brackets(mpc_int(), free),
+        mpc_pass()),
+    mpc_soft_delete
+  ));
+  
+  mpc_define(Base, mpc_or(5,
+    mpc_apply_to(mpc_tok(mpc_string_lit()), mpcaf_grammar_string, st),
+    mpc_apply_to(mpc_tok(mpc_char_lit()),   mpcaf_grammar_char, st),
+    mpc_apply_to(mpc_tok(mpc_regex_lit()),  mpcaf_grammar_regex, st),
+    mpc_apply_to(mpc_tok_braces(mpc_or(2, mpc_digits(), mpc_ident()), free), mpcaf_grammar_id, st),
+    mpc_tok_parens(Grammar, mpc_soft_delete)
+  ));
+  
+  mpc_optimise(Lang);
+  mpc_optimise(Stmt);
+  mpc_optimise(Grammar);
+  mpc_optimise(Term);
+  mpc_optimise(Factor);
+  mpc_optimise(Base);
+  
+  if (!mpc_parse_input(i, Lang, &r)) {
+    e = r.error;
+  } else {
+    e = NULL;
+  }
+  
+  mpc_cleanup(6, Lang, Stmt, Grammar, Term, Factor, Base);
+  
+  return e;
+}
+
+mpc_err_t *mpca_lang_file(int flags, FILE *f, ...) {
+  mpca_grammar_st_t st;
+  mpc_input_t *i;
+  mpc_err_t *err;
+
+  va_list va;  
+  va_start(va, f);
+  
+  st.va = &va;
+  st.parsers_num = 0;
+  st.parsers = NULL;
+  st.flags = flags;
+  
+  i = mpc_input_new_file("<mpca_lang_file>", f);
+  err = mpca_lang_st(i, &st);
+  mpc_input_delete(i);
+  
+  free(st.parsers);
+  va_end(va);
+  return err;
+}
+
+mpc_err_t *mpca_lang_pipe(int flags, FILE *p, ...) {
+  mpca_grammar_st_t st;
+  mpc_input_t *i;
+  mpc_err_t *err;
+
+  va_list va;  
+  va_start(va, p);
+  
+  st.va = &va;
+  st.parsers_num = 0;
+  st.parsers = NULL;
+  st.flags = flags;
+  
+  i = mpc_input_new_pipe("<mpca_lang_pipe>", p);
+  err = mpca_lang_st(i, &st);
+  mpc_input_delete(i);
+  
+  free(st.parsers);
+  va_end(va);
+  return err;
+}
+
+mpc_err_t *mpca_lang(int flags, const char *language, ...) {
+  
+  mpca_grammar_st_t st;
+  mpc_input_t *i;
+  mpc_err_t *err;
+  
+  va_list va;  
+  va_start(va, language);
+  
+  st.va = &va;
+  st.parsers_num = 0;
+  st.parsers = NULL;
+  st.flags = flags;
+  
+  i = mpc_input_new_string("<mpca_lang>", language);
+  err = mpca_lang_st(i, &st);
+  mpc_input_delete(i);
+  
+  free(st.parsers);
+  va_end(va);
+  return err;
+}
+
+mpc_err_t *mpca_lang_contents(int flags, const char *filename, ...) {
+  
+  mpca_grammar_st_t st;
+  mpc_input_t *i;
+  mpc_err_t *err;
+  
+  va_list va;
+
+  FILE *f = fopen(filename, "rb");
+  
+  if (f == NULL) {
+    err = mpc_err_file(filename, "Unable to open file!");
+    return err;
+  }
+  
+  va_start(va, filename);
+  
+  st.va = &va;
+  st.parsers_num = 0;
+  st.parsers = NULL;
+  st.flags = flags;
+  
+  i = mpc_input_new_file(filename, f);
+  err = mpca_lang_st(i, &st);
+  mpc_input_delete(i);
+  
+  free(st.parsers);
+  va_end(va);  
+  
+  fclose(f);
+  
+  return err;
+}
+
+enum {
+  MPC_STATS_REPEAT = 4
+};
+
+static void mpc_stats_child(mpc_stats_t *s, mpc_parser_t *x) {
+  mpc_stats_t c;
+  mpc_stats_unretained(x, 0, &c);
+  s->nodes += c.nodes;
+  s->depth = c.depth + 1 > s->depth ? c.depth + 1 : s->depth;
+  s->calls += c.calls;
+  s->bytes += c.bytes;
+  s->probe = c.probe + 1;
+}
+
+static void mpc_stats_unretained(mpc_parser_t *p, int force, mpc_stats_t *s) {
+  
+  int i;
+  double calls, bytes, tried;
+  mpc_parser_t *x;
+  
+  memset(s, 0, sizeof(mpc_stats_t));
+  s->calls = 1;
+  s->probe = 1;
+  
+  if (p->retained && !force) { s->bytes = 1; return; }
+  
+  s->nodes = 1;
+  s->depth = 1;
+  
+  switch (p->type) {
+    
+    case MPC_TYPE_ANY:
+    case MPC_TYPE_SINGLE:
+    case MPC_TYPE_RANGE:
+    case MPC_TYPE_ONEOF:
+    case MPC_TYPE_NONEOF:
+    case MPC_TYPE_SATISFY: s->bytes = 1; break;
+    case MPC_TYPE_STRING:  s->bytes = (double)strlen(p->data.string.x); break;
+    
+    case MPC_TYPE_DFA:
+      mpc_stats_child(s, p->data.dfa.x);
+      s->nodes = 1; s->depth = 1; s->calls = 1; s->probe = 1;
+      break;
+    
+    case MPC_TYPE_TOKEN:
+      mpc_stats_child(s, p->data.token.x);
+      s->nodes = 1; s->depth = 1; s->calls = 1; s->probe = 1;
+      break;
+    
+    case MPC_TYPE_EXPECT:   mpc_stats_child(s, p->data.expect.x);   break;
+    case MPC_TYPE_APPLY:    mpc_stats_child(s, p->data.apply.x);    break;
+    case MPC_TYPE_APPLY_TO: mpc_stats_child(s, p->data.apply_to.x); break;
+    case MPC_TYPE_PREDICT:  mpc_stats_child(s, p->data.predict.x);  break;
+    case MPC_TYPE_PACKRAT:  mpc_stats_child(s, p->data.packrat.x);  break;
+    case MPC_TYPE_ARENA:    mpc_stats_child(s, p->data.arena.x);    break;
+    case MPC_TYPE_MAYBE:    mpc_stats_child(s, p->data.not.x);      break;
+    case MPC_TYPE_NOT:      mpc_stats_child(s, p->data.not.x); s->bytes = 0; break;
+    
+    case MPC_TYPE_MANY:
+    case MPC_TYPE_MANY1:
+    case MPC_TYPE_COUNT:
+      mpc_stats_child(s, p->data.repeat.x);
+      calls = s->calls - 1; bytes = s->bytes;
+      if (p->type == MPC_TYPE_COUNT) {
+        s->calls = 1 + p->data.repeat.n * calls;
+        s->bytes = p->data.repeat.n * bytes;
+        break;
+      }
+      x = p->data.repeat.x;
+      while (x->type == MPC_TYPE_EXPECT) { x = x->data.expect.x; }
+      if (p->data.repeat.f == mpcf_strfold
+      && (x->type == MPC_TYPE_ONEOF || x->type == MPC_TYPE_NONEOF)) {
+        s->calls = 1 + s->probe;
+      } else {
+        s->calls = 1 + MPC_STATS_REPEAT * calls + s->probe - 1;
+      }
+      s->bytes = MPC_STATS_REPEAT * bytes;
+      break;
+    
+    case MPC_TYPE_AND:
+      for (i = 0; i < p->data.and.n; i++) {
+        tried = s->probe;
+        mpc_stats_child(s, p->data.and.xs[i]);
+        if (i > 0) { s->probe = tried; }
+      }
+      break;
+    
+    case MPC_TYPE_OR:
+      calls = 0; bytes = 0; tried = 0;
+      for (i = 0; i < p->data.or.n; i++) {
+        s->calls = 0; s->bytes = 0;
+        mpc_stats_child(s, p->data.or.xs[i]);
+        calls += (p->data.or.first ? 0 : tried) + s->calls;
+        bytes += s->bytes;
+        tried += s->probe - 1;
+      }
+      s->calls = 1 + calls / p->data.or.n;
+      s->bytes = bytes / p->data.or.n;
+      s->probe = p->data.or.first ? 1 : 1 + tried;
+      break;
+    
+    default: break;
+  }
+  
+}
+
+void mpc_stats(mpc_parser_t* p) {
+  mpc_stats_t s;
+  mpc_stats_unretained(p, 1, &s);
+  printf("Stats\n");
+  printf("=====\n");
+  printf("Node Count: %i\n", s.nodes);
+  printf("Depth: %i\n", s.depth);
+  printf("Calls Per Byte: %.2f\n", s.bytes > 0 ? s.calls / s.bytes : s.calls);
+}
+
+mpc_profile_t *mpc_profile_new(void) {
+  mpc_profile_t *f = malloc(sizeof(mpc_profile_t));
+  f->rules_num = 0;
+  f->rules_slots = 0;
+  f->rules = NULL;
+  f->table = NULL;
+  return f;
+}
+
+void mpc_profile_delete(mpc_profile_t *f) {
+  int j;
+  for (j = 0; j < f->rules_num; j++) { free(f->rules[j].name); }
+  free(f->rules);
+  free(f->table);
+  free(f);
+}
+
+/*
+** Rules are printed most exclusive time first,
+** as those are where the parse spends its time.
+*/
+
+static int mpc_profile_cmp(const void *a, const void *b) {
+  const mpc_profile_rule_t *x = *(mpc_profile_rule_t* const*)a;
+  const mpc_profile_rule_t *y = *(mpc_profile_rule_t* const*)b;
+  if (x->exclusive != y->exclusive) { return x->exclusive < y->exclusive ? 1 : -1; }
+  return strcmp(x->name, y->name);
+}
+
+static mpc_profile_rule_t **mpc_profile_sorted(mpc_profile_t *f) {
+  int j;
+  mpc_profile_rule_t **xs = malloc(sizeof(mpc_profile_rule_t*) * (f->rules_num + 1));
+  for (j = 0; j < f->rules_num; j++) { xs[j] = &f->rules[j]; }
+  qsort(xs, (size_t)f->rules_num, sizeof(mpc_profile_rule_t*), mpc_profile_cmp);
+  return xs;
+}
+
+void mpc_profile_print(mpc_profile_t *f) {
+  mpc_profile_print_to(f, stdout);
+}
+
+void mpc_profile_print_to(mpc_profile_t *f, FILE *fp) {
+  
+  int j;
+  mpc_profile_rule_t *x, **xs = mpc_profile_sorted(f);
+  
+  fprintf(fp, "%-16s %10s %10s %10s %10s %10s %12s %12s\n", "Rule", 
+    "Calls", "Successes", "Failures", "Bytes", "Rewinds", "Incl (ms)", "Excl (ms)");
+  
+  for (j = 0; j < f->rules_num; j++) {
+    x = xs[j];
+    fprintf(fp, "%-16s %10lu %10lu %10lu %10lu %10lu %12.3f %12.3f\n", x->name, 
+      x->calls, x->successes, x->failures, x->bytes, x->rewinds,
+      x->inclusive * 1000.0, x->exclusive * 1000.0);
+  }
+  
+  free(xs);
+}
+
+static void mpc_profile_print_name(const char *s, FILE *fp) {
+  fputc('"', fp);
+  for (; *s; s++) {
+    if (*s == '"' || *s == '\\') { fprintf(fp, "\\%c", *s); }
+    else if ((unsigned char)*s < 0x20) { fprintf(fp, "\\u%04x", (unsigned char)*s); }
+    else { fputc(*s, fp); }
+  }
+  fputc('"', fp);
+}
+
+void mpc_profile_print_json_to(mpc_profile_t *f, FILE *fp) {
+  
+  int j;
+  mpc_profile_rule_t *x, **xs = mpc_profile_sorted(f);
+  
+  fprintf(fp, "[");
+  for (j = 0; j < f->rules_num; j++) {
+    x = xs[j];
+    fprintf(fp, "%s\n  {\"rule\": ", j ? "," : "");
+    mpc_profile_print_name(x->name, fp);
+    fprintf(fp, ", \"calls\": %lu, \"successes\": %lu, \"failures\": %lu, "
+      "\"bytes\": %lu, \"rewinds\": %lu, \"inclusive_ms\": %.6f, \"exclusive_ms\": %.6f}",
+      x->calls, x->successes, x->failures, x->bytes, x->rewinds,
+      x->inclusive * 1000.0, x->exclusive * 1000.0);
+  }
+  fprintf(fp, "%s]\n", f->rules_num ? "\n" : "");
+  
+  free(xs);
+}
+
+/*
+** Character parsers as their constructors build
+** them, which can be built again from what they
+** match without changing what they report.
+*/
+
+static mpc_parser_t *mpc_optimise_plain(mpc_parser_t *p) {
+  
+  int plain;
+  char *m;
+  mpc_parser_t *x;
+  
+  if (p->retained || p->type != MPC_TYPE_EXPECT) { return NULL; }
+  
+  x = p->data.expect.x;
+  if (x->retained) { return NULL; }
+  
+  switch (x->type) {
+    case MPC_TYPE_SINGLE:
+      if (x->data.single.x == '\0') { return NULL; }
+      m = malloc(4);
+      sprintf(m, "'%c'", x->data.single.x);
+      break;
+    case MPC_TYPE_RANGE:
+      if (x->data.range.x == '\0') { return NULL; }
+      m = malloc(64);
+      sprintf(m, "character between '%c' and '%c'", x->data.range.x, x->data.range.y);
+      break;
+    case MPC_TYPE_ONEOF:
+      m = malloc(strlen(x->data.oneof.x) + 10);
+      sprintf(m, "one of '%s'", x->data.oneof.x);
+      break;
+    case MPC_TYPE_STRING:
+      m = malloc(strlen(x->data.string.x) + 3);
+      sprintf(m, "\"%s\"", x->data.string.x);
+      break;
+    default: return NULL;
+  }
+  
+  plain = strcmp(m, p->data.expect.m) == 0;
+  free(m);
+  return plain ? x : NULL;
+}
+
+static int mpc_optimise_equal(mpc_parser_t *a, mpc_parser_t *b) {
+  
+  if (a == b) { return 1; }
+  if (a->retained || b->retained || a->type != b->type) { return 0; }
+  
+  switch (a->type) {
+    case MPC_TYPE_EXPECT:
+      return strcmp(a->data.expect.m, b->data.expect.m) == 0
+        && mpc_optimise_equal(a->data.expect.x, b->data.expect.x);
+    case MPC_TYPE_ANY:    return 1;
+    case MPC_TYPE_SINGLE: return a->data.single.x == b->data.single.x;
+    case MPC_TYPE_RANGE:  return a->data.range.x == b->data.range.x && a->data.range.y == b->data.range.y;
+    case MPC_TYPE_STRING: return strcmp(a->data.string.x, b->data.string.x) == 0;
+    case MPC_TYPE_ONEOF:
+    case MPC_TYPE_NONEOF: return strcmp(a->data.oneof.x, b->data.oneof.x) == 0;
+    default: return 0;
+  }
+  
+}
+
+/* Replaces the contents of `p` with its only child `t` */
+static void mpc_optimise_collapse(mpc_parser_t *p, mpc_parser_t *t) {
+  if (p->type == MPC_TYPE_OR) { free(p->data.or.xs); free(p->data.or.first); }
+  if (p->type == MPC_TYPE_AND) { free(p->data.and.xs); free(p->data.and.dxs); }
+  p->type = t->type;
+  p->data = t->data;
+  free(t->name); free(t);
+}
+
+/* Removes child `j` of an `or` or `and`, putting `t` in place of child `j-1` */
+static void mpc_optimise_replace(mpc_parser_t *p, int j, mpc_parser_t *t) {
+  int *n = p->type == MPC_TYPE_OR ? &p->data.or.n : &p->data.and.n;
+  mpc_parser_t **xs = p->type == MPC_TYPE_OR ? p->data.or.xs : p->data.and.xs;
+  xs[j-1] = t;
+  memmove(xs + j, xs + j + 1, (*n - j - 1) * sizeof(mpc_parser_t*));
+  (*n)--;
+  if (*n == 1) { mpc_optimise_collapse(p, t); }
+}
+
+static const char *mpc_optimise_text(mpc_parser_t *p, char *buffer) {
+  mpc_parser_t *x = mpc_optimise_plain(p);
+  if (x && x->type == MPC_TYPE_SINGLE) { buffer[0] = x->data.single.x; buffer[1] = '\0'; return buffer; }
+  if (x && x->type == MPC_TYPE_STRING) { return x->data.string.x; }
+  return NULL;
+}
+
+static mpc_parser_t *mpc_optimise_textual(const char *s) {
+  return s[1] == '\0' ? mpc_char(s[0]) : mpc_string(s);
+}
+
+static int mpc_optimise_has(mpc_parser_t *x, char c) {
+  switch (x->type) {
+    case MPC_TYPE_SINGLE: return c == x->data.single.x;
+    case MPC_TYPE_RANGE:  return c >= x->data.range.x && c <= x->data.range.y;
+    case MPC_TYPE_ONEOF:  return mpc_class_has(x->data.oneof.c, c);
+    default: return 0;
   }
-  return mpca_count(num, xs[0]);
 }
 
-static mpc_val_t *mpcaf_grammar_string(mpc_val_t *x, void *s) {
-  mpca_grammar_st_t *st = s;
-  char *y = mpcf_unescape(x);
-  mpc_parser_t *p = (st->flags & MPCA_LANG_WHITESPACE_SENSITIVE) ? mpc_string(y) : mpc_tok(mpc_string(y));
-  free(y);
-  return mpca_state(mpca_tag(mpc_apply(p, mpcf_str_ast), "string"));
+/*
+** The part of a re alternative a common prefix
+** can be hoisted from, which is either the first
+** parser of an `and` or the whole alternative if
+** it matches only text.
+*/
+
+static mpc_parser_t *mpc_optimise_head(mpc_parser_t *p) {
+  char buffer[2];
+  if (mpc_optimise_text(p, buffer)) { return p; }
+  if (p->type == MPC_TYPE_AND && !p->retained
+  &&  p->data.and.f == mpcf_strfold && p->data.and.n >= 2) { return p->data.and.xs[0]; }
+  return NULL;
 }
 
-static mpc_val_t *mpcaf_grammar_char(mpc_val_t *x, void *s) {
-  mpca_grammar_st_t *st = s;
-  char *y = mpcf_unescape(x);
-  mpc_parser_t *p = (st->flags & MPCA_LANG_WHITESPACE_SENSITIVE) ? mpc_char(y[0]) : mpc_tok(mpc_char(y[0]));
-  free(y);
-  return mpca_state(mpca_tag(mpc_apply(p, mpcf_str_ast), "char"));
+/*
+** Gives the number of characters of text both
+** alternatives start with, or -1 if they start
+** with the same parser of some other kind.
+*/
+
+static int mpc_optimise_common(mpc_parser_t *a, mpc_parser_t *b) {
+  
+  int k;
+  char ba[2], bb[2];
+  const char *sa, *sb;
+  mpc_parser_t *ha = mpc_optimise_head(a);
+  mpc_parser_t *hb = mpc_optimise_head(b);
+  
+  if (!ha || !hb) { return 0; }
+  
+  sa = mpc_optimise_text(ha, ba);
+  sb = mpc_optimise_text(hb, bb);
+  if (!sa || !sb) { return ha != a && hb != b && mpc_optimise_equal(ha, hb) ? -1 : 0; }
+  
+  for (k = 0; sa[k] && sa[k] == sb[k]; k++);
+  
+  /* An alternative can't be left matching nothing */
+  if ((ha == a && !sa[k]) || (hb == b && !sb[k])) { return 0; }
+  
+  return k;
+}
+
+/* Removes the common prefix from an alternative */
+static mpc_parser_t *mpc_optimise_split(mpc_parser_t *p, int k) {
+  
+  char buffer[2];
+  mpc_parser_t *h = mpc_optimise_head(p);
+  const char *s = k > 0 ? mpc_optimise_text(h, buffer) : NULL;
+  mpc_parser_t *t;
+  
+  if (s && s[k]) {
+    t = mpc_optimise_textual(s + k);
+    if (h == p) { mpc_delete(p); return t; }
+    mpc_delete(h);
+    p->data.and.xs[0] = t;
+    return p;
+  }
+  
+  if (!h->retained) { mpc_delete(h); }
+  
+  if (p->data.and.n == 2) {
+    t = p->data.and.xs[1];
+    free(p->data.and.xs); free(p->data.and.dxs); free(p->name); free(p);
+    return t;
+  }
+  
+  memmove(p->data.and.xs, p->data.and.xs + 1, (p->data.and.n - 1) * sizeof(mpc_parser_t*));
+  p->data.and.n--;
+  return p;
+}
+
+static void mpc_optimise_unretained(mpc_parser_t *p, int force);
+
+static mpc_parser_t *mpc_optimise_hoist(mpc_parser_t *a, mpc_parser_t *b, int k) {
+  
+  char buffer[2];
+  char *s;
+  mpc_parser_t *x, *t;
+  
+  if (k > 0) {
+    s = malloc(k + 1);
+    memcpy(s, mpc_optimise_text(mpc_optimise_head(a), buffer), k);
+    s[k] = '\0';
+    x = mpc_optimise_textual(s);
+    free(s);
+  } else {
+    x = mpc_copy(mpc_optimise_head(a));
+  }
+  
+  t = mpc_and(2, mpcf_strfold, x,
+    mpc_or(2, mpc_optimise_split(a, k), mpc_optimise_split(b, k)), free);
+  mpc_optimise_unretained(t, 0);
+  return t;
+}
+
+/*
+** A token is a literal, class or regex followed
+** by optional whitespace, which is what `mpc_tok`
+** and `mpc_sym` build and what literals in a
+** grammar become unless it is whitespace
+** sensitive. These match whole tokens in one
+** step, like the scan of a separate lexer would.
+*/
+
+static int mpc_token_head(mpc_parser_t *p) {
+  
+  if (p->type == MPC_TYPE_EXPECT && !p->retained) { p = p->data.expect.x; }
+  if (p->retained) { return 0; }
+  
+  switch (p->type) {
+    case MPC_TYPE_SINGLE:
+    case MPC_TYPE_RANGE:
+    case MPC_TYPE_ONEOF:
+    case MPC_TYPE_NONEOF:
+    case MPC_TYPE_STRING:
+    case MPC_TYPE_DFA: return 1;
+    default: return 0;
+  }
+  
+}
+
+static mpc_parser_t *mpc_token_strip(mpc_parser_t *p) {
+  while (p->type == MPC_TYPE_EXPECT && !p->retained) { p = p->data.expect.x; }
+  return p->retained ? NULL : p;
+}
+
+/* Returns the class of whitespace skipped by `mpc_blank` */
+static mpc_class_t *mpc_token_blank(mpc_parser_t *p) {
+  
+  p = mpc_token_strip(p);
+  if (!p || p->type != MPC_TYPE_APPLY || p->data.apply.f != mpcf_free) { return NULL; }
+  
+  p = mpc_token_strip(p->data.apply.x);
+  if (!p || p->type != MPC_TYPE_MANY || p->data.repeat.f != mpcf_strfold) { return NULL; }
+  
+  p = mpc_token_strip(p->data.repeat.x);
+  if (!p || (p->type != MPC_TYPE_ONEOF && p->type != MPC_TYPE_NONEOF)) { return NULL; }
+  
+  return p->data.oneof.c;
+}
+
+static int mpc_token_and(mpc_parser_t *p) {
+  return p->type == MPC_TYPE_AND && p->data.and.n == 2
+    && (p->data.and.f == mpcf_fst || p->data.and.f == mpcf_fst_free)
+    && mpc_token_head(p->data.and.xs[0])
+    && mpc_token_blank(p->data.and.xs[1]) != NULL;
+}
+
+static void mpc_optimise_unretained(mpc_parser_t *p, int force) {
+  
+  int i, n, m;
+  char ba[2], bb[2];
+  const char *sa = NULL, *sb = NULL;
+  char *s;
+  mpc_parser_t *a = NULL, *b = NULL, *t;
+  
+  if (p->retained && !force) { return; }
+  
+  /* Optimise Subexpressions */
+  
+  if (p->type == MPC_TYPE_EXPECT)   { mpc_optimise_unretained(p->data.expect.x, 0); }
+  if (p->type == MPC_TYPE_APPLY)    { mpc_optimise_unretained(p->data.apply.x, 0); }
+  if (p->type == MPC_TYPE_APPLY_TO) { mpc_optimise_unretained(p->data.apply_to.x, 0); }
+  if (p->type == MPC_TYPE_PREDICT)  { mpc_optimise_unretained(p->data.predict.x, 0); }
+  if (p->type == MPC_TYPE_PACKRAT)  { mpc_optimise_unretained(p->data.packrat.x, 0); }
+  if (p->type == MPC_TYPE_ARENA)    { mpc_optimise_unretained(p->data.arena.x, 0); }
+  if (p->type == MPC_TYPE_DFA)      { mpc_optimise_unretained(p->data.dfa.x, 0); }
+  if (p->type == MPC_TYPE_NOT)      { mpc_optimise_unretained(p->data.not.x, 0); }
+  if (p->type == MPC_TYPE_MAYBE)    { mpc_optimise_unretained(p->data.not.x, 0); }
+  if (p->type == MPC_TYPE_MANY)     { mpc_optimise_unretained(p->data.repeat.x, 0); }
+  if (p->type == MPC_TYPE_MANY1)    { mpc_optimise_unretained(p->data.repeat.x, 0); }
+  if (p->type == MPC_TYPE_COUNT)    { mpc_optimise_unretained(p->data.repeat.x, 0); }
+  
+  if (p->type == MPC_TYPE_OR) { 
+    for(i = 0; i < p->data.or.n; i++) {
+      mpc_optimise_unretained(p->data.or.xs[i], 0);
+    }
+  }
+  
+  if (p->type == MPC_TYPE_AND) {
+    for(i = 0; i < p->data.and.n; i++) {
+      mpc_optimise_unretained(p->data.and.xs[i], 0);
+    }
+  }  
+  
+  /* The `and` of a token is already fused so only its parts are optimised */
+  if (p->type == MPC_TYPE_TOKEN) {
+    mpc_optimise_unretained(p->data.token.x->data.and.xs[0], 0);
+    mpc_optimise_unretained(p->data.token.x->data.and.xs[1], 0);
+  }
+  
+  /* Perform optimisations */
+  
+  while (1) {
+    
+    /* Merge rhs `or` */
+    if (p->type == MPC_TYPE_OR
+    &&  p->data.or.xs[p->data.or.n-1]->type == MPC_TYPE_OR
+    && !p->data.or.xs[p->data.or.n-1]->retained) {
+      t = p->data.or.xs[p->data.or.n-1];
+      n = p->data.or.n; m = t->data.or.n;
+      p->data.or.n = n + m - 1;
+      p->data.or.xs = realloc(p->data.or.xs, sizeof(mpc_parser_t*) * (n + m -1));
+      memmove(p->data.or.xs + n - 1, t->data.or.xs, m * sizeof(mpc_parser_t*));
+      free(t->data.or.xs); free(t->data.or.first); free(t->name); free(t);
+      continue;
+    }
+
+    /* Merge lhs `or` */
+    if (p->type == MPC_TYPE_OR
+    &&  p->data.or.xs[0]->type == MPC_TYPE_OR
+    && !p->data.or.xs[0]->retained) {
+      t = p->data.or.xs[0];
+      n = p->data.or.n; m = t->data.or.n;
+      p->data.or.n = n + m - 1;
+      p->data.or.xs = realloc(p->data.or.xs, sizeof(mpc_parser_t*) * (n + m -1));
+      memmove(p->data.or.xs + m, p->data.or.xs + 1, (n - 1) * sizeof(mpc_parser_t*));
+      memmove(p->data.or.xs, t->data.or.xs, m * sizeof(mpc_parser_t*));
+      free(t->data.or.xs); free(t->data.or.first); free(t->name); free(t);
+      continue;
+    }
+    
+    /* Remove ast `pass` */
+    if (p->type == MPC_TYPE_AND
+    &&  p->data.and.n == 2
+    &&  p->data.and.xs[0]->type == MPC_TYPE_PASS
+    && !p->data.and.xs[0]->retained
+    &&  p->data.and.f == mpcf_fold_ast) {
+      t = p->data.and.xs[1];
+      mpc_delete(p->data.and.xs[0]);
+      free(p->data.and.xs); free(p->data.and.dxs); free(p->name);
+      memcpy(p, t, sizeof(mpc_parser_t));
+      free(t);
+      continue;
+    }
+    
+    /* Merge ast lhs `and` */
+    if (p->type == MPC_TYPE_AND
+    &&  p->data.and.f == mpcf_fold_ast
+    &&  p->data.and.xs[0]->type == MPC_TYPE_AND
+    && !p->data.and.xs[0]->retained
+    &&  p->data.and.xs[0]->data.and.f == mpcf_fold_ast) {
+      t = p->data.and.xs[0];
+      n = p->data.and.n; m = t->data.and.n;
+      p->data.and.n = n + m - 1;
+      p->data.and.xs = realloc(p->data.and.xs, sizeof(mpc_parser_t*) * (n + m - 1));
+      p->data.and.dxs = realloc(p->data.and.dxs, sizeof(mpc_dtor_t) * (n + m - 1 - 1));
+      memmove(p->data.and.xs + m, p->data.and.xs + 1, (n - 1) * sizeof(mpc_parser_t*));
+      memmove(p->data.and.xs, t->data.and.xs, m * sizeof(mpc_parser_t*));
+      for (i = 0; i < p->data.and.n-1; i++) { p->data.and.dxs[i] = (mpc_dtor_t)mpc_ast_delete; }
+      free(t->data.and.xs); free(t->data.and.dxs); free(t->name); free(t); 
+      continue;
+    }
+    
+    /* Merge ast rhs `and` */
+    if (p->type == MPC_TYPE_AND
+    &&  p->data.and.f == mpcf_fold_ast
+    &&  p->data.and.xs[p->data.and.n-1]->type == MPC_TYPE_AND
+    && !p->data.and.xs[p->data.and.n-1]->retained
+    &&  p->data.and.xs[p->data.and.n-1]->data.and.f == mpcf_fold_ast) {
+      t = p->data.and.xs[p->data.and.n-1];
+      n = p->data.and.n; m = t->data.and.n;
+      p->data.and.n = n + m - 1;
+      p->data.and.xs = realloc(p->data.and.xs, sizeof(mpc_parser_t*) * (n + m -1));
+      p->data.and.dxs = realloc(p->data.and.dxs, sizeof(mpc_dtor_t) * (n + m - 1 - 1));
+      memmove(p->data.and.xs + n - 1, t->data.and.xs, m * sizeof(mpc_parser_t*));
+      for (i = 0; i < p->data.and.n-1; i++) { p->data.and.dxs[i] = (mpc_dtor_t)mpc_ast_delete; }
+      free(t->data.and.xs); free(t->data.and.dxs); free(t->name); free(t); 
+      continue;
+    }
+
+    /* Remove re `lift` */
+    if (p->type == MPC_TYPE_AND
+    &&  p->data.and.n == 2
+    &&  p->data.and.xs[0]->type == MPC_TYPE_LIFT
+    &&  p->data.and.xs[0]->data.lift.lf == mpcf_ctor_str
+    && !p->data.and.xs[0]->retained
+    &&  p->data.and.f == mpcf_strfold) {
+      t = p->data.and.xs[1];
+      mpc_delete(p->data.and.xs[0]);
+      free(p->data.and.xs); free(p->data.and.dxs); free(p->name);
+      memcpy(p, t, sizeof(mpc_parser_t));
+      free(t);
+      continue;
+    }
+
+    /* Merge re lhs `and` */
+    if (p->type == MPC_TYPE_AND
+    &&  p->data.and.f == mpcf_strfold
+    &&  p->data.and.xs[0]->type == MPC_TYPE_AND
+    && !p->data.and.xs[0]->retained
+    &&  p->data.and.xs[0]->data.and.f == mpcf_strfold) {
+      t = p->data.and.xs[0];
+      n = p->data.and.n; m = t->data.and.n;
+      p->data.and.n = n + m - 1;
+      p->data.and.xs = realloc(p->data.and.xs, sizeof(mpc_parser_t*) * (n + m - 1));
+      p->data.and.dxs = realloc(p->data.and.dxs, sizeof(mpc_dtor_t) * (n + m - 1 - 1));
+      memmove(p->data.and.xs + m, p->data.and.xs + 1, (n - 1) * sizeof(mpc_parser_t*));
+      memmove(p->data.and.xs, t->data.and.xs, m * sizeof(mpc_parser_t*));
+      for (i = 0; i < p->data.and.n-1; i++) { p->data.and.dxs[i] = free; }
+      free(t->data.and.xs); free(t->data.and.dxs); free(t->name); free(t); 
+      continue;
+    }
+    
+    /* Merge re rhs `and` */
+    if (p->type == MPC_TYPE_AND
+    &&  p->data.and.f == mpcf_strfold
+    &&  p->data.and.xs[p->data.and.n-1]->type == MPC_TYPE_AND
+    && !p->data.and.xs[p->data.and.n-1]->retained
+    &&  p->data.and.xs[p->data.and.n-1]->data.and.f == mpcf_strfold) {
+      t = p->data.and.xs[p->data.and.n-1];
+      n = p->data.and.n; m = t->data.and.n;
+      p->data.and.n = n + m - 1;
+      p->data.and.xs = realloc(p->data.and.xs, sizeof(mpc_parser_t*) * (n + m -1));
+      p->data.and.dxs = realloc(p->data.and.dxs, sizeof(mpc_dtor_t) * (n + m - 1 - 1));
+      memmove(p->data.and.xs + n - 1, t->data.and.xs, m * sizeof(mpc_parser_t*));
+      for (i = 0; i < p->data.and.n-1; i++) { p->data.and.dxs[i] = free; }
+      free(t->data.and.xs); free(t->data.and.dxs); free(t->name); free(t); 
+      continue;
+    }
+    
+    /* Remove inner `expect` */
+    if (p->type == MPC_TYPE_EXPECT
+    &&  p->data.expect.x->type == MPC_TYPE_EXPECT
+    && !p->data.expect.x->retained) {
+      t = p->data.expect.x;
+      p->data.expect.x = t->data.expect.x;
+      free(t->data.expect.m); free(t->name); free(t);
+      continue;
+    }
+    
+    /* Fuse re `and` of characters into `string` */
+    if (p->type == MPC_TYPE_AND
+    &&  p->data.and.f == mpcf_strfold) {
+      for (i = 1; i < p->data.and.n; i++) {
+        sa = mpc_optimise_text(p->data.and.xs[i-1], ba);
+        sb = mpc_optimise_text(p->data.and.xs[i], bb);
+        if (sa && sb) { break; }
+      }
+      if (i < p->data.and.n) {
+        n = (int)strlen(sa); m = (int)strlen(sb);
+        s = malloc(n + m + 1);
+        memcpy(s, sa, n); memcpy(s + n, sb, m + 1);
+        t = mpc_string(s);
+        free(s);
+        mpc_delete(p->data.and.xs[i-1]);
+        mpc_delete(p->data.and.xs[i]);
+        mpc_optimise_replace(p, i, t);
+        continue;
+      }
+    }
+    
+    /* Merge `or` of characters into `oneof` */
+    if (p->type == MPC_TYPE_OR) {
+      for (i = 1; i < p->data.or.n; i++) {
+        a = mpc_optimise_plain(p->data.or.xs[i-1]);
+        b = mpc_optimise_plain(p->data.or.xs[i]);
+        if (a && b && a->type != MPC_TYPE_STRING && b->type != MPC_TYPE_STRING) { break; }
+      }
+      if (i < p->data.or.n) {
+        s = malloc(256);
+        for (n = 1, m = 0; n < 256; n++) {
+          if (mpc_optimise_has(a, (char)n) || mpc_optimise_has(b, (char)n)) { s[m++] = (char)n; }
+        }
+        s[m] = '\0';
+        t = mpc_oneof(s);
+        free(s);
+        mpc_delete(p->data.or.xs[i-1]);
+        mpc_delete(p->data.or.xs[i]);
+        mpc_optimise_replace(p, i, t);
+        continue;
+      }
+    }
+    
+    /* Hoist common prefix out of re alternatives */
+    if (p->type == MPC_TYPE_OR) {
+      for (i = 1, n = 0; i < p->data.or.n && !n; i++) {
+        n = mpc_optimise_common(p->data.or.xs[i-1], p->data.or.xs[i]);
+      }
+      if (n) {
+        i--;
+        t = mpc_optimise_hoist(p->data.or.xs[i-1], p->data.or.xs[i], n);
+        mpc_optimise_replace(p, i, t);
+        continue;
+      }
+    }
+    
+    /* Fuse `and` of token and whitespace into `token` */
+    if (p->type == MPC_TYPE_AND && !p->retained && mpc_token_and(p)) {
+      t = malloc(sizeof(mpc_parser_t));
+      memcpy(t, p, sizeof(mpc_parser_t));
+      p->type = MPC_TYPE_TOKEN;
+      p->data.token.x = t;
+      p->data.token.c = mpc_class_copy(mpc_token_blank(t->data.and.xs[1]));
+      continue;
+    }
+    
+    return;
+    
+  }
+  
 }
 
-static mpc_val_t *mpcaf_grammar_regex(mpc_val_t *x, void *s) {
-  mpca_grammar_st_t *st = s;
-  char *y = mpcf_unescape_regex(x);
-  mpc_parser_t *p = (st->flags & MPCA_LANG_WHITESPACE_SENSITIVE) ? mpc_re(y) : mpc_tok(mpc_re(y));
-  free(y);
-  return mpca_state(mpca_tag(mpc_apply(p, mpcf_str_ast), "regex"));
-}
+/*
+** The FIRST set of a parser is every character
+** it might consume first. The return value says
+** if it might also succeed without consuming
+** anything, in which case whatever follows it
+** could start instead. Parsers that can't be
+** seen through, such as undefined rules or rules
+** already being looked at, can start with any
+** character, and a budget keeps grammars with
+** many nullable rules from taking too long.
+*/
 
-/* Should this just use `isdigit` instead? */
-static int is_number(const char* s) {
-  size_t i;
-  for (i = 0; i < strlen(s); i++) { if (!strchr("0123456789", s[i])) { return 0; } }
+enum {
+  MPC_FIRST_DEPTH_MAX = 64,
+  MPC_FIRST_BUDGET    = 4096
+};
+
+typedef struct {
+  mpc_parser_t *rules[MPC_FIRST_DEPTH_MAX];
+  int rules_num;
+  int budget;
+} mpc_first_st_t;
+
+static int mpc_first_all(mpc_class_t *c) {
+  memset(c->map, 0xFF, sizeof(c->map));
   return 1;
 }
 
-static mpc_parser_t *mpca_grammar_find_parser(char *x, mpca_grammar_st_t *st) {
+static int mpc_first_type(mpc_parser_t *p, mpc_class_t *c, mpc_first_st_t *st);
+
+static int mpc_first(mpc_parser_t *p, mpc_class_t *c, mpc_first_st_t *st) {
   
-  int i;
-  mpc_parser_t *p;
+  int j, r;
   
-  /* Case of Number */
-  if (is_number(x)) {
+  if (st->budget-- <= 0) { return mpc_first_all(c); }
+  if (!p->retained) { return mpc_first_type(p, c, st); }
+  
+  for (j = 0; j < st->rules_num; j++) {
+    if (st->rules[j] == p) { return mpc_first_all(c); }
+  }
+  if (st->rules_num == MPC_FIRST_DEPTH_MAX) { return mpc_first_all(c); }
+  
+  st->rules[st->rules_num++] = p;
+  r = mpc_first_type(p, c, st);
+  st->rules_num--;
+  return r;
+}
 
-    i = strtol(x, NULL, 10);
+static int mpc_first_type(mpc_parser_t *p, mpc_class_t *c, mpc_first_st_t *st) {
+  
+  int j, r;
+  
+  switch (p->type) {
     
-    while (st->parsers_num <= i) {
-      st->parsers_num++;
-      st->parsers = realloc(st->parsers, sizeof(mpc_parser_t*) * st->parsers_num);
-      st->parsers[st->parsers_num-1] = va_arg(*st->va, mpc_parser_t*);
-      if (st->parsers[st->parsers_num-1] == NULL) {
-        return mpc_failf("No Parser in position %i! Only supplied %i Parsers!", i, st->parsers_num);
-      }
-    }
+    case MPC_TYPE_SINGLE: mpc_class_add(c, (unsigned char)p->data.single.x); return 0;
     
-    return st->parsers[st->parsers_num-1];
-  
-  /* Case of Identifier */
-  } else {
+    case MPC_TYPE_RANGE:
+      for (j = (unsigned char)p->data.range.x; j <= (unsigned char)p->data.range.y; j++) { mpc_class_add(c, j); }
+      return 0;
     
-    /* Search Existing Parsers */
-    for (i = 0; i < st->parsers_num; i++) {
-      mpc_parser_t *q = st->parsers[i];
-      if (q == NULL) { return mpc_failf("Unknown Parser '%s'!", x); }
-      if (q->name && strcmp(q->name, x) == 0) { return q; }
-    }
+    case MPC_TYPE_ONEOF:
+    case MPC_TYPE_NONEOF:
+      for (j = 0; j < 32; j++) { c->map[j] |= p->data.oneof.c->map[j]; }
+      return 0;
     
-    /* Search New Parsers */
-    while (1) {
+    case MPC_TYPE_STRING:
+      if (p->data.string.x[0] == '\0') { return 1; }
+      mpc_class_add(c, (unsigned char)p->data.string.x[0]);
+      return 0;
     
-      p = va_arg(*st->va, mpc_parser_t*);
-      
-      st->parsers_num++;
-      st->parsers = realloc(st->parsers, sizeof(mpc_parser_t*) * st->parsers_num);
-      st->parsers[st->parsers_num-1] = p;
-      
-      if (p == NULL || p->name == NULL) { return mpc_failf("Unknown Parser '%s'!", x); }
-      if (p->name && strcmp(p->name, x) == 0) { return p; }
-      
-    }
-  
-  }  
+    case MPC_TYPE_ANY:
+    case MPC_TYPE_SATISFY: mpc_first_all(c); return 0;
+    
+    case MPC_TYPE_FAIL: return 0;
+    
+    case MPC_TYPE_PASS:
+    case MPC_TYPE_LIFT:
+    case MPC_TYPE_LIFT_VAL:
+    case MPC_TYPE_STATE:
+    case MPC_TYPE_ANCHOR: return 1;
+    
+    case MPC_TYPE_EXPECT:   return mpc_first(p->data.expect.x, c, st);
+    case MPC_TYPE_APPLY:    return mpc_first(p->data.apply.x, c, st);
+    case MPC_TYPE_APPLY_TO: return mpc_first(p->data.apply_to.x, c, st);
+    case MPC_TYPE_PREDICT:  return mpc_first(p->data.predict.x, c, st);
+    case MPC_TYPE_PACKRAT:  return mpc_first(p->data.packrat.x, c, st);
+    case MPC_TYPE_ARENA:    return mpc_first(p->data.arena.x, c, st);
+    case MPC_TYPE_DFA:      return mpc_first(p->data.dfa.x, c, st);
+    case MPC_TYPE_TOKEN:    return mpc_first(p->data.token.x, c, st);
+    
+    case MPC_TYPE_NOT:   return 1;
+    case MPC_TYPE_MAYBE: mpc_first(p->data.not.x, c, st); return 1;
+    case MPC_TYPE_MANY:  mpc_first(p->data.repeat.x, c, st); return 1;
+    case MPC_TYPE_MANY1: return mpc_first(p->data.repeat.x, c, st);
+    case MPC_TYPE_COUNT: return p->data.repeat.n == 0 || mpc_first(p->data.repeat.x, c, st);
+    
+    case MPC_TYPE_OR:
+      r = p->data.or.n == 0;
+      for (j = 0; j < p->data.or.n; j++) { r = mpc_first(p->data.or.xs[j], c, st) || r; }
+      return r;
+    
+    case MPC_TYPE_AND:
+      for (j = 0; j < p->data.and.n; j++) {
+        if (!mpc_first(p->data.and.xs[j], c, st)) { return 0; }
+      }
+      return 1;
+    
+    default: return mpc_first_all(c);
+  }
   
 }
 
-static mpc_val_t *mpcaf_grammar_id(mpc_val_t *x, void *s) {
-  
-  mpca_grammar_st_t *st = s;
-  mpc_parser_t *p = mpca_grammar_find_parser(x, st);
-  free(x);
+/*
+** Builds the dispatch table of an `or`. It is
+** only kept if some character rules out at
+** least one alternative, and rules defined again
+** after it is built need it building again.
+*/
 
-  if (p->name) {
-    return mpca_state(mpca_root(mpca_add_tag(p, p->name)));
-  } else {
-    return mpca_state(mpca_root(p));
+static void mpc_optimise_or(mpc_parser_t *p) {
+  
+  int j, b, useful = 0;
+  unsigned char *t;
+  mpc_class_t c;
+  mpc_first_st_t st;
+  
+  free(p->data.or.first);
+  p->data.or.first = NULL;
+  if (p->data.or.n < 2 || p->data.or.n >= MPC_OR_ALL) { return; }
+  
+  t = malloc(256);
+  memset(t, MPC_OR_NONE, 256);
+  
+  for (j = 0; j < p->data.or.n; j++) {
+    memset(&c, 0, sizeof(mpc_class_t));
+    st.rules_num = 0;
+    st.budget = MPC_FIRST_BUDGET;
+    if (mpc_first(p->data.or.xs[j], &c, &st)) { mpc_first_all(&c); }
+    for (b = 0; b < 256; b++) {
+      if (mpc_class_has(&c, (char)b)) { t[b] = t[b] == MPC_OR_NONE ? (unsigned char)j : MPC_OR_ALL; }
+    }
   }
+  
+  for (b = 0; b < 256; b++) { useful = useful || t[b] != MPC_OR_ALL; }
+  if (useful) { p->data.or.first = t; } else { free(t); }
+  
 }
 
-mpc_parser_t *mpca_grammar_st(const char *grammar, mpca_grammar_st_t *st) {
-  
-  char *err_msg;
-  mpc_parser_t *err_out;
-  mpc_result_t r;
-  mpc_parser_t *GrammarTotal, *Grammar, *Term, *Factor, *Base;
+/*
+** What a parser might do to the input, used to
+** find sequences that never need to go back.
+** It might succeed having moved on, fail, or
+** fail having moved on. Anything which can't be
+** seen through might do all three, and so might
+** anything under `predictive`, where nothing
+** inside goes back when it fails.
+*/
+
+enum {
+  MPC_EFFECT_MOVES = 1,
+  MPC_EFFECT_FAILS = 2,
+  MPC_EFFECT_DIRTY = 4,
+  MPC_EFFECT_ALL   = 7
+};
+
+static int mpc_effect_type(mpc_parser_t *p, mpc_first_st_t *st);
+
+static int mpc_effect(mpc_parser_t *p, mpc_first_st_t *st) {
   
-  GrammarTotal = mpc_new("grammar_total");
-  Grammar = mpc_new("grammar");
-  Term = mpc_new("term");
-  Factor = mpc_new("factor");
-  Base = mpc_new("base");
+  int j, r;
   
-  mpc_define(GrammarTotal,
-    mpc_predictive(mpc_total(Grammar, mpc_soft_delete))
-  );
+  if (st->budget-- <= 0) { return MPC_EFFECT_ALL; }
+  if (!p->retained) { return mpc_effect_type(p, st); }
   
-  mpc_define(Grammar, mpc_and(2, mpcaf_grammar_or,
-    Term,
-    mpc_maybe(mpc_and(2, mpcf_snd_free, mpc_sym("|"), Grammar, free)),
-    mpc_soft_delete
-  ));
+  for (j = 0; j < st->rules_num; j++) {
+    if (st->rules[j] == p) { return MPC_EFFECT_ALL; }
+  }
+  if (st->rules_num == MPC_FIRST_DEPTH_MAX) { return MPC_EFFECT_ALL; }
   
-  mpc_define(Term, mpc_many1(mpcaf_grammar_and, Factor));
+  st->rules[st->rules_num++] = p;
+  r = mpc_effect_type(p, st);
+  st->rules_num--;
+  return r;
+}
+
+/*
+** A sequence only needs a mark if one of its
+** parts might fail after input has been used,
+** whether by a part before it or by itself.
+** Otherwise it always fails where it started.
+*/
+
+static int mpc_effect_and(mpc_parser_t *p, mpc_first_st_t *st, int *unsafe) {
   
-  mpc_define(Factor, mpc_and(2, mpcaf_grammar_repeat,
-    Base,
-      mpc_or(6,
-        mpc_sym("*"),
-        mpc_sym("+"),
-        mpc_sym("?"),
-        mpc_sym("!"),
-        mpc_tok_brackets(mpc_int(), free),
-        mpc_pass()),
-    mpc_soft_delete
-  ));
+  int j, e, r = 0;
   
-  mpc_define(Base, mpc_or(5,
-    mpc_apply_to(mpc_tok(mpc_string_lit()), mpcaf_grammar_string, st),
-    mpc_apply_to(mpc_tok(mpc_char_lit()),   mpcaf_grammar_char, st),
-    mpc_apply_to(mpc_tok(mpc_regex_lit()),  mpcaf_grammar_regex, st),
-    mpc_apply_to(mpc_tok_braces(mpc_or(2, mpc_digits(), mpc_ident()), free), mpcaf_grammar_id, st),
-    mpc_tok_parens(Grammar, mpc_soft_delete)
-  ));
+  *unsafe = 0;
+  for (j = 0; j < p->data.and.n; j++) {
+    e = mpc_effect(p->data.and.xs[j], st);
+    if ((e & MPC_EFFECT_FAILS) && ((e & MPC_EFFECT_DIRTY) || (r & MPC_EFFECT_MOVES))) { *unsafe = 1; }
+    r |= e & (MPC_EFFECT_MOVES | MPC_EFFECT_FAILS);
+  }
+  return r;
+}
+
+static int mpc_effect_type(mpc_parser_t *p, mpc_first_st_t *st) {
   
-  mpc_optimise(GrammarTotal);
-  mpc_optimise(Grammar);
-  mpc_optimise(Factor);
-  mpc_optimise(Term);
-  mpc_optimise(Base);
+  int j, e, r, unsafe;
   
-  if(!mpc_parse("<mpc_grammar_compiler>", grammar, GrammarTotal, &r)) {
-    err_msg = mpc_err_string(r.error);
-    err_out = mpc_failf("Invalid Grammar: %s", err_msg);
-    mpc_err_delete(r.error);
-    free(err_msg);
-    r.output = err_out;
+  switch (p->type) {
+    
+    case MPC_TYPE_ANY:
+    case MPC_TYPE_SINGLE:
+    case MPC_TYPE_RANGE:
+    case MPC_TYPE_ONEOF:
+    case MPC_TYPE_NONEOF:
+    case MPC_TYPE_SATISFY: return MPC_EFFECT_MOVES | MPC_EFFECT_FAILS;
+    
+    case MPC_TYPE_STRING:
+      return p->data.string.x[0] == '\0' ? 0 : MPC_EFFECT_MOVES | MPC_EFFECT_FAILS;
+    
+    case MPC_TYPE_PASS:
+    case MPC_TYPE_LIFT:
+    case MPC_TYPE_LIFT_VAL:
+    case MPC_TYPE_STATE: return 0;
+    
+    case MPC_TYPE_FAIL:
+    case MPC_TYPE_ANCHOR: return MPC_EFFECT_FAILS;
+    
+    case MPC_TYPE_EXPECT:   return mpc_effect(p->data.expect.x, st);
+    case MPC_TYPE_APPLY:    return mpc_effect(p->data.apply.x, st);
+    case MPC_TYPE_APPLY_TO: return mpc_effect(p->data.apply_to.x, st);
+    case MPC_TYPE_PACKRAT:  return mpc_effect(p->data.packrat.x, st);
+    case MPC_TYPE_ARENA:    return mpc_effect(p->data.arena.x, st);
+    case MPC_TYPE_DFA:      return mpc_effect(p->data.dfa.x, st);
+    case MPC_TYPE_TOKEN:    return mpc_effect(p->data.token.x, st);
+    
+    case MPC_TYPE_NOT:
+      e = mpc_effect(p->data.not.x, st);
+      return MPC_EFFECT_FAILS | (e & MPC_EFFECT_DIRTY ? MPC_EFFECT_MOVES : 0);
+    
+    case MPC_TYPE_MAYBE:
+    case MPC_TYPE_MANY:
+      e = p->type == MPC_TYPE_MAYBE ? mpc_effect(p->data.not.x, st) : mpc_effect(p->data.repeat.x, st);
+      return e & (MPC_EFFECT_MOVES | MPC_EFFECT_DIRTY) ? MPC_EFFECT_MOVES : 0;
+    
+    /*
+    ** A count doesn't go back if it runs out part
+    ** way, and a count of zero matches nothing
+    ** without running its parser at all.
+    */
+    
+    case MPC_TYPE_MANY1:
+    case MPC_TYPE_COUNT:
+      if (p->type == MPC_TYPE_COUNT && p->data.repeat.n == 0) { return 0; }
+      e = mpc_effect(p->data.repeat.x, st);
+      r = e & (MPC_EFFECT_MOVES | MPC_EFFECT_DIRTY) ? MPC_EFFECT_MOVES : 0;
+      r |= e & (MPC_EFFECT_FAILS | MPC_EFFECT_DIRTY);
+      if (p->type == MPC_TYPE_COUNT && p->data.repeat.n != 1
+      && (e & MPC_EFFECT_FAILS) && (e & MPC_EFFECT_MOVES)) { r |= MPC_EFFECT_DIRTY; }
+      return r;
+    
+    case MPC_TYPE_OR:
+      if (p->data.or.n == 0) { return 0; }
+      r = MPC_EFFECT_FAILS;
+      for (j = 0; j < p->data.or.n; j++) {
+        e = mpc_effect(p->data.or.xs[j], st);
+        if (e & MPC_EFFECT_DIRTY) { r |= MPC_EFFECT_MOVES | MPC_EFFECT_DIRTY; }
+        r |= e & MPC_EFFECT_MOVES;
+        if (!(e & MPC_EFFECT_FAILS)) { r &= ~MPC_EFFECT_FAILS; }
+      }
+      return r;
+    
+    case MPC_TYPE_AND:
+      if (p->data.and.n == 0) { return 0; }
+      return mpc_effect_and(p, st, &unsafe);
+    
+    default: return MPC_EFFECT_ALL;
   }
   
-  mpc_cleanup(5, GrammarTotal, Grammar, Term, Factor, Base);
+}
+
+/*
+** A parser is textual if its result is always
+** just the text it consumed, so it can run
+** under a `span` parser returning NULL instead.
+** Rules are never counted as they can be
+** defined again.
+*/
+
+static int mpc_textual(mpc_parser_t *p) {
   
-  mpc_optimise(r.output);
+  int j;
   
-  return (st->flags & MPCA_LANG_PREDICTIVE) ? mpc_predictive(r.output) : r.output;
+  if (p->retained) { return 0; }
+  
+  switch (p->type) {
+    case MPC_TYPE_ANY:
+    case MPC_TYPE_SINGLE:
+    case MPC_TYPE_RANGE:
+    case MPC_TYPE_ONEOF:
+    case MPC_TYPE_NONEOF:
+    case MPC_TYPE_SATISFY:
+    case MPC_TYPE_STRING: return 1;
+    
+    case MPC_TYPE_LIFT:   return p->data.lift.lf == mpcf_ctor_str;
+    case MPC_TYPE_EXPECT: return mpc_textual(p->data.expect.x);
+    case MPC_TYPE_DFA:    return mpc_textual(p->data.dfa.x);
+    
+    case MPC_TYPE_NOT:
+      return p->data.not.dx == free && p->data.not.lf == mpcf_ctor_str && mpc_textual(p->data.not.x);
+    case MPC_TYPE_MAYBE:
+      return p->data.not.lf == mpcf_ctor_str && mpc_textual(p->data.not.x);
+    
+    case MPC_TYPE_MANY:
+    case MPC_TYPE_MANY1:
+    case MPC_TYPE_COUNT: return p->data.repeat.span;
+    case MPC_TYPE_AND:   return p->data.and.span;
+    
+    case MPC_TYPE_OR:
+      for (j = 0; j < p->data.or.n; j++) {
+        if (!mpc_textual(p->data.or.xs[j])) { return 0; }
+      }
+      return p->data.or.n > 0;
+    
+    default: return 0;
+  }
   
 }
 
-mpc_parser_t *mpca_grammar(int flags, const char *grammar, ...) {
-  mpca_grammar_st_t st;
-  mpc_parser_t *res;
-  va_list va;
-  va_start(va, grammar);
+/* Marks a `many`, `count` or `and` whose result can be copied from the input */
+static void mpc_optimise_span(mpc_parser_t *p) {
   
-  st.va = &va;
-  st.parsers_num = 0;
-  st.parsers = NULL;
-  st.flags = flags;
+  int j;
+  
+  if (p->type == MPC_TYPE_AND) {
+    p->data.and.span = p->data.and.f == mpcf_strfold && p->data.and.n > 0;
+    for (j = 0; j < p->data.and.n; j++) {
+      if (!mpc_textual(p->data.and.xs[j])) { p->data.and.span = 0; }
+    }
+    for (j = 0; j < p->data.and.n - 1; j++) {
+      if (p->data.and.dxs[j] != free) { p->data.and.span = 0; }
+    }
+  } else {
+    p->data.repeat.span = p->data.repeat.f == mpcf_strfold
+      && (p->type != MPC_TYPE_COUNT || p->data.repeat.dx == free)
+      && mpc_textual(p->data.repeat.x);
+  }
   
-  res = mpca_grammar_st(grammar, &st);  
-  free(st.parsers);
-  va_end(va);
-  return res;
 }
 
-typedef struct {
-  char *ident;
-  char *name;
-  mpc_parser_t *grammar;
-} mpca_stmt_t;
-
-static mpc_val_t *mpca_stmt_afold(int n, mpc_val_t **xs) {
-  mpca_stmt_t *stmt = malloc(sizeof(mpca_stmt_t));
-  stmt->ident = ((char**)xs)[0];
-  stmt->name = ((char**)xs)[1];
-  stmt->grammar = ((mpc_parser_t**)xs)[3];
-  (void) n;
-  free(((char**)xs)[2]);
-  free(((char**)xs)[4]);
+static void mpc_optimise_and(mpc_parser_t *p) {
+  
+  int unsafe;
+  mpc_first_st_t st;
+  
+  st.rules_num = 0;
+  st.budget = MPC_FIRST_BUDGET;
+  mpc_effect_and(p, &st, &unsafe);
+  p->data.and.nomark = !unsafe;
   
-  return stmt;
 }
 
-static mpc_val_t *mpca_stmt_fold(int n, mpc_val_t **xs) {
+static void mpc_optimise_dispatch(mpc_parser_t *p, int force) {
   
   int i;
-  mpca_stmt_t **stmts = malloc(sizeof(mpca_stmt_t*) * (n+1));
   
-  for (i = 0; i < n; i++) {
-    stmts[i] = xs[i];
+  if (p->retained && !force) { return; }
+  
+  switch (p->type) {
+    case MPC_TYPE_EXPECT:   mpc_optimise_dispatch(p->data.expect.x, 0);   break;
+    case MPC_TYPE_APPLY:    mpc_optimise_dispatch(p->data.apply.x, 0);    break;
+    case MPC_TYPE_APPLY_TO: mpc_optimise_dispatch(p->data.apply_to.x, 0); break;
+    case MPC_TYPE_PREDICT:  mpc_optimise_dispatch(p->data.predict.x, 0);  break;
+    case MPC_TYPE_PACKRAT:  mpc_optimise_dispatch(p->data.packrat.x, 0);  break;
+    case MPC_TYPE_ARENA:    mpc_optimise_dispatch(p->data.arena.x, 0);    break;
+    case MPC_TYPE_DFA:      mpc_optimise_dispatch(p->data.dfa.x, 0);      break;
+    case MPC_TYPE_TOKEN:    mpc_optimise_dispatch(p->data.token.x, 0);    break;
+    case MPC_TYPE_NOT:
+    case MPC_TYPE_MAYBE:    mpc_optimise_dispatch(p->data.not.x, 0);      break;
+    case MPC_TYPE_MANY:
+    case MPC_TYPE_MANY1:
+    case MPC_TYPE_COUNT:
+      mpc_optimise_dispatch(p->data.repeat.x, 0);
+      mpc_optimise_span(p);
+      break;
+    
+    case MPC_TYPE_OR:
+      for (i = 0; i < p->data.or.n; i++) { mpc_optimise_dispatch(p->data.or.xs[i], 0); }
+      mpc_optimise_or(p);
+      break;
+    
+    case MPC_TYPE_AND:
+      for (i = 0; i < p->data.and.n; i++) { mpc_optimise_dispatch(p->data.and.xs[i], 0); }
+      mpc_optimise_and(p);
+      mpc_optimise_span(p);
+      break;
+    
+    default: break;
   }
-  stmts[n] = NULL;  
   
-  return stmts;
 }
 
-static void mpca_stmt_list_delete(mpc_val_t *x) {
+void mpc_optimise(mpc_parser_t *p) {
+  mpc_optimise_unretained(p, 1);
+  mpc_optimise_dispatch(p, 1);
+}
 
-  mpca_stmt_t **stmts = x;
 
-  while(*stmts) {
-    mpca_stmt_t *stmt = *stmts; 
-    free(stmt->ident);
-    free(stmt->name);
-    mpc_soft_delete(stmt->grammar);
-    free(stmt);  
-    stmts++;
+/*
+** Serialization
+**
+** Parsers are written out depth first, each as
+** its type followed by its data. Rules other than
+** the ones being saved can't be, and uses of the
+** saved ones are written as their place in the
+** list. Functions are written as their place in
+** the table below and tags as their place in the
+** tag table, so only grammars built by mpc itself
+** can be saved. New entries must only be added to
+** the end of either table. Numbers are four bytes
+** little endian so a blob can be loaded on any
+** machine.
+*/
+
+enum {
+  MPC_DUMP_VERSION = 3,
+  MPC_DUMP_RULE    = 255
+};
+
+typedef void (*mpc_func_t)(void);
+
+static const mpc_func_t mpc_dump_funcs[] = {
+  (mpc_func_t)free,
+  (mpc_func_t)mpc_delete,
+  (mpc_func_t)mpc_soi_anchor,
+  (mpc_func_t)mpc_eoi_anchor,
+  (mpc_func_t)mpc_boundary_anchor,
+  (mpc_func_t)mpcf_dtor_null,
+  (mpc_func_t)mpcf_ctor_null,
+  (mpc_func_t)mpcf_ctor_str,
+  (mpc_func_t)mpcf_free,
+  (mpc_func_t)mpcf_int,
+  (mpc_func_t)mpcf_hex,
+  (mpc_func_t)mpcf_oct,
+  (mpc_func_t)mpcf_float,
+  (mpc_func_t)mpcf_strtriml,
+  (mpc_func_t)mpcf_strtrimr,
+  (mpc_func_t)mpcf_strtrim,
+  (mpc_func_t)mpcf_escape,
+  (mpc_func_t)mpcf_escape_regex,
+  (mpc_func_t)mpcf_escape_string_raw,
+  (mpc_func_t)mpcf_escape_char_raw,
+  (mpc_func_t)mpcf_unescape,
+  (mpc_func_t)mpcf_unescape_regex,
+  (mpc_func_t)mpcf_unescape_string_raw,
+  (mpc_func_t)mpcf_unescape_char_raw,
+  (mpc_func_t)mpcf_null,
+  (mpc_func_t)mpcf_fst,
+  (mpc_func_t)mpcf_snd,
+  (mpc_func_t)mpcf_trd,
+  (mpc_func_t)mpcf_fst_free,
+  (mpc_func_t)mpcf_snd_free,
+  (mpc_func_t)mpcf_trd_free,
+  (mpc_func_t)mpcf_strfold,
+  (mpc_func_t)mpcf_maths,
+  (mpc_func_t)mpcf_fold_ast,
+  (mpc_func_t)mpcf_str_ast,
+  (mpc_func_t)mpcf_state_ast,
+  (mpc_func_t)mpcf_ast_add_rule,
+  (mpc_func_t)mpc_ast_delete,
+  (mpc_func_t)mpc_ast_copy,
+  (mpc_func_t)mpc_ast_tag,
+  (mpc_func_t)mpc_ast_add_tag,
+  (mpc_func_t)mpc_ast_add_root,
+  (mpc_func_t)mpcaf_list_delete,
+  (mpc_func_t)mpcaf_list_text,
+  (mpc_func_t)mpcaf_list_same,
+  (mpc_func_t)mpcaf_list_same_to,
+  (mpc_func_t)mpcaf_list_fold,
+  (mpc_func_t)mpcaf_list_rule,
+  (mpc_func_t)mpcaf_action_values,
+  (mpc_func_t)mpcaf_action_text,
+  (mpc_func_t)mpcf_ast_share,
+  NULL
+};
+
+static const char *mpc_dump_tags[] = { "string", "char", "regex", NULL };
+
+typedef struct {
+  unsigned char *data;
+  size_t size;
+  size_t slots;
+  int rules_num;
+  mpc_parser_t **rules;
+  int failed;
+} mpc_dump_t;
+
+static void mpc_dump_bytes(mpc_dump_t *d, const void *x, size_t n) {
+  if (d->size + n > d->slots) {
+    while (d->size + n > d->slots) { d->slots = d->slots ? d->slots * 2 : 256; }
+    d->data = realloc(d->data, d->slots);
   }
-  free(x);
+  memcpy(d->data + d->size, x, n);
+  d->size += n;
+}
 
+static void mpc_dump_byte(mpc_dump_t *d, int x) {
+  unsigned char b = (unsigned char)x;
+  mpc_dump_bytes(d, &b, 1);
 }
 
-static mpc_val_t *mpca_stmt_list_apply_to(mpc_val_t *x, void *s) {
+static void mpc_dump_int(mpc_dump_t *d, int x) {
+  unsigned long u = (unsigned long)(long)x;
+  unsigned char b[4];
+  b[0] = (unsigned char)(u & 0xFF);
+  b[1] = (unsigned char)((u >> 8) & 0xFF);
+  b[2] = (unsigned char)((u >> 16) & 0xFF);
+  b[3] = (unsigned char)((u >> 24) & 0xFF);
+  mpc_dump_bytes(d, b, 4);
+}
 
-  mpca_grammar_st_t *st = s;
-  mpca_stmt_t *stmt;
-  mpca_stmt_t **stmts = x;
-  mpc_parser_t *left;
+static void mpc_dump_str(mpc_dump_t *d, const char *s) {
+  int n = (int)strlen(s);
+  mpc_dump_int(d, n);
+  mpc_dump_bytes(d, s, n);
+}
 
-  while(*stmts) {
-    stmt = *stmts;
-    left = mpca_grammar_find_parser(stmt->ident, st);
-    if (st->flags & MPCA_LANG_PREDICTIVE) { stmt->grammar = mpc_predictive(stmt->grammar); }
-    if (stmt->name) { stmt->grammar = mpc_expect(stmt->grammar, stmt->name); }
-    mpc_optimise(stmt->grammar);
-    mpc_define(left, stmt->grammar);
-    free(stmt->ident);
-    free(stmt->name);
-    free(stmt);
-    stmts++;
+static void mpc_dump_func(mpc_dump_t *d, mpc_func_t f) {
+  int i;
+  if (f == NULL) { mpc_dump_int(d, -1); return; }
+  for (i = 0; mpc_dump_funcs[i]; i++) {
+    if (mpc_dump_funcs[i] == f) { mpc_dump_int(d, i); return; }
   }
-  
-  free(x);
-  
-  return NULL;
+  d->failed = 1;
 }
 
-static mpc_err_t *mpca_lang_st(mpc_input_t *i, mpca_grammar_st_t *st) {
-  
-  mpc_result_t r;
-  mpc_err_t *e;
-  mpc_parser_t *Lang, *Stmt, *Grammar, *Term, *Factor, *Base; 
-  
-  Lang    = mpc_new("lang");
-  Stmt    = mpc_new("stmt");
-  Grammar = mpc_new("grammar");
-  Term    = mpc_new("term");
-  Factor  = mpc_new("factor");
-  Base    = mpc_new("base");
-  
-  mpc_define(Lang, mpc_apply_to(
-    mpc_total(mpc_predictive(mpc_many(mpca_stmt_fold, Stmt)), mpca_stmt_list_delete),
-    mpca_stmt_list_apply_to, st
-  ));
-  
-  mpc_define(Stmt, mpc_and(5, mpca_stmt_afold,
-    mpc_tok(mpc_ident()), mpc_maybe(mpc_tok(mpc_string_lit())), mpc_sym(":"), Grammar, mpc_sym(";"),
-    free, free, free, mpc_soft_delete
-  ));
-  
-  mpc_define(Grammar, mpc_and(2, mpcaf_grammar_or,
-      Term,
-      mpc_maybe(mpc_and(2, mpcf_snd_free, mpc_sym("|"), Grammar, free)),
-      mpc_soft_delete
-  ));
-  
-  mpc_define(Term, mpc_many1(mpcaf_grammar_and, Factor));
-  
-  mpc_define(Factor, mpc_and(2, mpcaf_grammar_repeat,
-    Base,
-      mpc_or(6,
-        mpc_sym("*"),
-        mpc_sym("+"),
-        mpc_sym("?"),
-        mpc_sym("!"),
-        mpc_tok_brackets(mpc_int(), free),
-        mpc_pass()),
-    mpc_soft_delete
-  ));
-  
-  mpc_define(Base, mpc_or(5,
-    mpc_apply_to(mpc_tok(mpc_string_lit()), mpcaf_grammar_string, st),
-    mpc_apply_to(mpc_tok(mpc_char_lit()),   mpcaf_grammar_char, st),
-    mpc_apply_to(mpc_tok(mpc_regex_lit()),  mpcaf_grammar_regex, st),
-    mpc_apply_to(mpc_tok_braces(mpc_or(2, mpc_digits(), mpc_ident()), free), mpcaf_grammar_id, st),
-    mpc_tok_parens(Grammar, mpc_soft_delete)
-  ));
-  
-  mpc_optimise(Lang);
-  mpc_optimise(Stmt);
-  mpc_optimise(Grammar);
-  mpc_optimise(Term);
-  mpc_optimise(Factor);
-  mpc_optimise(Base);
-  
-  if (!mpc_parse_input(i, Lang, &r)) {
-    e = r.error;
-  } else {
-    e = NULL;
-  }
-  
-  mpc_cleanup(6, Lang, Stmt, Grammar, Term, Factor, Base);
-  
-  return e;
+static void mpc_dump_class(mpc_dump_t *d, const mpc_class_t *c) {
+  mpc_dump_bytes(d, c->map, sizeof(c->map));
 }
 
-mpc_err_t *mpca_lang_file(int flags, FILE *f, ...) {
-  mpca_grammar_st_t st;
-  mpc_input_t *i;
-  mpc_err_t *err;
+static void mpc_dump_rule(mpc_dump_t *d, mpc_parser_t *p) {
+  int i;
+  for (i = 0; i < d->rules_num; i++) {
+    if (d->rules[i] == p) { mpc_dump_int(d, i); return; }
+  }
+  d->failed = 1;
+}
 
-  va_list va;  
-  va_start(va, f);
+/* Writes the data `apply_to` passes to its function */
+static void mpc_dump_apply_to(mpc_dump_t *d, mpc_parser_t *p) {
   
-  st.va = &va;
-  st.parsers_num = 0;
-  st.parsers = NULL;
-  st.flags = flags;
-  
-  i = mpc_input_new_file("<mpca_lang_file>", f);
-  err = mpca_lang_st(i, &st);
-  mpc_input_delete(i);
+  int i;
+  mpc_apply_to_t f = p->data.apply_to.f;
   
-  free(st.parsers);
-  va_end(va);
-  return err;
-}
-
-mpc_err_t *mpca_lang_pipe(int flags, FILE *p, ...) {
-  mpca_grammar_st_t st;
-  mpc_input_t *i;
-  mpc_err_t *err;
-
-  va_list va;  
-  va_start(va, p);
+  if (f == mpcf_ast_add_rule || f == mpcaf_list_rule
+  ||  f == mpcaf_action_values || f == mpcaf_action_text) {
+    mpc_dump_rule(d, p->data.apply_to.d);
+    return;
+  }
   
-  st.va = &va;
-  st.parsers_num = 0;
-  st.parsers = NULL;
-  st.flags = flags;
+  if (f == (mpc_apply_to_t)mpc_ast_tag || f == (mpc_apply_to_t)mpc_ast_add_tag) {
+    for (i = 0; mpc_dump_tags[i]; i++) {
+      if (strcmp(mpc_dump_tags[i], p->data.apply_to.d) == 0) { mpc_dump_int(d, i); return; }
+    }
+  }
   
-  i = mpc_input_new_pipe("<mpca_lang_pipe>", p);
-  err = mpca_lang_st(i, &st);
-  mpc_input_delete(i);
+  if (f == mpcaf_list_same_to) { return; }
   
-  free(st.parsers);
-  va_end(va);
-  return err;
+  d->failed = 1;
 }
 
-mpc_err_t *mpca_lang(int flags, const char *language, ...) {
+static void mpc_dump_parser(mpc_dump_t *d, mpc_parser_t *p, int force) {
   
-  mpca_grammar_st_t st;
-  mpc_input_t *i;
-  mpc_err_t *err;
+  int i;
   
-  va_list va;  
-  va_start(va, language);
+  if (d->failed) { return; }
   
-  st.va = &va;
-  st.parsers_num = 0;
-  st.parsers = NULL;
-  st.flags = flags;
+  if (p->retained && !force) {
+    mpc_dump_byte(d, MPC_DUMP_RULE);
+    mpc_dump_rule(d, p);
+    return;
+  }
   
-  i = mpc_input_new_string("<mpca_lang>", language);
-  err = mpca_lang_st(i, &st);
-  mpc_input_delete(i);
+  mpc_dump_byte(d, p->type);
+  
+  switch (p->type) {
+    
+    case MPC_TYPE_FAIL:     mpc_dump_str(d, p->data.fail.m); break;
+    case MPC_TYPE_LIFT:     mpc_dump_func(d, (mpc_func_t)p->data.lift.lf); break;
+    case MPC_TYPE_LIFT_VAL: d->failed = 1; break;
+    case MPC_TYPE_ANCHOR:   mpc_dump_func(d, (mpc_func_t)p->data.anchor.f); break;
+    case MPC_TYPE_SATISFY:  mpc_dump_func(d, (mpc_func_t)p->data.satisfy.f); break;
+    case MPC_TYPE_SINGLE:   mpc_dump_byte(d, p->data.single.x); break;
+    case MPC_TYPE_STRING:   mpc_dump_str(d, p->data.string.x); break;
+    
+    case MPC_TYPE_EXPECT:
+      mpc_dump_parser(d, p->data.expect.x, 0);
+      mpc_dump_str(d, p->data.expect.m);
+      break;
+    
+    case MPC_TYPE_RANGE:
+      mpc_dump_byte(d, p->data.range.x);
+      mpc_dump_byte(d, p->data.range.y);
+      break;
+    
+    case MPC_TYPE_ONEOF:
+    case MPC_TYPE_NONEOF:
+      mpc_dump_str(d, p->data.oneof.x);
+      mpc_dump_class(d, p->data.oneof.c);
+      break;
+    
+    case MPC_TYPE_APPLY:
+      mpc_dump_parser(d, p->data.apply.x, 0);
+      mpc_dump_func(d, (mpc_func_t)p->data.apply.f);
+      break;
+    
+    case MPC_TYPE_APPLY_TO:
+      mpc_dump_parser(d, p->data.apply_to.x, 0);
+      mpc_dump_func(d, (mpc_func_t)p->data.apply_to.f);
+      mpc_dump_apply_to(d, p);
+      break;
+    
+    case MPC_TYPE_PREDICT: mpc_dump_parser(d, p->data.predict.x, 0); break;
+    case MPC_TYPE_ARENA:   mpc_dump_parser(d, p->data.arena.x, 0);   break;
+    
+    case MPC_TYPE_PACKRAT:
+      mpc_dump_parser(d, p->data.packrat.x, 0);
+      mpc_dump_func(d, (mpc_func_t)p->data.packrat.cf);
+      mpc_dump_func(d, (mpc_func_t)p->data.packrat.dx);
+      break;
+    
+    case MPC_TYPE_DFA:
+      mpc_dump_parser(d, p->data.dfa.x, 0);
+      mpc_dump_int(d, p->data.dfa.n);
+      for (i = 0; i < p->data.dfa.n * 256; i++) { mpc_dump_int(d, p->data.dfa.trans[i]); }
+      mpc_dump_bytes(d, p->data.dfa.accept, p->data.dfa.n);
+      for (i = 0; i < p->data.dfa.n; i++) {
+        mpc_dump_byte(d, p->data.dfa.loops[i] != NULL);
+        if (p->data.dfa.loops[i]) { mpc_dump_class(d, p->data.dfa.loops[i]); }
+      }
+      break;
+    
+    case MPC_TYPE_TOKEN:
+      mpc_dump_parser(d, p->data.token.x, 0);
+      mpc_dump_class(d, p->data.token.c);
+      break;
+    
+    case MPC_TYPE_NOT:
+    case MPC_TYPE_MAYBE:
+      mpc_dump_parser(d, p->data.not.x, 0);
+      mpc_dump_func(d, (mpc_func_t)p->data.not.dx);
+      mpc_dump_func(d, (mpc_func_t)p->data.not.lf);
+      break;
+    
+    case MPC_TYPE_MANY:
+    case MPC_TYPE_MANY1:
+    case MPC_TYPE_COUNT:
+      mpc_dump_int(d, p->data.repeat.n);
+      mpc_dump_func(d, (mpc_func_t)p->data.repeat.f);
+      mpc_dump_parser(d, p->data.repeat.x, 0);
+      mpc_dump_func(d, (mpc_func_t)p->data.repeat.dx);
+      break;
+    
+    case MPC_TYPE_OR:
+      mpc_dump_int(d, p->data.or.n);
+      for (i = 0; i < p->data.or.n; i++) { mpc_dump_parser(d, p->data.or.xs[i], 0); }
+      mpc_dump_byte(d, p->data.or.first != NULL);
+      if (p->data.or.first) { mpc_dump_bytes(d, p->data.or.first, 256); }
+      break;
+    
+    case MPC_TYPE_AND:
+      mpc_dump_int(d, p->data.and.n);
+      mpc_dump_func(d, (mpc_func_t)p->data.and.f);
+      for (i = 0; i < p->data.and.n; i++) { mpc_dump_parser(d, p->data.and.xs[i], 0); }
+      for (i = 0; i < p->data.and.n-1; i++) { mpc_dump_func(d, (mpc_func_t)p->data.and.dxs[i]); }
+      mpc_dump_byte(d, p->data.and.nomark);
+      break;
+    
+    default: break;
+  }
   
-  free(st.parsers);
-  va_end(va);
-  return err;
 }
 
-mpc_err_t *mpca_lang_contents(int flags, const char *filename, ...) {
-  
-  mpca_grammar_st_t st;
-  mpc_input_t *i;
-  mpc_err_t *err;
+void *mpc_dump(size_t *size, int n, ...) {
   
+  int i;
   va_list va;
-
-  FILE *f = fopen(filename, "rb");
+  mpc_dump_t d;
   
-  if (f == NULL) {
-    err = mpc_err_file(filename, "Unable to open file!");
-    return err;
-  }
+  d.data = NULL;
+  d.size = 0;
+  d.slots = 0;
+  d.rules_num = n;
+  d.rules = malloc(sizeof(mpc_parser_t*) * n);
+  d.failed = 0;
   
-  va_start(va, filename);
+  va_start(va, n);
+  for (i = 0; i < n; i++) { d.rules[i] = va_arg(va, mpc_parser_t*); }
+  va_end(va);
   
-  st.va = &va;
-  st.parsers_num = 0;
-  st.parsers = NULL;
-  st.flags = flags;
+  mpc_dump_bytes(&d, "mpc", 3);
+  mpc_dump_byte(&d, MPC_DUMP_VERSION);
+  mpc_dump_int(&d, n);
   
-  i = mpc_input_new_file(filename, f);
-  err = mpca_lang_st(i, &st);
-  mpc_input_delete(i);
+  for (i = 0; i < n; i++) {
+    mpc_dump_str(&d, d.rules[i]->name ? d.rules[i]->name : "");
+    mpc_dump_int(&d, d.rules[i]->id);
+    mpc_dump_parser(&d, d.rules[i], 1);
+  }
   
-  free(st.parsers);
-  va_end(va);  
+  free(d.rules);
   
-  fclose(f);
+  if (d.failed) {
+    free(d.data);
+    return NULL;
+  }
   
-  return err;
+  *size = d.size;
+  return d.data;
 }
 
-static int mpc_nodecount_unretained(mpc_parser_t* p, int force) {
+/*
+** Once reading fails every read gives back zero
+** and every parser read is a `pass`, so what was
+** read so far can always be deleted as normal.
+*/
 
-  int i, total;
+typedef struct {
+  const unsigned char *data;
+  size_t size;
+  size_t pos;
+  int rules_num;
+  mpc_parser_t **rules;
+  int failed;
+} mpc_load_t;
+
+static int mpc_load_fail(mpc_load_t *l) {
+  l->failed = 1;
+  return 0;
+}
 
-  if (p->retained && !force) { return 0; }
+static int mpc_load_bytes(mpc_load_t *l, void *x, size_t n) {
+  if (l->failed || n > l->size - l->pos) {
+    memset(x, 0, n);
+    return mpc_load_fail(l);
+  }
+  memcpy(x, l->data + l->pos, n);
+  l->pos += n;
+  return 1;
+}
 
-  if (p->type == MPC_TYPE_EXPECT) { return 1 + mpc_nodecount_unretained(p->data.expect.x, 0); }
+static int mpc_load_byte(mpc_load_t *l) {
+  unsigned char b;
+  mpc_load_bytes(l, &b, 1);
+  return b;
+}
 
-  if (p->type == MPC_TYPE_APPLY)    { return 1 + mpc_nodecount_unretained(p->data.apply.x, 0); }
-  if (p->type == MPC_TYPE_APPLY_TO) { return 1 + mpc_nodecount_unretained(p->data.apply_to.x, 0); }
-  if (p->type == MPC_TYPE_PREDICT)  { return 1 + mpc_nodecount_unretained(p->data.predict.x, 0); }
+static int mpc_load_int(mpc_load_t *l) {
+  unsigned char b[4];
+  unsigned long u;
+  mpc_load_bytes(l, b, 4);
+  u = (unsigned long)b[0] | ((unsigned long)b[1] << 8)
+    | ((unsigned long)b[2] << 16) | ((unsigned long)b[3] << 24);
+  return u & 0x80000000UL ? -(int)(0xFFFFFFFFUL - u) - 1 : (int)u;
+}
 
-  if (p->type == MPC_TYPE_NOT)   { return 1 + mpc_nodecount_unretained(p->data.not.x, 0); }
-  if (p->type == MPC_TYPE_MAYBE) { return 1 + mpc_nodecount_unretained(p->data.not.x, 0); }
+/* Reads a count of items at least `width` bytes each */
+static int mpc_load_count(mpc_load_t *l, int width) {
+  int n = mpc_load_int(l);
+  if (l->failed || n < 1 || (size_t)n > (l->size - l->pos) / width) { mpc_load_fail(l); return 1; }
+  return n;
+}
 
-  if (p->type == MPC_TYPE_MANY)  { return 1 + mpc_nodecount_unretained(p->data.repeat.x, 0); }
-  if (p->type == MPC_TYPE_MANY1) { return 1 + mpc_nodecount_unretained(p->data.repeat.x, 0); }
-  if (p->type == MPC_TYPE_COUNT) { return 1 + mpc_nodecount_unretained(p->data.repeat.x, 0); }
+static char *mpc_load_str(mpc_load_t *l) {
+  int n = mpc_load_int(l);
+  char *s;
+  if (l->failed || n < 0 || (size_t)n > l->size - l->pos) { mpc_load_fail(l); n = 0; }
+  s = malloc(n + 1);
+  mpc_load_bytes(l, s, n);
+  s[n] = '\0';
+  return s;
+}
 
-  if (p->type == MPC_TYPE_OR) { 
-    total = 0;
-    for(i = 0; i < p->data.or.n; i++) {
-      total += mpc_nodecount_unretained(p->data.or.xs[i], 0);
-    }
-    return total;
-  }
-  
-  if (p->type == MPC_TYPE_AND) {
-    total = 0;
-    for(i = 0; i < p->data.and.n; i++) {
-      total += mpc_nodecount_unretained(p->data.and.xs[i], 0);
-    }
-    return total;
+static mpc_func_t mpc_load_func(mpc_load_t *l) {
+  int i = mpc_load_int(l);
+  if (i == -1) { return NULL; }
+  if (i < 0 || i >= (int)(sizeof(mpc_dump_funcs) / sizeof(mpc_func_t)) - 1) {
+    mpc_load_fail(l);
+    return NULL;
   }
+  return mpc_dump_funcs[i];
+}
 
-  return 1;
-  
+static mpc_class_t *mpc_load_class(mpc_load_t *l) {
+  mpc_class_t *c = calloc(1, sizeof(mpc_class_t));
+  mpc_load_bytes(l, c->map, sizeof(c->map));
+  mpc_class_index(c);
+  return c;
 }
 
-void mpc_stats(mpc_parser_t* p) {
-  printf("Stats\n");
-  printf("=====\n");
-  printf("Node Count: %i\n", mpc_nodecount_unretained(p, 1));
+static mpc_parser_t *mpc_load_rule(mpc_load_t *l) {
+  int i = mpc_load_int(l);
+  if (i < 0 || i >= l->rules_num) { mpc_load_fail(l); return NULL; }
+  return l->rules[i];
 }
 
-static void mpc_optimise_unretained(mpc_parser_t *p, int force) {
+static void mpc_load_apply_to(mpc_load_t *l, mpc_parser_t *p) {
   
-  int i, n, m;
-  mpc_parser_t *t;
+  int i;
+  mpc_apply_to_t f = p->data.apply_to.f;
   
-  if (p->retained && !force) { return; }
+  if (f == mpcf_ast_add_rule || f == mpcaf_list_rule
+  ||  f == mpcaf_action_values || f == mpcaf_action_text) {
+    p->data.apply_to.d = mpc_load_rule(l);
+    return;
+  }
   
-  /* Optimise Subexpressions */
+  if (f == (mpc_apply_to_t)mpc_ast_tag || f == (mpc_apply_to_t)mpc_ast_add_tag) {
+    i = mpc_load_int(l);
+    if (i < 0 || i >= (int)(sizeof(mpc_dump_tags) / sizeof(char*)) - 1) { mpc_load_fail(l); return; }
+    p->data.apply_to.d = (void*)mpc_dump_tags[i];
+    return;
+  }
   
-  if (p->type == MPC_TYPE_EXPECT)   { mpc_optimise_unretained(p->data.expect.x, 0); }
-  if (p->type == MPC_TYPE_APPLY)    { mpc_optimise_unretained(p->data.apply.x, 0); }
-  if (p->type == MPC_TYPE_APPLY_TO) { mpc_optimise_unretained(p->data.apply_to.x, 0); }
-  if (p->type == MPC_TYPE_PREDICT)  { mpc_optimise_unretained(p->data.predict.x, 0); }
-  if (p->type == MPC_TYPE_NOT)      { mpc_optimise_unretained(p->data.not.x, 0); }
-  if (p->type == MPC_TYPE_MAYBE)    { mpc_optimise_unretained(p->data.not.x, 0); }
-  if (p->type == MPC_TYPE_MANY)     { mpc_optimise_unretained(p->data.repeat.x, 0); }
-  if (p->type == MPC_TYPE_MANY1)    { mpc_optimise_unretained(p->data.repeat.x, 0); }
-  if (p->type == MPC_TYPE_COUNT)    { mpc_optimise_unretained(p->data.repeat.x, 0); }
+  if (f == mpcaf_list_same_to) { return; }
   
-  if (p->type == MPC_TYPE_OR) { 
-    for(i = 0; i < p->data.or.n; i++) {
-      mpc_optimise_unretained(p->data.or.xs[i], 0);
-    }
+  mpc_load_fail(l);
+}
+
+static mpc_parser_t *mpc_load_parser(mpc_load_t *l) {
+  
+  int i, type;
+  mpc_parser_t *p;
+  
+  type = mpc_load_byte(l);
+  
+  if (type == MPC_DUMP_RULE) {
+    p = mpc_load_rule(l);
+    if (p) { return p; }
   }
   
-  if (p->type == MPC_TYPE_AND) {
-    for(i = 0; i < p->data.and.n; i++) {
-      mpc_optimise_unretained(p->data.and.xs[i], 0);
-    }
-  }  
+  if (l->failed) { return mpc_pass(); }
   
-  /* Perform optimisations */
+  p = mpc_undefined();
+  p->type = (char)type;
   
-  while (1) {
+  switch (type) {
     
-    /* Merge rhs `or` */
-    if (p->type == MPC_TYPE_OR
-    &&  p->data.or.xs[p->data.or.n-1]->type == MPC_TYPE_OR
-    && !p->data.or.xs[p->data.or.n-1]->retained) {
-      t = p->data.or.xs[p->data.or.n-1];
-      n = p->data.or.n; m = t->data.or.n;
-      p->data.or.n = n + m - 1;
-      p->data.or.xs = realloc(p->data.or.xs, sizeof(mpc_parser_t*) * (n + m -1));
-      memmove(p->data.or.xs + n - 1, t->data.or.xs, m * sizeof(mpc_parser_t*));
-      free(t->data.or.xs); free(t->name); free(t);
-      continue;
-    }
-
-    /* Merge lhs `or` */
-    if (p->type == MPC_TYPE_OR
-    &&  p->data.or.xs[0]->type == MPC_TYPE_OR
-    && !p->data.or.xs[0]->retained) {
-      t = p->data.or.xs[0];
-      n = p->data.or.n; m = t->data.or.n;
-      p->data.or.n = n + m - 1;
-      p->data.or.xs = realloc(p->data.or.xs, sizeof(mpc_parser_t*) * (n + m -1));
-      memmove(p->data.or.xs + m, t->data.or.xs + 1, n * sizeof(mpc_parser_t*));
-      memmove(p->data.or.xs, t->data.or.xs, m * sizeof(mpc_parser_t*));
-      free(t->data.or.xs); free(t->name); free(t);
-      continue;
-    }
+    case MPC_TYPE_UNDEFINED:
+    case MPC_TYPE_PASS:
+    case MPC_TYPE_STATE:
+    case MPC_TYPE_ANY: break;
     
-    /* Remove ast `pass` */
-    if (p->type == MPC_TYPE_AND
-    &&  p->data.and.n == 2
-    &&  p->data.and.xs[0]->type == MPC_TYPE_PASS
-    && !p->data.and.xs[0]->retained
-    &&  p->data.and.f == mpcf_fold_ast) {
-      t = p->data.and.xs[1];
-      mpc_delete(p->data.and.xs[0]);
-      free(p->data.and.xs); free(p->data.and.dxs); free(p->name);
-      memcpy(p, t, sizeof(mpc_parser_t));
-      free(t);
-      continue;
-    }
+    case MPC_TYPE_FAIL:    p->data.fail.m = mpc_load_str(l); break;
+    case MPC_TYPE_LIFT:    p->data.lift.lf = (mpc_ctor_t)mpc_load_func(l); break;
+    case MPC_TYPE_ANCHOR:  p->data.anchor.f = (int(*)(char,char))mpc_load_func(l); break;
+    case MPC_TYPE_SATISFY: p->data.satisfy.f = (int(*)(char))mpc_load_func(l); break;
+    case MPC_TYPE_SINGLE:  p->data.single.x = (char)mpc_load_byte(l); break;
+    case MPC_TYPE_STRING:  p->data.string.x = mpc_load_str(l); break;
     
-    /* Merge ast lhs `and` */
-    if (p->type == MPC_TYPE_AND
-    &&  p->data.and.f == mpcf_fold_ast
-    &&  p->data.and.xs[0]->type == MPC_TYPE_AND
-    && !p->data.and.xs[0]->retained
-    &&  p->data.and.xs[0]->data.and.f == mpcf_fold_ast) {
-      t = p->data.and.xs[0];
-      n = p->data.and.n; m = t->data.and.n;
-      p->data.and.n = n + m - 1;
-      p->data.and.xs = realloc(p->data.and.xs, sizeof(mpc_parser_t*) * (n + m - 1));
-      p->data.and.dxs = realloc(p->data.and.dxs, sizeof(mpc_dtor_t) * (n + m - 1 - 1));
-      memmove(p->data.and.xs + m, p->data.and.xs + 1, (n - 1) * sizeof(mpc_parser_t*));
-      memmove(p->data.and.xs, t->data.and.xs, m * sizeof(mpc_parser_t*));
-      for (i = 0; i < p->data.and.n-1; i++) { p->data.and.dxs[i] = (mpc_dtor_t)mpc_ast_delete; }
-      free(t->data.and.xs); free(t->data.and.dxs); free(t->name); free(t); 
-      continue;
-    }
+    case MPC_TYPE_EXPECT:
+      p->data.expect.x = mpc_load_parser(l);
+      p->data.expect.m = mpc_load_str(l);
+      break;
     
-    /* Merge ast rhs `and` */
-    if (p->type == MPC_TYPE_AND
-    &&  p->data.and.f == mpcf_fold_ast
-    &&  p->data.and.xs[p->data.and.n-1]->type == MPC_TYPE_AND
-    && !p->data.and.xs[p->data.and.n-1]->retained
-    &&  p->data.and.xs[p->data.and.n-1]->data.and.f == mpcf_fold_ast) {
-      t = p->data.and.xs[p->data.and.n-1];
-      n = p->data.and.n; m = t->data.and.n;
-      p->data.and.n = n + m - 1;
-      p->data.and.xs = realloc(p->data.and.xs, sizeof(mpc_parser_t*) * (n + m -1));
-      p->data.and.dxs = realloc(p->data.and.dxs, sizeof(mpc_dtor_t) * (n + m - 1 - 1));
-      memmove(p->data.and.xs + n - 1, t->data.and.xs, m * sizeof(mpc_parser_t*));
-      for (i = 0; i < p->data.and.n-1; i++) { p->data.and.dxs[i] = (mpc_dtor_t)mpc_ast_delete; }
-      free(t->data.and.xs); free(t->data.and.dxs); free(t->name); free(t); 
-      continue;
-    }
-
-    /* Remove re `lift` */
-    if (p->type == MPC_TYPE_AND
-    &&  p->data.and.n == 2
-    &&  p->data.and.xs[0]->type == MPC_TYPE_LIFT
-    &&  p->data.and.xs[0]->data.lift.lf == mpcf_ctor_str
-    && !p->data.and.xs[0]->retained
-    &&  p->data.and.f == mpcf_strfold) {
-      t = p->data.and.xs[1];
-      mpc_delete(p->data.and.xs[0]);
-      free(p->data.and.xs); free(p->data.and.dxs); free(p->name);
-      memcpy(p, t, sizeof(mpc_parser_t));
-      free(t);
-      continue;
-    }
-
-    /* Merge re lhs `and` */
-    if (p->type == MPC_TYPE_AND
-    &&  p->data.and.f == mpcf_strfold
-    &&  p->data.and.xs[0]->type == MPC_TYPE_AND
-    && !p->data.and.xs[0]->retained
-    &&  p->data.and.xs[0]->data.and.f == mpcf_strfold) {
-      t = p->data.and.xs[0];
-      n = p->data.and.n; m = t->data.and.n;
-      p->data.and.n = n + m - 1;
-      p->data.and.xs = realloc(p->data.and.xs, sizeof(mpc_parser_t*) * (n + m - 1));
-      p->data.and.dxs = realloc(p->data.and.dxs, sizeof(mpc_dtor_t) * (n + m - 1 - 1));
-      memmove(p->data.and.xs + m, p->data.and.xs + 1, (n - 1) * sizeof(mpc_parser_t*));
-      memmove(p->data.and.xs, t->data.and.xs, m * sizeof(mpc_parser_t*));
-      for (i = 0; i < p->data.and.n-1; i++) { p->data.and.dxs[i] = free; }
-      free(t->data.and.xs); free(t->data.and.dxs); free(t->name); free(t); 
-      continue;
-    }
+    case MPC_TYPE_RANGE:
+      p->data.range.x = (char)mpc_load_byte(l);
+      p->data.range.y = (char)mpc_load_byte(l);
+      break;
     
-    /* Merge re rhs `and` */
-    if (p->type == MPC_TYPE_AND
-    &&  p->data.and.f == mpcf_strfold
-    &&  p->data.and.xs[p->data.and.n-1]->type == MPC_TYPE_AND
-    && !p->data.and.xs[p->data.and.n-1]->retained
-    &&  p->data.and.xs[p->data.and.n-1]->data.and.f == mpcf_strfold) {
-      t = p->data.and.xs[p->data.and.n-1];
-      n = p->data.and.n; m = t->data.and.n;
-      p->data.and.n = n + m - 1;
-      p->data.and.xs = realloc(p->data.and.xs, sizeof(mpc_parser_t*) * (n + m -1));
-      p->data.and.dxs = realloc(p->data.and.dxs, sizeof(mpc_dtor_t) * (n + m - 1 - 1));
-      memmove(p->data.and.xs + n - 1, t->data.and.xs, m * sizeof(mpc_parser_t*));
-      for (i = 0; i < p->data.and.n-1; i++) { p->data.and.dxs[i] = free; }
-      free(t->data.and.xs); free(t->data.and.dxs); free(t->name); free(t); 
-      continue;
-    }
+    case MPC_TYPE_ONEOF:
+    case MPC_TYPE_NONEOF:
+      p->data.oneof.x = mpc_load_str(l);
+      p->data.oneof.c = mpc_load_class(l);
+      break;
     
-    return;
+    case MPC_TYPE_APPLY:
+      p->data.apply.x = mpc_load_parser(l);
+      p->data.apply.f = (mpc_apply_t)mpc_load_func(l);
+      break;
+    
+    case MPC_TYPE_APPLY_TO:
+      p->data.apply_to.x = mpc_load_parser(l);
+      p->data.apply_to.f = (mpc_apply_to_t)mpc_load_func(l);
+      mpc_load_apply_to(l, p);
+      break;
+    
+    case MPC_TYPE_PREDICT: p->data.predict.x = mpc_load_parser(l); break;
+    case MPC_TYPE_ARENA:   p->data.arena.x = mpc_load_parser(l);   break;
+    
+    case MPC_TYPE_PACKRAT:
+      p->data.packrat.x = mpc_load_parser(l);
+      p->data.packrat.cf = (mpc_apply_t)mpc_load_func(l);
+      p->data.packrat.dx = (mpc_dtor_t)mpc_load_func(l);
+      break;
+    
+    case MPC_TYPE_DFA:
+      p->data.dfa.x = mpc_load_parser(l);
+      p->data.dfa.n = mpc_load_count(l, 256 * 4);
+      p->data.dfa.trans = malloc(sizeof(int) * 256 * p->data.dfa.n);
+      p->data.dfa.accept = malloc(p->data.dfa.n);
+      p->data.dfa.loops = calloc(p->data.dfa.n, sizeof(mpc_class_t*));
+      for (i = 0; i < p->data.dfa.n * 256; i++) {
+        p->data.dfa.trans[i] = mpc_load_int(l);
+        if (p->data.dfa.trans[i] < -1 || p->data.dfa.trans[i] >= p->data.dfa.n) { mpc_load_fail(l); }
+      }
+      mpc_load_bytes(l, p->data.dfa.accept, p->data.dfa.n);
+      for (i = 0; i < p->data.dfa.n; i++) {
+        if (mpc_load_byte(l)) { p->data.dfa.loops[i] = mpc_load_class(l); }
+      }
+      break;
+    
+    case MPC_TYPE_TOKEN:
+      p->data.token.x = mpc_load_parser(l);
+      p->data.token.c = mpc_load_class(l);
+      if (!mpc_token_and(p->data.token.x)) { mpc_load_fail(l); }
+      break;
+    
+    case MPC_TYPE_NOT:
+    case MPC_TYPE_MAYBE:
+      p->data.not.x = mpc_load_parser(l);
+      p->data.not.dx = (mpc_dtor_t)mpc_load_func(l);
+      p->data.not.lf = (mpc_ctor_t)mpc_load_func(l);
+      break;
+    
+    case MPC_TYPE_MANY:
+    case MPC_TYPE_MANY1:
+    case MPC_TYPE_COUNT:
+      p->data.repeat.n = mpc_load_int(l);
+      p->data.repeat.f = (mpc_fold_t)mpc_load_func(l);
+      p->data.repeat.x = mpc_load_parser(l);
+      p->data.repeat.dx = (mpc_dtor_t)mpc_load_func(l);
+      /* Worked out again rather than trusted, as a wrong mark hands folds NULL */
+      mpc_optimise_span(p);
+      break;
+    
+    case MPC_TYPE_OR:
+      p->data.or.n = mpc_load_count(l, 1);
+      p->data.or.xs = malloc(sizeof(mpc_parser_t*) * p->data.or.n);
+      for (i = 0; i < p->data.or.n; i++) { p->data.or.xs[i] = mpc_load_parser(l); }
+      if (mpc_load_byte(l)) {
+        p->data.or.first = malloc(256);
+        mpc_load_bytes(l, p->data.or.first, 256);
+        for (i = 0; i < 256; i++) {
+          if (p->data.or.first[i] >= p->data.or.n && p->data.or.first[i] < MPC_OR_ALL) { mpc_load_fail(l); }
+        }
+      }
+      break;
+    
+    case MPC_TYPE_AND:
+      p->data.and.n = mpc_load_count(l, 1);
+      p->data.and.f = (mpc_fold_t)mpc_load_func(l);
+      p->data.and.xs = malloc(sizeof(mpc_parser_t*) * p->data.and.n);
+      p->data.and.dxs = malloc(sizeof(mpc_dtor_t) * (p->data.and.n-1));
+      for (i = 0; i < p->data.and.n; i++) { p->data.and.xs[i] = mpc_load_parser(l); }
+      for (i = 0; i < p->data.and.n-1; i++) { p->data.and.dxs[i] = (mpc_dtor_t)mpc_load_func(l); }
+      p->data.and.nomark = mpc_load_byte(l) != 0;
+      mpc_optimise_span(p);
+      break;
     
+    default:
+      p->type = MPC_TYPE_PASS;
+      mpc_load_fail(l);
+      break;
   }
   
+  return p;
 }
 
-void mpc_optimise(mpc_parser_t *p) {
-  mpc_optimise_unretained(p, 1);
+int mpc_load(const void *data, size_t size, int n, ...) {
+  
+  int i;
+  char *name;
+  char magic[4];
+  va_list va;
+  mpc_load_t l;
+  mpc_parser_t **xs;
+  int *ids;
+  
+  l.data = data;
+  l.size = size;
+  l.pos = 0;
+  l.rules_num = n;
+  l.rules = malloc(sizeof(mpc_parser_t*) * n);
+  l.failed = 0;
+  
+  va_start(va, n);
+  for (i = 0; i < n; i++) { l.rules[i] = va_arg(va, mpc_parser_t*); }
+  va_end(va);
+  
+  mpc_load_bytes(&l, magic, 4);
+  if (memcmp(magic, "mpc", 3) != 0 || magic[3] != MPC_DUMP_VERSION
+  ||  mpc_load_int(&l) != n) { mpc_load_fail(&l); }
+  
+  xs = calloc(n, sizeof(mpc_parser_t*));
+  ids = calloc(n, sizeof(int));
+  
+  for (i = 0; i < n && !l.failed; i++) {
+    name = mpc_load_str(&l);
+    if (strcmp(name, l.rules[i]->name ? l.rules[i]->name : "") != 0) { mpc_load_fail(&l); }
+    free(name);
+    ids[i] = mpc_load_int(&l);
+    xs[i] = mpc_load_parser(&l);
+    if (xs[i]->retained) { xs[i] = NULL; mpc_load_fail(&l); }
+  }
+  
+  if (l.pos != l.size) { mpc_load_fail(&l); }
+  
+  for (i = 0; i < n; i++) {
+    if (xs[i] == NULL) { continue; }
+    if (l.failed || xs[i]->type == MPC_TYPE_UNDEFINED) { mpc_delete(xs[i]); continue; }
+    l.rules[i]->id = ids[i];
+    mpc_define(l.rules[i], xs[i]);
+  }
+  
+  free(ids);
+  free(xs);
+  free(l.rules);
+  return !l.failed;
 }
-
@@ -64,12 +64,38 @@ typedef union {
 struct mpc_parser_t;
 typedef struct mpc_parser_t mpc_parser_t;
 
+/*
+** Parsing only reads the parser it is given and
+** keeps everything it changes with the input, so
+** any number of threads can parse with the same
+** parser at once. Nothing may define, optimise or
+** delete the parsers while they do, and functions
+** the parsers call, such as actions, must be safe
+** to call from several threads too.
+*/
+
 int mpc_parse(const char *filename, const char *string, mpc_parser_t *p, mpc_result_t *r);
 int mpc_nparse(const char *filename, const char *string, size_t length, mpc_parser_t *p, mpc_result_t *r);
 int mpc_parse_file(const char *filename, FILE *file, mpc_parser_t *p, mpc_result_t *r);
 int mpc_parse_pipe(const char *filename, FILE *pipe, mpc_parser_t *p, mpc_result_t *r);
 int mpc_parse_contents(const char *filename, mpc_parser_t *p, mpc_result_t *r);
 
+/*
+** A context keeps what parsing allocates for
+** itself from one parse to the next, so once
+** it has parsed a few strings like the ones it
+** is given, parsing with it only allocates for
+** the result or error given back. A context may
+** only be used by one thread at a time.
+*/
+
+struct mpc_context_t;
+typedef struct mpc_context_t mpc_context_t;
+
+mpc_context_t *mpc_context_new(void);
+void mpc_context_delete(mpc_context_t *c);
+int mpc_parse_context(mpc_context_t *c, const char *filename, const char *string, mpc_parser_t *p, mpc_result_t *r);
+
 /*
 ** Function Types
 */
@@ -81,6 +107,24 @@ typedef mpc_val_t*(*mpc_apply_t)(mpc_val_t*);
 typedef mpc_val_t*(*mpc_apply_to_t)(mpc_val_t*,void*);
 typedef mpc_val_t*(*mpc_fold_t)(int,mpc_val_t**);
 
+/*
+** Push Parsing
+*/
+
+enum {
+  MPC_PUSH_FAILURE    = 0,
+  MPC_PUSH_SUCCESS    = 1,
+  MPC_PUSH_INCOMPLETE = 2
+};
+
+struct mpc_push_t;
+typedef struct mpc_push_t mpc_push_t;
+
+mpc_push_t *mpc_push_new(const char *filename, mpc_parser_t *p, mpc_dtor_t d);
+int mpc_push_feed(mpc_push_t *s, const char *chunk, size_t length, mpc_result_t *r);
+int mpc_push_end(mpc_push_t *s, mpc_result_t *r);
+void mpc_push_delete(mpc_push_t *s);
+
 /*
 ** Building a Parser
 */
@@ -139,6 +183,7 @@ mpc_parser_t *mpc_or(int n, ...);
 mpc_parser_t *mpc_and(int n, mpc_fold_t f, ...);
 
 mpc_parser_t *mpc_predictive(mpc_parser_t *a);
+mpc_parser_t *mpc_packrat(mpc_parser_t *a, mpc_apply_t cf, mpc_dtor_t da);
 
 /*
 ** Common Parsers
@@ -261,10 +306,25 @@ mpc_parser_t *mpc_re(const char *re);
 ** AST
 */
 
+/*
+** Parsers given to `mpca_lang` are numbered in
+** the order they are passed, starting from zero.
+** A node records the ID of the first grammar rule
+** it was tagged with in `rule` (or -1 if none),
+** and every rule in its tag as a bit of `rules`.
+** Only IDs below the width of `unsigned long`
+** fit in `rules`, which is 64 on most 64 bit
+** Unix systems but 32 on Windows. Rules with
+** higher IDs get no bit and must be found from
+** `rule` or the tag instead.
+*/
+
 typedef struct mpc_ast_t {
   char *tag;
   char *contents;
   mpc_state_t state;
+  int rule;
+  unsigned long rules;
   int children_num;
   struct mpc_ast_t** children;
 } mpc_ast_t;
@@ -277,6 +337,7 @@ mpc_ast_t *mpc_ast_add_tag(mpc_ast_t *a, const char *t);
 mpc_ast_t *mpc_ast_add_root_tag(mpc_ast_t *a, const char *t);
 mpc_ast_t *mpc_ast_tag(mpc_ast_t *a, const char *t);
 mpc_ast_t *mpc_ast_state(mpc_ast_t *a, mpc_state_t s);
+mpc_ast_t *mpc_ast_copy(mpc_ast_t *a);
 
 void mpc_ast_delete(mpc_ast_t *a);
 void mpc_ast_print(mpc_ast_t *a);
@@ -320,6 +381,36 @@ mpc_parser_t *mpca_add_tag(mpc_parser_t *a, const char *t);
 mpc_parser_t *mpca_root(mpc_parser_t *a);
 mpc_parser_t *mpca_state(mpc_parser_t *a);
 mpc_parser_t *mpca_total(mpc_parser_t *a);
+mpc_parser_t *mpca_packrat(mpc_parser_t *a);
+
+/*
+** A parse started from `mpca_arena` builds its
+** whole tree in a single arena with interned
+** tags, which is freed when `mpc_ast_delete` is
+** called on the root. Deleting any other node of
+** such a tree does nothing, tags must not be
+** written to, and nodes made with `mpc_ast_new`
+** that are added to it are not freed with it.
+*/
+
+mpc_parser_t *mpca_arena(mpc_parser_t *a);
+
+/*
+** With `MPCA_LANG_ACTIONS` each rule given an
+** action with `mpca_action` builds its value
+** directly instead of an AST. The action is
+** passed the values of the rules referenced in
+** its body, or the text it matched if there are
+** none, and owns them as a fold function does.
+** Values it returns are deleted with `d`. Rules
+** without an action pass the values of their body
+** on to the rule using them, so a parse should
+** start from a rule with an action. Actions must
+** be attached before calling `mpca_lang`, and the
+** packrat and arena flags are ignored.
+*/
+
+mpc_parser_t *mpca_action(mpc_parser_t *a, mpc_fold_t f, mpc_dtor_t d);
 
 mpc_parser_t *mpca_not(mpc_parser_t *a);
 mpc_parser_t *mpca_maybe(mpc_parser_t *a);
@@ -334,7 +425,11 @@ mpc_parser_t *mpca_and(int n, ...);
 enum {
   MPCA_LANG_DEFAULT              = 0,
   MPCA_LANG_PREDICTIVE           = 1,
-  MPCA_LANG_WHITESPACE_SENSITIVE = 2
+  MPCA_LANG_WHITESPACE_SENSITIVE = 2,
+  MPCA_LANG_PACKRAT              = 4,
+  MPCA_LANG_ARENA                = 8,
+  MPCA_LANG_ACTIONS              = 16,
+  MPCA_LANG_STATS                = 32
 };
 
 mpc_parser_t *mpca_grammar(int flags, const char *grammar, ...);
@@ -350,9 +445,81 @@ mpc_err_t *mpca_lang_contents(int flags, const char *filename, ...);
 
 
 void mpc_print(mpc_parser_t *p);
+
+/*
+** As well as simplifying `p`, optimising gives
+** each `or` in it a table picking alternatives
+** by their first character, and lets each `and`
+** that can only fail where it started skip
+** marking the input to go back to. Both look
+** into the rules `p` uses, so if one of those is
+** defined again `p` should be optimised again.
+** Tokens built by `mpc_tok` and `mpc_sym`, and
+** literals in grammars, are also fused so that
+** each is matched along with the whitespace
+** after it in one step, and folds of text with
+** `mpcf_strfold` are copied from the input in
+** one go rather than built up a character at a
+** time.
+*/
+
 void mpc_optimise(mpc_parser_t *p);
+
+/*
+** Prints the node count, depth and an estimate
+** of the calls made for each byte consumed. The
+** estimate comes from the shape of `p` alone and
+** only says how two versions of it compare. With
+** `MPCA_LANG_STATS` the same figures are printed
+** for each rule before and after optimising.
+*/
+
 void mpc_stats(mpc_parser_t *p);
 
+/*
+** Rules can be saved with `mpc_dump`, which gives
+** back a block of memory to write to a file or
+** embed as a C array, and defined again with
+** `mpc_load` without parsing any grammar or regex
+** text. They must be loaded into rules of the same
+** names given in the same order. Rules they use
+** must be saved with them, and only grammars using
+** functions from mpc itself, such as ones built by
+** `mpca_lang`, can be saved. Actions are not saved
+** so must be attached before loading as they are
+** before `mpca_lang`. `mpc_dump` gives back `NULL`
+** if the rules can't be saved. `mpc_load` gives
+** back zero, changing no rules, if the data is cut
+** short or was saved from other rules or another
+** version of mpc. It is not meant to be given
+** data from anywhere but `mpc_dump`.
+*/
+
+void *mpc_dump(size_t *size, int n, ...);
+int mpc_load(const void *data, size_t size, int n, ...);
+
+/*
+** A profile counts, for each named parser run
+** by `mpc_parse_profile`, how often it was called,
+** succeeded and failed, the bytes it consumed,
+** how often the input was rewound while it was
+** the innermost named parser running, and the
+** time spent in it with and without the named
+** parsers it called. A profile adds up over any
+** number of parses, but can't be used by two at
+** once. Time in a rule calling itself is counted
+** for each call.
+*/
+
+typedef struct mpc_profile_t mpc_profile_t;
+
+mpc_profile_t *mpc_profile_new(void);
+void mpc_profile_delete(mpc_profile_t *f);
+int mpc_parse_profile(const char *filename, const char *string, mpc_parser_t *p, mpc_result_t *r, mpc_profile_t *f);
+void mpc_profile_print(mpc_profile_t *f);
+void mpc_profile_print_to(mpc_profile_t *f, FILE *fp);
+void mpc_profile_print_json_to(mpc_profile_t *f, FILE *fp);
+
 int mpc_test_pass(mpc_parser_t *p, const char *s, const void *d,
   int(*tester)(const void*, const void*), 
   mpc_dtor_t destructor, 
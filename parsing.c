@@ -1,6 +1,11 @@
 #include "mpc.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 /**
  * @file prompt.c 
@@ -11,8 +16,6 @@
 
 /*Preprocessors for when run on a Windows machine*/
 #ifdef _WIN32
-#include <string.h>
-
 static char buffer[2048];
 
 
@@ -33,6 +36,8 @@ void add_history(char *dummy){}
 #else
 #include <editline/readline.h>
 #include <editline/history.h>
+#include <pthread.h>
+#include <unistd.h>
 #endif
 
 #define LASSERT(args, cond, fmt, ...) \
@@ -172,7 +177,7 @@ lval* lval_err(char* fmt, ...){
 lval* lval_sym(char* s){
 	lval *v = malloc(sizeof(lval));
 	v->type = LVAL_SYM;
-	v->sym 	= malloc(sizeof(strlen(s)+1));
+	v->sym 	= malloc(strlen(s)+1);
        	strcpy(v->sym, s);
 
 	return v;	
@@ -226,47 +231,41 @@ void lval_del(lval* v){
 }
 
 
+/*
+ * Actions the parser runs as it matches each rule, so the lvals are
+ * built directly. Number and symbol get the text they matched, the
+ * lists get the lvals of the expressions inside them.
+ */
+
 /* I know this funtion is kind of of unsafe, but I like to live on the edge*/
-lval* lval_read_num(mpc_ast_t* t){
-	double x = atof(t->contents);
+mpc_val_t* lval_read_num(int n, mpc_val_t** xs){
+	(void)n;
+	double x = atof(xs[0]);
+	free(xs[0]);
 	return lval_num(x);
 }
 
-lval* lval_add(lval* v, lval* x);
-lval* lval_read(mpc_ast_t* t){
-	/* If Symbol or Number return an lval of that type */
-	if(strstr(t->tag, "number")){
-		return lval_read_num(t);
-	}
-
-	if(strstr(t->tag, "symbol")){	
-		return lval_sym(t->contents);
-	}
+mpc_val_t* lval_read_sym(int n, mpc_val_t** xs){
+	(void)n;
+	lval* x = lval_sym(xs[0]);
+	free(xs[0]);
+	return x;
+}
 
-	/* create an empty list if root(>) or sexpr */
-	lval* x = NULL;
-	if(strcmp(t->tag, ">") == 0){
-		x = lval_sexpr();
-	}
-	if(strstr(t->tag, "sexpr")){
-		x = lval_sexpr();
-	}
-	if(strstr(t->tag, "qexpr")) {
-		x = lval_qexpr();
+lval* lval_add(lval* v, lval* x);
+lval* lval_read_list(lval* x, int n, mpc_val_t** xs){
+	for(int i=0; i < n; i++){
+		x = lval_add(x, xs[i]);
 	}
+	return x;
+}
 
-	/* Fill the list with valid expression contained within */
-	for(int i=0; i < t->children_num; i++){
-		if(strcmp(t->children[i]->contents, "(") == 0) {continue;}
-		if(strcmp(t->children[i]->contents, ")") == 0) {continue;}
-		if(strcmp(t->children[i]->contents, "{") == 0) {continue;}
-		if(strcmp(t->children[i]->contents, "}") == 0) {continue;}
-		if(strcmp(t->children[i]->tag,  "regex") == 0) {continue;}
-
-		x = lval_add(x, lval_read(t->children[i]));
-	}
+mpc_val_t* lval_read_sexpr(int n, mpc_val_t** xs){
+	return lval_read_list(lval_sexpr(), n, xs);
+}
 
-	return x;
+mpc_val_t* lval_read_qexpr(int n, mpc_val_t** xs){
+	return lval_read_list(lval_qexpr(), n, xs);
 }
 
 lval* lval_add(lval* v, lval* x){
@@ -276,6 +275,104 @@ lval* lval_add(lval* v, lval* x){
 	return v;
 }
 
+/*
+ * Hand written reader for the Peasant grammar. It makes a single pass
+ * over the input and builds the lvals as it goes, accepting exactly what
+ * the grammar in main() accepts. Anything it can't read gives back NULL,
+ * and the caller runs the mpc parser again to get a proper error message.
+ */
+
+static int lval_read_space(char c){
+	return c != '\0' && strchr(" \f\n\r\t\v", c) != NULL;
+}
+
+static int lval_read_symchar(char c){
+	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9')
+		|| (c != '\0' && strchr("_+-*/\\=<>!&^%", c) != NULL);
+}
+
+/* Length of the number at the start of s, or 0 if it doesn't start with one */
+static size_t lval_read_numlen(const char* s){
+	size_t n = (s[0] == '-');
+	if(s[n] < '0' || s[n] > '9'){ return 0; }
+	while(s[n] >= '0' && s[n] <= '9'){ n++; }
+	if(s[n] == '.'){
+		n++;
+		while(s[n] >= '0' && s[n] <= '9'){ n++; }
+	}
+	return n;
+}
+
+/*
+ * Reads the text from s up to end. A number or symbol is never cut off
+ * by end, as end is either the end of the string or just past a bracket.
+ */
+lval* lval_read_range(const char* s, const char* end){
+	lval* x = lval_sexpr();
+	/* The lists still open around x, innermost last */
+	lval** open = NULL;
+	int depth = 0, slots = 0, ok = 1;
+	char buf[64];
+
+	while(s < end && lval_read_space(*s)){ s++; }
+
+	while(s < end){
+		char c = *s;
+		size_t n;
+
+		if(c == '(' || c == '{'){
+			if(depth == slots){
+				slots = slots ? slots * 2 : 16;
+				open = realloc(open, sizeof(lval*) * slots);
+			}
+			open[depth++] = x;
+			x = (c == '(') ? lval_sexpr() : lval_qexpr();
+			s++;
+		}else if(c == ')' || c == '}'){
+			if(depth == 0 || x->type != (c == ')' ? LVAL_SEXPR : LVAL_QEXPR)){ ok = 0; break; }
+			x = lval_add(open[--depth], x);
+			s++;
+		}else if((n = lval_read_numlen(s)) > 0 || lval_read_symchar(c)){
+			/* Like the grammar, a number is tried first, so "12abc" is 12 then abc */
+			int num = (n > 0);
+			if(!num){
+				while(lval_read_symchar(s[n])){ n++; }
+			}
+
+			/* Copy the token out so atof and lval_sym stop at its end */
+			char* t = (n < sizeof(buf)) ? buf : malloc(n+1);
+			memcpy(t, s, n);
+			t[n] = '\0';
+			x = lval_add(x, num ? lval_num(atof(t)) : lval_sym(t));
+			if(t != buf){ free(t); }
+			s += n;
+		}else{
+			ok = 0;
+			break;
+		}
+
+		while(s < end && lval_read_space(*s)){ s++; }
+	}
+
+	if(ok && depth == 0){
+		free(open);
+		return x;
+	}
+
+	/* The unfinished lists aren't attached to each other yet */
+	while(depth > 0){
+		lval_del(x);
+		x = open[--depth];
+	}
+	lval_del(x);
+	free(open);
+	return NULL;
+}
+
+lval* lval_read_str(const char* s){
+	return lval_read_range(s, s + strlen(s));
+}
+
 void lval_print(lval* v);
 
 void lval_expr_print(lval* v, char open, char close){
@@ -675,6 +772,260 @@ lval* lval_eval(lenv *e, lval* v){
 	return v;
 }
 
+/*
+ * Loading a file reads it in pieces on several threads. A piece may end
+ * just past any bracket that closes a top level form: brackets are never
+ * part of a number or a symbol, so the pieces read the same as the whole
+ * file does. Finding those brackets is the only pass over the file that
+ * isn't shared out, so it looks at 16 bytes at a time and only stops at
+ * the ones holding a bracket.
+ */
+
+typedef struct {
+	const char* start;
+	const char* end;
+	lval* x;
+} load_piece;
+
+typedef struct {
+	load_piece* pieces;
+	int count;
+	int first;
+	int stride;
+} load_job;
+
+#ifdef __SSE2__
+static int load_ctz(unsigned int m){
+#ifdef __GNUC__
+	return __builtin_ctz(m);
+#else
+	int n = 0;
+	while(!(m & 1)){ m >>= 1; n++; }
+	return n;
+#endif
+}
+
+static int load_popcount(unsigned int m){
+#ifdef __GNUC__
+	return __builtin_popcount(m);
+#else
+	int n = 0;
+	for(; m; m &= m - 1){ n++; }
+	return n;
+#endif
+}
+#endif
+
+/* Adds a cut at offset at, giving back where the next one may go */
+static size_t load_cut(size_t** cuts, int* count, size_t at, size_t step){
+	*cuts = realloc(*cuts, sizeof(size_t) * (*count + 1));
+	(*cuts)[(*count)++] = at;
+	return at + step;
+}
+
+/* Offsets to split the text at, each at least step bytes past the last */
+static size_t* load_split(const char* s, size_t len, size_t step, int* count){
+	size_t* cuts = NULL;
+	size_t next = step, i = 0;
+	long depth = 0;
+	*count = 0;
+
+#ifdef __SSE2__
+	const __m128i so = _mm_set1_epi8('('), sc = _mm_set1_epi8(')');
+	const __m128i qo = _mm_set1_epi8('{'), qc = _mm_set1_epi8('}');
+	for(; i + 16 <= len && depth >= 0; i += 16){
+		__m128i v = _mm_loadu_si128((const __m128i*)(s + i));
+		unsigned int open = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, so), _mm_cmpeq_epi8(v, qo)));
+		unsigned int close = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, sc), _mm_cmpeq_epi8(v, qc)));
+
+		/* Only go through the brackets one at a time if a cut could go here */
+		if(i + 16 < next || depth > load_popcount(close)){
+			depth += load_popcount(open) - load_popcount(close);
+			continue;
+		}
+		for(unsigned int m = open | close; m && depth >= 0; m &= m - 1){
+			int b = load_ctz(m);
+			if((open >> b) & 1){ depth++; }
+			else if(--depth == 0 && i + b + 1 >= next){ next = load_cut(&cuts, count, i + b + 1, step); }
+		}
+	}
+#endif
+
+	/* A stray closing bracket makes its piece fail, so splitting can stop there */
+	for(; i < len && depth >= 0; i++){
+		if(s[i] == '(' || s[i] == '{'){ depth++; }
+		else if((s[i] == ')' || s[i] == '}') && --depth == 0 && i + 1 >= next){
+			next = load_cut(&cuts, count, i + 1, step);
+		}
+	}
+	return cuts;
+}
+
+static void* load_job_run(void* arg){
+	load_job* j = arg;
+	for(int i = j->first; i < j->count; i += j->stride){
+		j->pieces[i].x = lval_read_range(j->pieces[i].start, j->pieces[i].end);
+	}
+	return NULL;
+}
+
+/* Reads the pieces, using up to jobs threads */
+static void load_read_pieces(load_piece* pieces, int count, int jobs){
+	if(jobs > count){ jobs = count; }
+	load_job* js = malloc(sizeof(load_job) * jobs);
+	for(int t = 0; t < jobs; t++){
+		js[t] = (load_job){ pieces, count, t, jobs };
+	}
+
+#ifndef _WIN32
+	pthread_t* threads = malloc(sizeof(pthread_t) * jobs);
+	int* started = calloc(jobs, sizeof(int));
+	for(int t = 1; t < jobs; t++){
+		started[t] = pthread_create(&threads[t], NULL, load_job_run, &js[t]) == 0;
+	}
+	load_job_run(&js[0]);
+	for(int t = 1; t < jobs; t++){
+		if(started[t]){ pthread_join(threads[t], NULL); }
+		else{ load_job_run(&js[t]); }
+	}
+	free(started);
+	free(threads);
+#else
+	for(int t = 0; t < jobs; t++){ load_job_run(&js[t]); }
+#endif
+
+	free(js);
+}
+
+static char* load_file(const char* path, size_t* size){
+	FILE* f = fopen(path, "rb");
+	if(f == NULL){ return NULL; }
+
+	fseek(f, 0, SEEK_END);
+	long n = ftell(f);
+	rewind(f);
+
+	char* data = n >= 0 ? malloc(n + 1) : NULL;
+	if(data == NULL || fread(data, 1, n, f) != (size_t)n){
+		free(data);
+		fclose(f);
+		return NULL;
+	}
+
+	fclose(f);
+	data[n] = '\0';
+	*size = n;
+	return data;
+}
+
+/* Reads the text with mpc, which also explains why it can't be read */
+static lval* load_mpc(const char* path, const char* data, mpc_parser_t* Peasant, mpc_profile_t* profile){
+	mpc_result_t r;
+	int ok = profile ? mpc_parse_profile(path, data, Peasant, &r, profile)
+		: mpc_parse(path, data, Peasant, &r);
+	if(ok){ return r.output; }
+	mpc_err_print(r.error);
+	mpc_err_delete(r.error);
+	return NULL;
+}
+
+/*
+ * Reads every expression in the file into one sexpr, as if it were typed
+ * on one line at the prompt. Prints why and gives back NULL if it can't.
+ */
+static lval* load_read(const char* path, mpc_parser_t* Peasant, int jobs, mpc_profile_t* profile){
+	size_t size = 0;
+	char* data = load_file(path, &size);
+	if(data == NULL){
+		printf("Could not open '%s'.\n", path);
+		return NULL;
+	}
+
+	/* When profiling, the whole file goes through mpc so its rules are timed */
+	if(profile){
+		lval* x = load_mpc(path, data, Peasant, profile);
+		free(data);
+		return x;
+	}
+
+	/* Give each thread a few pieces so one slow piece doesn't hold up the rest */
+	int count = 0;
+	size_t step = size / ((size_t)jobs * 4) + 1;
+	size_t* cuts = jobs > 1 ? load_split(data, size, step < 65536 ? 65536 : step, &count) : NULL;
+
+	load_piece* pieces = malloc(sizeof(load_piece) * (count + 1));
+	for(int i = 0; i <= count; i++){
+		pieces[i].start = data + (i == 0 ? 0 : cuts[i-1]);
+		pieces[i].end = data + (i == count ? size : cuts[i]);
+	}
+	free(cuts);
+	load_read_pieces(pieces, count + 1, jobs);
+
+	/* Put the pieces back together in order, or let mpc explain the failure */
+	int total = 0, ok = 1;
+	for(int i = 0; i <= count; i++){
+		if(pieces[i].x){ total += pieces[i].x->count; }
+		else{ ok = 0; }
+	}
+
+	lval* x = NULL;
+	if(ok){
+		x = lval_sexpr();
+		x->cell = malloc(sizeof(lval*) * total);
+		for(int i = 0; i <= count; i++){
+			for(int j = 0; j < pieces[i].x->count; j++){
+				x->cell[x->count++] = pieces[i].x->cell[j];
+			}
+			pieces[i].x->count = 0;
+		}
+	}else{
+		x = load_mpc(path, data, Peasant, NULL);
+	}
+
+	for(int i = 0; i <= count; i++){
+		if(pieces[i].x){ lval_del(pieces[i].x); }
+	}
+	free(pieces);
+	free(data);
+	return x;
+}
+
+/*
+ * The grammar cache holds the grammar text followed by the rules saved
+ * with mpc_dump, so a cache made from a different grammar is never used.
+ * Loading it skips parsing the grammar and compiling its regexes.
+ */
+
+static char* grammar_cache_read(const char* path, const char* grammar, size_t* size){
+	FILE* f = fopen(path, "rb");
+	if(f == NULL){ return NULL; }
+
+	fseek(f, 0, SEEK_END);
+	long n = ftell(f);
+	rewind(f);
+
+	size_t len = strlen(grammar) + 1;
+	char* data = n > 0 ? malloc(n) : NULL;
+	if(data == NULL || fread(data, 1, n, f) != (size_t)n
+		|| (size_t)n < len || memcmp(data, grammar, len) != 0){
+		free(data);
+		fclose(f);
+		return NULL;
+	}
+
+	fclose(f);
+	*size = n;
+	return data;
+}
+
+static void grammar_cache_write(const char* path, const char* grammar, const void* rules, size_t size){
+	FILE* f = fopen(path, "wb");
+	if(f == NULL){ return; }
+	fwrite(grammar, 1, strlen(grammar) + 1, f);
+	fwrite(rules, 1, size, f);
+	fclose(f);
+}
+
 int main(int argc, char** argv){
 	/* Creating the parsers for the Polish notation*/
 	mpc_parser_t* Number	= mpc_new("number");
@@ -696,7 +1047,14 @@ int main(int argc, char** argv){
 	 * 		  and the end of an input
 	 */ 
 
-	mpca_lang(MPCA_LANG_DEFAULT,
+	/*Build lvals straight from the parser, the whole input is one sexpr*/
+	mpca_action(Number, lval_read_num, (mpc_dtor_t)lval_del);
+	mpca_action(Symbol, lval_read_sym, (mpc_dtor_t)lval_del);
+	mpca_action(Sexpr, lval_read_sexpr, (mpc_dtor_t)lval_del);
+	mpca_action(Qexpr, lval_read_qexpr, (mpc_dtor_t)lval_del);
+	mpca_action(Peasant, lval_read_sexpr, (mpc_dtor_t)lval_del);
+
+	const char* grammar =
 		"								\
 			number	: /-?[0-9]+(\\.[0-9]*)?/;			\
 			symbol	: /[a-zA-Z0-9_+\\-*\\/\\\\=<>!&^%]+/;		\
@@ -704,37 +1062,99 @@ int main(int argc, char** argv){
 			qexpr	: '{' <expr>* '}';				\
 			expr	: <number> | <symbol> | <sexpr> | <qexpr>;	\
 			peasant	: /^/ <expr>* /$/;				\
-		",
-		Number, Symbol, Sexpr, Qexpr, Expr, Peasant
-	);
+		";
+
+	/* With --stats, show what optimising does to each rule */
+	/* With --cache FILE, keep the compiled grammar in FILE between runs */
+	/* With --jobs N, read files given on N threads, by default one per core */
+	/* With --profile text or --profile json, time each rule reading the files */
+	int flags = MPCA_LANG_ACTIONS;
+	const char* cache = NULL;
+	const char* profile = NULL;
+	int jobs = 1, files = 0;
+#ifndef _WIN32
+	jobs = (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+	for(int i = 1; i < argc; i++){
+		if(strcmp(argv[i], "--stats") == 0){ flags |= MPCA_LANG_STATS; }
+		else if(strcmp(argv[i], "--cache") == 0 && i + 1 < argc){ cache = argv[++i]; }
+		else if(strcmp(argv[i], "--jobs") == 0 && i + 1 < argc){ jobs = atoi(argv[++i]); }
+		else if(strcmp(argv[i], "--profile") == 0 && i + 1 < argc){ profile = argv[++i]; }
+		else{ argv[++files] = argv[i]; }
+	}
+	if(jobs < 1){ jobs = 1; }
+
+	size_t size = 0;
+	char* data = cache ? grammar_cache_read(cache, grammar, &size) : NULL;
+	size_t len = strlen(grammar) + 1;
+	if(data == NULL || !mpc_load(data + len, size - len, 6,
+			Number, Symbol, Sexpr, Qexpr, Expr, Peasant)){
+		mpca_lang(flags, grammar, Number, Symbol, Sexpr, Qexpr, Expr, Peasant);
+		void* rules = cache ? mpc_dump(&size, 6, Number, Symbol, Sexpr, Qexpr, Expr, Peasant) : NULL;
+		if(rules){ grammar_cache_write(cache, grammar, rules, size); }
+		free(rules);
+	}
+	free(data);
 	
 	lenv* e = lenv_new();
 	lenv_add_builtins(e);
 
+	/* Evaluate each expression in the files given in turn, then exit */
+	if(files > 0){
+		mpc_profile_t* prof = profile ? mpc_profile_new() : NULL;
+		for(int i = 1; i <= files; i++){
+			lval* x = load_read(argv[i], Peasant, jobs, prof);
+			if(x == NULL){ continue; }
+			for(int j = 0; j < x->count; j++){
+				lval* y = lval_eval(e, x->cell[j]);
+				if(y->type == LVAL_ERR){ lval_println(y); }
+				lval_del(y);
+			}
+			x->count = 0;
+			lval_del(x);
+		}
+		if(prof){
+			if(strcmp(profile, "json") == 0){ mpc_profile_print_json_to(prof, stderr); }
+			else{ mpc_profile_print_to(prof, stderr); }
+			mpc_profile_delete(prof);
+		}
+		lenv_del(e);
+		mpc_cleanup(6, Number, Symbol, Sexpr, Qexpr, Expr, Peasant);
+		return 0;
+	}
+
 	/*Print Version and Exit information*/
 	puts("Peasant Lisp Version 0.1");
 	puts("Press ctrl+c to exit\n");
 	
-	/* Attempt to parse the user input*/
+	/* Attempt to parse the user input, reusing one context for every line */
+	mpc_context_t* ctx = mpc_context_new();
 	while(1){
 		char* input = readline("Peasant> ");
 		add_history(input);
-		mpc_result_t r;
-		/* On success, print the AST */
-		if(mpc_parse("<stdin>", input, Peasant, &r)){
-			lval* x = lval_eval(e, lval_read(r.output));
+		/* Read with the fast reader, mpc is only needed to explain a failure */
+		lval* x = lval_read_str(input);
+		if(x == NULL){
+			mpc_result_t r;
+			if(mpc_parse_context(ctx, "<stdin>", input, Peasant, &r)){
+				x = r.output;
+			}else{
+				/* Print the error messages */
+				mpc_err_print(r.error);
+				mpc_err_delete(r.error);
+			}
+		}
+
+		/* On success, evaluate the expression read */
+		if(x){
+			x = lval_eval(e, x);
 			lval_println(x);
 			lval_del(x);
-			//mpc_ast_print(r.output);
-			mpc_ast_delete(r.output);
-		}else{
-			/* Else print the error messages */
-			mpc_err_print(r.error);
-			mpc_err_delete(r.error);
 		}
 		free(input);
 	}
 
+	mpc_context_delete(ctx);
 	lenv_del(e);
 
 	/* Undefine and Delete the parsers*/
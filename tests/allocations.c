@@ -0,0 +1,141 @@
+/*
+ * Counts the calls to malloc, calloc and realloc made by each
+ * mpc_parse_context call once the context is warm, with every
+ * other allocation left to the result.
+ *
+ *   AST      the tree, whose tags and children arrays are
+ *            grown with realloc as it is put together
+ *   arena    only the arena the tree is returned in
+ *   actions  only the text handed to each action that takes
+ *            the text it matched; the actions here allocate
+ *            nothing themselves
+ *
+ * Interposing malloc like this relies on glibc.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "peasant.h"
+
+extern void *__libc_malloc(size_t n);
+extern void *__libc_calloc(size_t n, size_t m);
+extern void *__libc_realloc(void *p, size_t n);
+
+static long allocs = 0;
+static int counting = 0;
+
+void *malloc(size_t n){ allocs += counting; return __libc_malloc(n); }
+void *calloc(size_t n, size_t m){ allocs += counting; return __libc_calloc(n, m); }
+void *realloc(void *p, size_t n){ allocs += counting; return __libc_realloc(p, n); }
+
+enum { ROUNDS = 100 };
+
+/* Allocations per parse of the lines below, on average */
+enum { AST_ALLOCS = 136, ARENA_ALLOCS = 4 };
+
+static const char *lines[] = {
+	"(+ 1 2)",
+	"(def {x y} (list 1 2.5 -3 {a b c}))",
+	"{head (list 1 2 3)}",
+	"(\\ {x} {* x x})",
+	"(if (== x 1) {print a} {print 2})",
+	"(eval (head {(+ 1 2) (+ 10 20)}))",
+	"x",
+	"(((((((((1)))))))))",
+};
+
+enum { LINES = sizeof(lines) / sizeof(lines[0]) };
+
+/* The actions give back a value that needs no allocation */
+static char value;
+static long texts = 0;
+
+static mpc_val_t *read_text(int n, mpc_val_t **xs){
+	(void)n;
+	texts++;
+	free(xs[0]);
+	return &value;
+}
+
+static mpc_val_t *read_list(int n, mpc_val_t **xs){
+	(void)n;
+	(void)xs;
+	return &value;
+}
+
+/* Blocks in a tree from mpc_ast_new */
+static long ast_blocks(mpc_ast_t *a){
+	long n = 3 + (a->children_num > 0);
+	for(int i = 0; i < a->children_num; i++){ n += ast_blocks(a->children[i]); }
+	return n;
+}
+
+/* Parses every line ROUNDS times, giving the allocations per parse */
+static double count(peasant_t *g, mpc_context_t *c, int ast, long *blocks){
+	mpc_result_t r;
+	long total = 0;
+	*blocks = 0;
+	for(int k = 0; k < ROUNDS; k++){
+		for(int j = 0; j < LINES; j++){
+			allocs = 0;
+			counting = 1;
+			int ok = mpc_parse_context(c, "<test>", lines[j], g->peasant, &r);
+			counting = 0;
+			total += allocs;
+			if(!ok){ mpc_err_print(r.error); exit(1); }
+			if(ast){
+				*blocks += ast_blocks(r.output);
+				mpc_ast_delete(r.output);
+			}
+		}
+	}
+	*blocks /= ROUNDS * LINES;
+	return (double)total / (ROUNDS * LINES);
+}
+
+int main(void){
+	const char *names[] = { "AST", "arena", "actions" };
+	int flags[] = { MPCA_LANG_DEFAULT, MPCA_LANG_ARENA, MPCA_LANG_ACTIONS };
+	int failed = 0;
+
+	for(int f = 0; f < 3; f++){
+		peasant_t g;
+		long blocks;
+		peasant_new(&g);
+		if(flags[f] & MPCA_LANG_ACTIONS){
+			mpca_action(g.number, read_text, NULL);
+			mpca_action(g.symbol, read_text, NULL);
+			mpca_action(g.sexpr, read_list, NULL);
+			mpca_action(g.qexpr, read_list, NULL);
+			mpca_action(g.peasant, read_list, NULL);
+		}
+		peasant_lang(&g, flags[f]);
+
+		/* Warm the context up first */
+		mpc_context_t *c = mpc_context_new();
+		count(&g, c, !(flags[f] & MPCA_LANG_ACTIONS), &blocks);
+		texts = 0;
+		double n = count(&g, c, !(flags[f] & MPCA_LANG_ACTIONS), &blocks);
+		double text = (double)texts / (ROUNDS * LINES);
+
+		switch(f){
+			case 0:
+				printf("%-8s %6.2f allocations per parse, at most %d, tree has %ld blocks\n", names[f], n, AST_ALLOCS, blocks);
+				if(n > AST_ALLOCS){ failed = 1; }
+				break;
+			case 1:
+				printf("%-8s %6.2f allocations per parse, at most %d\n", names[f], n, ARENA_ALLOCS);
+				if(n > ARENA_ALLOCS){ failed = 1; }
+				break;
+			case 2:
+				printf("%-8s %6.2f allocations per parse, %.2f texts\n", names[f], n, text);
+				if(n != text){ failed = 1; }
+				break;
+		}
+
+		mpc_context_delete(c);
+		peasant_delete(&g);
+	}
+
+	return failed;
+}
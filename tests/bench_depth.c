@@ -0,0 +1,41 @@
+/*
+ * Parsing time against nesting depth. The time per level
+ * should stay flat from ten levels to a million; a rising
+ * curve means some step is worse than linear in the depth.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "peasant.h"
+
+int main(void){
+	peasant_t g;
+	peasant_new(&g);
+	peasant_lang(&g, MPCA_LANG_DEFAULT);
+
+	printf("%10s %12s %12s\n", "depth", "ms", "ns/level");
+	for(long depth = 10; depth <= 1000000; depth *= 10){
+		char *input = malloc(2 * depth + 2);
+		for(long k = 0; k < depth; k++){ input[k] = '('; input[2 * depth - k] = ')'; }
+		input[depth] = 'x';
+		input[2 * depth + 1] = '\0';
+
+		int reps = depth < 10000 ? (int)(100000 / depth) : 1;
+		mpc_result_t r;
+		clock_t t = clock();
+		for(int k = 0; k < reps; k++){
+			if(!mpc_parse("bench", input, g.peasant, &r)){
+				mpc_err_print(r.error);
+				return 1;
+			}
+			mpc_ast_delete(r.output);
+		}
+		double sec = (double)(clock() - t) / CLOCKS_PER_SEC / reps;
+		printf("%10ld %12.3f %12.1f\n", depth, sec * 1000, sec * 1e9 / depth);
+		free(input);
+	}
+
+	peasant_delete(&g);
+	return 0;
+}
@@ -0,0 +1,50 @@
+/*
+ * Reading time of the hand written reader against the mpc
+ * grammar with lval actions, on scripts of growing size made
+ * of the same Peasant forms.
+ */
+
+#include <time.h>
+#include "reader.h"
+
+static const char *forms =
+	"(def {fib} (\\ {n} {if (< n 2) {n} {+ (fib (- n 1)) (fib (- n 2))}}))\n"
+	"(print (map (\\ {x} {* x 2.5}) {1 2 3 -4 5}))\n";
+
+int main(void){
+	peasant_t g;
+	peasant_new(&g);
+	reader_lang(&g);
+
+	printf("%10s %12s %12s %8s\n", "size", "reader ms", "mpc ms", "speedup");
+	for(size_t size = 4 << 10; size <= 1 << 20; size *= 4){
+		size_t n = strlen(forms), len = 0;
+		char *input = malloc(size + n + 1);
+		while(len < size){ memcpy(input + len, forms, n); len += n; }
+		input[len] = '\0';
+
+		int reps = (int)((4 << 20) / size);
+		clock_t t = clock();
+		for(int k = 0; k < reps; k++){
+			lval_del(lval_read_str(input));
+		}
+		double fast = (double)(clock() - t) / CLOCKS_PER_SEC / reps;
+
+		mpc_result_t r;
+		t = clock();
+		for(int k = 0; k < reps; k++){
+			if(!mpc_parse("bench", input, g.peasant, &r)){
+				mpc_err_print(r.error);
+				return 1;
+			}
+			lval_del(r.output);
+		}
+		double slow = (double)(clock() - t) / CLOCKS_PER_SEC / reps;
+
+		printf("%8zu KB %12.3f %12.3f %7.1fx\n", len >> 10, fast * 1000, slow * 1000, slow / fast);
+		free(input);
+	}
+
+	peasant_delete(&g);
+	return 0;
+}
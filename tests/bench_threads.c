@@ -0,0 +1,40 @@
+/*
+ * Parses per second against the number of threads sharing
+ * one grammar, up to twice the number of cores. Each thread
+ * does the same amount of work, so on an idle machine the
+ * speedup should follow the thread count up to the cores.
+ */
+
+#include <time.h>
+#include <unistd.h>
+#include "threads.h"
+
+static double now(void){
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+int main(void){
+	int cores = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	double base = 0;
+
+	threads_setup();
+	rounds = 2;
+
+	printf("%8s %10s %12s %8s\n", "threads", "s", "parses/s", "speedup");
+	for(int n = 1; n <= 2 * cores && n <= MAX_THREADS; n *= 2){
+		double t = now();
+		int bad = threads_run(n);
+		t = now() - t;
+		if(n == 1){ base = t; }
+		printf("%8d %10.3f %12.0f %8.2f\n", n, t, n * rounds * INPUTS / t, base * n / t);
+		if(bad){
+			printf("%d mismatches\n", bad);
+			return 1;
+		}
+	}
+
+	threads_cleanup();
+	return 0;
+}
@@ -0,0 +1,47 @@
+/*
+ * Parsing throughput against input size. Each input is the
+ * same Peasant forms repeated, so MB/s should stay flat as
+ * the input grows; a falling curve means some step is
+ * worse than linear in the input length.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "peasant.h"
+
+static const char *forms =
+	"(def {fib} (\\ {n} {if (< n 2) {n} {+ (fib (- n 1)) (fib (- n 2))}}))\n"
+	"(print (map (\\ {x} {* x 2.5}) {1 2 3 -4 5}))\n";
+
+int main(void){
+	peasant_t g;
+	peasant_new(&g);
+	peasant_lang(&g, MPCA_LANG_DEFAULT);
+
+	printf("%10s %12s %10s\n", "size", "ms", "MB/s");
+	for(size_t size = 16 << 10; size <= 4 << 20; size *= 4){
+		size_t n = strlen(forms), len = 0;
+		char *input = malloc(size + n + 1);
+		while(len < size){ memcpy(input + len, forms, n); len += n; }
+		input[len] = '\0';
+
+		int reps = (int)((8 << 20) / size);
+		mpc_result_t r;
+		clock_t t = clock();
+		for(int k = 0; k < reps; k++){
+			if(!mpc_nparse("bench", input, len, g.peasant, &r)){
+				mpc_err_print(r.error);
+				return 1;
+			}
+			mpc_ast_delete(r.output);
+		}
+		double sec = (double)(clock() - t) / CLOCKS_PER_SEC / reps;
+		printf("%8zu KB %12.2f %10.2f\n", len >> 10, sec * 1000, len / sec / (1 << 20));
+		free(input);
+	}
+
+	peasant_delete(&g);
+	return 0;
+}
@@ -0,0 +1,60 @@
+/*
+ * A count of zero matches nothing without running its parser,
+ * whatever comes next in the input, in regular expressions,
+ * combinators and grammars alike.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "mpc.h"
+
+static const struct { const char *re, *input, *match; } regexes[] = {
+	{ "(a){0}", "xy", "" },
+	{ "(a){0}", "ay", "" },
+	{ "b(a){0}c", "bc", "bc" },
+	{ "b(a){0}c", "bac", NULL },
+	{ "(a*){0}", "aaa", "" },
+	{ "(a*){0}b", "b", "b" },
+};
+
+enum { REGEXES = sizeof(regexes) / sizeof(regexes[0]) };
+
+static int check(const char *what, const char *input, mpc_parser_t *p, const char *match){
+	mpc_result_t r;
+	int ok = mpc_parse("<test>", input, p, &r);
+	int good = match ? ok && strcmp(r.output, match) == 0 : !ok;
+	printf("%-12s on %-4s %s\n", what, input, good ? "ok" : "wrong");
+	if(ok){ free(r.output); }else{ mpc_err_delete(r.error); }
+	return good;
+}
+
+int main(void){
+	int failed = 0;
+
+	for(int k = 0; k < REGEXES; k++){
+		mpc_parser_t *p = mpc_re(regexes[k].re);
+		if(!check(regexes[k].re, regexes[k].input, p, regexes[k].match)){ failed = 1; }
+		mpc_delete(p);
+	}
+
+	mpc_parser_t *p = mpc_and(3, mpcf_strfold,
+		mpc_char('b'), mpc_count(0, mpcf_strfold, mpc_many(mpcf_strfold, mpc_char('a')), free), mpc_char('c'),
+		free, free);
+	if(!check("mpc_count", "bc", p, "bc")){ failed = 1; }
+	mpc_delete(p);
+
+	/* Grammars are checked in each mode that parses differently */
+	int flags[] = { MPCA_LANG_DEFAULT, MPCA_LANG_PREDICTIVE, MPCA_LANG_PACKRAT };
+	for(int f = 0; f < 3; f++){
+		mpc_result_t r;
+		mpc_parser_t *e = mpc_new("e");
+		mpc_err_t *err = mpca_lang(flags[f], " e : /^/ 'b' 'a'{0} 'c' /$/ ; ", e, NULL);
+		if(err){ mpc_err_print(err); return 1; }
+		int ok = mpc_parse("<test>", "bc", e, &r);
+		printf("grammar %-4d on bc   %s\n", flags[f], ok ? "ok" : "wrong");
+		if(ok){ mpc_ast_delete(r.output); }else{ mpc_err_delete(r.error); failed = 1; }
+		mpc_delete(e);
+	}
+
+	return failed;
+}
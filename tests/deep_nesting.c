@@ -0,0 +1,100 @@
+/*
+ * Parses Peasant input nested 100000 levels deep on a
+ * thread with a 64 KB stack, which only works if neither
+ * parsing nor deleting the tree recurses once per level.
+ * Both a well formed input and one missing its last
+ * bracket are tried, with and without memoization and an
+ * arena.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "peasant.h"
+
+enum { DEPTH = 100000, STACK = 64 << 10 };
+
+typedef struct {
+	peasant_t *g;
+	const char *input;
+	int ok;
+	long levels;
+} job_t;
+
+/* Counts the sexpr nodes without recursing */
+static long count_sexprs(mpc_ast_t *a){
+	long n = 0, num = 0, slots = 64;
+	mpc_ast_t **pending = malloc(sizeof(mpc_ast_t*) * slots);
+	pending[num++] = a;
+	while(num > 0){
+		a = pending[--num];
+		if(strstr(a->tag, "sexpr")){ n++; }
+		if(num + a->children_num > slots){
+			slots = 2 * (num + a->children_num);
+			pending = realloc(pending, sizeof(mpc_ast_t*) * slots);
+		}
+		for(int i = 0; i < a->children_num; i++){ pending[num++] = a->children[i]; }
+	}
+	free(pending);
+	return n;
+}
+
+static void *run(void *x){
+	job_t *j = x;
+	mpc_result_t r;
+	j->ok = mpc_parse("deep", j->input, j->g->peasant, &r);
+	if(j->ok){
+		j->levels = count_sexprs(r.output);
+		mpc_ast_delete(r.output);
+	} else {
+		mpc_err_delete(r.error);
+	}
+	return NULL;
+}
+
+static int parse_small_stack(peasant_t *g, const char *input, long *levels){
+	pthread_t t;
+	pthread_attr_t attr;
+	job_t j = { g, input, 0, 0 };
+	pthread_attr_init(&attr);
+	pthread_attr_setstacksize(&attr, STACK);
+	if(pthread_create(&t, &attr, run, &j) != 0){ perror("pthread_create"); exit(1); }
+	pthread_join(t, NULL);
+	pthread_attr_destroy(&attr);
+	*levels = j.levels;
+	return j.ok;
+}
+
+int main(void){
+	int failed = 0;
+	int flags[] = { MPCA_LANG_DEFAULT, MPCA_LANG_PACKRAT, MPCA_LANG_ARENA };
+	const char *names[] = { "default", "packrat", "arena" };
+
+	char *input = malloc(2 * DEPTH + 2);
+	for(int k = 0; k < DEPTH; k++){ input[k] = '('; input[2 * DEPTH - k] = ')'; }
+	input[DEPTH] = 'x';
+	input[2 * DEPTH + 1] = '\0';
+
+	for(int f = 0; f < 3; f++){
+		peasant_t g;
+		long levels;
+		peasant_new(&g);
+		peasant_lang(&g, flags[f]);
+
+		int ok = parse_small_stack(&g, input, &levels);
+		printf("%-8s depth %d: %s, %ld levels\n", names[f], DEPTH, ok ? "parsed" : "failed", levels);
+		if(!ok || levels != DEPTH){ failed = 1; }
+
+		input[2 * DEPTH] = '\0';
+		ok = parse_small_stack(&g, input, &levels);
+		input[2 * DEPTH] = ')';
+		printf("%-8s depth %d unclosed: %s\n", names[f], DEPTH, ok ? "parsed" : "rejected");
+		if(ok){ failed = 1; }
+
+		peasant_delete(&g);
+	}
+
+	free(input);
+	return failed;
+}
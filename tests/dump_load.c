@@ -0,0 +1,143 @@
+/*
+ * Round trip of grammars through mpc_dump and mpc_load with
+ * every mpca_lang flag. The loaded rules must parse a set of
+ * inputs, good and bad, to the same trees, values and error
+ * messages as the rules they were saved from.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "peasant.h"
+
+enum { MAX_RULES = 6 };
+
+typedef struct {
+	const char *name;
+	const char *grammar;
+	int rules_num;
+	const char *rules[MAX_RULES];
+	const char *inputs[8];
+} grammar_t;
+
+static const grammar_t grammars[] = {
+	{ "peasant", NULL, 6, { "number", "symbol", "sexpr", "qexpr", "expr", "peasant" },
+		{ "(+ 1 2)", "(def {x y} (list 1 2.5 -3 {a b c}))", "", "x y\nz",
+		  "(+ 1 {2)", "(((1)))))", "-", NULL } },
+	{ "maths",
+		" expression : <product> (('+' | '-') <product>)* ;     "
+		" product    : <value> (('*' | '/') <value>)* ;        "
+		" value      : /[0-9]+/ | '(' <expression> ')' ;       "
+		" maths      : /^/ <expression> /$/ ;                  ",
+		4, { "expression", "product", "value", "maths" },
+		{ "1+2*3", "(1 + 2) * 3", "((4))/ 2 - 1", "1+", "2**3", "(1", "", NULL } },
+};
+
+enum { GRAMMARS = sizeof(grammars) / sizeof(grammars[0]) };
+
+static const int flags[] = {
+	MPCA_LANG_DEFAULT, MPCA_LANG_PREDICTIVE, MPCA_LANG_WHITESPACE_SENSITIVE,
+	MPCA_LANG_PACKRAT, MPCA_LANG_ARENA, MPCA_LANG_PACKRAT | MPCA_LANG_ARENA,
+	MPCA_LANG_ACTIONS
+};
+
+enum { FLAGS = sizeof(flags) / sizeof(flags[0]) };
+
+/* Writes out the values of a rule as a list, for the actions mode */
+static mpc_val_t *show_list(int n, mpc_val_t **xs){
+	size_t len = 3;
+	for(int i = 0; i < n; i++){ if(xs[i]){ len += strlen(xs[i]) + 1; } }
+	char *s = malloc(len);
+	strcpy(s, "(");
+	for(int i = 0; i < n; i++){
+		if(xs[i]){ strcat(s, xs[i]); strcat(s, " "); free(xs[i]); }
+	}
+	strcat(s, ")");
+	return s;
+}
+
+/* Writes out an AST on one line */
+static void show_ast(mpc_ast_t *a, char *o){
+	sprintf(o + strlen(o), "[%s '%s'", a->tag, a->contents);
+	for(int i = 0; i < a->children_num; i++){ show_ast(a->children[i], o); }
+	strcat(o, "]");
+}
+
+static void new_rules(const grammar_t *g, int f, mpc_parser_t **p){
+	for(int i = 0; i < g->rules_num; i++){
+		p[i] = mpc_new(g->rules[i]);
+		if(flags[f] & MPCA_LANG_ACTIONS){ mpca_action(p[i], show_list, free); }
+	}
+}
+
+static char *result(const grammar_t *g, int f, mpc_parser_t **p, const char *input){
+	mpc_result_t r;
+	char *s;
+	if(!mpc_parse("<test>", input, p[g->rules_num - 1], &r)){
+		s = mpc_err_string(r.error);
+		mpc_err_delete(r.error);
+		return s;
+	}
+	if(flags[f] & MPCA_LANG_ACTIONS){ return r.output; }
+	s = calloc(1, 1 << 16);
+	show_ast(r.output, s);
+	mpc_ast_delete(r.output);
+	return s;
+}
+
+int main(void){
+	int failed = 0;
+
+	for(int k = 0; k < GRAMMARS; k++){
+		const grammar_t *g = &grammars[k];
+		const char *grammar = g->grammar ? g->grammar : peasant_grammar;
+
+		for(int f = 0; f < FLAGS; f++){
+			mpc_parser_t *a[MAX_RULES], *b[MAX_RULES];
+			size_t size = 0;
+			void *data = NULL;
+			int loaded = 0, same = 1;
+			mpc_err_t *err;
+
+			new_rules(g, f, a);
+			new_rules(g, f, b);
+
+			if(g->rules_num == 6){
+				err = mpca_lang(flags[f], grammar, a[0], a[1], a[2], a[3], a[4], a[5], NULL);
+				if(!err){ data = mpc_dump(&size, 6, a[0], a[1], a[2], a[3], a[4], a[5]); }
+				if(data){ loaded = mpc_load(data, size, 6, b[0], b[1], b[2], b[3], b[4], b[5]); }
+			}else{
+				err = mpca_lang(flags[f], grammar, a[0], a[1], a[2], a[3], NULL);
+				if(!err){ data = mpc_dump(&size, 4, a[0], a[1], a[2], a[3]); }
+				if(data){ loaded = mpc_load(data, size, 4, b[0], b[1], b[2], b[3]); }
+			}
+			if(err){ mpc_err_print(err); return 1; }
+
+			for(int j = 0; loaded && g->inputs[j]; j++){
+				char *x = result(g, f, a, g->inputs[j]);
+				char *y = result(g, f, b, g->inputs[j]);
+				if(strcmp(x, y) != 0){
+					printf("%s flags %d: [%s]\nsaved  %s\nloaded %s\n", g->name, flags[f], g->inputs[j], x, y);
+					same = 0;
+				}
+				free(x);
+				free(y);
+			}
+
+			printf("%-8s flags %2d: %s\n", g->name, flags[f],
+				!data ? "not saved" : !loaded ? "not loaded" : same ? "same" : "different");
+			if(!data || !loaded || !same){ failed = 1; }
+
+			free(data);
+			for(int i = 0; i < g->rules_num; i++){
+				mpc_undefine(a[i]);
+				mpc_undefine(b[i]);
+			}
+			for(int i = 0; i < g->rules_num; i++){
+				mpc_delete(a[i]);
+				mpc_delete(b[i]);
+			}
+		}
+	}
+
+	return failed;
+}
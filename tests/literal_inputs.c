@@ -0,0 +1,70 @@
+/*
+ * Literal strings that only partly match, read from a string,
+ * a file and a pipe. With backtracking the partial match is
+ * given back, and under `predictive` it is left consumed, but
+ * either way every kind of input must parse the same.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "mpc.h"
+
+static const char *grammar = " item : \"ab\" | \"ac\" | /[a-z]+/ ; ";
+
+static const struct { int flags; const char *input, *match; } cases[] = {
+	{ MPCA_LANG_DEFAULT, "ad", "ad" },
+	{ MPCA_LANG_PREDICTIVE, "ad", "d" },
+	{ MPCA_LANG_PREDICTIVE, "ac", "c" },
+};
+
+enum { CASES = sizeof(cases) / sizeof(cases[0]) };
+
+static int parse(int how, const char *input, mpc_parser_t *p, mpc_result_t *r){
+	int fds[2], ok;
+	FILE *f;
+	if(how == 0){ return mpc_parse("<string>", input, p, r); }
+	if(how == 1){
+		f = tmpfile();
+		fputs(input, f);
+		rewind(f);
+		ok = mpc_parse_file("<file>", f, p, r);
+	}else{
+		if(pipe(fds) != 0){ perror("pipe"); exit(1); }
+		if(write(fds[1], input, strlen(input)) != (ssize_t)strlen(input)){ perror("write"); exit(1); }
+		close(fds[1]);
+		f = fdopen(fds[0], "r");
+		ok = mpc_parse_pipe("<pipe>", f, p, r);
+	}
+	fclose(f);
+	return ok;
+}
+
+int main(void){
+	const char *hows[] = { "string", "file", "pipe" };
+	int failed = 0;
+
+	for(int k = 0; k < CASES; k++){
+		mpc_parser_t *item = mpc_new("item");
+		mpc_err_t *err = mpca_lang(cases[k].flags, grammar, item, NULL);
+		if(err){ mpc_err_print(err); return 1; }
+
+		for(int how = 0; how < 3; how++){
+			mpc_result_t r;
+			char got[64] = "";
+			if(parse(how, cases[k].input, item, &r)){
+				snprintf(got, sizeof(got), "%s", ((mpc_ast_t*)r.output)->contents);
+				mpc_ast_delete(r.output);
+			}else{
+				mpc_err_delete(r.error);
+			}
+			int good = strcmp(got, cases[k].match) == 0;
+			printf("flags %d %-6s on %s: '%s' %s\n", cases[k].flags, hows[how], cases[k].input, got, good ? "ok" : "wrong");
+			if(!good){ failed = 1; }
+		}
+
+		mpc_delete(item);
+	}
+
+	return failed;
+}
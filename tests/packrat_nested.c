@@ -0,0 +1,102 @@
+/*
+ * Packrat parsing of deeply nested input. Every level of
+ * "((( x )))" succeeds with a tree holding all the levels
+ * inside it, so a memo table that copies whole trees does
+ * quadratic work and holds quadratic memory. The second
+ * grammar backtracks at the outermost level, so the whole
+ * tree inside it is also answered from the table. Run on
+ * input with a 'y' after every ')' it backtracks at every
+ * level, which takes exponential time without memoization
+ * and linear time with it.
+ *
+ * Prints time and peak memory against depth, and fails if
+ * a result differs from the one without memoization, if the
+ * peak memory gets anywhere near quadratic, or if packrat
+ * parsing isn't far faster on the exponential case.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+#include "mpc.h"
+
+enum { MAX_DEPTH = 4000, MAX_RSS_MB = 64 };
+
+/* Depths for the exponential case, and the speedup wanted */
+enum { MAX_BACKTRACK_DEPTH = 20, MIN_SPEEDUP = 100 };
+
+static const char *grammars[] = {
+	" s : '(' <s> ')' | 'x' ; top : /^/ <s> /$/ ; ",
+	" s : '(' <s> ')' 'x' | '(' <s> ')' 'y' | 'q' ; top : /^/ <s> /$/ ; ",
+};
+
+static char *nested(int g, int depth){
+	char *input = malloc(3 * depth + 2), *c = input;
+	for(int k = 0; k < depth; k++){ *c++ = '('; }
+	*c++ = g == 0 ? 'x' : 'q';
+	for(int k = 0; k < depth; k++){
+		*c++ = ')';
+		if(g == 1){ *c++ = k < depth-1 ? 'x' : 'y'; }
+		if(g == 2){ *c++ = 'y'; }
+	}
+	*c = '\0';
+	return input;
+}
+
+static mpc_ast_t *parse(int g, int flags, const char *input, double *ms){
+	mpc_parser_t *s = mpc_new("s"), *top = mpc_new("top");
+	mpc_err_t *err = mpca_lang(flags, grammars[g > 0], s, top, NULL);
+	if(err){ mpc_err_print(err); exit(1); }
+
+	mpc_result_t r;
+	clock_t t = clock();
+	if(!mpc_parse("nested", input, top, &r)){
+		mpc_err_print(r.error);
+		exit(1);
+	}
+	*ms = (double)(clock() - t) / CLOCKS_PER_SEC * 1000;
+
+	mpc_cleanup(2, s, top);
+	return r.output;
+}
+
+static long peak_mb(void){
+	struct rusage u;
+	getrusage(RUSAGE_SELF, &u);
+	return u.ru_maxrss >> 10;
+}
+
+int main(void){
+	int failed = 0;
+
+	printf("%8s %8s %12s %12s %8s\n", "case", "depth", "plain ms", "packrat ms", "peak MB");
+	for(int g = 0; g < 3; g++){
+		int from = g < 2 ? 500 : 4, to = g < 2 ? MAX_DEPTH : MAX_BACKTRACK_DEPTH;
+		for(int depth = from; depth <= to; depth = g < 2 ? depth * 2 : depth + 4){
+			char *input = nested(g, depth);
+			double plain, packrat;
+			mpc_ast_t *a = parse(g, MPCA_LANG_DEFAULT, input, &plain);
+			mpc_ast_t *b = parse(g, MPCA_LANG_PACKRAT, input, &packrat);
+			printf("%8d %8d %12.2f %12.2f %8ld\n", g, depth, plain, packrat, peak_mb());
+			if(!mpc_ast_eq(a, b)){
+				printf("case %d depth %d: packrat tree differs\n", g, depth);
+				failed = 1;
+			}
+			if(g == 2 && depth == to && packrat * MIN_SPEEDUP > plain){
+				printf("case %d depth %d: packrat is not %d times faster\n", g, depth, MIN_SPEEDUP);
+				failed = 1;
+			}
+			mpc_ast_delete(a);
+			mpc_ast_delete(b);
+			free(input);
+		}
+	}
+
+	if(peak_mb() > MAX_RSS_MB){
+		printf("peak memory %ld MB is over %d MB\n", peak_mb(), MAX_RSS_MB);
+		failed = 1;
+	}
+	return failed;
+}
@@ -0,0 +1,43 @@
+#ifndef peasant_h
+#define peasant_h
+
+#include <stdlib.h>
+#include "mpc.h"
+
+/*
+ * The Peasant grammar from parsing.c, shared by
+ * the tests and benchmarks here.
+ */
+
+static const char *peasant_grammar =
+	" number  : /-?[0-9]+(\\.[0-9]*)?/;                   "
+	" symbol  : /[a-zA-Z0-9_+\\-*\\/\\\\=<>!&^%]+/;        "
+	" sexpr   : '(' <expr>* ')';                          "
+	" qexpr   : '{' <expr>* '}';                          "
+	" expr    : <number> | <symbol> | <sexpr> | <qexpr>;  "
+	" peasant : /^/ <expr>* /$/;                          ";
+
+typedef struct {
+	mpc_parser_t *number, *symbol, *sexpr, *qexpr, *expr, *peasant;
+} peasant_t;
+
+static inline void peasant_new(peasant_t *g){
+	g->number = mpc_new("number");
+	g->symbol = mpc_new("symbol");
+	g->sexpr = mpc_new("sexpr");
+	g->qexpr = mpc_new("qexpr");
+	g->expr = mpc_new("expr");
+	g->peasant = mpc_new("peasant");
+}
+
+static inline void peasant_lang(peasant_t *g, int flags){
+	mpc_err_t *e = mpca_lang(flags, peasant_grammar,
+		g->number, g->symbol, g->sexpr, g->qexpr, g->expr, g->peasant);
+	if(e){ mpc_err_print(e); mpc_err_delete(e); exit(1); }
+}
+
+static inline void peasant_delete(peasant_t *g){
+	mpc_cleanup(6, g->number, g->symbol, g->sexpr, g->qexpr, g->expr, g->peasant);
+}
+
+#endif
@@ -0,0 +1,62 @@
+/*
+ * Parses several forms back to back from one pipe, with one
+ * mpc_parse_pipe call per form. Each parse must leave the
+ * stream where it stopped, including the bytes it looked
+ * ahead at, so the next one starts at the next form. After
+ * "(a)" the grammar tries "=>" and reads two bytes of "=("
+ * before giving up, which both have to be put back.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "mpc.h"
+
+static const char *input = "(a)(b)(c)=(d)=>e(f)";
+static const char *forms[] = { "(a)", "(b)", "(c)", "=", "(d)=>e", "(f)" };
+
+enum { FORMS = sizeof(forms) / sizeof(forms[0]) };
+
+/* Writes out the text an AST matched */
+static void contents(mpc_ast_t *a, char *o){
+	strcat(o, a->contents);
+	for(int i = 0; i < a->children_num; i++){ contents(a->children[i], o); }
+}
+
+int main(void){
+	int fds[2], failed = 0;
+	mpc_parser_t *e = mpc_new("e");
+	mpc_err_t *err = mpca_lang(MPCA_LANG_DEFAULT,
+		" e : '(' /[a-z]+/ ')' \"=>\" /[a-z]/ | '(' /[a-z]+/ ')' | '=' ; ", e, NULL);
+	if(err){ mpc_err_print(err); return 1; }
+
+	if(pipe(fds) != 0){ perror("pipe"); return 1; }
+	if(write(fds[1], input, strlen(input)) != (ssize_t)strlen(input)){ perror("write"); return 1; }
+	close(fds[1]);
+	FILE *f = fdopen(fds[0], "r");
+
+	for(int k = 0; k < FORMS; k++){
+		mpc_result_t r;
+		char got[64] = "";
+		if(mpc_parse_pipe("<pipe>", f, e, &r)){
+			contents(r.output, got);
+			mpc_ast_delete(r.output);
+		}else{
+			char *s = mpc_err_string(r.error);
+			snprintf(got, sizeof(got), "%s", s);
+			free(s);
+			mpc_err_delete(r.error);
+		}
+		printf("form %d: %-8s %s\n", k, forms[k], strcmp(got, forms[k]) == 0 ? "ok" : got);
+		if(strcmp(got, forms[k]) != 0){ failed = 1; }
+	}
+
+	if(getc(f) != EOF){
+		printf("input left over after the last form\n");
+		failed = 1;
+	}
+
+	fclose(f);
+	mpc_delete(e);
+	return failed;
+}
@@ -0,0 +1,62 @@
+/*
+ * The counts mpc_parse_profile gives for a parse that passes
+ * and one that fails. A failed parse is run a second time to
+ * get its errors exactly, which must not be counted again.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "mpc.h"
+
+static const struct { const char *input; int ok; long top[3], word[3]; } cases[] = {
+	/* calls, successes, failures */
+	{ "abc def", 1, { 1, 1, 0 }, { 3, 2, 1 } },
+	{ "abc def 1", 0, { 1, 0, 1 }, { 3, 2, 1 } },
+};
+
+enum { CASES = sizeof(cases) / sizeof(cases[0]) };
+
+/* Reads a rule's counts back out of the printed profile */
+static void counts(const char *out, const char *rule, long *c){
+	char name[32];
+	const char *line = out;
+	c[0] = c[1] = c[2] = -1;
+	while((line = strchr(line, '\n'))){
+		line++;
+		if(sscanf(line, "%31s %ld %ld %ld", name, &c[0], &c[1], &c[2]) == 4 && strcmp(name, rule) == 0){ return; }
+	}
+	c[0] = c[1] = c[2] = -1;
+}
+
+int main(void){
+	int failed = 0;
+	mpc_parser_t *top = mpc_new("top"), *word = mpc_new("word");
+	mpc_err_t *err = mpca_lang(MPCA_LANG_DEFAULT,
+		" top : /^/ <word>+ /$/ ; word : /[a-z]+/ ; ", top, word, NULL);
+	if(err){ mpc_err_print(err); return 1; }
+
+	for(int k = 0; k < CASES; k++){
+		mpc_profile_t *f = mpc_profile_new();
+		mpc_result_t r;
+		char out[4096] = "";
+		long t[3], w[3];
+
+		int ok = mpc_parse_profile("<test>", cases[k].input, top, &r, f);
+		if(ok){ mpc_ast_delete(r.output); }else{ mpc_err_delete(r.error); }
+
+		FILE *fp = fmemopen(out, sizeof(out) - 1, "w");
+		mpc_profile_print_to(f, fp);
+		fclose(fp);
+		mpc_profile_delete(f);
+
+		counts(out, "top", t);
+		counts(out, "word", w);
+		int good = ok == cases[k].ok && memcmp(t, cases[k].top, sizeof(t)) == 0 && memcmp(w, cases[k].word, sizeof(w)) == 0;
+		printf("%-10s top %ld %ld %ld, word %ld %ld %ld: %s\n", cases[k].input,
+			t[0], t[1], t[2], w[0], w[1], w[2], good ? "ok" : "wrong");
+		if(!good){ failed = 1; }
+	}
+
+	mpc_cleanup(2, top, word);
+	return failed;
+}
@@ -0,0 +1,26 @@
+#ifndef reader_h
+#define reader_h
+
+/*
+ * Builds parsing.c into the test with its main() renamed, so
+ * the hand written reader and the lval actions can be run
+ * against each other.
+ */
+
+#define main peasant_main
+#include "parsing.c"
+#undef main
+
+#include "peasant.h"
+
+/* The grammar with the same actions as main() in parsing.c */
+static void reader_lang(peasant_t *g){
+	mpca_action(g->number, lval_read_num, (mpc_dtor_t)lval_del);
+	mpca_action(g->symbol, lval_read_sym, (mpc_dtor_t)lval_del);
+	mpca_action(g->sexpr, lval_read_sexpr, (mpc_dtor_t)lval_del);
+	mpca_action(g->qexpr, lval_read_qexpr, (mpc_dtor_t)lval_del);
+	mpca_action(g->peasant, lval_read_sexpr, (mpc_dtor_t)lval_del);
+	peasant_lang(g, MPCA_LANG_ACTIONS);
+}
+
+#endif
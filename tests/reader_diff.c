@@ -0,0 +1,90 @@
+/*
+ * Differential test of the hand written reader against the
+ * mpc grammar with lval actions. Random inputs, mixing well
+ * formed forms with stray brackets and odd tokens, must be
+ * accepted or rejected by both, and read into the same lvals.
+ */
+
+#include "reader.h"
+
+enum { INPUTS = 50000 };
+
+/* Appends v to o, with numbers printed exactly */
+static void show(lval *v, char *o){
+	switch(v->type){
+		case LVAL_NUM: sprintf(o + strlen(o), "#%.17g", v->num); break;
+		case LVAL_SYM: sprintf(o + strlen(o), "'%s", v->sym); break;
+		default:
+			strcat(o, v->type == LVAL_SEXPR ? "(" : "{");
+			for(int i = 0; i < v->count; i++){ strcat(o, " "); show(v->cell[i], o); }
+			strcat(o, v->type == LVAL_SEXPR ? ")" : "}");
+	}
+}
+
+/* Appends a random form nested at most d deep to in at n */
+static int gen(char *in, int n, int d){
+	static const char *junk[] = { ")", "}", "]", "((", "-", ".", "#", "1.5.3", "\t", "-.", "--1" };
+	static const char *atoms[] = { "1", "-2.5", "x", "+", "def", "7.", "12abc", "-x", "a-1",
+		"0.25e", "\\", "<=", "-09.", "A_b%", "a_symbol_longer_than_the_readers_buffer_of_sixty_four_characters" };
+	static const char *spaces[] = { " ", "", "\n", "  \v", "\f\r" };
+	int k = rand() % 8;
+
+	if(k == 7){
+		return n + sprintf(in + n, "%s", junk[rand() % 11]);
+	}
+	if(d == 0 || k < 3){
+		return n + sprintf(in + n, "%s%s", atoms[rand() % 15], spaces[rand() % 5]);
+	}
+
+	n += sprintf(in + n, "%s", k & 1 ? "(" : "{");
+	for(int c = rand() % 5; c > 0; c--){ n = gen(in, n, d - 1); }
+	return n + sprintf(in + n, "%s%s", k & 1 ? ")" : "}", rand() % 2 ? " " : "");
+}
+
+int main(void){
+	static const char chars[] = "()(){}{}  \n\t-.0123456789abz+*/\\=<>!&^%_]#";
+	static char in[1 << 20], a[1 << 22], b[1 << 22];
+	int same = 0, rejected = 0, bad = 0;
+	peasant_t g;
+
+	peasant_new(&g);
+	reader_lang(&g);
+	srand(7);
+
+	for(int k = 0; k < INPUTS; k++){
+		int n = 0;
+		if(k % 3 == 0){
+			for(int len = rand() % 30; n < len; n++){ in[n] = chars[rand() % (sizeof(chars) - 1)]; }
+			in[n] = '\0';
+		}else{
+			if(rand() % 3 == 0){ n += sprintf(in, " \n"); }
+			for(int j = rand() % 5; j > 0; j--){ n = gen(in, n, 5); }
+		}
+
+		mpc_result_t r;
+		lval *x = lval_read_str(in);
+		int ok = mpc_parse("<test>", in, g.peasant, &r);
+
+		if(!!x != ok){
+			if(bad++ < 5){ printf("reader %s, mpc %s: [%s]\n", x ? "accepts" : "rejects", ok ? "accepts" : "rejects", in); }
+		}else if(x){
+			a[0] = b[0] = '\0';
+			show(x, a);
+			show(r.output, b);
+			if(strcmp(a, b) != 0){
+				if(bad++ < 5){ printf("different lvals for [%s]\nreader %s\nmpc    %s\n", in, a, b); }
+			}else{
+				same++;
+			}
+		}else{
+			rejected++;
+		}
+
+		if(x){ lval_del(x); }
+		if(ok){ lval_del(r.output); }else{ mpc_err_delete(r.error); }
+	}
+
+	printf("%d read the same, %d rejected by both, %d different\n", same, rejected, bad);
+	peasant_delete(&g);
+	return bad != 0;
+}
@@ -0,0 +1,19 @@
+/*
+ * Stress test for sharing one grammar between threads. Eight
+ * threads parse the same inputs in the default, packrat, arena
+ * and actions modes at once, and every result must match the
+ * one from a single thread.
+ */
+
+#include "threads.h"
+
+enum { THREADS = 8 };
+
+int main(void){
+	threads_setup();
+	rounds = 2;
+	int bad = threads_run(THREADS);
+	printf("%d threads, %d parses, %d mismatches\n", THREADS, THREADS * rounds * INPUTS, bad);
+	threads_cleanup();
+	return bad != 0;
+}
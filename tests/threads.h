@@ -0,0 +1,130 @@
+#ifndef threads_h
+#define threads_h
+
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include "peasant.h"
+
+/*
+ * Threads parsing with one shared grammar in each mode. Every
+ * result, or error message, is compared with the one the same
+ * input gave before any threads were started.
+ */
+
+enum { INPUTS = 2000, MODES = 4, MAX_THREADS = 64 };
+
+static const int modes[MODES] = {
+	MPCA_LANG_DEFAULT, MPCA_LANG_PACKRAT, MPCA_LANG_ARENA, MPCA_LANG_ACTIONS
+};
+
+static peasant_t grammars[MODES];
+static char *inputs[INPUTS];
+static char *expected[MODES][INPUTS];
+
+static int rounds = 1, mismatches = 0;
+static pthread_mutex_t mismatches_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Writes out the values of a rule as a list, for the actions mode */
+static mpc_val_t *show_list(int n, mpc_val_t **xs){
+	size_t len = 3;
+	for(int i = 0; i < n; i++){ if(xs[i]){ len += strlen(xs[i]) + 1; } }
+	char *s = malloc(len);
+	strcpy(s, "(");
+	for(int i = 0; i < n; i++){
+		if(xs[i]){ strcat(s, xs[i]); strcat(s, " "); free(xs[i]); }
+	}
+	strcat(s, ")");
+	return s;
+}
+
+static char *result(int mode, const char *input){
+	mpc_result_t r;
+	if(!mpc_parse("<threads>", input, grammars[mode].peasant, &r)){
+		char *s = mpc_err_string(r.error);
+		mpc_err_delete(r.error);
+		return s;
+	}
+	if(modes[mode] & MPCA_LANG_ACTIONS){ return r.output; }
+	char *s = malloc(64);
+	sprintf(s, "ok %d", ((mpc_ast_t*)r.output)->children_num);
+	mpc_ast_delete(r.output);
+	return s;
+}
+
+static void threads_setup(void){
+	const char *chars = "()(){} 12-.ab+*x]";
+	const char *form = "(+ 1 {a 2.5} (x -3))";
+
+	for(int m = 0; m < MODES; m++){
+		peasant_t *g = &grammars[m];
+		peasant_new(g);
+		if(modes[m] & MPCA_LANG_ACTIONS){
+			mpca_action(g->number, show_list, free);
+			mpca_action(g->symbol, show_list, free);
+			mpca_action(g->sexpr, show_list, free);
+			mpca_action(g->qexpr, show_list, free);
+			mpca_action(g->peasant, show_list, free);
+		}
+		peasant_lang(g, modes[m]);
+	}
+
+	/* Half the inputs are well formed, half are random */
+	srand(3);
+	for(int i = 0; i < INPUTS; i++){
+		int len = 1 + rand() % 200;
+		inputs[i] = malloc(len + 1);
+		for(int j = 0; j < len; j++){
+			inputs[i][j] = i % 2 ? chars[rand() % strlen(chars)] : form[j % strlen(form)];
+		}
+		inputs[i][len] = '\0';
+	}
+
+	for(int m = 0; m < MODES; m++){
+		for(int i = 0; i < INPUTS; i++){ expected[m][i] = result(m, inputs[i]); }
+	}
+}
+
+static void threads_cleanup(void){
+	for(int m = 0; m < MODES; m++){
+		for(int i = 0; i < INPUTS; i++){ free(expected[m][i]); }
+		peasant_delete(&grammars[m]);
+	}
+	for(int i = 0; i < INPUTS; i++){ free(inputs[i]); }
+}
+
+/* Each thread goes through the inputs and modes in its own order */
+static void *worker(void *x){
+	unsigned seed = (unsigned)(size_t)x;
+	int local = 0;
+	for(int k = 0; k < rounds; k++){
+		for(int j = 0; j < INPUTS; j++){
+			int i = (int)((j * 7919u + seed * 104729u) % INPUTS);
+			int m = (j + (int)seed) % MODES;
+			char *s = result(m, inputs[i]);
+			if(strcmp(s, expected[m][i]) != 0){ local++; }
+			free(s);
+		}
+	}
+	pthread_mutex_lock(&mismatches_lock);
+	mismatches += local;
+	pthread_mutex_unlock(&mismatches_lock);
+	return NULL;
+}
+
+/* Runs n threads to the end and gives back the mismatches */
+static int threads_run(int n){
+	pthread_t t[MAX_THREADS];
+	if(n > MAX_THREADS){ n = MAX_THREADS; }
+	mismatches = 0;
+	for(int i = 0; i < n; i++){
+		if(pthread_create(&t[i], NULL, worker, (void*)(size_t)(i + 1)) != 0){
+			perror("pthread_create");
+			exit(1);
+		}
+	}
+	for(int i = 0; i < n; i++){ pthread_join(t[i], NULL); }
+	return mismatches;
+}
+
+#endif